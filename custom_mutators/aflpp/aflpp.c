@@ -75,6 +75,32 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 
 }
 
+/* the same, but directly into the output buffers afl-fuzz hands us, several
+   mutants per call - no intermediate buffer and no per-exec call */
+
+u32 afl_custom_fuzz_batch(my_mutator_t *data, const u8 *buf, size_t buf_size,
+                          u8 *add_buf, size_t add_buf_size, u8 **out_bufs,
+                          size_t *out_sizes, u32 batch_size, size_t max_size) {
+
+  u32 i;
+
+  if (buf_size > max_size) { buf_size = max_size; }
+
+  for (i = 0; i < batch_size; ++i) {
+
+    u32 havoc_steps = 1 + rand_below(data->afl, 16);
+
+    memcpy(out_bufs[i], buf, buf_size);
+    out_sizes[i] =
+        afl_mutate(data->afl, out_bufs[i], buf_size, havoc_steps, false, true,
+                   add_buf, add_buf_size, max_size);
+
+  }
+
+  return batch_size;
+
+}
+
 /**
  * Deinitialize everything
  *
@@ -16,9 +16,7 @@ extern "C" {
 
 #include <iostream>
 #include <fstream>
-#include <unordered_map>
 #include <vector>
-#include <regex>
 
 #define AUTOTOKENS_DEBUG 0
 #define AUTOTOKENS_ONLY_FAV 0
@@ -74,22 +72,276 @@ static u32        extras_cnt, a_extras_cnt;
 static u64        all_spaces, all_tabs, all_lf, all_ws;
 static u64        all_structure_items;
 static u64        fuzz_count;
-static unordered_map<string, vector<u32> *> file_mapping;
-static unordered_map<u32, vector<u32> *>    id_mapping;
-static unordered_map<string, u32>           token_to_id;
-static unordered_map<u32, string>           id_to_token;
-static string                               output;
-static regex                               *regex_comment_custom;
-// multiline requires g++-11 libs :(
-static regex regex_comment_star(
-    "/\\*([:print:]|\n)*?\\*/",
-    regex_constants::optimize /* | regex_constants::multiline */);
-static regex        regex_word("[A-Za-z0-9_$.-]+", regex::optimize);
-static regex        regex_whitespace(R"([ \t]+)", regex::optimize);
-static vector<u32> *s;  // the structure of the currently selected input
+static string      output;
+static string      input;  // the current input with comments removed
+static const char *comment_custom;
+static u32         comment_custom_len;
+
+/* Token storage: all token strings are stored back to back in token_arena,
+   a token id indexes token_off/token_len. token_hash is an open addressing
+   table of id + 1 (0 = empty slot) used to intern new tokens. */
+static vector<char> token_arena;
+static vector<u32>  token_off;
+static vector<u32>  token_len;
+static vector<u32>  token_hash;
+
+/* Structures: the token ids of all analyzed inputs are stored back to back in
+   structure_items, a structure index gives offset and length.
+   entry_structure maps a queue entry id to its structure index + 1, 0 if not
+   analyzed yet and ENTRY_SKIP if it is not usable for us. */
+#define ENTRY_SKIP 0xffffffffU
+static vector<u32> structure_items;
+static vector<u64> structure_off;
+static vector<u32> structure_len;
+static vector<u32> entry_structure;
+
+/* The lexer output, offset and length into the input. */
+struct token_ref {
+
+  u32 off, len;
+
+};
+
+static vector<token_ref> lexed;
+
+/* Character classes for the lexer, indexed by the byte value. */
+#define CC_SPACE 1
+#define CC_IDENT 2       // can start an identifier
+#define CC_IDENT_CONT 4  // can continue an identifier
+#define CC_PRINT 8
+static u8 char_class[256];
+
+static const u32 *s;  // the structure of the currently selected input
+static u32        s_size;
 
 // FUNCTIONS
 
+static inline const char *token_data(u32 id) {
+
+  return token_arena.data() + token_off[id];
+
+}
+
+static inline u32 token_hash_slot(const char *str, u32 len) {
+
+  return (u32)hash64((u8 *)str, len, 0xa5b35705) & (token_hash.size() - 1);
+
+}
+
+static void token_hash_grow() {
+
+  u32 size = token_hash.size() ? token_hash.size() << 1 : 1024;
+  token_hash.assign(size, 0);
+
+  for (u32 id = 0; id < current_id; ++id) {
+
+    u32 slot = token_hash_slot(token_data(id), token_len[id]);
+    while (token_hash[slot]) {
+
+      slot = (slot + 1) & (size - 1);
+
+    }
+
+    token_hash[slot] = id + 1;
+
+  }
+
+}
+
+/* Returns the id of the token, adding it if we have not seen it before. */
+static u32 token_intern(const char *str, u32 len) {
+
+  if (unlikely((current_id + 1) * 2 > token_hash.size())) { token_hash_grow(); }
+
+  u32 slot = token_hash_slot(str, len), id;
+
+  while ((id = token_hash[slot])) {
+
+    --id;
+    if (token_len[id] == len && !memcmp(token_data(id), str, len)) {
+
+      return id;
+
+    }
+
+    slot = (slot + 1) & (token_hash.size() - 1);
+
+  }
+
+  token_off.push_back(token_arena.size());
+  token_len.push_back(len);
+  token_arena.insert(token_arena.end(), str, str + len);
+  token_hash[slot] = current_id + 1;
+
+  return current_id++;
+
+}
+
+/* Learn a dictionary entry as token if it is printable. */
+static u32 token_learn_extra(const u8 *ptr, u32 len) {
+
+  for (u32 i = 0; i < len; ++i) {
+
+    if (!isascii((int)ptr[i]) && !isprint((int)ptr[i])) { return 0; }
+
+  }
+
+  if (len) { token_intern((const char *)ptr, len); }
+  return 1;
+
+}
+
+/* Append a structure and make it the current one. */
+static u32 structure_add(const u32 *items, u32 len) {
+
+  structure_off.push_back(structure_items.size());
+  structure_len.push_back(len);
+  structure_items.insert(structure_items.end(), items, items + len);
+  all_structure_items += len;
+
+  s = structure_items.data() + structure_off[valid_structures];
+  s_size = len;
+
+  return valid_structures++;
+
+}
+
+/* The same classes as the tokenizer before the lexer rewrite: whitespace is
+   isspace(), identifiers start with isalnum()/'$'/'_' and may also contain
+   '.' and '/', so existing corpora are split the same way. */
+static void init_char_class() {
+
+  for (u32 c = 0; c < 256; ++c) {
+
+    u8 cls = 0;
+
+    if (c == ' ' || (c >= '\t' && c <= '\r')) { cls |= CC_SPACE; }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '$' || c == '_') {
+
+      cls |= CC_IDENT | CC_IDENT_CONT;
+
+    }
+
+    if (c == '.' || c == '/') { cls |= CC_IDENT_CONT; }
+    if (c >= 0x20 && c < 0x7f) { cls |= CC_PRINT; }
+
+    char_class[c] = cls;
+
+  }
+
+}
+
+/* Remove comments from buf into the input string. Without AUTOTOKENS_COMMENT
+   these are C style block comments, otherwise everything from the comment
+   string up to (excluding) the end of the line. */
+static void strip_comments(const char *buf, u32 len) {
+
+  u32 i = 0;
+
+  input.clear();
+  input.reserve(len);
+
+  while (i < len) {
+
+    const char *start, *end;
+
+    if (comment_custom_len) {
+
+      start = (const char *)afl_memmem(buf + i, len - i, comment_custom,
+                                       comment_custom_len);
+      if (!start) { break; }
+
+      end = start + comment_custom_len;
+      while (end < buf + len && *end != '\n' && *end != '\r') {
+
+        ++end;
+
+      }
+
+    } else {
+
+      start = (const char *)afl_memmem(buf + i, len - i, "/*", 2);
+      if (!start) { break; }
+
+      end = (const char *)afl_memmem(start + 2, buf + len - start - 2, "*/", 2);
+      if (!end) { break; }  // not terminated, keep it
+      end += 2;
+
+    }
+
+    input.append(buf + i, start - buf - i);
+    i = end - buf;
+
+  }
+
+  input.append(buf + i, len - i);
+
+}
+
+/* Length of a quoted string starting at pos, 0 if it is not terminated
+   before the end of the line or a non-printable character. */
+static u32 lex_string(const u8 *buf, u32 pos, u32 len) {
+
+  u8 quote = buf[pos];
+
+  for (u32 i = pos + 1; i < len; ++i) {
+
+    if (buf[i] == quote) {
+
+      if (buf[i - 1] != '\\') { return i + 1 - pos; }
+
+    } else if (unlikely(!(char_class[buf[i]] & CC_PRINT))) {
+
+      return 0;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Split the input into whitespace, identifier, string and single character
+   tokens. */
+static void tokenize(const u8 *buf, u32 len) {
+
+  u32 pos = 0, n;
+
+  lexed.clear();
+
+  while (pos < len) {
+
+    u32 start = pos;
+    u8  cls = char_class[buf[pos]];
+
+    if (cls & CC_SPACE) {
+
+      while (++pos < len && (char_class[buf[pos]] & CC_SPACE)) {}
+
+    } else if (cls & CC_IDENT) {
+
+      while (++pos < len && (char_class[buf[pos]] & CC_IDENT_CONT)) {}
+
+    } else if ((buf[pos] == '"' || buf[pos] == '\'') &&
+               (!pos || buf[pos - 1] != '\\') &&
+               (n = lex_string(buf, pos, len))) {
+
+      pos += n;
+
+    } else {
+
+      ++pos;
+
+    }
+
+    lexed.push_back({start, pos - start});
+
+  }
+
+}
+
 /* This function is called once after everything is set up but before
    any fuzzing attempt has been performed.
    This is called in afl_custom_queue_get() */
@@ -112,33 +364,8 @@ static void first_run(void *data) {
 
       while (extras_cnt < afl_ptr->extras_cnt) {
 
-        u32 ok = 1, l = afl_ptr->extras[extras_cnt].len;
-        u8 *buf, *ptr = afl_ptr->extras[extras_cnt].data;
-
-        for (u32 i = 0; i < l; ++i) {
-
-          if (!isascii((int)ptr[i]) && !isprint((int)ptr[i])) {
-
-            ok = 0;
-            break;
-
-          }
-
-        }
-
-        if (ok) {
-
-          buf = (u8 *)malloc(afl_ptr->extras[extras_cnt].len + 1);
-          memcpy(buf, afl_ptr->extras[extras_cnt].data,
-                 afl_ptr->extras[extras_cnt].len);
-          buf[afl_ptr->extras[extras_cnt].len] = 0;
-          token_to_id[(char *)buf] = current_id;
-          id_to_token[current_id] = (char *)buf;
-          ++current_id;
-          ++valid;
-
-        }
-
+        valid += token_learn_extra(afl_ptr->extras[extras_cnt].data,
+                                   afl_ptr->extras[extras_cnt].len);
         ++extras_cnt;
 
       }
@@ -203,7 +430,7 @@ static void first_run(void *data) {
 static u32 good_whitespace_or_singleval() {
 
   u32 i = rand_below(afl_ptr, current_id);
-  if (id_to_token[i].size() == 1) { return i; }
+  if (token_len[i] == 1) { return i; }
   i = rand_below(afl_ptr, all_ws);
   if (i < all_spaces) {
 
@@ -250,8 +477,9 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
 
   }
 
-  vector<u32> m = *s;  // copy of the structure we will modify
-  u32         i, m_size = (u32)m.size();
+  static vector<u32> m;  // copy of the structure we will modify
+  m.assign(s, s + s_size);
+  u32 i, m_size = s_size;
 
   u32 rounds =
       MIN(change_max,
@@ -277,15 +505,28 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
 
         pos = rand_below(afl_ptr, m_size);
         u32 cur_item = m[pos];
-        do {
 
-          new_item = rand_below(afl_ptr, current_id);
+        // whitespace is replaced by whitespace, everything else by non-space
+        // tokens. Pick from the right id range directly, rejection sampling
+        // over all ids gets very slow with many tokens.
+        if (cur_item < whitespace_ids) {
+
+          do {
+
+            new_item = rand_below(afl_ptr, whitespace_ids);
+
+          } while (unlikely(new_item == cur_item));
+
+        } else {
+
+          do {
+
+            new_item = whitespace_ids +
+                       rand_below(afl_ptr, current_id - whitespace_ids);
 
-        } while (unlikely(
+          } while (unlikely(new_item == cur_item));
 
-            new_item == cur_item ||
-            ((whitespace_ids < new_item && whitespace_ids >= cur_item) ||
-             (whitespace_ids >= new_item && whitespace_ids < cur_item))));
+        }
 
         // DEBUGF(stderr, "MUT: %u -> %u\n", cur_item, new_item);
         m[pos] = new_item;
@@ -296,11 +537,7 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
       /* INSERT (m_size +1 so we insert also after last place) */
       case 10 ... 13: {
 
-        do {
-
-          new_item = rand_below(afl_ptr, current_id);
-
-        } while (unlikely(new_item >= whitespace_ids));
+        new_item = rand_below(afl_ptr, whitespace_ids);
 
         u32 pos = rand_below(afl_ptr, m_size + 1);
         m.insert(m.begin() + pos, new_item);
@@ -315,12 +552,13 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
       /* SPLICING */
       case 14 ... 22: {
 
-        u32  strategy = rand_below(afl_ptr, 4), dst_off, n;
-        auto src = id_mapping[rand_below(afl_ptr, valid_structures)];
-        u32  src_size = src->size();
-        u32  src_off = rand_below(afl_ptr, src_size - AUTOTOKENS_SPLICE_MIN);
-        u32  rand_r = 1 + MAX(AUTOTOKENS_SPLICE_MIN,
-                              MIN(AUTOTOKENS_SPLICE_MAX, src_size - src_off));
+        u32 strategy = rand_below(afl_ptr, 4), dst_off, n;
+        u32 src_idx = rand_below(afl_ptr, valid_structures);
+        const u32 *src = structure_items.data() + structure_off[src_idx];
+        u32        src_size = structure_len[src_idx];
+        u32 src_off = rand_below(afl_ptr, src_size - AUTOTOKENS_SPLICE_MIN);
+        u32 rand_r = 1 + MAX(AUTOTOKENS_SPLICE_MIN,
+                             MIN(AUTOTOKENS_SPLICE_MAX, src_size - src_off));
 
         switch (strategy) {
 
@@ -331,8 +569,7 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
             n = AUTOTOKENS_SPLICE_MIN +
                 rand_below(afl_ptr, MIN(AUTOTOKENS_SPLICE_MAX,
                                         rand_r - AUTOTOKENS_SPLICE_MIN));
-            m.insert(m.begin() + dst_off, src->begin() + src_off,
-                     src->begin() + src_off + n);
+            m.insert(m.begin() + dst_off, src + src_off, src + src_off + n);
             m_size += n;
             // DEBUGF(stderr, "SPLICE-INS: %u at %u\n", n, dst_off);
 
@@ -351,8 +588,7 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
                         MIN(m_size - dst_off - AUTOTOKENS_SPLICE_MIN,
                             src_size - src_off - AUTOTOKENS_SPLICE_MIN)));
 
-            copy(src->begin() + src_off, src->begin() + src_off + n,
-                 m.begin() + dst_off);
+            copy(src + src_off, src + src_off + n, m.begin() + dst_off);
 
             // DEBUGF(stderr, "SPLICE-MUT: %u at %u\n", n, dst_off);
             break;
@@ -400,14 +636,14 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
 
   /* Now we create the output */
 
-  output = "";
+  output.clear();
   u32 prev_size = 1, was_whitespace = 1;
 
   for (i = 0; i < m_size; ++i) {
 
     if (likely(i + 1 < m_size)) {
 
-      u32 this_size = id_to_token[m[i]].size();
+      u32 this_size = token_len[m[i]];
       u32 is_whitespace = m[i] < whitespace_ids;
 
       /* The output we are generating might need repairing.
@@ -417,7 +653,8 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
       if (unlikely(!(prev_size == 1 || was_whitespace || this_size == 1 ||
                      is_whitespace))) {
 
-        output += id_to_token[good_whitespace_or_singleval()];
+        u32 ws = good_whitespace_or_singleval();
+        output.append(token_data(ws), token_len[ws]);
 
       }
 
@@ -426,7 +663,7 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
 
     }
 
-    output += id_to_token[m[i]];
+    output.append(token_data(m[i]), token_len[m[i]]);
 
   }
 
@@ -452,90 +689,6 @@ extern "C" size_t afl_custom_fuzz(my_mutator_t *data, u8 *buf, size_t buf_size,
 
 }
 
-/* I get f*cking stack overflow using C++ regex with a regex of
-   "\"[[:print:]]*?\"" if this matches a long string even with regex::optimize
-   enabled :-( */
-static u8 my_search_string(string::const_iterator  cur,
-                           string::const_iterator  ende,
-                           string::const_iterator *match_begin,
-                           string::const_iterator *match_end) {
-
-  string::const_iterator start = cur, found_begin;
-  u8                     quote_type = 0;
-
-  while (cur < ende) {
-
-    switch (*cur) {
-
-      case '"': {
-
-        if (cur == start || *(cur - 1) != '\\') {
-
-          if (!quote_type) {
-
-            found_begin = cur;
-            quote_type = 1;
-
-          } else if (quote_type == 1) {
-
-            *match_begin = found_begin;
-            *match_end = cur + 1;
-            return 1;
-
-          }
-
-        }
-
-        break;
-
-      }
-
-      case '\'': {
-
-        if (cur == start || *(cur - 1) != '\\') {
-
-          if (!quote_type) {
-
-            found_begin = cur;
-            quote_type = 2;
-
-          } else if (quote_type == 2) {
-
-            *match_begin = found_begin;
-            *match_end = cur + 1;
-            return 1;
-
-          }
-
-        }
-
-        break;
-
-      }
-
-      case '\n':
-      case '\r':
-      case 0: {
-
-        quote_type = 0;
-        break;
-
-      }
-
-      default:
-        if (unlikely(quote_type && !isprint(*cur))) { quote_type = 0; }
-        break;
-
-    }
-
-    ++cur;
-
-  }
-
-  return 0;
-
-}
-
 /* We are not using afl_custom_queue_new_entry() because not every corpus entry
    will be necessarily fuzzed with this custom mutator.
    So we use afl_custom_queue_get() instead. */
@@ -584,69 +737,29 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
     while (extras_cnt < afl_ptr->extras_cnt) {
 
-      u32 ok = 1, l = afl_ptr->extras[extras_cnt].len;
-      u8 *buf, *ptr = afl_ptr->extras[extras_cnt].data;
-
-      for (u32 i = 0; i < l; ++i) {
-
-        if (!isascii((int)ptr[i]) && !isprint((int)ptr[i])) {
-
-          ok = 0;
-          break;
-
-        }
-
-      }
-
-      if (ok) {
-
-        buf = (u8 *)malloc(afl_ptr->extras[extras_cnt].len + 1);
-        memcpy(buf, afl_ptr->extras[extras_cnt].data,
-               afl_ptr->extras[extras_cnt].len);
-        buf[afl_ptr->extras[extras_cnt].len] = 0;
-        token_to_id[(char *)buf] = current_id;
-        id_to_token[current_id] = (char *)buf;
-        ++current_id;
-
-      }
-
+      token_learn_extra(afl_ptr->extras[extras_cnt].data,
+                        afl_ptr->extras[extras_cnt].len);
       ++extras_cnt;
 
     }
 
     while (a_extras_cnt < afl_ptr->a_extras_cnt) {
 
-      u32 ok = 1, l = afl_ptr->a_extras[a_extras_cnt].len;
-      u8 *ptr = afl_ptr->a_extras[a_extras_cnt].data;
-
-      for (u32 i = 0; i < l; ++i) {
-
-        if (!isascii((int)ptr[i]) && !isprint((int)ptr[i])) {
-
-          ok = 0;
-          break;
-
-        }
-
-      }
-
-      if (ok) {
-
-        token_to_id[(char *)ptr] = current_id;
-        id_to_token[current_id] = (char *)ptr;
-        ++current_id;
-
-      }
-
+      token_learn_extra(afl_ptr->a_extras[a_extras_cnt].data,
+                        afl_ptr->a_extras[a_extras_cnt].len);
       ++a_extras_cnt;
 
     }
 
   }
 
-  vector<u32> *structure = NULL;
-  string       fn = (char *)filename;
-  auto         entry = file_mapping.find(fn);
+  u32 qid = afl_ptr->queue_cur->id;
+  if (unlikely(qid >= entry_structure.size())) {
+
+    entry_structure.resize(afl_ptr->queued_items > qid ? afl_ptr->queued_items
+                                                       : qid + 1);
+
+  }
 
   // if there is only one active queue item at start and it is very small
   // the we create once a structure randomly.
@@ -656,29 +769,26 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
         afl_ptr->queue_cur->len < AFL_TXT_MIN_LEN) {
 
       DEBUGF(stderr, "Creating an entry from thin air...\n");
-      structure = new vector<u32>();
-      u32 item, prev, cnt = current_id >> 1;
-      structure->reserve(cnt + 4);
+      static vector<u32> structure;
+      u32                item, prev, cnt = current_id >> 1;
+      structure.clear();
+      structure.reserve(cnt + 4);
       for (u32 i = 0; i < cnt; i++) {
 
         item = rand_below(afl_ptr, current_id);
-        if (i && id_to_token[item].length() > 1 &&
-            id_to_token[prev].length() > 1) {
+        if (i && token_len[item] > 1 && token_len[prev] > 1) {
 
-          structure->push_back(good_whitespace_or_singleval());
+          structure.push_back(good_whitespace_or_singleval());
 
         }
 
-        structure->push_back(item);
+        structure.push_back(item);
         prev = item;
 
       }
 
-      s = structure;
-      file_mapping[fn] = structure;
-      id_mapping[valid_structures] = structure;
-      ++valid_structures;
-      all_structure_items += structure->size();
+      entry_structure[qid] =
+          structure_add(structure.data(), structure.size()) + 1;
 
       return 1;
 
@@ -688,29 +798,28 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
   }
 
-  if (entry == file_mapping.end()) {
+  if (entry_structure[qid] == 0) {
 
     // this input file was not analyzed for tokens yet, so let's do it!
     size_t len = afl_ptr->queue_cur->len;
 
     if (len < AFL_TXT_MIN_LEN) {
 
-      file_mapping[fn] = structure;  // NULL ptr so we don't read the file again
+      entry_structure[qid] = ENTRY_SKIP;  // so we don't read the file again
       s = NULL;
       DEBUGF(stderr, "Too short (%lu) %s\n", len, filename);
       return 1;
 
     } else if (len > AFL_TXT_MAX_LEN) {
 
-      file_mapping[fn] = structure;  // NULL ptr so we don't read the file again
+      entry_structure[qid] = ENTRY_SKIP;  // so we don't read the file again
       s = NULL;
       DEBUGF(stderr, "Too long (%lu) %s\n", len, filename);
       return 1;
 
     }
 
-    u8    *input_buf = queue_testcase_get(afl_ptr, afl_ptr->queue_cur);
-    string input((char *)input_buf, afl_ptr->queue_cur->len);
+    u8 *input_buf = queue_testcase_get(afl_ptr, afl_ptr->queue_cur);
 
     if (!afl_ptr->shm.cmplog_mode) {
 
@@ -720,14 +829,18 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
       u32 valid_chars = 0;
       for (u32 i = 0; i < len; ++i) {
 
-        if (isascii((int)input[i]) || isprint((int)input[i])) { ++valid_chars; }
+        if (isascii((int)input_buf[i]) || isprint((int)input_buf[i])) {
+
+          ++valid_chars;
+
+        }
 
       }
 
       // we want at least 95% of text characters ...
       if (((len * AFL_TXT_MIN_PERCENT) / 100) > valid_chars) {
 
-        file_mapping[fn] = NULL;
+        entry_structure[qid] = ENTRY_SKIP;
         s = NULL;
         DEBUGF(stderr, "Not text (%lu) %s\n", len, filename);
         return 1;
@@ -736,29 +849,33 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
     }
 
-    // DEBUGF(stderr, "Read %lu bytes for %s\nBefore comment trim:\n%s\n",
-    // input.size(), filename, input.c_str());
+    strip_comments((char *)input_buf, len);
 
-    if (regex_comment_custom) {
+    DEBUGF(stderr, "After comment removal %lu bytes for %s\n%s\n",
+           input.size(), filename, input.c_str());
 
-      input = regex_replace(input, *regex_comment_custom, "$2");
+    u32 spaces = 0, tabs = 0, linefeeds = 0;
 
-    } else {
+    for (u32 i = 0; i < input.size(); ++i) {
 
-      input = regex_replace(input, regex_comment_star, "");
+      switch (input[i]) {
 
-    }
+        case ' ':
+          ++spaces;
+          break;
+        case '\t':
+          ++tabs;
+          break;
+        case '\n':
+          ++linefeeds;
+          break;
 
-    DEBUGF(stderr, "After replace %lu bytes for %s\n%s\n", input.size(),
-           filename, input.c_str());
+      }
 
-    u32  spaces = count(input.begin(), input.end(), ' ');
-    u32  tabs = count(input.begin(), input.end(), '\t');
-    u32  linefeeds = count(input.begin(), input.end(), '\n');
-    bool ends_with_linefeed = input[input.length() - 1] == '\n';
+    }
 
-    DEBUGF(stderr, "spaces=%u tabs=%u linefeeds=%u ends=%u\n", spaces, tabs,
-           linefeeds, ends_with_linefeed);
+    DEBUGF(stderr, "spaces=%u tabs=%u linefeeds=%u\n", spaces, tabs,
+           linefeeds);
 
     all_spaces += spaces;
     all_tabs += tabs;
@@ -766,126 +883,15 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
     all_ws = all_spaces + all_tabs + all_lf;
 
     // now extract all tokens
-    vector<string>         tokens;
-    string::const_iterator cur = input.begin(), ende = input.end(), found, prev,
-                           match_begin, match_end;
-
-    DEBUGF(stderr, "START!\n");
-
-    while (my_search_string(cur, ende, &match_begin, &match_end)) {
-
-      prev = cur;
-      found = match_begin;
-      cur = match_end;
-
-      IFDEBUG {
-
-        string foo(match_begin, match_end);
-        DEBUGF(stderr,
-               "string %s found at start %lu offset %lu continue at %lu\n",
-               foo.c_str(), prev - input.begin(), found - prev,
-               cur - input.begin());
-
-      }
-
-      if (prev < found) {  // there are items between search start and find
-        while (prev < found) {
-
-          if (isspace(*prev)) {
-
-            auto start = prev;
-            while (isspace(*prev)) {
-
-              ++prev;
-
-            }
-
-            tokens.push_back(std::string(start, prev));
-            DEBUGF(stderr, "WHITESPACE %ld \"%s\"\n", prev - start,
-                   tokens[tokens.size() - 1].c_str());
-
-          } else if (isalnum(*prev) || *prev == '$' || *prev == '_') {
-
-            auto start = prev;
-            while (isalnum(*prev) || *prev == '$' || *prev == '_' ||
-                   *prev == '.' || *prev == '/') {
-
-              ++prev;
-
-            }
-
-            tokens.push_back(string(start, prev));
-            DEBUGF(stderr, "IDENTIFIER %ld \"%s\"\n", prev - start,
-                   tokens[tokens.size() - 1].c_str());
-
-          } else {
-
-            tokens.push_back(string(prev, prev + 1));
-            DEBUGF(stderr, "OTHER \"%c\"\n", *prev);
-            ++prev;
-
-          }
-
-        }
-
-      }
-
-      tokens.push_back(string(match_begin, match_end));
-      DEBUGF(stderr, "TOK: %s\n", tokens[tokens.size() - 1].c_str());
-
-    }
-
-    DEBUGF(stderr, "AFTER all strings\n");
-
-    if (cur < ende) {
-
-      while (cur < ende) {
-
-        if (isspace(*cur)) {
-
-          auto start = cur;
-          while (isspace(*cur)) {
-
-            ++cur;
-
-          }
-
-          tokens.push_back(std::string(start, cur));
-          DEBUGF(stderr, "WHITESPACE %ld \"%s\"\n", cur - start,
-                 tokens[tokens.size() - 1].c_str());
-
-        } else if (isalnum(*cur) || *cur == '$' || *cur == '_') {
-
-          auto start = cur;
-          while (isalnum(*cur) || *cur == '$' || *cur == '_' || *cur == '.' ||
-                 *cur == '/') {
-
-            ++cur;
-
-          }
-
-          tokens.push_back(std::string(start, cur));
-          DEBUGF(stderr, "IDENTIFIER %ld \"%s\"\n", cur - start,
-                 tokens[tokens.size() - 1].c_str());
-
-        } else {
-
-          tokens.push_back(std::string(cur, cur + 1));
-          DEBUGF(stderr, "OTHER \"%c\"\n", *cur);
-          ++cur;
-
-        }
-
-      }
-
-    }
+    const u8 *in = (const u8 *)input.data();
+    tokenize(in, input.size());
 
     IFDEBUG {
 
       DEBUGF(stderr, "DUMPING TOKENS:\n");
-      for (u32 i = 0; i < tokens.size(); ++i) {
+      for (u32 i = 0; i < lexed.size(); ++i) {
 
-        DEBUGF(stderr, "%s", tokens[i].c_str());
+        DEBUGF(stderr, "%.*s", lexed[i].len, in + lexed[i].off);
 
       }
 
@@ -893,9 +899,9 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
     }
 
-    if (tokens.size() < AUTOTOKENS_SIZE_MIN) {
+    if (lexed.size() < AUTOTOKENS_SIZE_MIN) {
 
-      file_mapping[fn] = NULL;
+      entry_structure[qid] = ENTRY_SKIP;
       s = NULL;
       DEBUGF(stderr, "too few tokens\n");
       return 1;
@@ -904,41 +910,24 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
     /* Now we transform the tokens into an ID list and saved that */
 
-    structure = new vector<u32>();
-    u32 id;
-
-    for (u32 i = 0; i < tokens.size(); ++i) {
-
-      if ((id = token_to_id[tokens[i]]) == 0) {
-
-        // First time we see this token, add it to the list
-        token_to_id[tokens[i]] = current_id;
-        id_to_token[current_id] = tokens[i];
-        structure->push_back(current_id);
-        ++current_id;
+    static vector<u32> ids;
+    ids.resize(lexed.size());
 
-      } else {
+    for (u32 i = 0; i < lexed.size(); ++i) {
 
-        structure->push_back(id);
-
-      }
+      ids[i] = token_intern((const char *)in + lexed[i].off, lexed[i].len);
 
     }
 
-    // save the token structure to the file mapping
-    file_mapping[fn] = structure;
-    id_mapping[valid_structures] = structure;
-    ++valid_structures;
-    s = structure;
-    all_structure_items += structure->size();
+    // save the token structure for this queue entry
+    entry_structure[qid] = structure_add(ids.data(), ids.size()) + 1;
 
     // we are done!
-    DEBUGF(stderr, "DONE! We have %lu tokens in the structure\n",
-           structure->size());
+    DEBUGF(stderr, "DONE! We have %u tokens in the structure\n", s_size);
 
   } else {
 
-    if (entry->second == NULL) {
+    if (entry_structure[qid] == ENTRY_SKIP) {
 
       DEBUGF(stderr, "Skipping %s\n", filename);
       s = NULL;
@@ -946,7 +935,9 @@ extern "C" unsigned char afl_custom_queue_get(void                *data,
 
     }
 
-    s = entry->second;
+    u32 idx = entry_structure[qid] - 1;
+    s = structure_items.data() + structure_off[idx];
+    s_size = structure_len[idx];
     DEBUGF(stderr, "OK %s\n", filename);
 
   }
@@ -1015,60 +1006,32 @@ extern "C" my_mutator_t *afl_custom_init(afl_state *afl, unsigned int seed) {
 
   if (getenv("AUTOTOKENS_COMMENT")) {
 
-    char buf[256];
-    snprintf(buf, sizeof(buf), "(%s.*)([\r\n]?)", getenv("AUTOTOKENS_COMMENT"));
-    regex_comment_custom = new regex(buf, regex::optimize);
+    comment_custom = getenv("AUTOTOKENS_COMMENT");
+    comment_custom_len = strlen(comment_custom);
 
   }
 
   data->afl = afl_ptr = afl;
 
+  init_char_class();
+
   // set common whitespace tokens
   // we deliberately do not put uncommon ones here to these will count as
   // identifier tokens.
-  token_to_id[" "] = current_id;
-  id_to_token[current_id] = " ";
-  ++current_id;
-  token_to_id["\t"] = current_id;
-  id_to_token[current_id] = "\t";
-  ++current_id;
-  token_to_id["\n"] = current_id;
-  id_to_token[current_id] = "\n";
-  ++current_id;
-  token_to_id["\r\n"] = current_id;
-  id_to_token[current_id] = "\r\n";
-  ++current_id;
-  token_to_id[" \n"] = current_id;
-  id_to_token[current_id] = " \n";
-  ++current_id;
-  token_to_id["  "] = current_id;
-  id_to_token[current_id] = "  ";
-  ++current_id;
-  token_to_id["\t\t"] = current_id;
-  id_to_token[current_id] = "\t\t";
-  ++current_id;
-  token_to_id["\n\n"] = current_id;
-  id_to_token[current_id] = "\n\n";
-  ++current_id;
-  token_to_id["\r\n\r\n"] = current_id;
-  id_to_token[current_id] = "\r\n\r\n";
-  ++current_id;
-  token_to_id["    "] = current_id;
-  id_to_token[current_id] = "    ";
-  ++current_id;
-  token_to_id["\t\t\t\t"] = current_id;
-  id_to_token[current_id] = "\t\t\t\t";
-  ++current_id;
-  token_to_id["\n\n\n\n"] = current_id;
-  id_to_token[current_id] = "\n\n\n\n";
-  ++current_id;
+  static const char *whitespace[] = {
+
+      " ",  "\t",   "\n",       "\r\n", " \n",       "  ",
+      "\t\t", "\n\n", "\r\n\r\n", "    ", "\t\t\t\t", "\n\n\n\n"};
+
+  for (u32 i = 0; i < sizeof(whitespace) / sizeof(whitespace[0]); ++i) {
+
+    token_intern(whitespace[i], strlen(whitespace[i]));
+
+  }
+
   whitespace_ids = current_id;
-  token_to_id["\""] = current_id;
-  id_to_token[current_id] = "\"";
-  ++current_id;
-  token_to_id["'"] = current_id;
-  id_to_token[current_id] = "'";
-  ++current_id;
+  token_intern("\"", 1);
+  token_intern("'", 1);
 
   return data;
 
@@ -1092,8 +1055,11 @@ extern "C" void afl_custom_deinit(my_mutator_t *data) {
           "  Number of all seen tokens:  %u\n"
           "  Number of input structures: %u\n"
           "  Number of all items in structures: %llu\n"
-          "  Number of total fuzzes: %llu\n\n",
-          current_id - 1, valid_structures, all_structure_items, fuzz_count);
+          "  Number of total fuzzes: %llu\n"
+          "  Token storage: %lu bytes\n\n",
+          current_id - 1, valid_structures, all_structure_items, fuzz_count,
+          (unsigned long)(token_arena.size() + token_hash.size() * 4 +
+                          current_id * 8 + structure_items.size() * 4));
 
   free(data);
 
@@ -63,6 +63,22 @@ def fuzz(buf, add_buf, max_size):
     return ret
 
 
+# Uncomment the following method to produce several mutants per call. If
+# present it is used instead of fuzz(), which saves the call overhead per exec.
+#
+# def fuzz_batch(buf, add_buf, max_size, count):
+#     '''
+#     Called per batch of fuzzing iterations.
+#
+#     @type count: int
+#     @param count: Maximum number of mutants to return.
+#
+#     @rtype: list
+#     @return: A list of up to count bytearray (or other bytes-like) objects
+#     '''
+#     return [fuzz(buf, add_buf, max_size) for _ in range(count)]
+
+
 # Uncomment and implement the following methods if you want to use a custom
 # trimming algorithm. See also the documentation for a better API description.
 
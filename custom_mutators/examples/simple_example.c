@@ -50,7 +50,7 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
                        size_t add_buf_size,  // add_buf can be NULL
                        size_t max_size) {
 
-  int size = (rand() % 100) + 1;
+  size_t size = (rand() % 100) + 1;
   if (size > max_size) size = max_size;
 
   memset(data->fuzz_buf, _FIXED_CHAR, size);
@@ -60,6 +60,31 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 
 }
 
+#ifdef _FUZZ_BATCH
+/* Batched variant: writes batch_size mutants straight into the buffers owned
+   by afl-fuzz. When present it is used instead of afl_custom_fuzz. */
+uint32_t afl_custom_fuzz_batch(my_mutator_t *data, const uint8_t *buf,
+                               size_t buf_size, uint8_t *add_buf,
+                               size_t add_buf_size, uint8_t **out_bufs,
+                               size_t *out_sizes, uint32_t batch_size,
+                               size_t max_size) {
+
+  for (uint32_t i = 0; i < batch_size; i++) {
+
+    size_t size = (rand() % 100) + 1;
+    if (size > max_size) size = max_size;
+
+    memset(out_bufs[i], _FIXED_CHAR, size);
+    out_sizes[i] = size;
+
+  }
+
+  return batch_size;
+
+}
+
+#endif
+
 /**
  * Deinitialize everything
  *
@@ -245,3 +245,105 @@ void swap(int *a, int *b) {
 
 }
 
+/* Arena variants of the mutations. They build the mutated walk with block
+ * copies on the arena instead of allocating and filling temporary walks. */
+
+Array *gen_input_arena(Arena *a, state *pda, Array *input, int from_state) {
+
+  state *  state_ptr;
+  trigger *trigger_ptr;
+  int      randval;
+
+  if (input == NULL) { input = walk_new(a, INIT_SIZE); }
+
+  while (from_state != final_state) {
+
+    state_ptr = pda + from_state;
+    randval = rand_below(global_afl, state_ptr->trigger_len);
+    trigger_ptr = state_ptr->ptr + randval;
+    walk_push(a, input, from_state, trigger_ptr->term, trigger_ptr->term_len,
+              randval);
+    from_state = trigger_ptr->dest;
+
+  }
+
+  return input;
+
+}
+
+Array *performRandomMutationArena(Arena *a, state *pda, Array *input) {
+
+  if (!input->used) { return gen_input_arena(a, pda, NULL, init_state); }
+
+  // Keep the walk up to a random offset and regenerate from its state
+  int    idx = rand_below(global_afl, input->used);
+  Array *mutated = walk_new(a, input->used + INIT_SIZE);
+  walk_append(a, mutated, input, 0, idx);
+  return gen_input_arena(a, pda, mutated, input->start[idx].state);
+
+}
+
+Array *performSpliceOneArena(Arena *a, Array *originput,
+                             StateMap *statemap_orig, Array *splicecand) {
+
+  int *points, npoints = 0, state, cnt;
+
+  // Offsets in the splice candidate whose state also occurs in the original
+  points = (int *)arena_alloc(a, (splicecand->used + 1) * sizeof(int));
+  for (size_t x = 0; x < splicecand->used; x++) {
+
+    state = splicecand->start[x].state;
+    if (statemap_orig->start[state + 1] > statemap_orig->start[state]) {
+
+      points[npoints++] = x;
+
+    }
+
+  }
+
+  if (!npoints) { return NULL; }
+
+  // Pick a splice point and one of the original offsets with the same state
+  int splice_idx = points[rand_below(global_afl, npoints)];
+  state = splicecand->start[splice_idx].state;
+  cnt = statemap_orig->start[state + 1] - statemap_orig->start[state];
+  int orig_idx = statemap_orig->idx[statemap_orig->start[state] +
+                                    rand_below(global_afl, cnt)];
+
+  Array *spliced =
+      walk_new(a, orig_idx + splicecand->used - splice_idx + 1);
+  walk_append(a, spliced, originput, 0, orig_idx);
+  walk_append(a, spliced, splicecand, splice_idx, splicecand->used);
+  return spliced;
+
+}
+
+Array *doMultArena(Arena *a, Array *input, StateMap *statemap) {
+
+  int  state = statemap->recur[rand_below(global_afl, statemap->recurlen)];
+  int *offsets = statemap->idx + statemap->start[state];
+  int  cnt = statemap->start[state + 1] - statemap->start[state];
+
+  // Choose two different occurrences of the recursive state
+  int first = rand_below(global_afl, cnt);
+  int second = rand_below(global_afl, cnt - 1);
+  if (second >= first) { second += 1; }
+  int firstIdx = offsets[first], secondIdx = offsets[second];
+  int lo = firstIdx < secondIdx ? firstIdx : secondIdx;
+  int hi = firstIdx < secondIdx ? secondIdx : firstIdx;
+
+  // prefix + feature * len + postfix
+  int    len = rand_below(global_afl, RECUR_THRESHOLD);
+  Array *mult = walk_new(
+      a, firstIdx + (hi - lo) * len + (input->used - secondIdx) + 1);
+  walk_append(a, mult, input, 0, firstIdx);
+  for (int x = 0; x < len; x++) {
+
+    walk_append(a, mult, input, lo, hi);
+
+  }
+
+  walk_append(a, mult, input, secondIdx, input->used);
+  return mult;
+
+}
@@ -30,7 +30,7 @@ void insertArray(Array *a, int state, char *symbol, size_t symbol_len,
   terminal *term_ptr;
   if (a->used == a->size) {
 
-    a->size = a->size * sizeof(terminal);
+    a->size *= 2;
     a->start = (terminal *)realloc(a->start, a->size * sizeof(terminal));
 
   }
@@ -117,7 +117,7 @@ void insertArraySplice(SpliceCandArray *a, Candidate *candidate, int idx) {
   SpliceCand *candptr;
   if (a->used == a->size) {
 
-    a->size = a->size * sizeof(SpliceCand);
+    a->size *= 2;
     a->start = (SpliceCand *)realloc(a->start, a->size * sizeof(SpliceCand));
 
   }
@@ -154,20 +154,8 @@ int fact(int n) {
 /* Uses the walk to create the input in-memory */
 u8 *unparse_walk(Array *input) {
 
-  terminal *term_ptr;
-  int       offset = 0;
-  u8 *      unparsed = (u8 *)malloc(input->inputlen + 1);
-  term_ptr = &input->start[offset];
-  strcpy(unparsed, term_ptr->symbol);
-  offset += 1;
-  while (offset < input->used) {
-
-    term_ptr = &input->start[offset];
-    strcat(unparsed, term_ptr->symbol);
-    offset += 1;
-
-  }
-
+  u8 *unparsed = (u8 *)malloc(input->inputlen + 1);
+  unparsed[unparse_walk_buf(input, unparsed, input->inputlen)] = 0;
   return unparsed;
 
 }
@@ -188,13 +176,14 @@ void write_input(Array *input, u8 *fn) {
 
   }
 
-  // Write the length parameters
+  // Write the length parameters. Only the used part of the array is stored,
+  // so the size equals the number of used entries
+  fwrite(&input->used, sizeof(size_t), 1, fp);
   fwrite(&input->used, sizeof(size_t), 1, fp);
-  fwrite(&input->size, sizeof(size_t), 1, fp);
   fwrite(&input->inputlen, sizeof(size_t), 1, fp);
 
   // Write the dynamic array to file
-  fwrite(input->start, input->size * sizeof(terminal), 1, fp);
+  fwrite(input->start, input->used * sizeof(terminal), 1, fp);
   // printf("\nUsed:%zu Size:%zu Inputlen:%zu", input->used, input->size,
   // input->inputlen);
   fclose(fp);
@@ -266,3 +255,302 @@ Array *read_input(state *pda, u8 *fn) {
 
 }
 
+
+/* Arena allocator for walks. All allocations live until the next
+ * arena_reset(), which releases them at once. */
+static arena_chunk *arena_chunk_new(size_t size) {
+
+  arena_chunk *chunk = (arena_chunk *)malloc(sizeof(arena_chunk) + size);
+  if (!chunk) {
+
+    fprintf(stderr, "\n[GF] Arena allocation of %zu bytes failed\n", size);
+    exit(1);
+
+  }
+
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+
+}
+
+void arena_init(Arena *a, size_t size) {
+
+  a->head = arena_chunk_new(size);
+  a->total = 0;
+  a->last = NULL;
+  a->last_size = 0;
+
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+
+  arena_chunk *chunk = a->head;
+  size = (size + 15) & ~(size_t)15;
+
+  if (chunk->used + size > chunk->size) {
+
+    size_t new_size = chunk->size * 2;
+    while (new_size < size) {
+
+      new_size *= 2;
+
+    }
+
+    chunk = arena_chunk_new(new_size);
+    chunk->next = a->head;
+    a->head = chunk;
+
+  }
+
+  a->last = chunk->data + chunk->used;
+  a->last_size = size;
+  chunk->used += size;
+  a->total += size;
+  return a->last;
+
+}
+
+/* Grows an allocation. The most recent allocation is extended in place if
+ * the chunk has room left, everything else is copied. */
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size) {
+
+  arena_chunk *chunk = a->head;
+  void *       res;
+
+  new_size = (new_size + 15) & ~(size_t)15;
+
+  if (ptr && ptr == a->last &&
+      chunk->used - a->last_size + new_size <= chunk->size) {
+
+    chunk->used += new_size - a->last_size;
+    a->total += new_size - a->last_size;
+    a->last_size = new_size;
+    return ptr;
+
+  }
+
+  res = arena_alloc(a, new_size);
+  if (ptr && old_size) { memcpy(res, ptr, old_size); }
+  return res;
+
+}
+
+/* Releases all allocations. If the last round needed more than one chunk, a
+ * single chunk large enough for all of it replaces them, so that the arena
+ * settles on one chunk. */
+void arena_reset(Arena *a) {
+
+  if (a->head->next) {
+
+    size_t size = a->head->size;
+    while (size < a->total) {
+
+      size *= 2;
+
+    }
+
+    arena_free(a);
+    a->head = arena_chunk_new(size);
+
+  }
+
+  a->head->used = 0;
+  a->total = 0;
+  a->last = NULL;
+  a->last_size = 0;
+
+}
+
+void arena_free(Arena *a) {
+
+  arena_chunk *chunk = a->head, *next;
+  while (chunk) {
+
+    next = chunk->next;
+    free(chunk);
+    chunk = next;
+
+  }
+
+  a->head = NULL;
+
+}
+
+/* Walks on the arena. The terminal array is allocated right after the Array
+ * header so that it can be grown in place while it is the last allocation. */
+Array *walk_new(Arena *a, size_t initialSize) {
+
+  Array *walk = (Array *)arena_alloc(a, sizeof(Array));
+  walk->start = (terminal *)arena_alloc(a, initialSize * sizeof(terminal));
+  walk->used = 0;
+  walk->size = initialSize;
+  walk->inputlen = 0;
+  return walk;
+
+}
+
+static inline void walk_reserve(Arena *a, Array *walk, size_t n) {
+
+  if (walk->used + n <= walk->size) { return; }
+
+  size_t size = walk->size * 2;
+  while (size < walk->used + n) {
+
+    size *= 2;
+
+  }
+
+  walk->start = (terminal *)arena_grow(a, walk->start,
+                                       walk->used * sizeof(terminal),
+                                       size * sizeof(terminal));
+  walk->size = size;
+
+}
+
+void walk_push(Arena *a, Array *walk, int state, char *symbol,
+               size_t symbol_len, int trigger_idx) {
+
+  terminal *term_ptr;
+
+  walk_reserve(a, walk, 1);
+  term_ptr = &walk->start[walk->used++];
+  term_ptr->state = state;
+  term_ptr->symbol = symbol;
+  term_ptr->symbol_len = symbol_len;
+  term_ptr->trigger_idx = trigger_idx;
+  walk->inputlen += symbol_len;
+
+}
+
+/* Appends src[from, to) to walk */
+void walk_append(Arena *a, Array *walk, Array *src, size_t from, size_t to) {
+
+  if (to <= from) { return; }
+
+  walk_reserve(a, walk, to - from);
+  memcpy(&walk->start[walk->used], &src->start[from],
+         (to - from) * sizeof(terminal));
+  walk->used += to - from;
+
+  for (size_t x = from; x < to; x++) {
+
+    walk->inputlen += src->start[x].symbol_len;
+
+  }
+
+}
+
+/* Drops the terminals of the walk that do not fit completely into max_size
+ * bytes, so that the walk still describes the unparsed input */
+void walk_truncate(Array *walk, size_t max_size) {
+
+  while (walk->used && walk->inputlen > max_size) {
+
+    walk->inputlen -= walk->start[--walk->used].symbol_len;
+
+  }
+
+}
+
+/* Unparses the walk into buf, truncated to max_size bytes */
+size_t unparse_walk_buf(Array *input, u8 *buf, size_t max_size) {
+
+  size_t    len = 0, cpy;
+  terminal *term_ptr;
+
+  for (size_t x = 0; x < input->used && len < max_size; x++) {
+
+    term_ptr = &input->start[x];
+    cpy = term_ptr->symbol_len;
+    if (cpy > max_size - len) { cpy = max_size - len; }
+    memcpy(buf + len, term_ptr->symbol, cpy);
+    len += cpy;
+
+  }
+
+  return len;
+
+}
+
+/* Same as read_input() but places the walk on the arena and only reads the
+ * used part of the stored array */
+Array *read_input_arena(Arena *a, state *pda, u8 *fn) {
+
+  size_t    hdr[3];
+  terminal *term;
+  FILE *    fp;
+
+  fp = fopen(fn, "rb");
+  if (fp == NULL) { return NULL; }
+
+  if (fread(hdr, sizeof(size_t), 3, fp) != 3 || hdr[0] > hdr[1]) {
+
+    fclose(fp);
+    return NULL;
+
+  }
+
+  Array *input = walk_new(a, hdr[0] ? hdr[0] : 1);
+  if (fread(input->start, sizeof(terminal), hdr[0], fp) != hdr[0]) {
+
+    fclose(fp);
+    return NULL;
+
+  }
+
+  fclose(fp);
+
+  input->used = hdr[0];
+  input->inputlen = hdr[2];
+
+  // Update the pointers to the terminals since they would have changed
+  for (size_t x = 0; x < input->used; x++) {
+
+    term = &input->start[x];
+    term->symbol = (pda + term->state)->ptr[term->trigger_idx].term;
+
+  }
+
+  return input;
+
+}
+
+/* Creates a flat statemap of the walk: the walk offsets of every state
+ * grouped by state (counting sort) and the states that occur repeatedly */
+StateMap *build_statemap(Arena *a, Array *input) {
+
+  StateMap *map = (StateMap *)arena_alloc(a, sizeof(StateMap));
+  int *     fill;
+
+  map->start = (int *)arena_alloc(a, (numstates + 1) * sizeof(int));
+  map->idx = (int *)arena_alloc(a, (input->used + 1) * sizeof(int));
+  map->recur = (int *)arena_alloc(a, numstates * sizeof(int));
+  map->recurlen = 0;
+  fill = (int *)arena_alloc(a, numstates * sizeof(int));
+
+  memset(map->start, 0, (numstates + 1) * sizeof(int));
+  for (size_t x = 0; x < input->used; x++) {
+
+    map->start[input->start[x].state + 1]++;
+
+  }
+
+  for (int x = 0; x < numstates; x++) {
+
+    if (map->start[x + 1] >= 2) { map->recur[map->recurlen++] = x; }
+    map->start[x + 1] += map->start[x];
+    fill[x] = map->start[x];
+
+  }
+
+  for (size_t x = 0; x < input->used; x++) {
+
+    map->idx[fill[input->start[x].state]++] = x;
+
+  }
+
+  return map;
+
+}
@@ -7,6 +7,9 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "afl-fuzz.h"
 #include "gramfuzz.h"
 
@@ -17,17 +20,14 @@ typedef struct my_mutator {
   afl_state_t *afl;
 
   u8 *   mutator_buf;
-  u8 *   unparsed_input;
   Array *mutated_walk;
   Array *orig_walk;
 
-  IdxMap_new *statemap;  // Keeps track of the statemap
-  UT_array ** recurIdx;
-  // Get_Dupes_Ret* getdupesret; // Recursive feature map
-  int recurlen;
+  StateMap *statemap;  // Keeps track of the statemap and recursive features
+
+  Arena orig_arena;  // Holds the walk of the current queue entry
+  Arena mut_arena;   // Holds the mutated walk, reset on every fuzz call
 
-  int mut_alloced;
-  int orig_alloced;
   int mut_idx;  // Signals the current mutator being used, used to cycle through
                 // each mutator
 
@@ -123,6 +123,105 @@ state *create_pda(u8 *automaton_file) {
 
 }
 
+/* Maps an automaton compiled by preprocess/compile_automaton.py. The
+ * terminals are used in place from the mapping, only the state and trigger
+ * tables are allocated. Returns NULL if the file is not in that format. */
+state *create_pda_bin(u8 *automaton_file) {
+
+  gram_bin_header * hdr;
+  gram_bin_state *  bin_states;
+  gram_bin_trigger *bin_triggers;
+  state *           pda;
+  trigger *         triggers;
+  struct stat       st;
+  u8 *              map, *strtab;
+  s32               fd;
+
+  fd = open(automaton_file, O_RDONLY);
+  if (fd < 0) { PFATAL("Unable to open '%s'", automaton_file); }
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(gram_bin_header)) {
+
+    close(fd);
+    return NULL;
+
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { PFATAL("Unable to mmap '%s'", automaton_file); }
+
+  hdr = (gram_bin_header *)map;
+  if (memcmp(hdr->magic, GRAM_BIN_MAGIC, sizeof(hdr->magic))) {
+
+    munmap(map, st.st_size);
+    return NULL;
+
+  }
+
+  u64 expected = sizeof(gram_bin_header) +
+                 (u64)hdr->numstates * sizeof(gram_bin_state) +
+                 (u64)hdr->num_triggers * sizeof(gram_bin_trigger) +
+                 hdr->strtab_len;
+
+  if (hdr->version != GRAM_BIN_VERSION || (u64)st.st_size != expected ||
+      hdr->init_state >= hdr->numstates ||
+      hdr->final_state >= hdr->numstates) {
+
+    FATAL("Corrupt or incompatible binary automaton '%s'", automaton_file);
+
+  }
+
+  bin_states = (gram_bin_state *)(map + sizeof(gram_bin_header));
+  bin_triggers = (gram_bin_trigger *)(bin_states + hdr->numstates);
+  strtab = (u8 *)(bin_triggers + hdr->num_triggers);
+
+  init_state = hdr->init_state;
+  final_state = hdr->final_state;
+  numstates = hdr->numstates;
+  printf("\n[GF] Binary automaton file passed:%s", automaton_file);
+  printf("\tInit=%d Final=%d NumStates=%d\n", init_state, final_state,
+         numstates);
+
+  pda = (state *)calloc(numstates, sizeof(state));
+  triggers = (trigger *)calloc(hdr->num_triggers + 1, sizeof(trigger));
+  if (!pda || !triggers) { PFATAL("automaton alloc"); }
+
+  for (u32 x = 0; x < hdr->num_triggers; x++) {
+
+    gram_bin_trigger *bt = &bin_triggers[x];
+    if (bt->dest >= hdr->numstates ||
+        (u64)bt->term_off + bt->term_len >= hdr->strtab_len) {
+
+      FATAL("Corrupt trigger %u in '%s'", x, automaton_file);
+
+    }
+
+    triggers[x].dest = bt->dest;
+    triggers[x].term = (char *)strtab + bt->term_off;
+    triggers[x].term_len = bt->term_len;
+
+  }
+
+  for (u32 x = 0; x < hdr->numstates; x++) {
+
+    gram_bin_state *bs = &bin_states[x];
+    if ((u64)bs->first_trigger + bs->trigger_cnt > hdr->num_triggers) {
+
+      FATAL("Corrupt state %u in '%s'", x, automaton_file);
+
+    }
+
+    pda[x].state_name = x;
+    pda[x].trigger_len = bs->trigger_cnt;
+    pda[x].ptr = triggers + bs->first_trigger;
+
+  }
+
+  // The mapping stays alive, the terminals point into it
+  return pda;
+
+}
+
 my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
   my_mutator_t *data = calloc(1, sizeof(my_mutator_t));
@@ -144,10 +243,9 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   global_afl = afl;  // dirty
   data->seed = seed;
 
-  data->mut_alloced = 0;
-  data->orig_alloced = 0;
   data->mut_idx = 0;
-  data->recurlen = 0;
+  arena_init(&data->orig_arena, ARENA_INIT_SIZE);
+  arena_init(&data->mut_arena, ARENA_INIT_SIZE);
 
   // data->mutator_buf = NULL;
   // data->unparsed_input = NULL;
@@ -162,7 +260,12 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   char *automaton_file = getenv("GRAMATRON_AUTOMATION");
   if (automaton_file) {
 
-    pda = create_pda(automaton_file);
+    // Prefer the compiled format, fall back to parsing JSON
+    if (!(pda = create_pda_bin(automaton_file))) {
+
+      pda = create_pda(automaton_file);
+
+    }
 
   } else {
 
@@ -181,32 +284,21 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
                        u8 **out_buf, uint8_t *add_buf, size_t add_buf_size,
                        size_t max_size) {
 
-  u8 *unparsed_input;
-
-  // Pick a mutator
-  // int choice = rand() % MUTATORS;
-  // data->mut_idx = 1;
   // GC old mutant
-  if (data->mut_alloced) {
-
-    free(data->mutated_walk->start);
-    free(data->mutated_walk);
-    data->mut_alloced = 0;
-
-  };
-
-  // printf("\nChoice:%d", choice);
+  arena_reset(&data->mut_arena);
+  data->mutated_walk = NULL;
 
   if (data->mut_idx == 0) {  // Perform random mutation
-    data->mutated_walk = performRandomMutation(pda, data->orig_walk);
-    data->mut_alloced = 1;
+
+    data->mutated_walk =
+        performRandomMutationArena(&data->mut_arena, pda, data->orig_walk);
 
   } else if (data->mut_idx == 1 &&
 
-             data->recurlen) {  // Perform recursive mutation
+             data->statemap->recurlen) {  // Perform recursive mutation
+
     data->mutated_walk =
-        doMult(data->orig_walk, data->recurIdx, data->recurlen);
-    data->mut_alloced = 1;
+        doMultArena(&data->mut_arena, data->orig_walk, data->statemap);
 
   } else if (data->mut_idx == 2) {  // Perform splice mutation
 
@@ -216,29 +308,26 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 
     // Read the input representation for the splice candidate
     u8 *   automaton_fn = alloc_printf("%s.aut", q->fname);
-    Array *spliceCandidate = read_input(pda, automaton_fn);
+    Array *spliceCandidate =
+        read_input_arena(&data->mut_arena, pda, automaton_fn);
 
     if (spliceCandidate) {
 
       data->mutated_walk =
-          performSpliceOne(data->orig_walk, data->statemap, spliceCandidate);
-      data->mut_alloced = 1;
-      free(spliceCandidate->start);
-      free(spliceCandidate);
-
-    } else {
-
-      data->mutated_walk = gen_input(pda, NULL);
-      data->mut_alloced = 1;
+          performSpliceOneArena(&data->mut_arena, data->orig_walk,
+                                data->statemap, spliceCandidate);
 
     }
 
     ck_free(automaton_fn);
 
-  } else {  // Generate an input from scratch
+  }
 
-    data->mutated_walk = gen_input(pda, NULL);
-    data->mut_alloced = 1;
+  // Generate an input from scratch (also if splicing found no splice point)
+  if (!data->mutated_walk) {
+
+    data->mutated_walk =
+        gen_input_arena(&data->mut_arena, pda, NULL, init_state);
 
   }
 
@@ -249,12 +338,13 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
   else
     data->mut_idx += 1;
 
-  // Unparse the mutated automaton walk
-  if (data->unparsed_input) { free(data->unparsed_input); }
-  data->unparsed_input = unparse_walk(data->mutated_walk);
-  *out_buf = data->unparsed_input;
+  // Cut the walk to max_size, queue_new_entry() stores it as it is
+  if (max_size > MAX_FILE) { max_size = MAX_FILE; }
+  walk_truncate(data->mutated_walk, max_size);
 
-  return data->mutated_walk->inputlen;
+  // Unparse the mutated automaton walk
+  *out_buf = data->mutator_buf;
+  return unparse_walk_buf(data->mutated_walk, data->mutator_buf, max_size);
 
 }
 
@@ -327,87 +417,20 @@ u8 afl_custom_queue_new_entry(my_mutator_t * data,
 uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
   // get the filename
-  u8 *        automaton_fn = alloc_printf("%s.aut", filename);
-  IdxMap_new *statemap_ptr;
-  terminal *  term_ptr;
-  int         state;
-
-  // TODO: I don't think we need to update pointers when reading back
-  // Probably build two different versions of read_input one for flushing
-  // inputs to disk and the other that
-  if (data->orig_alloced) {
+  u8 *automaton_fn = alloc_printf("%s.aut", filename);
 
-    free(data->orig_walk->start);
-    free(data->orig_walk);
-    data->orig_alloced = 0;
+  // The previous walk and its statemap go away with the arena
+  arena_reset(&data->orig_arena);
 
-  }
-
-  if (data->statemap) {
-
-    for (int x = 0; x < numstates; x++) {
-
-      utarray_free(data->statemap[x].nums);
-
-    }
-
-    free(data->statemap);
-
-  }
-
-  if (data->recurIdx) {
-
-    data->recurlen = 0;
-    free(data->recurIdx);
-
-  }
-
-  data->orig_walk = read_input(pda, automaton_fn);
-  data->orig_alloced = 1;
-
-  // Create statemap for the fuzz candidate
-  IdxMap_new *statemap_start =
-      (IdxMap_new *)malloc(sizeof(IdxMap_new) * numstates);
-  for (int x = 0; x < numstates; x++) {
-
-    statemap_ptr = &statemap_start[x];
-    utarray_new(statemap_ptr->nums, &ut_int_icd);
-
-  }
-
-  int offset = 0;
-  while (offset < data->orig_walk->used) {
-
-    term_ptr = &data->orig_walk->start[offset];
-    state = term_ptr->state;
-    statemap_ptr = &statemap_start[state];
-    utarray_push_back(statemap_ptr->nums, &offset);
-    offset += 1;
-
-  }
-
-  data->statemap = statemap_start;
-
-  // Create recursive feature map (if it exists)
-  data->recurIdx = malloc(sizeof(UT_array *) * numstates);
-  // Retrieve the duplicated states
-  offset = 0;
-  while (offset < numstates) {
-
-    statemap_ptr = &data->statemap[offset];
-    int length = utarray_len(statemap_ptr->nums);
-    if (length >= 2) {
-
-      data->recurIdx[data->recurlen] = statemap_ptr->nums;
-      data->recurlen += 1;
-
-    }
+  data->orig_walk = read_input_arena(&data->orig_arena, pda, automaton_fn);
+  if (!data->orig_walk) {
 
-    offset += 1;
+    FATAL("Unable to read the automaton walk '%s'", automaton_fn);
 
   }
 
-  // data->getdupesret = get_dupes(data->orig_walk, &data->recurlen);
+  // Create statemap and recursive feature map for the fuzz candidate
+  data->statemap = build_statemap(&data->orig_arena, data->orig_walk);
 
   ck_free(automaton_fn);
   return 1;
@@ -422,6 +445,8 @@ uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
 void afl_custom_deinit(my_mutator_t *data) {
 
+  arena_free(&data->orig_arena);
+  arena_free(&data->mut_arena);
   free(data->mutator_buf);
   free(data);
 
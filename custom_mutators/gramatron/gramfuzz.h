@@ -75,6 +75,81 @@ typedef struct {
 
 } Array;
 
+/*****************
+/ ARENA FOR WALKS
+*****************/
+
+// Walks created while fuzzing are carved from an arena that is reset in one
+// go instead of being malloc()ed and free()d one by one. The most recent
+// allocation can be grown in place, which is how walks are extended.
+
+#define ARENA_INIT_SIZE (1 << 20)
+
+typedef struct arena_chunk {
+
+  struct arena_chunk *next;
+  size_t              size;
+  size_t              used;
+  u8                  data[];
+
+} arena_chunk;
+
+typedef struct {
+
+  arena_chunk *head;       // Chunk allocations are currently served from
+  size_t       total;      // Bytes handed out since the last reset
+  u8 *         last;       // Most recent allocation
+  size_t       last_size;  // and its size
+
+} Arena;
+
+/*****************
+/ FLAT STATEMAP FOR ARENA WALKS
+*****************/
+
+typedef struct {
+
+  int *start;     // numstates + 1 offsets into idx
+  int *idx;       // Walk offsets grouped by state
+  int *recur;     // States that occur at least twice in the walk
+  int  recurlen;  // Number of entries in recur
+
+} StateMap;
+
+/*****************
+/ BINARY AUTOMATON FORMAT (see preprocess/compile_automaton.py)
+*****************/
+
+#define GRAM_BIN_MAGIC "GRAMATRN"
+#define GRAM_BIN_VERSION 1
+
+typedef struct {
+
+  u8  magic[8];
+  u32 version;
+  u32 numstates;
+  u32 init_state;
+  u32 final_state;
+  u32 num_triggers;
+  u32 strtab_len;
+
+} gram_bin_header;
+
+typedef struct {
+
+  u32 first_trigger;
+  u32 trigger_cnt;
+
+} gram_bin_state;
+
+typedef struct {
+
+  u32 dest;
+  u32 term_off;
+  u32 term_len;
+
+} gram_bin_trigger;
+
 /*****************
 / DYNAMIC ARRAY FOR STATEMAPS/RECURSION MAPS
 *****************/
@@ -195,7 +270,28 @@ int    fact(int);
 void                add_to_corpus(struct json_object *, Array *);
 struct json_object *term_to_json(terminal *);
 
+/* Arena */
+void   arena_init(Arena *, size_t);
+void * arena_alloc(Arena *, size_t);
+void * arena_grow(Arena *, void *, size_t, size_t);
+void   arena_reset(Arena *);
+void   arena_free(Arena *);
+Array *walk_new(Arena *, size_t);
+void   walk_push(Arena *, Array *, int, char *, size_t, int);
+void   walk_append(Arena *, Array *, Array *, size_t, size_t);
+void   walk_truncate(Array *, size_t);
+size_t unparse_walk_buf(Array *, u8 *, size_t);
+Array *read_input_arena(Arena *, state *, u8 *);
+StateMap *build_statemap(Arena *, Array *);
+
+/* Arena mutation methods */
+Array *gen_input_arena(Arena *, state *, Array *, int);
+Array *performRandomMutationArena(Arena *, state *, Array *);
+Array *performSpliceOneArena(Arena *, Array *, StateMap *, Array *);
+Array *doMultArena(Arena *, Array *, StateMap *);
+
 /* Gramatron specific prototypes */
+state *create_pda_bin(u8 *);
 u8 *   unparse_walk(Array *);
 Array *performSpliceGF(state *, Array *, afl_state_t *);
 void   dump_input(u8 *, char *, int *);
@@ -0,0 +1,74 @@
+import sys
+import json
+import struct
+
+# Compiles the JSON automaton created by construct_automata.py into the binary
+# format that gramatron.so can mmap() directly instead of parsing JSON at
+# startup. Layout (all integers are little endian u32, see gramfuzz.h):
+#
+#   header:   magic "GRAMATRN", version, numstates, init_state, final_state,
+#             number of triggers, size of the string table
+#   states:   numstates x (index of first trigger, number of triggers)
+#   triggers: number of triggers x (dest state, term offset, term length)
+#   strings:  all terminals, each NUL terminated, duplicates stored once
+
+MAGIC = b'GRAMATRN'
+VERSION = 1
+
+def main(automaton, out):
+    with open(automaton, 'r') as fd:
+        data = json.load(fd)
+
+    # Mirror create_pda(): the state table has room for numstates + 1 states
+    numstates = int(data["numstates"]) + 1
+    init_state = int(data["init_state"])
+    final_state = int(data["final_state"])
+
+    states = [(0, 0)] * numstates
+    triggers = []
+    strtab = bytearray()
+    str_offsets = {}
+
+    for key in sorted(data["pda"], key = int):
+        idx = int(key)
+        assert idx < numstates, 'State %d out of range' % idx
+        states[idx] = (len(triggers), len(data["pda"][key]))
+        for _, dest, term in data["pda"][key]:
+            if term == '\\n':
+                term = '\n'
+            raw = term.encode('utf-8')
+            if raw not in str_offsets:
+                str_offsets[raw] = len(strtab)
+                strtab += raw + b'\0'
+            triggers.append((int(dest), str_offsets[raw], len(raw)))
+
+    with open(out, 'wb') as fd:
+        fd.write(MAGIC)
+        fd.write(struct.pack('<6I', VERSION, numstates, init_state,
+            final_state, len(triggers), len(strtab)))
+        for first, count in states:
+            fd.write(struct.pack('<2I', first, count))
+        for dest, offset, length in triggers:
+            fd.write(struct.pack('<3I', dest, offset, length))
+        fd.write(strtab)
+
+    print ('[X] Compiled %d states, %d triggers, %d bytes of terminals to %s'
+        % (numstates, len(triggers), len(strtab), out))
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser(description = 'Script to compile a JSON automaton to the binary format')
+    parser.add_argument(
+            '--automaton',
+            type = str,
+            help = 'Location of the JSON automaton')
+    parser.add_argument(
+            '--out',
+            type = str,
+            default = None,
+            help = 'Output file (default: <automaton>.bin)')
+    args = parser.parse_args()
+    out = args.out
+    if out is None:
+        out = args.automaton.rsplit('.json', 1)[0] + '.bin'
+    main(args.automaton, out)
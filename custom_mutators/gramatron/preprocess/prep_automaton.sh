@@ -33,6 +33,11 @@ fi
 echo $CMD
 $CMD
 
+# Compile the automaton to the binary format gramatron.so can mmap()
+CMD="python3 compile_automaton.py --automaton ${FILENAME}_automata.json"
+echo $CMD
+$CMD
+
 # Move PDA to the source dir of the grammar
-echo "Copying ${FILENAME}_automata.json to $GRAMMAR_DIR"
-mv "${FILENAME}_automata.json" $GRAMMAR_DIR/  
+echo "Copying ${FILENAME}_automata.json and ${FILENAME}_automata.bin to $GRAMMAR_DIR"
+mv "${FILENAME}_automata.json" "${FILENAME}_automata.bin" $GRAMMAR_DIR/  
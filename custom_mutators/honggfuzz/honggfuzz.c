@@ -21,10 +21,33 @@ typedef struct my_mutator {
   run_t       *run;
   u8          *mutator_buf;
   unsigned int seed;
-  unsigned int extras_cnt, a_extras_cnt;
 
 } my_mutator_t;
 
+/* The cmp feedback map of honggfuzz is the table of recent compares of
+   afl-fuzz, mangle_ConstFeedbackDict() reads it directly */
+
+_Static_assert(sizeof(cmpfeedback_t) == sizeof(struct cmp_tokens),
+               "cmpfeedback_t and struct cmp_tokens differ");
+
+/* The afl-fuzz dictionaries for mangle_StaticDict(), not copied */
+
+size_t afl_mutator_dict_count(void) {
+
+  return afl_dict_count(afl_struct);
+
+}
+
+const uint8_t *afl_mutator_dict_get(size_t idx, size_t *len) {
+
+  u32       l;
+  const u8 *val = afl_dict_get(afl_struct, idx, &l);
+
+  *len = l;
+  return val;
+
+}
+
 my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
   my_mutator_t *data = calloc(1, sizeof(my_mutator_t));
@@ -54,53 +77,12 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   run.global->mutate.mutationsPerRun = NUMBER_OF_MUTATIONS;
   run.mutationsPerRun = NUMBER_OF_MUTATIONS;
   run.global->timing.lastCovUpdate = 6;
-
-  // global->feedback.cmpFeedback
-  // global->feedback.cmpFeedbackMap
+  run.global->feedback.cmpFeedbackMap = (cmpfeedback_t *)afl->cmp_tokens;
 
   return data;
 
 }
 
-/* When a new queue entry is added we check if there are new dictionary
-   entries to add to honggfuzz structure */
-
-void afl_custom_queue_new_entry(my_mutator_t  *data,
-                                const uint8_t *filename_new_queue,
-                                const uint8_t *filename_orig_queue) {
-
-  if (run.global->mutate.dictionaryCnt >= 1024) return;
-
-  while (data->extras_cnt < data->afl->extras_cnt &&
-         run.global->mutate.dictionaryCnt < 1024) {
-
-    memcpy(run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].val,
-           data->afl->extras[data->extras_cnt].data,
-           data->afl->extras[data->extras_cnt].len);
-    run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].len =
-        data->afl->extras[data->extras_cnt].len;
-    run.global->mutate.dictionaryCnt++;
-    data->extras_cnt++;
-
-  }
-
-  while (data->a_extras_cnt < data->afl->a_extras_cnt &&
-         run.global->mutate.dictionaryCnt < 1024) {
-
-    memcpy(run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].val,
-           data->afl->a_extras[data->a_extras_cnt].data,
-           data->afl->a_extras[data->a_extras_cnt].len);
-    run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].len =
-        data->afl->a_extras[data->a_extras_cnt].len;
-    run.global->mutate.dictionaryCnt++;
-    data->a_extras_cnt++;
-
-  }
-
-  return;
-
-}
-
 /* we could set only_printable if is_ascii is set ... let's see
 uint8_t afl_custom_queue_get(void *data, const uint8_t *filename) {
 
@@ -124,6 +106,9 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
   run.dynfile->size = buf_size;
   *out_buf = data->mutator_buf;
 
+  /* only use the cmp feedback once cmplog has filled it a bit */
+  run.global->feedback.cmpFeedback = afl_cmp_pair_count(data->afl) > 0;
+
   /* the mutation */
   mangle_mangleContent(&run, NUMBER_OF_MUTATIONS);
 
@@ -527,14 +527,26 @@ static void mangle_Magic(run_t *run, bool printable) {
 
 static void mangle_StaticDict(run_t *run, bool printable) {
 
-  if (run->global->mutate.dictionaryCnt == 0) {
+  size_t own = run->global->mutate.dictionaryCnt;
+  size_t cnt = own + afl_mutator_dict_count();
+
+  if (cnt == 0) {
 
     mangle_Bytes(run, printable);
     return;
 
   }
 
-  uint64_t choice = util_rndGet(0, run->global->mutate.dictionaryCnt - 1);
+  uint64_t choice = util_rndGet(0, cnt - 1);
+  if (choice >= own) {
+
+    size_t         len;
+    const uint8_t *val = afl_mutator_dict_get(choice - own, &len);
+    mangle_UseValue(run, val, len, printable);
+    return;
+
+  }
+
   mangle_UseValue(run, run->global->mutate.dictionary[choice].val,
                   run->global->mutate.dictionary[choice].len, printable);
 
@@ -28,4 +28,8 @@
 
 extern void mangle_mangleContent(run_t* run, int speed_factor);
 
+/* Dictionaries of afl-fuzz, provided by honggfuzz.c */
+extern size_t         afl_mutator_dict_count(void);
+extern const uint8_t* afl_mutator_dict_get(size_t idx, size_t* len);
+
 #endif
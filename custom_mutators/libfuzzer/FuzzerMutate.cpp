@@ -17,6 +17,14 @@
 #include <random>
 #include <chrono>
 
+// The afl-fuzz dictionaries and table of recent compares, see libfuzzer.cpp
+extern "C" size_t         afl_mutator_dict_count(void);
+extern "C" const uint8_t *afl_mutator_dict_get(size_t Idx, size_t *Len);
+extern "C" size_t         afl_mutator_cmp_count(void);
+extern "C" void           afl_mutator_cmp_get(size_t Idx, const uint8_t **A,
+                                              size_t *LenA, const uint8_t **B,
+                                              size_t *LenB);
+
 namespace fuzzer {
 
 const size_t        Dictionary::kMaxDictSize;
@@ -51,6 +59,8 @@ MutationDispatcher::MutationDispatcher(Random &              Rand,
            "ManualDict"},
           {&MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary,
            "PersAutoDict"},
+          {&MutationDispatcher::Mutate_AddWordFromAFLDictionary, "AFLDict"},
+          {&MutationDispatcher::Mutate_AddWordFromAFLCmp, "AFLCmp"},
 
       });
 
@@ -341,6 +351,69 @@ size_t MutationDispatcher::Mutate_AddWordFromTORC(uint8_t *Data, size_t Size,
 
 }
 
+size_t MutationDispatcher::Mutate_AddWordFromAFLDictionary(uint8_t *Data,
+                                                           size_t   Size,
+                                                           size_t   MaxSize) {
+
+  size_t Count = afl_mutator_dict_count(), Len;
+  if (Size > MaxSize || !Count) return 0;
+  const uint8_t *W = afl_mutator_dict_get(Rand(Count), &Len);
+  if (!Len || Len > Word::GetMaxSize()) return 0;
+  DictionaryEntry DE(Word(W, Len));
+  return ApplyDictionaryEntry(Data, Size, MaxSize, DE);
+
+}
+
+// Like Mutate_AddWordFromTORC(), with the compares cmplog saw in afl-fuzz.
+size_t MutationDispatcher::Mutate_AddWordFromAFLCmp(uint8_t *Data, size_t Size,
+                                                    size_t MaxSize) {
+
+  size_t Count = afl_mutator_cmp_count(), LenA, LenB;
+  if (!Count) return 0;
+  const uint8_t *A, *B;
+  afl_mutator_cmp_get(Rand(Count), &A, &LenA, &B, &LenB);
+
+  DictionaryEntry DE;
+  if (LenA == LenB && LenA == 8) {
+
+    uint64_t X, Y;
+    memcpy(&X, A, 8);
+    memcpy(&Y, B, 8);
+    DE = MakeDictionaryEntryFromCMP(X, Y, Data, Size);
+
+  } else if (LenA == LenB && LenA == 4) {
+
+    uint32_t X, Y;
+    memcpy(&X, A, 4);
+    memcpy(&Y, B, 4);
+    DE = MakeDictionaryEntryFromCMP(X, Y, Data, Size);
+
+  } else if (LenA == LenB && LenA == 2) {
+
+    uint16_t X, Y;
+    memcpy(&X, A, 2);
+    memcpy(&Y, B, 2);
+    DE = MakeDictionaryEntryFromCMP(X, Y, Data, Size);
+
+  } else {
+
+    size_t Len = std::min(LenA, LenB);
+    DE = MakeDictionaryEntryFromCMP(Word(A, Len), Word(B, Len), Data, Size);
+
+  }
+
+  if (!DE.GetW().size()) return 0;
+  Size = ApplyDictionaryEntry(Data, Size, MaxSize, DE);
+  if (!Size) return 0;
+  DictionaryEntry &DERef =
+      CmpDictionaryEntriesDeque[CmpDictionaryEntriesDequeIdx++ %
+                                kCmpDictionaryEntriesDequeSize];
+  DERef = DE;
+  CurrentDictionaryEntrySequence.push_back(&DERef);
+  return Size;
+
+}
+
 size_t MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary(
     uint8_t *Data, size_t Size, size_t MaxSize) {
 
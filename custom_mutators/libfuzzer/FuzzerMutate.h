@@ -58,6 +58,14 @@ public:
   /// Mutates data by adding a word from the TORC.
   size_t Mutate_AddWordFromTORC(uint8_t *Data, size_t Size, size_t MaxSize);
 
+  /// Mutates data by adding a word from the afl-fuzz dictionaries.
+  size_t Mutate_AddWordFromAFLDictionary(uint8_t *Data, size_t Size,
+                                         size_t MaxSize);
+
+  /// Mutates data by adding a word from the afl-fuzz table of recent
+  /// compares.
+  size_t Mutate_AddWordFromAFLCmp(uint8_t *Data, size_t Size, size_t MaxSize);
+
   /// Mutates data by adding a word from the persistent automatic dictionary.
   size_t Mutate_AddWordFromPersistentAutoDictionary(uint8_t *Data, size_t Size,
                                                     size_t MaxSize);
@@ -25,10 +25,46 @@ typedef struct my_mutator {
   afl_state_t *afl;
   u8 *         mutator_buf;
   unsigned int seed;
-  unsigned int extras_cnt, a_extras_cnt;
 
 } my_mutator_t;
 
+/* Read-only access to the afl-fuzz dictionaries and table of recent compares
+   for the AFLDict and AFLCmp mutations in FuzzerMutate.cpp */
+
+extern "C" size_t afl_mutator_dict_count(void) {
+
+  return afl_dict_count(afl_struct);
+
+}
+
+extern "C" const uint8_t *afl_mutator_dict_get(size_t idx, size_t *len) {
+
+  u32       l;
+  const u8 *val = afl_dict_get(afl_struct, idx, &l);
+
+  *len = l;
+  return val;
+
+}
+
+extern "C" size_t afl_mutator_cmp_count(void) {
+
+  return afl_cmp_pair_count(afl_struct);
+
+}
+
+extern "C" void afl_mutator_cmp_get(size_t idx, const uint8_t **a,
+                                    size_t *len_a, const uint8_t **b,
+                                    size_t *len_b) {
+
+  u32 la, lb;
+
+  afl_cmp_pair_get(afl_struct, idx, a, &la, b, &lb);
+  *len_a = la;
+  *len_b = lb;
+
+}
+
 extern "C" int dummy(const uint8_t *Data, size_t Size) {
 
   (void)(Data);
@@ -75,46 +111,6 @@ extern "C" my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
 }
 
-/* When a new queue entry is added we check if there are new dictionary
-   entries to add to honggfuzz structure */
-#if 0
-extern "C" uint8_t afl_custom_queue_new_entry(my_mutator_t * data,
-                                              const uint8_t *filename_new_queue,
-                                              const uint8_t *filename_orig_queue) {
-
-  while (data->extras_cnt < afl_struct->extras_cnt) {
-
-    /*
-        memcpy(run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].val,
-               afl_struct->extras[data->extras_cnt].data,
-               afl_struct->extras[data->extras_cnt].len);
-        run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].len =
-            afl_struct->extras[data->extras_cnt].len;
-        run.global->mutate.dictionaryCnt++;
-    */
-    data->extras_cnt++;
-
-  }
-
-  while (data->a_extras_cnt < afl_struct->a_extras_cnt) {
-
-    /*
-        memcpy(run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].val,
-               afl_struct->a_extras[data->a_extras_cnt].data,
-               afl_struct->a_extras[data->a_extras_cnt].len);
-        run.global->mutate.dictionary[run.global->mutate.dictionaryCnt].len =
-            afl_struct->a_extras[data->a_extras_cnt].len;
-        run.global->mutate.dictionaryCnt++;
-        data->a_extras_cnt++;
-    */
-
-  }
-
-  return 0;
-
-}
-
-#endif
 /* we could set only_printable if is_ascii is set ... let's see
 uint8_t afl_custom_queue_get(void *data, const uint8_t *filename) {
 
@@ -5,6 +5,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include "config.h"
 #include "debug.h"
 #include "afl-fuzz.h"
@@ -19,17 +22,89 @@ afl_state_t *afl_struct;
     {}
 #endif
 
+/* Defaults for SYMCC_WORKERS, SYMCC_QUEUE_SIZE and SYMCC_TIMEOUT (seconds) */
+
+#define SYMCC_MAX_WORKERS 64
+#define SYMCC_DEF_QUEUE_SIZE 256
+#define SYMCC_DEF_TIMEOUT 60
+
+/* A queue entry waiting for a concolic run */
+
+typedef struct symcc_job {
+
+  u8 *fname;                            /* queue file                       */
+  u32 id;                               /* queue entry id                   */
+  u64 seq;                              /* enqueue order, newer is bigger   */
+
+} symcc_job_t;
+
+/* A running symcc process */
+
+typedef struct symcc_worker {
+
+  pid_t pid;                            /* 0 if idle                        */
+  u8   *fname;                          /* queue file being run             */
+  u8   *tmp_dir;                        /* SYMCC_OUTPUT_DIR of this worker  */
+  u8   *input;                          /* private input copy (@@ targets)  */
+  u64   start;                          /* start time (ms)                  */
+
+} symcc_worker_t;
+
 typedef struct my_mutator {
 
   afl_state_t *afl;
-  u8 *         mutator_buf;
-  u8 *         out_dir;
-  u8 *         tmp_dir;
-  u8 *         target;
+  u8          *mutator_buf;
+  u8          *out_dir;
+  u8          *tmp_dir;
+  u8          *target;
   uint32_t     seed;
 
+  symcc_worker_t workers[SYMCC_MAX_WORKERS];
+  u32            workers_cnt;
+  u64            timeout;               /* ms                               */
+
+  symcc_job_t *jobs;                    /* pending entries, unordered       */
+  u32          jobs_cnt, jobs_max;
+  u64          jobs_seq;
+
+  u8 **ready;                           /* generated inputs, FIFO           */
+  u32  ready_pos, ready_cnt, ready_size;
+
 } my_mutator_t;
 
+static u64 now_ms(void) {
+
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec * 1000ULL) + (tv.tv_usec / 1000);
+
+}
+
+static void rm_rf(u8 *dir) {
+
+  int pid = fork();
+
+  if (pid == -1) return;
+
+  if (pid) {
+
+    waitpid(pid, NULL, 0);
+    return;
+
+  }
+
+  char *args[4];
+  args[0] = "/bin/rm";
+  args[1] = "-rf";
+  args[2] = dir;
+  args[3] = NULL;
+  execvp(args[0], args);
+  DBG("exec:FAIL\n");
+  exit(-1);
+
+}
+
 my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
   if (getenv("AFL_CUSTOM_MUTATOR_ONLY"))
@@ -62,27 +137,43 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
   }
 
-  data->tmp_dir = alloc_printf("%s/tmp", data->out_dir);
-  setenv("SYMCC_OUTPUT_DIR", data->tmp_dir, 1);
-  int pid = fork();
+  data->workers_cnt = 1;
+  if (getenv("SYMCC_WORKERS")) {
 
-  if (pid == -1) return NULL;
+    data->workers_cnt = atoi(getenv("SYMCC_WORKERS"));
+    if (data->workers_cnt < 1 || data->workers_cnt > SYMCC_MAX_WORKERS)
+      FATAL("SYMCC_WORKERS must be between 1 and %u", SYMCC_MAX_WORKERS);
 
-  if (pid) pid = waitpid(pid, NULL, 0);
+  }
 
-  if (pid == 0) {
+  data->jobs_max = SYMCC_DEF_QUEUE_SIZE;
+  if (getenv("SYMCC_QUEUE_SIZE")) {
 
-    char *args[4];
-    args[0] = "/bin/rm";
-    args[1] = "-rf";
-    args[2] = data->out_dir;
-    args[3] = NULL;
-    execvp(args[0], args);
-    DBG("exec:FAIL\n");
-    exit(-1);
+    data->jobs_max = atoi(getenv("SYMCC_QUEUE_SIZE"));
+    if (data->jobs_max < 1) FATAL("SYMCC_QUEUE_SIZE must be at least 1");
+
+  }
+
+  data->timeout = SYMCC_DEF_TIMEOUT * 1000;
+  if (getenv("SYMCC_TIMEOUT")) {
+
+    data->timeout = atoi(getenv("SYMCC_TIMEOUT")) * 1000;
 
   }
 
+  data->jobs = calloc(data->jobs_max, sizeof(symcc_job_t));
+  if (!data->jobs) {
+
+    free(data->mutator_buf);
+    free(data);
+    perror("jobs alloc");
+    return NULL;
+
+  }
+
+  data->tmp_dir = alloc_printf("%s/tmp", data->out_dir);
+  rm_rf(data->out_dir);
+
   data->afl = afl;
   data->seed = seed;
   afl_struct = afl;
@@ -93,228 +184,385 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   if (mkdir(data->tmp_dir, 0755))
     PFATAL("Could not create directory %s", data->tmp_dir);
 
-  DBG("out_dir=%s, target=%s\n", data->out_dir, data->target);
+  for (u32 i = 0; i < data->workers_cnt; ++i) {
+
+    symcc_worker_t *w = &data->workers[i];
+
+    w->tmp_dir = alloc_printf("%s/%u", data->tmp_dir, i);
+    if (mkdir(w->tmp_dir, 0755))
+      PFATAL("Could not create directory %s", w->tmp_dir);
+
+    if (!afl->fsrv.use_stdin) {
+
+      w->input = alloc_printf("%s/.input.%u", data->tmp_dir, i);
+
+    }
+
+  }
+
+  DBG("out_dir=%s, target=%s, workers=%u\n", data->out_dir, data->target,
+      data->workers_cnt);
 
   return data;
 
 }
 
-/* When a new queue entry is added we run this input with the symcc
-   instrumented binary */
-uint8_t afl_custom_queue_new_entry(my_mutator_t * data,
-                                   const uint8_t *filename_new_queue,
-                                   const uint8_t *filename_orig_queue) {
+/* How interesting a pending entry is for a concolic run. The attributes are
+   only known once afl-fuzz has calibrated the entry, which is why this is
+   evaluated when picking a job and not when queueing it. */
 
-  int         pipefd[2];
-  struct stat st;
-  ACTF("Queueing to symcc: %s", filename_new_queue);
-  u8 *fn = alloc_printf("%s", filename_new_queue);
-  if (!(stat(fn, &st) == 0 && S_ISREG(st.st_mode) && st.st_size)) {
+static u64 job_score(my_mutator_t *data, symcc_job_t *job) {
 
-    ck_free(fn);
-    PFATAL("Couldn't find enqueued file: %s", fn);
+  afl_state_t *afl = data->afl;
+  u64          score = 0;
+
+  if (job->id < afl->queued_items && afl->queue_buf &&
+      !strcmp((char *)afl->queue_buf[job->id]->fname, (char *)job->fname)) {
+
+    struct queue_entry *q = afl->queue_buf[job->id];
+
+    score = ((u64)q->has_new_cov << 2) | ((u64)q->favored << 1) |
+            (u64)(!q->var_behavior);
 
   }
 
-  if (afl_struct->fsrv.use_stdin) {
+  /* newer first among equals */
+  return (score << 48) | job->seq;
 
-    if (pipe(pipefd) == -1) {
+}
 
-      ck_free(fn);
-      PFATAL("Couldn't create a pipe for interacting with symcc child process");
+static void ready_push(my_mutator_t *data, u8 *fn) {
 
-    }
+  if (data->ready_pos && data->ready_pos == data->ready_cnt) {
+
+    data->ready_pos = data->ready_cnt = 0;
 
   }
 
-  int pid = fork();
+  if (data->ready_cnt == data->ready_size) {
 
-  if (pid == -1) return 0;
+    if (data->ready_pos) {
 
-  if (pid) {
+      memmove(data->ready, data->ready + data->ready_pos,
+              (data->ready_cnt - data->ready_pos) * sizeof(u8 *));
+      data->ready_cnt -= data->ready_pos;
+      data->ready_pos = 0;
 
-    if (afl_struct->fsrv.use_stdin) {
+    } else {
 
-      close(pipefd[0]);
-      int fd = open(fn, O_RDONLY);
+      data->ready_size = data->ready_size ? data->ready_size * 2 : 64;
+      data->ready = ck_realloc(data->ready, data->ready_size * sizeof(u8 *));
 
-      if (fd >= 0) {
+    }
 
-        ssize_t r = read(fd, data->mutator_buf, MAX_FILE);
-        DBG("fn=%s, fd=%d, size=%ld\n", fn, fd, r);
-        ck_free(fn);
-        close(fd);
-        if (r <= 0) {
+  }
 
-          close(pipefd[1]);
-          return 0;
+  data->ready[data->ready_cnt++] = fn;
 
-        }
+}
 
-        if (r > fcntl(pipefd[1], F_GETPIPE_SZ))
-          fcntl(pipefd[1], F_SETPIPE_SZ, MAX_FILE);
-        ck_write(pipefd[1], data->mutator_buf, r, filename_new_queue);
+/* Move what a finished worker generated to the output dir - their names
+   collide between runs - and remember it for afl_custom_fuzz */
 
-      } else {
+static void collect_worker(my_mutator_t *data, symcc_worker_t *w) {
 
-        ck_free(fn);
-        close(pipefd[1]);
-        PFATAL(
-            "Something happened to the enqueued file before sending its "
-            "contents to symcc binary");
+  struct dirent **nl;
+  int32_t         items = scandir(w->tmp_dir, &nl, NULL, NULL);
+  u8             *origin_name = basename(w->fname);
+  int32_t         i;
 
-      }
+  if (items > 0) {
 
-      close(pipefd[1]);
+    for (i = 0; i < items; ++i) {
 
-    }
+      struct stat st;
+      u8 *source_name = alloc_printf("%s/%s", w->tmp_dir, nl[i]->d_name);
+      if (stat(source_name, &st) || !S_ISREG(st.st_mode)) {
 
-    pid = waitpid(pid, NULL, 0);
+        /* "." and ".." */
 
-    // At this point we need to transfer files to output dir, since their names
-    // collide and symcc will just overwrite them
+      } else if (st.st_size) {
 
-    struct dirent **nl;
-    int32_t         items = scandir(data->tmp_dir, &nl, NULL, NULL);
-    u8 *            origin_name = basename(filename_new_queue);
-    int32_t         i;
-    if (items > 0) {
+        u8 *destination_name =
+            alloc_printf("%s/%s.%s", data->out_dir, origin_name, nl[i]->d_name);
+        if (!rename(source_name, destination_name)) {
 
-      for (i = 0; i < (u32)items; ++i) {
+          ready_push(data, destination_name);
+          DBG("found=%s\n", destination_name);
 
-        struct stat st;
-        u8 *source_name = alloc_printf("%s/%s", data->tmp_dir, nl[i]->d_name);
-        DBG("test=%s\n", fn);
-        if (stat(source_name, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+        } else {
 
-          u8 *destination_name =
-              alloc_printf("%s/%s.%s", data->out_dir, origin_name, nl[i]->d_name);
-          rename(source_name, destination_name);
           ck_free(destination_name);
-          DBG("found=%s\n", source_name);
 
         }
 
-        ck_free(source_name);
-        free(nl[i]);
+      } else {
+
+        unlink(source_name);
 
       }
 
-      free(nl);
+      ck_free(source_name);
+      free(nl[i]);
 
     }
 
+    free(nl);
+
   }
 
-  if (pid == 0) {
+  ck_free(w->fname);
+  w->fname = NULL;
+  w->pid = 0;
 
-    if (afl_struct->fsrv.use_stdin) {
+}
 
-      unsetenv("SYMCC_INPUT_FILE");
-      close(pipefd[1]);
-      dup2(pipefd[0], 0);
+static void start_worker(my_mutator_t *data, symcc_worker_t *w,
+                         symcc_job_t *job) {
+
+  afl_state_t *afl = data->afl;
+  int          in_fd = -1;
+
+  if (w->input) {
+
+    /* afl-fuzz keeps rewriting its own @@ file, give symcc a stable copy */
+
+    int   fd = open(job->fname, O_RDONLY);
+    ssize_t r = fd >= 0 ? read(fd, data->mutator_buf, MAX_FILE) : -1;
+    if (fd >= 0) close(fd);
+    if (r <= 0) goto skip;
+
+    unlink(w->input);
+    fd = open(w->input, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+    if (fd < 0) goto skip;
+    ck_write(fd, data->mutator_buf, r, w->input);
+    close(fd);
+
+  } else {
+
+    in_fd = open(job->fname, O_RDONLY);
+    if (in_fd < 0) goto skip;
+
+  }
+
+  ACTF("Running symcc on: %s", job->fname);
+
+  w->pid = fork();
+
+  if (w->pid == -1) {
+
+    w->pid = 0;
+    if (in_fd >= 0) close(in_fd);
+    goto skip;
+
+  }
+
+  if (w->pid == 0) {
+
+    char **argv = afl->argv;
+
+    setenv("SYMCC_OUTPUT_DIR", w->tmp_dir, 1);
+
+    if (w->input) {
+
+      u32 argc = 0, i;
+      while (afl->argv[argc]) {
+
+        ++argc;
+
+      }
+
+      argv = ck_alloc((argc + 1) * sizeof(char *));
+      for (i = 0; i < argc; ++i) {
+
+        argv[i] = afl->fsrv.out_file && !strcmp(afl->argv[i], afl->fsrv.out_file)
+                      ? (char *)w->input
+                      : afl->argv[i];
+
+      }
+
+      setenv("SYMCC_INPUT_FILE", w->input, 1);
 
     } else {
 
-      setenv("SYMCC_INPUT_FILE", afl_struct->fsrv.out_file, 1);
+      unsetenv("SYMCC_INPUT_FILE");
+      dup2(in_fd, 0);
+      close(in_fd);
 
     }
 
+    /* let afl-fuzz keep the cpu when there is nothing spare */
+    if (nice(10) == -1) {}
+
     DBG("exec=%s\n", data->target);
     close(1);
     close(2);
-    dup2(afl_struct->fsrv.dev_null_fd, 1);
-    dup2(afl_struct->fsrv.dev_null_fd, 2);
+    dup2(afl->fsrv.dev_null_fd, 1);
+    dup2(afl->fsrv.dev_null_fd, 2);
 
-    execvp(data->target, afl_struct->argv);
+    execvp(data->target, argv);
     DBG("exec=FAIL\n");
     exit(-1);
 
   }
 
-  return 0;
+  if (in_fd >= 0) close(in_fd);
+  w->fname = job->fname;
+  w->start = now_ms();
+  return;
+
+skip:
+  ck_free(job->fname);
 
 }
 
-uint32_t afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
-                               size_t buf_size) {
+/* Reap finished workers and hand them the best pending entries. Never
+   blocks, so afl-fuzz keeps fuzzing while symcc runs on the spare cores. */
 
-  uint32_t        count = 0, i;
-  struct dirent **nl;
-  int32_t         items = scandir(data->out_dir, &nl, NULL, NULL);
+static void poll_workers(my_mutator_t *data) {
 
-  if (items > 0) {
+  u64 now = 0;
 
-    for (i = 0; i < (u32)items; ++i) {
+  for (u32 i = 0; i < data->workers_cnt; ++i) {
 
-      struct stat st;
-      u8 *        fn = alloc_printf("%s/%s", data->out_dir, nl[i]->d_name);
-      DBG("test=%s\n", fn);
-      if (stat(fn, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+    symcc_worker_t *w = &data->workers[i];
 
-        DBG("found=%s\n", fn);
-        count++;
+    if (w->pid) {
 
-      }
+      if (waitpid(w->pid, NULL, WNOHANG) == w->pid) {
 
-      ck_free(fn);
-      free(nl[i]);
+        collect_worker(data, w);
+
+      } else if (data->timeout) {
+
+        if (!now) now = now_ms();
+        if (now - w->start > data->timeout) {
+
+          kill(w->pid, SIGKILL);
+          waitpid(w->pid, NULL, 0);
+          collect_worker(data, w);
+
+        }
+
+      }
 
     }
 
-    free(nl);
+    if (!w->pid && data->jobs_cnt) {
 
-  }
+      u32 best = 0;
+      u64 best_score = job_score(data, &data->jobs[0]);
 
-  DBG("dir=%s, count=%u\n", data->out_dir, count);
-  return count;
+      for (u32 j = 1; j < data->jobs_cnt; ++j) {
 
-}
+        u64 score = job_score(data, &data->jobs[j]);
+        if (score > best_score) {
 
-/* here we actually just read the files generated from symcc */
-size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
-                       u8 **out_buf, uint8_t *add_buf, size_t add_buf_size,
-                       size_t max_size) {
+          best = j;
+          best_score = score;
 
-  struct dirent **nl;
-  int32_t         i, done = 0, items = scandir(data->out_dir, &nl, NULL, NULL);
-  ssize_t         size = 0;
+        }
+
+      }
+
+      symcc_job_t job = data->jobs[best];
+      data->jobs[best] = data->jobs[--data->jobs_cnt];
+      start_worker(data, w, &job);
 
-  if (items <= 0) return 0;
+    }
 
-  for (i = 0; i < (u32)items; ++i) {
+  }
 
-    struct stat st;
-    u8 *        fn = alloc_printf("%s/%s", data->out_dir, nl[i]->d_name);
+}
 
-    if (done == 0) {
+/* When a new queue entry is added we queue it for a run with the symcc
+   instrumented binary. If the queue is full, the least interesting pending
+   entry is dropped. */
+uint8_t afl_custom_queue_new_entry(my_mutator_t  *data,
+                                   const uint8_t *filename_new_queue,
+                                   const uint8_t *filename_orig_queue) {
 
-      if (stat(fn, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+  symcc_job_t job;
 
-        int fd = open(fn, O_RDONLY);
+  (void)filename_orig_queue;
 
-        if (fd >= 0) {
+  job.fname = alloc_printf("%s", filename_new_queue);
+  job.id = data->afl->queued_items - 1;
+  job.seq = ++data->jobs_seq;
 
-          size = read(fd, data->mutator_buf, max_size);
-          *out_buf = data->mutator_buf;
+  DBG("Queueing to symcc: %s\n", job.fname);
 
-          close(fd);
-          done = 1;
+  if (data->jobs_cnt == data->jobs_max) {
 
-        }
+    u32 worst = 0;
+    u64 worst_score = job_score(data, &data->jobs[0]);
+
+    for (u32 j = 1; j < data->jobs_cnt; ++j) {
+
+      u64 score = job_score(data, &data->jobs[j]);
+      if (score < worst_score) {
+
+        worst = j;
+        worst_score = score;
 
       }
 
-      unlink(fn);
+    }
+
+    ck_free(data->jobs[worst].fname);
+    data->jobs[worst] = job;
+
+  } else {
+
+    data->jobs[data->jobs_cnt++] = job;
+
+  }
+
+  poll_workers(data);
+
+  return 0;
+
+}
+
+uint32_t afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
+                               size_t buf_size) {
+
+  (void)buf;
+  (void)buf_size;
+
+  poll_workers(data);
+
+  DBG("dir=%s, count=%u\n", data->out_dir, data->ready_cnt - data->ready_pos);
+  return data->ready_cnt - data->ready_pos;
+
+}
+
+/* here we actually just read the files generated from symcc */
+size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
+                       u8 **out_buf, uint8_t *add_buf, size_t add_buf_size,
+                       size_t max_size) {
+
+  ssize_t size = 0;
+
+  while (!size && data->ready_pos < data->ready_cnt) {
+
+    u8 *fn = data->ready[data->ready_pos++];
+    int fd = open(fn, O_RDONLY);
+
+    if (fd >= 0) {
+
+      size = read(fd, data->mutator_buf, max_size);
+      if (size < 0) size = 0;
+      *out_buf = data->mutator_buf;
+      close(fd);
 
     }
 
+    unlink(fn);
     ck_free(fn);
-    free(nl[i]);
 
   }
 
-  free(nl);
   DBG("FUZZ size=%lu\n", size);
   return (uint32_t)size;
 
@@ -327,6 +575,37 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
  */
 void afl_custom_deinit(my_mutator_t *data) {
 
+  for (u32 i = 0; i < data->workers_cnt; ++i) {
+
+    symcc_worker_t *w = &data->workers[i];
+
+    if (w->pid) {
+
+      kill(w->pid, SIGKILL);
+      waitpid(w->pid, NULL, 0);
+
+    }
+
+    ck_free(w->fname);
+    ck_free(w->tmp_dir);
+    ck_free(w->input);
+
+  }
+
+  for (u32 i = 0; i < data->jobs_cnt; ++i) {
+
+    ck_free(data->jobs[i].fname);
+
+  }
+
+  for (u32 i = data->ready_pos; i < data->ready_cnt; ++i) {
+
+    ck_free(data->ready[i]);
+
+  }
+
+  ck_free(data->ready);
+  free(data->jobs);
   free(data->mutator_buf);
   free(data);
 
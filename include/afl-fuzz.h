@@ -136,6 +136,12 @@
   #define AFL_RAND_RETURN u32
 #endif
 
+/* The RNG runs RAND_LANES independent xoshiro256++ generators side by side
+   (so the compiler can vectorize them) and refills a buffer of RAND_BUF_SIZE
+   32 bit words at once. */
+#define RAND_LANES 4
+#define RAND_BUF_SIZE 512
+
 extern s8  interesting_8[INTERESTING_8_LEN];
 extern s16 interesting_16[INTERESTING_8_LEN + INTERESTING_16_LEN];
 extern s32
@@ -166,11 +172,12 @@ struct queue_entry {
       favored,                          /* Currently favored?               */
       fs_redundant,                     /* Marked as redundant in the fs?   */
       is_ascii,                         /* Is the input just ascii text?    */
-      disabled;                         /* Is disabled from fuzz selection  */
+      disabled,                         /* Is disabled from fuzz selection  */
+      archived;                         /* Disabled by queue_archive()      */
 
   u32 bitmap_size,                      /* Number of bits set in bitmap     */
       fuzz_level,                       /* Number of fuzzing iterations     */
-      n_fuzz_entry                      /* offset in n_fuzz                 */
+      rare_edge                         /* Its least hit edge, edge_hits[]  */
 #ifdef INTROSPECTION
       ,
       stats_selected,                   /* stats: how often selected        */
@@ -185,6 +192,7 @@ struct queue_entry {
       handicap,                         /* Number of queue cycles behind    */
       depth,                            /* Path depth                       */
       exec_cksum,                       /* Checksum of the execution trace  */
+      n_fuzz_cksum,                     /* Path checksum, key in n_fuzz     */
       custom,                           /* Marker for custom mutators       */
       stats_mutated;                    /* stats: # of mutations performed  */
 
@@ -205,6 +213,35 @@ struct queue_entry {
 
   struct queue_entry *mother;           /* queue entry this based on        */
 
+  u64 *splice_sketch;                   /* Hashes of aligned content blocks */
+  u32  splice_sketch_cnt;               /* Number of block hashes, 0 = none */
+  u8   splice_sketch_lvl;               /* Block size SPLICE_SKETCH_BLOCK<<n */
+
+  struct mutator_bandit_arm *bandit;    /* Finds/execs per mutator, or NULL */
+
+  u32 *exec_hist;                       /* Run times of mutants, log2 ms    */
+
+};
+
+/* An input killed at the adaptive timeout, with the stage that made it */
+
+struct tmout_deferred {
+
+  u8 *buf;                              /* The input                        */
+  u32 len;                              /* Its length                       */
+  u8 *stage_short;                      /* Stage for describe_op()          */
+  s32 stage_cur_byte, stage_cur_val, splicing_with;
+  u8  stage_val_type;
+
+};
+
+/* Crashes saved for one stack hash (AFL_CRASH_BUCKET_LIMIT) */
+
+struct crash_bucket {
+
+  u64 hash;                             /* Stack hash, 0 = free slot        */
+  u32 saved;                            /* Crashes saved with this hash     */
+
 };
 
 struct extra_data {
@@ -215,6 +252,25 @@ struct extra_data {
 
 };
 
+/* Flags of the offsets returned by extras_positions() */
+
+#define EXTRAS_POS_START 1
+#define EXTRAS_POS_END 2
+
+/* Node of the token prefix automaton used by extras_positions() */
+
+struct extras_ac_node {
+
+  u32 child;                            /* First child node, 0 = none       */
+  u32 sibling;                          /* Next child of the parent         */
+  u32 fail;                             /* Aho-Corasick failure link        */
+  u8  byte;                             /* Byte leading to this node        */
+  u8  depth;                            /* Length of the prefix             */
+  u8  token;                            /* A complete token ends here       */
+  u8  suffix_token;                     /* ... or one of its suffixes       */
+
+};
+
 struct auto_extra_data {
 
   u8  data[MAX_AUTO_EXTRA];             /* Dictionary token data            */
@@ -223,6 +279,35 @@ struct auto_extra_data {
 
 };
 
+/* Table of recent compares: the operands cmplog logged for the last
+   queue entries, shared read-only with custom mutators. The operands of a
+   compare are in two consecutive slots, starting at an even one. cnt only
+   grows, slot cnt % CMP_TOKENS is overwritten next. The layout matches
+   cmpfeedback_t of honggfuzz. */
+
+struct cmp_tokens {
+
+  u32 cnt;                              /* Operands added so far            */
+
+  struct {
+
+    u8  val[CMP_TOKEN_LEN];             /* Operand bytes                    */
+    u32 len;                            /* Operand length                   */
+
+  } tok[CMP_TOKENS];
+
+};
+
+/* Finds and execs of one arm of the mutator bandit: a custom mutator, or
+   havoc (and splice) as the last arm. */
+
+struct mutator_bandit_arm {
+
+  double finds;                         /* New paths and crashes            */
+  double execs;                         /* Executions spent                 */
+
+};
+
 /* Fuzzing stages */
 
 enum {
@@ -347,6 +432,7 @@ enum {
   /* 13 */ PY_FUNC_DESCRIBE,
   /* 14 */ PY_FUNC_FUZZ_SEND,
   /* 15 */ PY_FUNC_SPLICE_OPTOUT,
+  /* 16 */ PY_FUNC_FUZZ_BATCH,
   PY_FUNC_COUNT
 
 };
@@ -361,6 +447,10 @@ typedef struct py_mutator {
   u8    *fuzz_buf;
   size_t fuzz_size;
 
+  /* fuzz() arguments, reused across calls while python holds no reference */
+  PyObject *fuzz_arg_buf, *fuzz_arg_add_buf, *fuzz_arg_max_size;
+  size_t    fuzz_max_size;
+
   Py_buffer post_process_buf;
 
   u8    *trim_buf;
@@ -373,14 +463,35 @@ typedef struct py_mutator {
 
 #endif
 
+/* MOpt operator stats of a pilot swarm or of the core module. finds and
+   cycles are the values at the start of the current period. */
+
+struct mopt_op_stats {
+
+  u64 finds[operator_num], finds_v2[operator_num];
+  u64 cycles[operator_num], cycles_v2[operator_num];
+
+};
+
+/* A MOpt pilot swarm, i.e. a particle of the swarm optimization */
+
+struct mopt_swarm {
+
+  double x_now[operator_num];           /* Operator probabilities           */
+  double v_now[operator_num];           /* Their velocities                 */
+  double L_best[operator_num];          /* Position with best efficiency    */
+  double eff_best[operator_num];        /* Best efficiency per operator     */
+  double probability_now[operator_num]; /* Cumulative x_now, for selection  */
+  double fitness;                       /* Finds per time, last period      */
+
+  struct mopt_op_stats stats;
+
+};
+
 typedef struct MOpt_globals {
 
-  u64  *finds;
-  u64  *finds_v2;
-  u64  *cycles;
-  u64  *cycles_v2;
-  u64  *cycles_v3;
-  u32   is_pilot_mode;
+  struct mopt_op_stats *stats;
+  u32                   is_pilot_mode;
   u64  *pTime;
   u64   period;
   char *havoc_stagename;
@@ -402,14 +513,18 @@ typedef struct afl_env_vars {
       afl_exit_on_seed_issues, afl_try_affinity, afl_ignore_problems,
       afl_keep_timeouts, afl_no_crash_readme, afl_ignore_timeouts,
       afl_no_startup_calibration, afl_no_warn_instability,
-      afl_post_process_keep_original, afl_crashing_seeds_as_new_crash;
+      afl_post_process_keep_original, afl_crashing_seeds_as_new_crash,
+      afl_python_release_gil, afl_targeted_extras, afl_custom_mutator_isolate,
+      afl_custom_mutator_bandit, afl_mopt_share, afl_queue_archive,
+      afl_adaptive_tmout;
 
   u8 *afl_tmpdir, *afl_custom_mutator_library, *afl_python_module, *afl_path,
       *afl_hang_tmout, *afl_forksrv_init_tmout, *afl_preload,
       *afl_max_det_extras, *afl_statsd_host, *afl_statsd_port,
       *afl_crash_exitcode, *afl_statsd_tags_flavor, *afl_testcache_size,
       *afl_testcache_entries, *afl_child_kill_signal, *afl_fsrv_kill_signal,
-      *afl_target_env, *afl_persistent_record, *afl_exit_on_time;
+      *afl_target_env, *afl_persistent_record, *afl_exit_on_time,
+      *afl_crash_bucket_limit;
 
   s32 afl_pizza_mode;
 
@@ -437,6 +552,7 @@ typedef struct afl_state {
   afl_forkserver_t fsrv;
   sharedmem_t      shm;
   sharedmem_t     *shm_fuzz;
+  sharedmem_t     *shm_crash;
   afl_env_vars_t   afl_env;
 
   char **argv;                                            /* argv if needed */
@@ -462,23 +578,12 @@ typedef struct afl_state {
   u64 tmp_core_time;
   s32 swarm_now;
 
-  double x_now[swarm_num][operator_num], L_best[swarm_num][operator_num],
-      eff_best[swarm_num][operator_num], G_best[operator_num],
-      v_now[swarm_num][operator_num], probability_now[swarm_num][operator_num],
-      swarm_fitness[swarm_num];
-
-  u64 stage_finds_puppet[swarm_num][operator_num], /* Patterns found per
-                                                            fuzz stage    */
-      stage_finds_puppet_v2[swarm_num][operator_num],
-      stage_cycles_puppet_v2[swarm_num][operator_num],
-      stage_cycles_puppet_v3[swarm_num][operator_num],
-      stage_cycles_puppet[swarm_num][operator_num],
-      operator_finds_puppet[operator_num],
-      core_operator_finds_puppet[operator_num],
-      core_operator_finds_puppet_v2[operator_num],
-      core_operator_cycles_puppet[operator_num],
-      core_operator_cycles_puppet_v2[operator_num],
-      core_operator_cycles_puppet_v3[operator_num]; /* Execs per fuzz stage */
+  struct mopt_swarm    mopt_swarm[swarm_num];   /* Pilot swarms           */
+  struct mopt_op_stats mopt_core;               /* Core module stats      */
+  double               G_best[operator_num];    /* Global best position   */
+  struct mopt_share   *mopt_share;     /* AFL_MOPT_SHARE, see afl-fuzz-mopt.c */
+  u32                  mopt_share_slot;
+  s32                  mopt_share_fd;  /* holds the fcntl() lock of the slot */
 
   double period_pilot_tmp;
   s32    key_lv;
@@ -498,6 +603,19 @@ typedef struct afl_state {
   u32 hang_tmout,                       /* Timeout used for hang det (ms)   */
       stats_update_freq;                /* Stats update frequency (execs)   */
 
+  u32 fuzz_tmout;                       /* Adaptive timeout of queue_cur    */
+  u64 early_kills;                      /* Runs killed at fuzz_tmout        */
+  u8 *virgin_early;                     /* Bits seen in early killed runs   */
+
+  struct tmout_deferred *tmout_deferred;  /* Early kills to re-run          */
+  u32                    tmout_deferred_cnt;
+
+  struct crash_bucket *crash_bucket;    /* Saved crashes per stack hash     */
+  u32 crash_bucket_size,                /* Slots in crash_bucket (pow2)     */
+      crash_buckets,                    /* Stack hashes seen                */
+      crash_bucket_limit;               /* AFL_CRASH_BUCKET_LIMIT           */
+  u64 crashes_limited;                  /* Crashes dropped by the limit     */
+
   u8 havoc_stack_pow2,                  /* HAVOC_STACK_POW2                 */
       no_unlink,                        /* do not unlink cur_input          */
       debug,                            /* Debug mode                       */
@@ -540,7 +658,8 @@ typedef struct afl_state {
       expand_havoc,                /* perform expensive havoc after no find */
       cycle_schedules,                  /* cycle power schedules?           */
       old_seed_selection,               /* use vanilla afl seed selection   */
-      reinit_table;                     /* reinit the queue weight table    */
+      reinit_table,                     /* reinit the queue weight table    */
+      want_exec_cksum;                  /* stage needs last_exec_cksum      */
 
   u8 *virgin_bits,                      /* Regions yet untouched by fuzzing */
       *virgin_tmout,                    /* Bits we haven't seen in tmouts   */
@@ -550,11 +669,20 @@ typedef struct afl_state {
   u32    *alias_table;                /* alias weighted random lookup table */
   u32     active_items;                 /* enabled entries in the queue     */
 
+  struct queue_entry **alias_queue;     /* Entries in the table, if compact */
+  u32                  alias_items;     /* Number of entries in the table   */
+
   u8 *var_bytes;                        /* Bytes that appear to be variable */
 
-#define N_FUZZ_SIZE (1 << 21)
+/* Path frequencies: a count-min sketch of N_FUZZ_DEPTH rows with
+   1 << N_FUZZ_BITS counters each, see n_fuzz_get() */
+#define N_FUZZ_BITS 19
+#define N_FUZZ_DEPTH 4
   u32 *n_fuzz;
 
+  u32 *edge_hits;                       /* RARE: execs per edge, estimated  */
+  u32  rare_edge_cutoff;                /* RARE: hits of a rare edge        */
+
   volatile u8 stop_soon,                /* Ctrl-C pressed?                  */
       clear_screen;                     /* Window resized?                  */
 
@@ -564,6 +692,7 @@ typedef struct afl_state {
       queued_discovered,                /* Items discovered during this run */
       queued_imported,                  /* Items imported via -S            */
       queued_favored,                   /* Paths deemed favorable           */
+      queued_archived,                  /* Paths moved out by queue_archive */
       queued_with_cov,                  /* Paths with new coverage bytes    */
       pending_not_fuzzed,               /* Queued but not done yet          */
       pending_favored,                  /* Pending favored paths            */
@@ -598,11 +727,18 @@ typedef struct afl_state {
       longest_find_time,                /* Longest time taken for a find    */
       exit_on_time,                     /* Delay to exit if no new paths    */
       sync_time,                        /* Sync time (ms)                   */
-      switch_fuzz_mode;                 /* auto or fixed fuzz mode          */
+      switch_fuzz_mode,                 /* auto or fixed fuzz mode          */
+      last_exec_cksum;                  /* Path checksum of the last exec   */
 
   u32 slowest_exec_ms,                  /* Slowest testcase non hang in ms  */
       subseq_tmouts;                    /* Number of timeouts in a row      */
 
+  u64 trim_chunk_execs[32],             /* Trim execs per log2 chunk size   */
+      trim_chunk_hits[32],              /* ... that could remove the chunk  */
+      trim_size_in[32],                 /* Trimmer bytes in per log2 size   */
+      trim_size_out[32];                /* Trimmer bytes out per log2 size  */
+  u32 trim_size_runs[32];               /* Trims done per log2 input size   */
+
   u8 *stage_name,                       /* Name of the current fuzz stage   */
       *stage_short,                     /* Short stage name                 */
       *syncing_party;                   /* Currently syncing with...        */
@@ -626,9 +762,11 @@ typedef struct afl_state {
 
   u32 rand_cnt;                         /* Random number counter            */
 
-  /*  unsigned long rand_seed[3]; would also work */
-  AFL_RAND_RETURN rand_seed[3];
-  s64             init_seed;
+  u64 rand_seed[4][RAND_LANES];         /* xoshiro256++ state of all lanes  */
+  s64 init_seed;
+
+  u32 rand_buf[RAND_BUF_SIZE];          /* Pre-generated random words       */
+  u32 rand_buf_pos;                     /* Next unused word in rand_buf     */
 
   u64 total_cal_us,                     /* Total calibration time (us)      */
       total_cal_cycles;                 /* Total calibration cycles         */
@@ -654,10 +792,23 @@ typedef struct afl_state {
 
   struct extra_data *extras;            /* Extra tokens to fuzz with        */
   u32                extras_cnt;        /* Total number of tokens read      */
+  u32               *extras_index;      /* Case-insensitive hash of extras  */
+  u32                extras_index_size; /* Slots in extras_index            */
+  u8                 extras_index_dirty; /* extras[] changed, reindex     */
 
   struct auto_extra_data
       a_extras[MAX_AUTO_EXTRAS];        /* Automatically selected extras    */
   u32 a_extras_cnt;                     /* Total number of tokens available */
+  u32 a_extras_index[MAX_AUTO_EXTRAS * 2]; /* Hash index into a_extras[]   */
+  u32 a_extras_by_len[USE_AUTO_EXTRAS]; /* Most used a_extras[] by size     */
+  u8  a_extras_by_len_dirty;            /* a_extras_by_len needs a rebuild  */
+  u32 a_extras_weight[MAX_AUTO_EXTRAS + 1]; /* Fenwick tree of pick weights */
+  u32 a_extras_weight_sum;              /* Sum of all a_extras[] weights    */
+
+  struct extras_ac_node *extras_ac;     /* Prefix automaton of all extras   */
+  u32                    extras_ac_cnt; /* Nodes in extras_ac               */
+  u32 extras_ac_root[256];              /* Children of the root node        */
+  u8  extras_ac_dirty;                  /* Extras changed, rebuild the AC   */
 
   /* afl_postprocess API - Now supported via custom mutators */
 
@@ -681,6 +832,13 @@ typedef struct afl_state {
   struct afl_pass_stat *pass_stats;
   struct cmp_map       *orig_cmp_map;
 
+  struct cmp_tokens *cmp_tokens;        /* Recent compares, custom mutators */
+  u32               *cmp_tokens_seen;   /* Hashes of recently added pairs   */
+
+  struct mutator_bandit_arm *mutator_bandit;  /* Recent stats, NULL = off   */
+  double *mutator_bandit_mult;          /* Budget multipliers, this entry   */
+  u64     mutator_bandit_execs;         /* Execs in mutator_bandit[]        */
+
   u8 describe_op_buf_256[256]; /* describe_op will use this to return a string
                                   up to 256 */
 
@@ -738,6 +896,8 @@ typedef struct afl_state {
 
   u8 *ex_buf;
 
+  u8 *extras_pos_buf;
+
   u8 *testcase_buf, *splicecase_buf;
 
   u32 custom_mutators_count;
@@ -746,6 +906,10 @@ typedef struct afl_state {
 
   list_t custom_mutator_list;
 
+  /* Python thread state while the GIL is released during target runs */
+  void *py_thread_state;
+  u8    py_release_gil;
+
   /* this is a fixed buffer of size map_size that can be used by any function if
    * they do not call another function */
   u8 *map_tmp_buf;
@@ -796,7 +960,12 @@ struct custom_mutator {
   char       *name_short;
   void       *dh;
   u8         *post_process_buf;
+  u8         *fuzz_batch_buf;               /* afl_custom_fuzz_batch outputs */
+  u8         *fuzz_batch_bufs[CUSTOM_MUTATOR_BATCH];
+  size_t      fuzz_batch_sizes[CUSTOM_MUTATOR_BATCH];
   u8          stacked_custom_prob, stacked_custom;
+  u8          isolated;             /* runs in an out-of-process host (data) */
+  u32         bandit_arm;                 /* index in afl->mutator_bandit[] */
 
   void *data;                                    /* custom mutator data ptr */
 
@@ -870,6 +1039,32 @@ struct custom_mutator {
   size_t (*afl_custom_fuzz)(void *data, u8 *buf, size_t buf_size, u8 **out_buf,
                             u8 *add_buf, size_t add_buf_size, size_t max_size);
 
+  /**
+   * Perform several custom mutations on a given input in one call, writing
+   * the mutants directly into buffers owned by afl-fuzz. This avoids both
+   * the per-exec call overhead and the copy out of mutator owned memory.
+   * If present, it is used instead of afl_custom_fuzz.
+   *
+   * (Optional)
+   *
+   * @param[in] data Pointer returned in afl_custom_init by this custom mutator
+   * @param[in] buf Pointer to the input data to be mutated. Must not be
+   *     modified.
+   * @param[in] buf_size Size of the input data
+   * @param[in] add_buf Buffer containing an additional test case (splicing)
+   * @param[in] add_buf_size Size of the additional test case
+   * @param[out] out_bufs Array of batch_size buffers, each max_size bytes
+   *     large and owned by afl-fuzz. Mutant i is written to out_bufs[i].
+   * @param[out] out_sizes The size of each mutant written to out_bufs.
+   * @param[in] batch_size Maximum number of mutants to produce.
+   * @param[in] max_size Maximum size of each mutant.
+   * @return Number of mutants produced (0 to batch_size), 0 ends the stage.
+   */
+  u32 (*afl_custom_fuzz_batch)(void *data, const u8 *buf, size_t buf_size,
+                               u8 *add_buf, size_t add_buf_size, u8 **out_bufs,
+                               size_t *out_sizes, u32 batch_size,
+                               size_t max_size);
+
   /**
    * Describe the current testcase, generated by the last mutation.
    * This will be called, for example, to give the written testcase a name
@@ -1054,6 +1249,7 @@ void afl_states_request_skip(void);
 
 /* Setup shmem for testcase delivery */
 void setup_testcase_shmem(afl_state_t *afl);
+void setup_crash_shmem(afl_state_t *afl);
 
 void read_afl_environment(afl_state_t *, char **);
 
@@ -1067,6 +1263,17 @@ u8   trim_case_custom(afl_state_t *, struct queue_entry *q, u8 *in_buf,
 void run_afl_custom_queue_new_entry(afl_state_t *, struct queue_entry *, u8 *,
                                     u8 *);
 
+/* Exec budget bandit (AFL_CUSTOM_MUTATOR_BANDIT) */
+void mutator_bandit_init(afl_state_t *);
+void mutator_bandit_sample(afl_state_t *);
+u32  mutator_bandit_budget(afl_state_t *, u32, u32);
+void mutator_bandit_update(afl_state_t *, u32, u32, u32);
+void mutator_bandit_destroy(afl_state_t *);
+
+/* Out-of-process custom mutators (AFL_CUSTOM_MUTATOR_ISOLATE) */
+struct custom_mutator *load_custom_mutator_host(afl_state_t *, const char *);
+void                   destroy_custom_mutator_host(struct custom_mutator *);
+
 /* Python */
 #ifdef USE_PYTHON
 
@@ -1074,6 +1281,10 @@ struct custom_mutator *load_custom_mutator_py(afl_state_t *, char *);
 void                   finalize_py_module(void *);
 
 u32         fuzz_count_py(void *, const u8 *, size_t);
+u32         fuzz_batch_py(void *, const u8 *, size_t, u8 *, size_t, u8 **,
+                          size_t *, u32, size_t);
+void        py_release_gil(afl_state_t *);
+void        py_acquire_gil(afl_state_t *);
 void        fuzz_send_py(void *, const u8 *, size_t);
 size_t      post_process_py(void *, u8 *, size_t, u8 **);
 s32         init_trim_py(void *, u8 *, size_t);
@@ -1097,7 +1308,10 @@ void mark_as_redundant(afl_state_t *, struct queue_entry *, u8);
 void add_to_queue(afl_state_t *, u8 *, u32, u8);
 void destroy_queue(afl_state_t *);
 void update_bitmap_score(afl_state_t *, struct queue_entry *);
+void update_edge_hits(afl_state_t *, struct queue_entry *, u64);
 void cull_queue(afl_state_t *);
+void queue_archive(afl_state_t *);
+void queue_restore(afl_state_t *);
 u32  calculate_score(afl_state_t *, struct queue_entry *);
 
 /* Bitmap */
@@ -1119,9 +1333,11 @@ u8 *describe_op(afl_state_t *, u8, size_t);
 #endif
 u8 save_if_interesting(afl_state_t *, void *, u32, u8);
 u8 has_new_bits(afl_state_t *, u8 *);
-u8 has_new_bits_unclassified(afl_state_t *, u8 *);
+u8 has_new_bits_unclassified(afl_state_t *, u8 *, u64 *);
+u8 has_new_bits_cksum(afl_state_t *, u8 *, u64 *);
 #ifndef AFL_SHOWMAP
 void classify_counts(afl_forkserver_t *);
+u64  classify_and_hash(afl_forkserver_t *);
 #endif
 
 /* Extras */
@@ -1132,6 +1348,9 @@ void dedup_extras(afl_state_t *);
 void deunicode_extras(afl_state_t *);
 void add_extra(afl_state_t *afl, u8 *mem, u32 len);
 void maybe_add_auto(afl_state_t *, u8 *, u32);
+u32 *auto_extras_by_len(afl_state_t *);
+u32  pick_auto_extra(afl_state_t *);
+u8  *extras_positions(afl_state_t *, u8 *, u32);
 void save_auto(afl_state_t *);
 void load_auto(afl_state_t *);
 void destroy_extras(afl_state_t *);
@@ -1163,6 +1382,8 @@ u8   calibrate_case(afl_state_t *, struct queue_entry *, u8 *, u32, u8);
 u8   trim_case(afl_state_t *, struct queue_entry *, u8 *);
 u8   common_fuzz_stuff(afl_state_t *, u8 *, u32);
 fsrv_run_result_t fuzz_run_target(afl_state_t *, afl_forkserver_t *fsrv, u32);
+void adaptive_tmout_start(afl_state_t *);
+void adaptive_tmout_flush(afl_state_t *);
 
 /* Fuzz one */
 
@@ -1170,6 +1391,10 @@ u8   fuzz_one_original(afl_state_t *);
 u8   pilot_fuzzing(afl_state_t *);
 u8   core_fuzzing(afl_state_t *);
 void pso_updating(afl_state_t *);
+void mopt_init(afl_state_t *);
+void mopt_period_done(afl_state_t *, MOpt_globals_t *);
+void mopt_share_setup(afl_state_t *);
+void mopt_share_destroy(afl_state_t *);
 u8   fuzz_one(afl_state_t *);
 
 /* Init */
@@ -1214,44 +1439,69 @@ u8 common_fuzz_cmplog_stuff(afl_state_t *afl, u8 *out_buf, u32 len);
 /* RedQueen */
 u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len);
 
-/* our RNG wrapper */
-AFL_RAND_RETURN rand_next(afl_state_t *afl);
+/* refill afl->rand_buf, used by the inline RNG routines below */
+void rand_fill(afl_state_t *afl);
 
 /* probability between 0.0 and 1.0 */
 double rand_next_percent(afl_state_t *afl);
 
 /**** Inline routines ****/
 
-/* Generate a random number (from 0 to limit - 1). This may
-   have slight bias. */
+/* our RNG wrapper */
+
+static inline u32 rand_next32(afl_state_t *afl) {
+
+  if (unlikely(afl->rand_buf_pos >= RAND_BUF_SIZE)) { rand_fill(afl); }
+  return afl->rand_buf[afl->rand_buf_pos++];
+
+}
+
+static inline AFL_RAND_RETURN rand_next(afl_state_t *afl) {
+
+#ifdef WORD_SIZE_64
+  u64 hi = rand_next32(afl);
+  return (hi << 32) | rand_next32(afl);
+#else
+  return rand_next32(afl);
+#endif
+
+}
+
+/* Generate a random number (from 0 to limit - 1) without bias. */
 
 static inline u32 rand_below(afl_state_t *afl, u32 limit) {
 
   if (unlikely(limit <= 1)) return 0;
 
-  /* The boundary not being necessarily a power of 2,
-     we need to ensure the result uniformity. */
   if (unlikely(!afl->rand_cnt--) && likely(!afl->fixed_seed)) {
 
     ck_read(afl->fsrv.dev_urandom_fd, &afl->rand_seed, sizeof(afl->rand_seed),
             "/dev/urandom");
-    // srandom(afl->rand_seed[0]);
-    afl->rand_cnt = (RESEED_RNG / 2) + (afl->rand_seed[1] % RESEED_RNG);
+    afl->rand_cnt = (RESEED_RNG / 2) + (afl->rand_seed[1][0] % RESEED_RNG);
+    afl->rand_buf_pos = RAND_BUF_SIZE;
 
   }
 
-  /* Modulo is biased - we don't want our fuzzing to be biased so let's do it
-   right. See:
-   https://stackoverflow.com/questions/10984974/why-do-people-say-there-is-modulo-bias-when-using-a-random-number-generator
-   */
-  u64 unbiased_rnd;
-  do {
+  /* Modulo is biased and needs two divisions to fix. Lemire's method instead
+     takes the upper half of rnd * limit and only has to reject (and compute
+     a modulo) in the rare case that the lower half is below limit. See:
+     https://arxiv.org/abs/1805.10941 */
+
+  u64 m = (u64)rand_next32(afl) * limit;
 
-    unbiased_rnd = rand_next(afl);
+  if (unlikely((u32)m < limit)) {
 
-  } while (unlikely(unbiased_rnd >= (UINT64_MAX - (UINT64_MAX % limit))));
+    u32 threshold = -limit % limit;
 
-  return unbiased_rnd % limit;
+    while ((u32)m < threshold) {
+
+      m = (u64)rand_next32(afl) * limit;
+
+    }
+
+  }
+
+  return m >> 32;
 
 }
 
@@ -1284,7 +1534,7 @@ static inline u32 rand_below_datalen(afl_state_t *afl, u32 limit) {
 static inline s64 rand_get_seed(afl_state_t *afl) {
 
   if (unlikely(afl->fixed_seed)) { return afl->init_seed; }
-  return afl->rand_seed[0];
+  return afl->rand_seed[0][0];
 
 }
 
@@ -1307,6 +1557,109 @@ static inline u64 next_p2(u64 val) {
 
 }
 
+/* Path frequency sketch: a path is counted in one slot per row, its count is
+   the smallest of these. Conservative update only increments the slots that
+   hold that minimum, so collisions inflate counts much less. */
+
+static inline u32 n_fuzz_slot(u64 cksum, u32 row) {
+
+  static const u64 mul[N_FUZZ_DEPTH] = {
+
+      0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+      0xd6e8feb86659fd93ULL};
+
+  return (row << N_FUZZ_BITS) + (u32)((cksum * mul[row]) >> (64 - N_FUZZ_BITS));
+
+}
+
+static inline u32 n_fuzz_get(afl_state_t *afl, u64 cksum) {
+
+  u32 row, min = 0xFFFFFFFF;
+
+  for (row = 0; row < N_FUZZ_DEPTH; ++row) {
+
+    min = MIN(min, afl->n_fuzz[n_fuzz_slot(cksum, row)]);
+
+  }
+
+  return min;
+
+}
+
+static inline void n_fuzz_add(afl_state_t *afl, u64 cksum) {
+
+  u32 slot[N_FUZZ_DEPTH], row, min = 0xFFFFFFFF;
+
+  for (row = 0; row < N_FUZZ_DEPTH; ++row) {
+
+    slot[row] = n_fuzz_slot(cksum, row);
+    min = MIN(min, afl->n_fuzz[slot[row]]);
+
+  }
+
+  /* saturated */
+  if (unlikely(min == 0xFFFFFFFF)) { return; }
+
+  for (row = 0; row < N_FUZZ_DEPTH; ++row) {
+
+    if (afl->n_fuzz[slot[row]] == min) { afl->n_fuzz[slot[row]] = min + 1; }
+
+  }
+
+}
+
+/* Read-only view of the dictionaries and of the table of recent compares
+   for custom mutators. Nothing is copied, so the mutator always sees the
+   current state without per-exec cost. */
+
+/* Number of user and auto dictionary tokens */
+
+static inline u32 afl_dict_count(afl_state_t *afl) {
+
+  return afl->extras_cnt + afl->a_extras_cnt;
+
+}
+
+/* Token idx < afl_dict_count(), user dictionary first */
+
+static inline const u8 *afl_dict_get(afl_state_t *afl, u32 idx, u32 *len) {
+
+  if (idx < afl->extras_cnt) {
+
+    *len = afl->extras[idx].len;
+    return afl->extras[idx].data;
+
+  }
+
+  idx -= afl->extras_cnt;
+  *len = afl->a_extras[idx].len;
+  return afl->a_extras[idx].data;
+
+}
+
+/* Number of operand pairs in the table of recent compares */
+
+static inline u32 afl_cmp_pair_count(afl_state_t *afl) {
+
+  if (!afl->cmp_tokens) { return 0; }
+  return MIN(afl->cmp_tokens->cnt, (u32)CMP_TOKENS) / 2;
+
+}
+
+/* Operands of pair idx < afl_cmp_pair_count() */
+
+static inline void afl_cmp_pair_get(afl_state_t *afl, u32 idx, const u8 **v0,
+                                    u32 *l0, const u8 **v1, u32 *l1) {
+
+  struct cmp_tokens *ct = afl->cmp_tokens;
+
+  *v0 = ct->tok[idx * 2].val;
+  *l0 = ct->tok[idx * 2].len;
+  *v1 = ct->tok[idx * 2 + 1].val;
+  *l1 = ct->tok[idx * 2 + 1].len;
+
+}
+
 /* Returns the testcase buf from the file behind this queue entry.
   Increases the refcount. */
 u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q);
@@ -1323,6 +1676,15 @@ void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q, u8 *in,
 
 void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q, u8 *mem);
 
+/* (Re)compute the splice sketch of a queue entry from its content */
+
+void queue_splice_sketch(struct queue_entry *q, u8 *buf);
+
+/* Find the range in which the content of two queue entries differs */
+
+u8 queue_splice_diff(struct queue_entry *a, struct queue_entry *b, u32 *from,
+                     u32 *to);
+
 #if TESTCASE_CACHE == 1
   #error define of TESTCASE_CACHE must be zero or larger than 1
 #endif
@@ -73,6 +73,13 @@
 /* Maximum allowed fails per CMP value. Default: 96 */
 #define CMPLOG_FAIL_MAX 96
 
+/* Recent cmplog operands kept for custom mutators (afl->cmp_tokens), in
+   pairs, a power of two. Default: 16384 */
+#define CMP_TOKENS (1 << 14)
+
+/* Maximum length of one of these operands. Default: 32 */
+#define CMP_TOKEN_LEN 32
+
 /* -------------------------------------*/
 /* Now non-cmplog configuration options */
 /* -------------------------------------*/
@@ -163,11 +170,30 @@
 
 #define TMOUT_LIMIT 250U
 
+/* Adaptive timeouts (AFL_ADAPTIVE_TMOUT): once an entry has this many
+   execution time samples, its mutants are killed at ADAPTIVE_TMOUT_MULT
+   times the log2 bucket of the given percentile (per mille) of its run
+   times, but never earlier than ADAPTIVE_TMOUT_MIN (ms). The histogram has
+   ADAPTIVE_TMOUT_BUCKETS log2 buckets. At most ADAPTIVE_TMOUT_DEFER killed
+   inputs wait for their full re-run: */
+
+#define ADAPTIVE_TMOUT_SAMPLES 256
+#define ADAPTIVE_TMOUT_PERMILLE 999
+#define ADAPTIVE_TMOUT_MULT 4U
+#define ADAPTIVE_TMOUT_MIN 10U
+#define ADAPTIVE_TMOUT_BUCKETS 16
+#define ADAPTIVE_TMOUT_DEFER 64U
+
 /* Maximum number of unique hangs or crashes to record: */
 
 #define KEEP_UNIQUE_HANG 500U
 #define KEEP_UNIQUE_CRASH 10000U
 
+/* Return addresses (after the faulting pc) that make up the stack hash a
+   crashing target publishes for AFL_CRASH_BUCKET_LIMIT: */
+
+#define CRASH_STACK_FRAMES 4
+
 /* Baseline number of random tweaks during a single 'havoc' stage: */
 
 #define HAVOC_CYCLES 256U
@@ -183,6 +209,27 @@
 
 #define HAVOC_MIN 12U
 
+/* Maximum number of mutants requested per afl_custom_fuzz_batch() call.
+   afl-fuzz reserves this many MAX_FILE sized output buffers per custom
+   mutator that implements the batch API: */
+
+#define CUSTOM_MUTATOR_BATCH 16U
+
+/* Time (ms) an out-of-process custom mutator host (AFL_CUSTOM_MUTATOR_ISOLATE)
+   may take for one call before it is considered hung and restarted: */
+
+#define CUSTOM_MUTATOR_HOST_TMOUT 10000
+
+/* Exec budget bandit across custom mutators and havoc
+   (AFL_CUSTOM_MUTATOR_BANDIT): the global finds per exec weigh as much as
+   this many execs of the current queue entry, the global counts are halved
+   once they exceed the window so that they follow recent finds, and this
+   percentage of the budget is spread evenly so that no mutator starves: */
+
+#define MUTATOR_BANDIT_PRIOR 50000
+#define MUTATOR_BANDIT_WINDOW (4 * 1024 * 1024)
+#define MUTATOR_BANDIT_FLOOR 10
+
 /* Power Schedule Divisor */
 #define POWER_BETA 1U
 #define MAX_FACTOR (POWER_BETA * 32)
@@ -225,6 +272,21 @@
 
 #define SPLICE_HAVOC 32
 
+/* Splice sketches: block size (power of 2) and the maximum number of block
+   hashes kept per queue entry, bigger inputs use bigger blocks. Also the
+   number of partners rejected by their sketch before one is taken anyway: */
+
+#define SPLICE_SKETCH_BLOCK 32
+#define SPLICE_SKETCH_LEN 64
+#define SPLICE_SKETCH_TRIES 16
+
+/* Queue archival (AFL_QUEUE_ARCHIVE): how often an entry must have been
+   fuzzed before it can be archived, and after how many queue cycles without
+   finds all archived entries are brought back: */
+
+#define QUEUE_ARCHIVE_LEVEL 2
+#define QUEUE_ARCHIVE_RESTORE_CYCLES 4
+
 /* Maximum offset for integer addition / subtraction stages: */
 
 #define ARITH_MAX 35
@@ -236,6 +298,18 @@
 #define TRIM_START_STEPS 16
 #define TRIM_END_STEPS 1024
 
+/* Learned trimming: a chunk size (by power of two) is skipped once it had
+   TRIM_LEARN_EXECS execs of which less than TRIM_LEARN_MIN_HITS percent
+   removed something. Input sizes (by power of two) are not trimmed anymore
+   once TRIM_LEARN_RUNS trims of them removed less than TRIM_LEARN_MIN_GAIN
+   percent of the bytes. One in TRIM_LEARN_EXPLORE trims ignores both: */
+
+#define TRIM_LEARN_EXECS 256
+#define TRIM_LEARN_MIN_HITS 1
+#define TRIM_LEARN_RUNS 32
+#define TRIM_LEARN_MIN_GAIN 1
+#define TRIM_LEARN_EXPLORE 8
+
 /* Maximum size of input file, in bytes (keep under 100MB, default 1MB):
    (note that if this value is changed, several areas in afl-cc.c, afl-fuzz.c
    and afl-fuzz-state.c have to be changed as well! */
@@ -251,6 +325,14 @@
 #define TMIN_SET_MIN_SIZE 4
 #define TMIN_SET_STEPS 128
 
+/* Sanitizer stack frames hashed into a crash bucket by afl-triage, the
+   amount of child stderr parsed per run and the cap on minimization passes
+   for a bucket representative: */
+
+#define TRIAGE_FRAMES 3
+#define TRIAGE_REPORT_MAX (64 * 1024)
+#define TRIAGE_MIN_PASSES 4
+
 /* Maximum dictionary token size (-x), in bytes: */
 
 #define MAX_DICT_FILE 128
@@ -273,6 +355,19 @@
 #define USE_AUTO_EXTRAS 4096
 #define MAX_AUTO_EXTRAS (USE_AUTO_EXTRAS * 8)
 
+/* Half of the havoc picks from the auto-extracted tokens are weighted by how
+   often a token was found again (1 + hit count, capped at this value), the
+   other half stay uniform so that new tokens get tried as well: */
+
+#define AUTO_EXTRAS_WEIGHT_CAP 64
+
+/* With AFL_TARGETED_EXTRAS the deterministic dictionary steps only use offsets
+   where a token, or at least EXTRAS_POS_MIN_PREFIX bytes of one, is already
+   present. Only the first EXTRAS_POS_MAX_DEPTH bytes of a token are matched: */
+
+#define EXTRAS_POS_MIN_PREFIX 3
+#define EXTRAS_POS_MAX_DEPTH 16
+
 /* Scaling factor for the effector map used to skip some of the more
    expensive deterministic steps. The actual divisor is set to
    2^EFF_MAP_SCALE2 bytes: */
@@ -391,6 +486,11 @@
 
 #define SHM_FUZZ_ENV_VAR "__AFL_SHM_FUZZ_ID"
 
+/* Environment variable used to pass the SHM ID of the crash stack hash to the
+   called program. */
+
+#define SHM_CRASH_ENV_VAR "__AFL_SHM_CRASH_ID"
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR "__AFL_CLANG_MODE"
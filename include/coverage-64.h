@@ -7,6 +7,7 @@
 
 u32 skim(const u64 *virgin, const u64 *current, const u64 *current_end);
 u64 classify_word(u64 word);
+u64 classify_hash_discover(u64 *current, u64 *virgin, u32 words, u8 *ret);
 
 inline u64 classify_word(u64 word) {
 
@@ -106,6 +107,43 @@ inline void discover_word(u8 *ret, u64 *current, u64 *virgin) {
 
 }
 
+/* The fused per-exec pass: classifies the trace in place, computes the sparse
+   path checksum and, if virgin is set, merges the trace into it (reflecting
+   new counts or tuples in ret like discover_word). Each word is read once and
+   zero blocks are skipped four words at a time. words must be a multiple of
+   four, which holds as map sizes are aligned to 64 bytes. */
+inline u64 classify_hash_discover(u64 *current, u64 *virgin, u32 words,
+                                  u8 *ret) {
+
+  u64 h = HASH_CONST;
+  u32 i, j;
+
+  for (i = 0; i < words; i += 4) {
+
+    if (likely(!(current[i] | current[i + 1] | current[i + 2] |
+                 current[i + 3]))) {
+
+      continue;
+
+    }
+
+    for (j = i; j < i + 4; ++j) {
+
+      if (!current[j]) { continue; }
+
+      current[j] = classify_word(current[j]);
+      h = hash_trace_word(h, j, current[j]);
+
+      if (virgin) { discover_word(ret, current + j, virgin + j); }
+
+    }
+
+  }
+
+  return hash_trace_final(h);
+
+}
+
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
   #define PACK_SIZE 64
 inline u32 skim(const u64 *virgin, const u64 *current, const u64 *current_end) {
@@ -16,6 +16,7 @@ static char *afl_environment_deprecated[] = {
 
 static char *afl_environment_variables[] = {
 
+    "AFL_ADAPTIVE_TMOUT",
     "AFL_ALIGNED_ALLOC",
     "AFL_ALLOW_TMP",
     "AFL_ANALYZE_HEX",
@@ -34,8 +35,11 @@ static char *afl_environment_variables[] = {
     "AFL_CODE_START",
     "AFL_COMPCOV_BINNAME",
     "AFL_COMPCOV_LEVEL",
+    "AFL_CRASH_BUCKET_LIMIT",
     "AFL_CRASH_EXITCODE",
     "AFL_CRASHING_SEEDS_AS_NEW_CRASH",
+    "AFL_CUSTOM_MUTATOR_BANDIT",
+    "AFL_CUSTOM_MUTATOR_ISOLATE",
     "AFL_CUSTOM_MUTATOR_LIBRARY",
     "AFL_CUSTOM_MUTATOR_ONLY",
     "AFL_CUSTOM_INFO_PROGRAM",
@@ -184,10 +188,13 @@ static char *afl_environment_variables[] = {
     "AFL_NO_STARTUP_CALIBRATION",
     "AFL_NO_WARN_INSTABILITY",
     "AFL_UNTRACER_FILE",
+    "AFL_UNTRACER_MODULES",
+    "AFL_UNTRACER_UNPATCH",
     "AFL_LLVM_USE_TRACE_PC",
     "AFL_MAP_SIZE",
     "AFL_MAPSIZE",
     "AFL_MAX_DET_EXTRAS",
+    "AFL_MOPT_SHARE",
     "AFL_NO_X86",  // not really an env but we dont want to warn on it
     "AFL_NOOPT",
     "AFL_NYX_AUX_SIZE",
@@ -197,11 +204,16 @@ static char *afl_environment_variables[] = {
     "AFL_PASSTHROUGH",
     "AFL_PATH",
     "AFL_PERFORMANCE_FILE",
+    "AFL_PERSISTENT_DRIFT",
     "AFL_PERSISTENT_RECORD",
+    "AFL_PERSISTENT_RESET",
     "AFL_POST_PROCESS_KEEP_ORIGINAL",
     "AFL_PRELOAD",
+    "AFL_PRELOAD_FORKSRV_AT",
     "AFL_TARGET_ENV",
+    "AFL_TARGETED_EXTRAS",
     "AFL_PYTHON_MODULE",
+    "AFL_PYTHON_RELEASE_GIL",
     "AFL_QEMU_CUSTOM_BIN",
     "AFL_QEMU_COMPCOV",
     "AFL_QEMU_COMPCOV_DEBUG",
@@ -221,6 +233,7 @@ static char *afl_environment_variables[] = {
     "AFL_QEMU_EXCLUDE_RANGES",
     "AFL_QEMU_SNAPSHOT",
     "AFL_QEMU_TRACK_UNSTABLE",
+    "AFL_QUEUE_ARCHIVE",
     "AFL_QUIET",
     "AFL_RANDOM_ALLOC_CANARY",
     "AFL_REAL_PATH",
@@ -247,6 +260,7 @@ static char *afl_environment_variables[] = {
     "AFL_USE_TSAN",
     "AFL_USE_CFISAN",
     "AFL_USE_LSAN",
+    "AFL_USERSPACE_SNAPSHOT",
     "AFL_WINE_PATH",
     "AFL_NO_SNAPSHOT",
     "AFL_EXPAND_HAVOC_NOW",
@@ -111,6 +111,7 @@ typedef struct afl_forkserver {
       dev_urandom_fd,                   /* Persistent fd for /dev/urandom   */
 
       dev_null_fd,                      /* Persistent fd for /dev/null      */
+      child_err_fd,                     /* Child stderr, -1 = /dev/null     */
       fsrv_ctl_fd,                      /* Fork server control pipe (write) */
       fsrv_st_fd;                       /* Fork server status pipe (read)   */
 
@@ -130,6 +131,7 @@ typedef struct afl_forkserver {
 
   /* Note: last_run_timed_out is u32 to send it to the child as 4 byte array */
   u32 last_run_timed_out;               /* Traced process timed out?        */
+  u32 last_exec_ms;                     /* Duration of the last run         */
 
   u8 last_kill_signal;                  /* Signal that killed the child     */
 
@@ -162,6 +164,8 @@ typedef struct afl_forkserver {
 
   u8 *shmem_fuzz;                       /* allocated memory for fuzzing     */
 
+  u64 *crash_hash;                      /* Stack hash of a crashing child   */
+
   char *cmplog_binary;                  /* the name of the cmplog binary    */
 
   /* persistent mode replay functionality */
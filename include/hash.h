@@ -110,5 +110,34 @@ static inline u32 hash32(const void *key, u32 len, u32 seed) {
   #endif                                                     /* ^__x86_64__ */
 #endif
 
+/* Sparse path checksum for the coverage map. Instead of hashing the whole
+   buffer, only the non-zero words are folded in together with their word
+   index, so the cost scales with the number of hit tuples and the result does
+   not depend on any per-run seed. The per-word step is MurmurHash3-alike. */
+
+static inline u64 hash_trace_word(u64 h, u64 idx, u64 word) {
+
+  u64 k = (word ^ (idx * 0x9e3779b97f4a7c15ULL)) * 0x87c37b91114253d5ULL;
+
+  k = (k << 31) | (k >> 33);
+  h ^= k * 0x4cf5ad432745937fULL;
+  h = (h << 27) | (h >> 37);
+
+  return h * 5 + 0x52dce729;
+
+}
+
+static inline u64 hash_trace_final(u64 h) {
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+
+}
+
 #endif                                                     /* !_HAVE_HASH_H */
 
@@ -0,0 +1,674 @@
+/*
+   american fuzzy lop++ - persistent mode state reset
+   --------------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                     Heiko Eißfeldt <heiko.eissfeldt@hexco.de>,
+                     Andrea Fioraldi <andreafioraldi@gmail.com>,
+                     Dominik Maier <mail@dmnk.co>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     https://www.apache.org/licenses/LICENSE-2.0
+
+   Keeps leaky __AFL_LOOP() harnesses in persistent mode. When the loop is
+   entered the first time, the writable segments of the main executable
+   (.data, .bss, minus RELRO and the runtime's own state) and all regions
+   registered with __afl_persistent_register() are copied. At the end of
+   every Nth iteration the live memory is diffed page by page against that
+   checkpoint and the pages that differ are copied back.
+
+   The same diff can report which globals drifted away from their value at
+   loop entry, named from the symbol table of the executable, to help
+   fixing the harness instead.
+
+   The checkpointed memory includes the redzones ASAN puts between globals,
+   so it is only accessed with the uninstrumented loops below, never with
+   libc memcpy()/memcmp(), which ASAN intercepts.
+
+ */
+
+#ifndef _AFL_PERSISTENT_RESET_INL_H
+#define _AFL_PERSISTENT_RESET_INL_H
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define AFL_PERS_RESET_MAX_RANGES 256
+#define AFL_PERS_RESET_MAX_EXCLUDE 16
+#define AFL_PERS_RESET_MAX_REPORTED 1024
+#define AFL_PERS_RESET_PAGE 4096
+
+struct afl_pers_reset_range {
+
+  u8    *start;
+  size_t len;
+  u8    *copy;
+  u8     registered;
+  u8     reported;
+
+};
+
+struct afl_pers_reset_sym {
+
+  u8         *start;
+  size_t      len;
+  const char *name;
+  u8          reported;
+
+};
+
+/* Lives in its own mapping, so it is never part of the checkpoint */
+
+struct afl_pers_reset_state {
+
+  u32 every;                             /* restore every N iterations  */
+  s32 drift_fd;                          /* -1 if nothing is reported   */
+  u32 iteration;
+  u8  checkpointed;
+  u64 restored_pages;
+
+  u32                         ranges_cnt;
+  struct afl_pers_reset_range ranges[AFL_PERS_RESET_MAX_RANGES];
+  u32                         exclude_cnt;
+  struct afl_pers_reset_range exclude[AFL_PERS_RESET_MAX_EXCLUDE];
+
+  /* data symbols of the main executable, sorted, for the drift report */
+  u32                        syms_cnt;
+  struct afl_pers_reset_sym *syms;
+
+  /* changed pages without a symbol that were already reported */
+  u32 pages_cnt;
+  u8 *pages[AFL_PERS_RESET_MAX_REPORTED];
+
+};
+
+static struct afl_pers_reset_state *afl_pers_reset;
+
+/* A barrier in the loops keeps the compiler from turning them back into
+   memcpy()/memcmp() calls */
+
+#define AFL_PERS_RESET_NO_SAN __attribute__((no_sanitize_address))
+
+static AFL_PERS_RESET_NO_SAN void afl_persistent_reset_memcpy(u8       *dst,
+                                                              const u8 *src,
+                                                              size_t    len) {
+
+  size_t i = 0;
+
+  for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+
+    __builtin_memcpy(dst + i, src + i, sizeof(u64));
+    __asm__ volatile("" ::: "memory");
+
+  }
+
+  for (; i < len; ++i) {
+
+    dst[i] = src[i];
+    __asm__ volatile("" ::: "memory");
+
+  }
+
+}
+
+/* Returns whether [a, a + len) and [b, b + len) differ */
+
+static AFL_PERS_RESET_NO_SAN int afl_persistent_reset_differs(const u8 *a,
+                                                              const u8 *b,
+                                                              size_t    len) {
+
+  size_t i = 0;
+
+  for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+
+    u64 x, y;
+
+    __builtin_memcpy(&x, a + i, sizeof(u64));
+    __builtin_memcpy(&y, b + i, sizeof(u64));
+    if (x != y) { return 1; }
+    __asm__ volatile("" ::: "memory");
+
+  }
+
+  for (; i < len; ++i) {
+
+    if (a[i] != b[i]) { return 1; }
+
+  }
+
+  return 0;
+
+}
+
+/* Sets up the state, every = 0 and drift_fd = -1 only track drift if
+   either is wanted later. Returns -1 if the state cannot be allocated. */
+
+static int afl_persistent_reset_init(u32 every, s32 drift_fd) {
+
+  afl_pers_reset = mmap(NULL, sizeof(struct afl_pers_reset_state),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+  if (afl_pers_reset == MAP_FAILED) {
+
+    afl_pers_reset = NULL;
+    return -1;
+
+  }
+
+  afl_pers_reset->every = every;
+  afl_pers_reset->drift_fd = drift_fd;
+  return 0;
+
+}
+
+/* Copies a range into a fresh mapping */
+
+static u8 *afl_persistent_reset_copy(u8 *start, size_t len) {
+
+  u8 *copy = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (copy == MAP_FAILED) { return NULL; }
+  afl_persistent_reset_memcpy(copy, start, len);
+  return copy;
+
+}
+
+static int afl_persistent_reset_add(u8 *start, size_t len, u8 registered) {
+
+  struct afl_pers_reset_range *r;
+
+  if (!len) { return 0; }
+  if (afl_pers_reset->ranges_cnt >= AFL_PERS_RESET_MAX_RANGES) { return -1; }
+
+  r = &afl_pers_reset->ranges[afl_pers_reset->ranges_cnt];
+  r->start = start;
+  r->len = len;
+  r->copy = NULL;
+  r->registered = registered;
+  r->reported = 0;
+
+  /* registered after the loop was entered, its current state is what we
+     go back to */
+  if (afl_pers_reset->checkpointed &&
+      !(r->copy = afl_persistent_reset_copy(start, len))) {
+
+    return -1;
+
+  }
+
+  ++afl_pers_reset->ranges_cnt;
+  return 0;
+
+}
+
+/* A region that is written by the harness or the runtime on purpose */
+
+static int afl_persistent_reset_register(void *ptr, size_t len) {
+
+  return afl_persistent_reset_add((u8 *)ptr, len, 1);
+
+}
+
+/* A region that is never restored, must be called before the checkpoint */
+
+static void afl_persistent_reset_exclude(void *ptr, size_t len) {
+
+  struct afl_pers_reset_range *e;
+
+  if (!ptr || !len ||
+      afl_pers_reset->exclude_cnt >= AFL_PERS_RESET_MAX_EXCLUDE) {
+
+    return;
+
+  }
+
+  e = &afl_pers_reset->exclude[afl_pers_reset->exclude_cnt++];
+  e->start = (u8 *)ptr;
+  e->len = len;
+
+}
+
+/* Removes [start, end) from all ranges, splitting them where needed */
+
+static void afl_persistent_reset_cut(u8 *start, u8 *end) {
+
+  u32 i;
+
+  for (i = 0; i < afl_pers_reset->ranges_cnt; ++i) {
+
+    struct afl_pers_reset_range *r = &afl_pers_reset->ranges[i];
+    u8                          *r_end = r->start + r->len;
+
+    if (end <= r->start || start >= r_end) { continue; }
+
+    if (start > r->start && end < r_end) {
+
+      if (afl_persistent_reset_add(end, r_end - end, r->registered)) {
+
+        /* no room to split, give up on the tail */
+        r->len = start - r->start;
+        continue;
+
+      }
+
+      r = &afl_pers_reset->ranges[i];
+      r->len = start - r->start;
+
+    } else if (start > r->start) {
+
+      r->len = start - r->start;
+
+    } else if (end < r_end) {
+
+      r->len = r_end - end;
+      r->start = end;
+
+    } else {
+
+      afl_pers_reset->ranges[i--] =
+          afl_pers_reset->ranges[--afl_pers_reset->ranges_cnt];
+
+    }
+
+  }
+
+}
+
+/* Collects the writable segments of the main executable from its program
+   headers. Returns -1 for static executables, libc and the allocator would
+   be reset as well. */
+
+static int afl_persistent_reset_exe(ElfW(Addr) *bias) {
+
+  const ElfW(Phdr) *phdr = (const ElfW(Phdr) *)getauxval(AT_PHDR);
+  u32               phnum = getauxval(AT_PHNUM), i;
+  u8                dynamic = 0, have_bias = 0;
+
+  if (!phdr) { return -1; }
+
+  for (i = 0; i < phnum; ++i) {
+
+    if (phdr[i].p_type == PT_PHDR) {
+
+      *bias = (ElfW(Addr))phdr - phdr[i].p_vaddr;
+      have_bias = 1;
+
+    }
+
+    if (phdr[i].p_type == PT_INTERP) { dynamic = 1; }
+
+  }
+
+  if (!dynamic || !have_bias) { return -1; }
+
+  for (i = 0; i < phnum; ++i) {
+
+    u8 *start = (u8 *)(*bias + phdr[i].p_vaddr);
+
+    if (phdr[i].p_type == PT_LOAD && (phdr[i].p_flags & PF_W)) {
+
+      if (afl_persistent_reset_add(start, phdr[i].p_memsz, 0)) { return -1; }
+
+    } else if (phdr[i].p_type == PT_GNU_RELRO) {
+
+      afl_persistent_reset_exclude(start, phdr[i].p_memsz);
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+static int afl_persistent_reset_sym_cmp(const void *a, const void *b) {
+
+  const struct afl_pers_reset_sym *x = a, *y = b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+
+}
+
+static int afl_persistent_reset_in_range(u8 *addr) {
+
+  u32 i;
+
+  for (i = 0; i < afl_pers_reset->ranges_cnt; ++i) {
+
+    struct afl_pers_reset_range *r = &afl_pers_reset->ranges[i];
+    if (addr >= r->start && addr < r->start + r->len) { return 1; }
+
+  }
+
+  return 0;
+
+}
+
+/* Collects the data symbols from the static (or else the dynamic) symbol
+   table of /proc/self/exe. The file stays mapped for the names. */
+
+static void afl_persistent_reset_load_syms(ElfW(Addr) bias) {
+
+  struct stat  st;
+  ElfW(Ehdr)  *eh;
+  ElfW(Shdr)  *sh, *symtab = NULL;
+  ElfW(Sym)   *sym;
+  const char  *strtab;
+  u8          *elf;
+  size_t       cnt, i;
+  s32          fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) { return; }
+
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+
+    close(fd);
+    return;
+
+  }
+
+  elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (elf == MAP_FAILED) { return; }
+
+  eh = (ElfW(Ehdr) *)elf;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || !eh->e_shoff ||
+      eh->e_shentsize != sizeof(ElfW(Shdr)) ||
+      eh->e_shoff + (u64)eh->e_shnum * sizeof(ElfW(Shdr)) >
+          (u64)st.st_size) {
+
+    goto fail;
+
+  }
+
+  sh = (ElfW(Shdr) *)(elf + eh->e_shoff);
+  for (i = 0; i < eh->e_shnum; ++i) {
+
+    if (sh[i].sh_type == SHT_SYMTAB) {
+
+      symtab = &sh[i];
+      break;
+
+    }
+
+    if (sh[i].sh_type == SHT_DYNSYM) { symtab = &sh[i]; }
+
+  }
+
+  if (!symtab || symtab->sh_link >= eh->e_shnum ||
+      symtab->sh_offset + symtab->sh_size > (u64)st.st_size ||
+      sh[symtab->sh_link].sh_offset + sh[symtab->sh_link].sh_size >
+          (u64)st.st_size) {
+
+    goto fail;
+
+  }
+
+  sym = (ElfW(Sym) *)(elf + symtab->sh_offset);
+  cnt = symtab->sh_size / sizeof(ElfW(Sym));
+  strtab = (const char *)elf + sh[symtab->sh_link].sh_offset;
+
+  afl_pers_reset->syms =
+      mmap(NULL, cnt * sizeof(struct afl_pers_reset_sym) + 1,
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (afl_pers_reset->syms == MAP_FAILED) {
+
+    afl_pers_reset->syms = NULL;
+    goto fail;
+
+  }
+
+  for (i = 0; i < cnt; ++i) {
+
+    struct afl_pers_reset_sym *s;
+    u8                        *start = (u8 *)(bias + sym[i].st_value);
+
+    if (ELF64_ST_TYPE(sym[i].st_info) != STT_OBJECT || !sym[i].st_size ||
+        sym[i].st_shndx == SHN_UNDEF ||
+        sym[i].st_name >= sh[symtab->sh_link].sh_size ||
+        !afl_persistent_reset_in_range(start)) {
+
+      continue;
+
+    }
+
+    s = &afl_pers_reset->syms[afl_pers_reset->syms_cnt++];
+    s->start = start;
+    s->len = sym[i].st_size;
+    s->name = strtab + sym[i].st_name;
+    s->reported = 0;
+
+  }
+
+  qsort(afl_pers_reset->syms, afl_pers_reset->syms_cnt,
+        sizeof(struct afl_pers_reset_sym), afl_persistent_reset_sym_cmp);
+  return;
+
+fail:
+  munmap(elf, st.st_size);
+
+}
+
+/* Called when __AFL_LOOP() is entered the first time. Returns -1 if the
+   checkpoint cannot be taken. */
+
+static int afl_persistent_reset_checkpoint(void) {
+
+  ElfW(Addr) bias = 0;
+  u32        i;
+
+  if (afl_persistent_reset_exe(&bias)) { return -1; }
+
+  for (i = 0; i < afl_pers_reset->exclude_cnt; ++i) {
+
+    struct afl_pers_reset_range *e = &afl_pers_reset->exclude[i];
+    afl_persistent_reset_cut(e->start, e->start + e->len);
+
+  }
+
+  for (i = 0; i < afl_pers_reset->ranges_cnt; ++i) {
+
+    struct afl_pers_reset_range *r = &afl_pers_reset->ranges[i];
+    if (!(r->copy = afl_persistent_reset_copy(r->start, r->len))) {
+
+      return -1;
+
+    }
+
+  }
+
+  if (afl_pers_reset->drift_fd >= 0) {
+
+    afl_persistent_reset_load_syms(bias);
+
+  }
+
+  afl_pers_reset->checkpointed = 1;
+  return 0;
+
+}
+
+static struct afl_pers_reset_sym *afl_persistent_reset_find_sym(u8 *addr) {
+
+  u32 lo = 0, hi = afl_pers_reset->syms_cnt;
+
+  while (lo < hi) {
+
+    u32 mid = lo + (hi - lo) / 2;
+
+    if (afl_pers_reset->syms[mid].start <= addr) {
+
+      lo = mid + 1;
+
+    } else {
+
+      hi = mid;
+
+    }
+
+  }
+
+  if (lo && addr < afl_pers_reset->syms[lo - 1].start +
+                       afl_pers_reset->syms[lo - 1].len) {
+
+    return &afl_pers_reset->syms[lo - 1];
+
+  }
+
+  return NULL;
+
+}
+
+/* The state of a statically linked sanitizer runtime changes all the time,
+   that is no drift of the harness */
+
+static int afl_persistent_reset_is_san(const char *name) {
+
+  return strstr(name, "__asan") || strstr(name, "__msan") ||
+         strstr(name, "__lsan") || strstr(name, "__ubsan") ||
+         strstr(name, "__sanitizer");
+
+}
+
+/* Reports every symbol (or unnamed page) in a changed chunk once */
+
+static AFL_PERS_RESET_NO_SAN void afl_persistent_reset_report(struct afl_pers_reset_range *r,
+                                        u8 *live, u8 *copy, size_t len) {
+
+  s32    fd = afl_pers_reset->drift_fd;
+  u32    iter = afl_pers_reset->iteration;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+
+    struct afl_pers_reset_sym *s;
+    u32                        j;
+
+    if (live[i] == copy[i]) { continue; }
+
+    if (r->registered) {
+
+      if (!r->reported) {
+
+        dprintf(fd,
+                "[AFL] persistent drift in iteration %u: registered region "
+                "%p+0x%zx changed\n",
+                iter, r->start, (size_t)(live + i - r->start));
+        r->reported = 1;
+
+      }
+
+      return;
+
+    }
+
+    if ((s = afl_persistent_reset_find_sym(live + i))) {
+
+      if (!s->reported && !afl_persistent_reset_is_san(s->name)) {
+
+        dprintf(fd,
+                "[AFL] persistent drift in iteration %u: %s (%zu bytes at %p) "
+                "changed\n",
+                iter, s->name, s->len, s->start);
+
+      }
+
+      s->reported = 1;
+
+      i = s->start + s->len - live - 1;
+      continue;
+
+    }
+
+    for (j = 0; j < afl_pers_reset->pages_cnt; ++j) {
+
+      if (afl_pers_reset->pages[j] == live) { return; }
+
+    }
+
+    if (j < AFL_PERS_RESET_MAX_REPORTED) {
+
+      afl_pers_reset->pages[afl_pers_reset->pages_cnt++] = live;
+      dprintf(fd,
+              "[AFL] persistent drift in iteration %u: unnamed data at %p "
+              "changed\n",
+              iter, live + i);
+
+    }
+
+    return;
+
+  }
+
+}
+
+/* Called at the end of every iteration of the loop */
+
+static void afl_persistent_reset_iteration(void) {
+
+  u8  restore;
+  u32 i;
+
+  if (!afl_pers_reset || !afl_pers_reset->checkpointed) { return; }
+
+  ++afl_pers_reset->iteration;
+  restore = afl_pers_reset->every &&
+            !(afl_pers_reset->iteration % afl_pers_reset->every);
+  if (!restore && afl_pers_reset->drift_fd < 0) { return; }
+
+  for (i = 0; i < afl_pers_reset->ranges_cnt; ++i) {
+
+    struct afl_pers_reset_range *r = &afl_pers_reset->ranges[i];
+    u8                          *live = r->start, *end = r->start + r->len;
+
+    while (live < end) {
+
+      u8    *next = (u8 *)(((uintptr_t)live + AFL_PERS_RESET_PAGE) &
+                        ~(uintptr_t)(AFL_PERS_RESET_PAGE - 1));
+      u8    *copy = r->copy + (live - r->start);
+      size_t len = (next < end ? next : end) - live;
+
+      if (afl_persistent_reset_differs(live, copy, len)) {
+
+        if (afl_pers_reset->drift_fd >= 0) {
+
+          afl_persistent_reset_report(r, live, copy, len);
+
+        }
+
+        if (restore) {
+
+          afl_persistent_reset_memcpy(live, copy, len);
+          ++afl_pers_reset->restored_pages;
+
+        }
+
+      }
+
+      live += len;
+
+    }
+
+  }
+
+}
+
+#endif
+
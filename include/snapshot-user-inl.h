@@ -0,0 +1,763 @@
+/*
+   american fuzzy lop++ - userspace snapshot routines
+   --------------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                     Heiko Eißfeldt <heiko.eissfeldt@hexco.de>,
+                     Andrea Fioraldi <andreafioraldi@gmail.com>,
+                     Dominik Maier <mail@dmnk.co>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     https://www.apache.org/licenses/LICENSE-2.0
+
+   Snapshots without the AFL-Snapshot-LKM. All private writable mappings are
+   registered with an unprivileged userfaultfd in asynchronous write-protect
+   mode, which makes the kernel track written pages without any fault
+   handler. When the target exits, only the written pages are restored from
+   a copy (or dropped if they were never populated), mappings and file
+   descriptors created since the snapshot are released and execution jumps
+   back to the snapshot point.
+
+   Needs Linux 6.7+ (UFFD_FEATURE_WP_ASYNC and the PAGEMAP_SCAN ioctl). If
+   anything cannot be restored (threads were started, the heap shrank below
+   the snapshot, a mapping went away, the target called _exit() ...), the
+   process really exits and the forkserver simply forks a new child. Built
+   against kernel headers without userfaultfd write protection (before 5.7)
+   it is always reported as unsupported.
+
+ */
+
+#ifndef _AFL_SNAPSHOT_USER_INL_H
+#define _AFL_SNAPSHOT_USER_INL_H
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#if !defined(UFFDIO_WRITEPROTECT) || !defined(SYS_userfaultfd)
+
+static int afl_snapshot_user_init(void) {
+
+  return -1;
+
+}
+
+static int afl_snapshot_user_take(sigjmp_buf *env) {
+
+  (void)env;
+  return -1;
+
+}
+
+#else
+
+#ifndef UFFD_USER_MODE_ONLY
+  #define UFFD_USER_MODE_ONLY 1
+#endif
+
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+  #define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+
+#ifndef UFFD_FEATURE_WP_ASYNC
+  #define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+/* From linux/fs.h (6.7), older headers do not have it */
+
+#ifndef PAGEMAP_SCAN
+
+  #define PAGE_IS_WRITTEN (1 << 1)
+  #define PAGE_IS_PRESENT (1 << 3)
+  #define PAGE_IS_SWAPPED (1 << 4)
+
+  #define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region {
+
+  __u64 start;
+  __u64 end;
+  __u64 categories;
+
+};
+
+struct pm_scan_arg {
+
+  __u64 size;
+  __u64 flags;
+  __u64 start;
+  __u64 end;
+  __u64 walk_end;
+  __u64 vec;
+  __u64 vec_len;
+  __u64 max_pages;
+  __u64 category_inverted;
+  __u64 category_mask;
+  __u64 category_anyof_mask;
+  __u64 return_mask;
+
+};
+
+  #define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+
+#endif
+
+#define AFL_SNAP_USER_FEATURES \
+  (UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED)
+
+/* Limits of the bookkeeping, a snapshot that does not fit is not taken */
+
+#define AFL_SNAP_USER_MAX_MAPS 1024
+#define AFL_SNAP_USER_MAX_SAVED (1 << 16)
+#define AFL_SNAP_USER_VEC 4096
+#define AFL_SNAP_USER_MAX_FD 1024
+#define AFL_SNAP_USER_OWN_FD 1000
+#define AFL_SNAP_USER_STACK (64 * 1024)
+#define AFL_SNAP_USER_MAPS_BUF (256 * 1024)
+
+/* Signal used to get onto the alternate stack for the restore */
+
+#define AFL_SNAP_USER_SIGNAL SIGRTMAX
+
+struct afl_snap_user_range {
+
+  u64 start, end;
+
+};
+
+struct afl_snap_user_saved {
+
+  u64 start, end, off;
+
+};
+
+/* Everything the restore needs lives in this mmap()ed block, which is not
+   part of the snapshot itself */
+
+struct afl_snap_user_state {
+
+  sigjmp_buf *env;
+
+  s32 uffd;
+  s32 pagemap_fd;
+
+  u64 brk;
+
+  /* all mappings at snapshot time, and those that are tracked */
+  u32                        maps_cnt;
+  struct afl_snap_user_range maps[AFL_SNAP_USER_MAX_MAPS];
+  u32                        tracked_cnt;
+  struct afl_snap_user_range tracked[AFL_SNAP_USER_MAX_MAPS];
+
+  /* our own mappings, never touched by the restore */
+  struct afl_snap_user_range own[3];
+
+  /* populated pages at snapshot time, sorted, and their copy */
+  u32                        saved_cnt;
+  struct afl_snap_user_saved saved[AFL_SNAP_USER_MAX_SAVED];
+  u8 *                       store;
+  u64                        store_size;
+
+  /* open file descriptors */
+  s32 max_fd;
+  u8  fd_open[AFL_SNAP_USER_MAX_FD];
+
+  struct page_region vec[AFL_SNAP_USER_VEC];
+  char               maps_buf[AFL_SNAP_USER_MAPS_BUF];
+
+};
+
+static struct afl_snap_user_state *afl_snap_user;
+
+/* Checks once in the forkserver whether the kernel can do it. The uffd has
+   to be created in every child, it is bound to the address space. */
+
+static int afl_snapshot_user_init(void) {
+
+  struct uffdio_api api = {.api = UFFD_API,
+                           .features = AFL_SNAP_USER_FEATURES};
+  s32               uffd, fd;
+
+  uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  if (uffd < 0) { return -1; }
+
+  if (ioctl(uffd, UFFDIO_API, &api) ||
+      (api.features & AFL_SNAP_USER_FEATURES) != AFL_SNAP_USER_FEATURES) {
+
+    close(uffd);
+    return -1;
+
+  }
+
+  close(uffd);
+
+  /* PAGEMAP_SCAN is just as new, make sure the ioctl is known */
+
+  fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) { return -1; }
+
+  struct pm_scan_arg arg = {.size = sizeof(arg)};
+  if (ioctl(fd, PAGEMAP_SCAN, &arg) < 0) {
+
+    close(fd);
+    return -1;
+
+  }
+
+  close(fd);
+  return 0;
+
+}
+
+/* Reads /proc/self/maps into the state buffer, returns the length */
+
+static ssize_t afl_snapshot_user_read_maps(void) {
+
+  ssize_t len = 0, ret;
+  s32     fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) { return -1; }
+
+  while ((ret = read(fd, afl_snap_user->maps_buf + len,
+                     AFL_SNAP_USER_MAPS_BUF - 1 - len)) > 0) {
+
+    len += ret;
+
+  }
+
+  close(fd);
+  if (ret < 0 || len >= AFL_SNAP_USER_MAPS_BUF - 1) { return -1; }
+  afl_snap_user->maps_buf[len] = 0;
+  return len;
+
+}
+
+/* Parses one maps line: "start-end perms offset dev inode   name" */
+
+static char *afl_snapshot_user_parse_line(char *line, u64 *start, u64 *end,
+                                          char *perms, char **name) {
+
+  char *next = strchr(line, '\n');
+  u8    field = 0;
+
+  if (next) { *next++ = 0; }
+
+  *start = strtoull(line, &line, 16);
+  *end = strtoull(line + 1, &line, 16);
+  memcpy(perms, line + 1, 4);
+  *name = "";
+
+  while (*line && field < 5) {
+
+    while (*line == ' ') {
+
+      ++line;
+
+    }
+
+    if (++field == 5) { break; }
+
+    while (*line && *line != ' ') {
+
+      ++line;
+
+    }
+
+  }
+
+  if (*line) { *name = line; }
+
+  return next;
+
+}
+
+static u8 afl_snapshot_user_is_own(u64 start, u64 end) {
+
+  for (u32 i = 0; i < 3; ++i) {
+
+    if (start < afl_snap_user->own[i].end &&
+        end > afl_snap_user->own[i].start) {
+
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Scans [start, end) for pages in the given categories. Returns the number
+   of ranges in the vec, and where the walk stopped in *walk_end. */
+
+static int afl_snapshot_user_scan(u64 start, u64 end, u64 categories,
+                                  u64 *walk_end) {
+
+  struct pm_scan_arg arg = {.size = sizeof(arg),
+                            .start = start,
+                            .end = end,
+                            .vec = (u64)afl_snap_user->vec,
+                            .vec_len = AFL_SNAP_USER_VEC,
+                            .category_anyof_mask = categories,
+                            .return_mask = categories};
+
+  int ret = ioctl(afl_snap_user->pagemap_fd, PAGEMAP_SCAN, &arg);
+  *walk_end = arg.walk_end;
+  return ret;
+
+}
+
+static s32 afl_snapshot_user_own_fd(s32 fd) {
+
+  s32 ret;
+
+  if (fd < 0) { return fd; }
+  ret = fcntl(fd, F_DUPFD_CLOEXEC, AFL_SNAP_USER_OWN_FD);
+  close(fd);
+  return ret;
+
+}
+
+/* Closes [from, to], with close_range() if the kernel has it */
+
+static void afl_snapshot_user_close_fds(s32 from, s32 to) {
+
+#ifdef SYS_close_range
+  if (!syscall(SYS_close_range, from, to, 0)) { return; }
+#endif
+
+  for (s32 fd = from; fd <= to; ++fd) {
+
+    close(fd);
+
+  }
+
+}
+
+static void afl_snapshot_user_restore_signal(int sig);
+static void afl_snapshot_user_exit(void);
+
+/* Takes the snapshot. The caller has to sigsetjmp() into env right before,
+   that is where the restore returns to. Returns 0 on success, on failure
+   the process continues as a normal forkserver child. */
+
+static int afl_snapshot_user_take(sigjmp_buf *env) {
+
+  struct afl_snap_user_state *s;
+  struct uffdio_api           api = {.api = UFFD_API,
+                                     .features = AFL_SNAP_USER_FEATURES};
+  struct sigaction            sa, old_sa;
+  stack_t                     ss, old_ss;
+  u8 *                        stack;
+  u64                         start, end, walk_end, total = 0;
+  char                        perms[4], *name, *line;
+  int                         cnt;
+  u8                          installed = 0;
+
+  s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (s == MAP_FAILED) { return -1; }
+  stack = mmap(NULL, AFL_SNAP_USER_STACK, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stack == MAP_FAILED) {
+
+    munmap(s, sizeof(*s));
+    return -1;
+
+  }
+
+  /* A different VMA flag keeps the kernel from merging mappings the target
+     creates later into ours, where the restore would not see them */
+
+  madvise(s, sizeof(*s), MADV_DONTFORK);
+  madvise(stack, AFL_SNAP_USER_STACK, MADV_DONTFORK);
+
+  afl_snap_user = s;
+  s->env = env;
+  s->own[0].start = (u64)s;
+  s->own[0].end = (u64)s + ((sizeof(*s) + 4095) & ~4095ULL);
+  s->own[1].start = (u64)stack;
+  s->own[1].end = (u64)stack + AFL_SNAP_USER_STACK;
+
+  /* our descriptors go out of the way so the target sees the same numbers
+     as without snapshots */
+  s->uffd = afl_snapshot_user_own_fd(
+      syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+  s->pagemap_fd = afl_snapshot_user_own_fd(
+      open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC));
+  if (s->uffd < 0 || s->pagemap_fd < 0 || ioctl(s->uffd, UFFDIO_API, &api)) {
+
+    goto fail;
+
+  }
+
+  /* Alternate stack and handler for the restore, and the exit hook. This
+     all happens before the memory is saved so it is part of the snapshot. */
+
+  ss.ss_sp = stack;
+  ss.ss_size = AFL_SNAP_USER_STACK;
+  ss.ss_flags = 0;
+  if (sigaltstack(&ss, &old_ss)) { goto fail; }
+  installed = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = afl_snapshot_user_restore_signal;
+  sa.sa_flags = SA_ONSTACK;
+  sigfillset(&sa.sa_mask);
+  if (sigaction(AFL_SNAP_USER_SIGNAL, &sa, &old_sa)) { goto fail; }
+  installed = 2;
+
+  /* cannot be undone, but does nothing once afl_snap_user is NULL again */
+  if (atexit(afl_snapshot_user_exit)) { goto fail; }
+
+  /* Write protect all private writable mappings and collect the populated
+     pages */
+
+  if (afl_snapshot_user_read_maps() < 0) { goto fail; }
+  line = s->maps_buf;
+
+  while (line && *line) {
+
+    line = afl_snapshot_user_parse_line(line, &start, &end, perms, &name);
+
+    if (afl_snapshot_user_is_own(start, end)) { continue; }
+    if (s->maps_cnt == AFL_SNAP_USER_MAX_MAPS) { goto fail; }
+    s->maps[s->maps_cnt].start = start;
+    s->maps[s->maps_cnt++].end = end;
+
+    if (perms[1] != 'w' || perms[3] != 'p' || !strcmp(name, "[vsyscall]")) {
+
+      continue;
+
+    }
+
+    struct uffdio_register reg = {.range = {start, end - start},
+                                  .mode = UFFDIO_REGISTER_MODE_WP};
+    struct uffdio_writeprotect wp = {.range = {start, end - start},
+                                     .mode = UFFDIO_WRITEPROTECT_MODE_WP};
+
+    if (ioctl(s->uffd, UFFDIO_REGISTER, &reg) ||
+        ioctl(s->uffd, UFFDIO_WRITEPROTECT, &wp)) {
+
+      goto fail;
+
+    }
+
+    s->tracked[s->tracked_cnt].start = start;
+    s->tracked[s->tracked_cnt++].end = end;
+
+    walk_end = start;
+    do {
+
+      cnt = afl_snapshot_user_scan(walk_end, end,
+                                   PAGE_IS_PRESENT | PAGE_IS_SWAPPED,
+                                   &walk_end);
+      if (cnt < 0) { goto fail; }
+
+      for (int i = 0; i < cnt; ++i) {
+
+        if (s->saved_cnt == AFL_SNAP_USER_MAX_SAVED) { goto fail; }
+        s->saved[s->saved_cnt].start = s->vec[i].start;
+        s->saved[s->saved_cnt].end = s->vec[i].end;
+        s->saved[s->saved_cnt++].off = total;
+        total += s->vec[i].end - s->vec[i].start;
+
+      }
+
+    } while (walk_end < end);
+
+  }
+
+  s->store_size = total ? total : 4096;
+  s->store = mmap(NULL, s->store_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (s->store == MAP_FAILED) { goto fail; }
+  madvise(s->store, s->store_size, MADV_DONTFORK);
+  s->own[2].start = (u64)s->store;
+  s->own[2].end = (u64)s->store + ((s->store_size + 4095) & ~4095ULL);
+
+  for (u32 i = 0; i < s->saved_cnt; ++i) {
+
+    memcpy(s->store + s->saved[i].off, (u8 *)s->saved[i].start,
+           s->saved[i].end - s->saved[i].start);
+
+  }
+
+  s->brk = syscall(SYS_brk, 0);
+
+  /* The open file descriptors */
+
+  s->max_fd = -1;
+  for (s32 fd = 0; fd < AFL_SNAP_USER_MAX_FD; ++fd) {
+
+    if (fcntl(fd, F_GETFD) != -1) {
+
+      s->fd_open[fd] = 1;
+      s->max_fd = fd;
+
+    }
+
+  }
+
+  return 0;
+
+fail:
+  /* closing the uffd also drops the registrations and write protection */
+  if (s->uffd >= 0) { close(s->uffd); }
+  if (s->pagemap_fd >= 0) { close(s->pagemap_fd); }
+  if (installed >= 2) { sigaction(AFL_SNAP_USER_SIGNAL, &old_sa, NULL); }
+  if (installed >= 1) { sigaltstack(&old_ss, NULL); }
+  afl_snap_user = NULL;
+  munmap(stack, AFL_SNAP_USER_STACK);
+  munmap(s, sizeof(*s));
+  return -1;
+
+}
+
+/* Copies back the populated part of [start, end) and drops the rest */
+
+static void afl_snapshot_user_restore_range(u64 start, u64 end) {
+
+  struct afl_snap_user_state *s = afl_snap_user;
+  u32                         lo = 0, hi = s->saved_cnt;
+
+  /* first saved range that ends after start */
+  while (lo < hi) {
+
+    u32 mid = (lo + hi) / 2;
+    if (s->saved[mid].end <= start) {
+
+      lo = mid + 1;
+
+    } else {
+
+      hi = mid;
+
+    }
+
+  }
+
+  while (start < end) {
+
+    if (lo < s->saved_cnt && s->saved[lo].start <= start) {
+
+      u64 to = s->saved[lo].end < end ? s->saved[lo].end : end;
+      memcpy((u8 *)start,
+             s->store + s->saved[lo].off + start - s->saved[lo].start,
+             to - start);
+      start = to;
+      ++lo;
+
+    } else {
+
+      u64 to = lo < s->saved_cnt && s->saved[lo].start < end
+                   ? s->saved[lo].start
+                   : end;
+      madvise((void *)start, to - start, MADV_DONTNEED);
+      start = to;
+
+    }
+
+  }
+
+}
+
+static u8 afl_snapshot_user_covered(struct afl_snap_user_range *r, u32 cnt,
+                                    u64 start, u64 end) {
+
+  for (u32 i = 0; i < cnt && start < end; ++i) {
+
+    if (r[i].start <= start && r[i].end > start) { start = r[i].end; }
+
+  }
+
+  return start >= end;
+
+}
+
+static u8 afl_snapshot_user_overlaps(struct afl_snap_user_range *r, u32 cnt,
+                                     u64 start, u64 end) {
+
+  for (u32 i = 0; i < cnt; ++i) {
+
+    if (r[i].start < end && r[i].end > start) { return 1; }
+
+  }
+
+  return 0;
+
+}
+
+/* Runs on the alternate stack. Everything on the normal stack is about to
+   be overwritten. */
+
+static void afl_snapshot_user_restore_signal(int sig) {
+
+  struct afl_snap_user_state *s = afl_snap_user;
+  struct stat                 st;
+  u64                         start, end, walk_end, cur_brk;
+  char                        perms[4], *name, *line;
+  int                         cnt;
+
+  (void)sig;
+
+  /* Threads cannot be brought back, and neither can a heap below the
+     snapshot's */
+
+  if (stat("/proc/self/task", &st) || st.st_nlink > 3) { _exit(0); }
+
+  cur_brk = syscall(SYS_brk, 0);
+  if (cur_brk < s->brk) { _exit(0); }
+  if (cur_brk > s->brk && (u64)syscall(SYS_brk, s->brk) != s->brk) {
+
+    _exit(0);
+
+  }
+
+  /* Release mappings created since the snapshot, bail out if one of the
+     tracked ones went away */
+
+  if (afl_snapshot_user_read_maps() < 0) { _exit(0); }
+  line = s->maps_buf;
+
+  while (line && *line) {
+
+    line = afl_snapshot_user_parse_line(line, &start, &end, perms, &name);
+
+    if (afl_snapshot_user_is_own(start, end) || !strcmp(name, "[stack]")) {
+
+      continue;
+
+    }
+
+    if (afl_snapshot_user_covered(s->maps, s->maps_cnt, start, end)) {
+
+      /* a tracked mapping that is no longer writable cannot be restored */
+      if ((perms[1] != 'w' || perms[3] != 'p') &&
+          afl_snapshot_user_overlaps(s->tracked, s->tracked_cnt, start, end)) {
+
+        _exit(0);
+
+      }
+
+      continue;
+
+    }
+
+    /* keep the parts that existed before */
+    for (u32 i = 0; i < s->maps_cnt && start < end; ++i) {
+
+      if (s->maps[i].end <= start || s->maps[i].start >= end) { continue; }
+      if (s->maps[i].start > start) {
+
+        munmap((void *)start, s->maps[i].start - start);
+
+      }
+
+      start = s->maps[i].end;
+
+    }
+
+    if (start < end) { munmap((void *)start, end - start); }
+
+  }
+
+  /* Restore the written pages and protect them again */
+
+  for (u32 i = 0; i < s->tracked_cnt; ++i) {
+
+    start = s->tracked[i].start;
+    end = s->tracked[i].end;
+    walk_end = start;
+
+    do {
+
+      cnt = afl_snapshot_user_scan(walk_end, end, PAGE_IS_WRITTEN, &walk_end);
+      if (cnt < 0) { _exit(0); }
+
+      for (int j = 0; j < cnt; ++j) {
+
+        struct uffdio_writeprotect wp = {
+            .range = {s->vec[j].start, s->vec[j].end - s->vec[j].start},
+            .mode = UFFDIO_WRITEPROTECT_MODE_WP};
+
+        afl_snapshot_user_restore_range(s->vec[j].start, s->vec[j].end);
+        if (ioctl(s->uffd, UFFDIO_WRITEPROTECT, &wp)) { _exit(0); }
+
+      }
+
+    } while (walk_end < end);
+
+  }
+
+  /* Close file descriptors opened since the snapshot */
+
+  for (s32 fd = 0; fd <= s->max_fd; ++fd) {
+
+    if (!s->fd_open[fd]) {
+
+      s32 to = fd;
+      while (to < s->max_fd && !s->fd_open[to + 1]) {
+
+        ++to;
+
+      }
+
+      afl_snapshot_user_close_fds(fd, to);
+      fd = to;
+
+    }
+
+  }
+
+  afl_snapshot_user_close_fds(s->max_fd + 1, AFL_SNAP_USER_MAX_FD - 1);
+
+  siglongjmp(*s->env, 1);
+
+}
+
+/* atexit() hook: instead of exiting go back to the snapshot */
+
+static void afl_snapshot_user_exit(void) {
+
+  struct sigaction sa;
+  sigset_t         set;
+
+  if (!afl_snap_user) { return; }
+
+  /* the target may have replaced the handler or blocked the signal */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = afl_snapshot_user_restore_signal;
+  sa.sa_flags = SA_ONSTACK;
+  sigfillset(&sa.sa_mask);
+  sigaction(AFL_SNAP_USER_SIGNAL, &sa, NULL);
+
+  sigemptyset(&set);
+  sigaddset(&set, AFL_SNAP_USER_SIGNAL);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+  raise(AFL_SNAP_USER_SIGNAL);
+
+}
+
+#endif                                                /* UFFDIO_WRITEPROTECT */
+
+#endif
+
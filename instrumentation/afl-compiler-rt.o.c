@@ -14,10 +14,12 @@
 
 */
 
-#ifdef __AFL_CODE_COVERAGE
+#if defined(__AFL_CODE_COVERAGE) || defined(__linux__)
   #ifndef _GNU_SOURCE
     #define _GNU_SOURCE
   #endif
+#endif
+#ifdef __AFL_CODE_COVERAGE
   #ifndef __USE_GNU
     #define __USE_GNU
   #endif
@@ -57,12 +59,19 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 
+#if defined(__linux__) && defined(__GLIBC__)
+  #include <execinfo.h>
+  #include <link.h>
+#endif
+
 #if !__GNUC__
   #include "llvm/Config/llvm-config.h"
 #endif
 
 #ifdef __linux__
   #include "snapshot-inl.h"
+  #include "snapshot-user-inl.h"
+  #include "persistent-reset-inl.h"
 #endif
 
 /* This is a somewhat ugly hack for the experimental 'trace-pc-guard' mode.
@@ -319,6 +328,216 @@ static void __afl_map_shm_fuzz() {
 
 }
 
+#if defined(__linux__) && defined(__GLIBC__)
+
+/* Crash stack hash for AFL_CRASH_BUCKET_LIMIT: the crash signal handlers
+   and the sanitizer death callback publish a hash of the faulting pc and
+   the return addresses above it into a shared word. Addresses are taken as
+   offsets into their module so the hash does not depend on ASLR, frames in
+   the sanitizer runtimes and in libc are skipped. */
+
+static u64             *__afl_crash_hash;
+static u8               __afl_crash_hashed;
+static struct sigaction __afl_crash_old_sa[32];
+static const int        __afl_crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE,
+                                                 SIGILL,  SIGABRT, SIGTRAP};
+
+void  __sanitizer_set_death_callback(void (*callback)(void))
+    __attribute__((weak));
+void *__asan_get_report_pc(void) __attribute__((weak));
+
+struct __afl_crash_frame {
+
+  uintptr_t   addr, base;
+  const char *module;
+
+};
+
+static int __afl_crash_frame_module(struct dl_phdr_info *info, size_t size,
+                                    void *data) {
+
+  struct __afl_crash_frame *frame = (struct __afl_crash_frame *)data;
+  u32                       i;
+
+  (void)size;
+
+  for (i = 0; i < info->dlpi_phnum; ++i) {
+
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+    if (phdr->p_type == PT_LOAD && frame->addr >= start &&
+        frame->addr < start + phdr->p_memsz) {
+
+      frame->base = info->dlpi_addr;
+      frame->module = info->dlpi_name;
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Module relative address, or 0 if it belongs to a sanitizer runtime or
+   to libc. */
+
+static uintptr_t __afl_crash_frame_offset(uintptr_t addr) {
+
+  static const char *runtime[] = {"libasan",     "libubsan", "libmsan",
+                                  "libtsan",     "liblsan",  "libclang_rt",
+                                  "libc.so",     NULL};
+  struct __afl_crash_frame frame = {addr, 0, NULL};
+  u32                      i;
+
+  dl_iterate_phdr(__afl_crash_frame_module, &frame);
+
+  for (i = 0; frame.module && runtime[i]; ++i) {
+
+    if (strstr(frame.module, runtime[i])) { return 0; }
+
+  }
+
+  return addr - frame.base;
+
+}
+
+/* Called by the handlers below, the first two frames are this function and
+   its caller. */
+
+static __attribute__((noinline)) void __afl_crash_hash_publish(void) {
+
+  void     *bt[64];
+  uintptr_t h[CRASH_STACK_FRAMES + 1], pc = 0, off;
+  int       cnt, i = 2;
+  u32       n = 0;
+
+  if (__afl_crash_hashed) { return; }
+  __afl_crash_hashed = 1;
+
+  cnt = backtrace(bt, 64);
+
+  /* ASAN knows the faulting pc, its report function was called from the
+     instruction right after it. Start the walk there, which skips the
+     runtime frames even if it is linked statically. */
+
+  if (__asan_get_report_pc) { pc = (uintptr_t)__asan_get_report_pc(); }
+
+  if (pc) {
+
+    int j;
+
+    for (j = i; j < cnt; ++j) {
+
+      if ((uintptr_t)bt[j] == pc + 1) {
+
+        i = j + 1;
+        break;
+
+      }
+
+    }
+
+    if ((off = __afl_crash_frame_offset(pc))) { h[n++] = off; }
+
+  }
+
+  for (; i < cnt && n < CRASH_STACK_FRAMES + 1; ++i) {
+
+    if ((off = __afl_crash_frame_offset((uintptr_t)bt[i]))) { h[n++] = off; }
+
+  }
+
+  *__afl_crash_hash = XXH3_64bits(h, n * sizeof(uintptr_t)) | 1;
+
+}
+
+static void __afl_crash_death_callback(void) {
+
+  __afl_crash_hash_publish();
+
+}
+
+/* Publish the hash, then restore the previous disposition of the signal.
+   A fault re-triggers when we return, a sent signal is raised again. So is
+   SIGTRAP: after an int3 the pc is already past the trap. */
+
+static void __afl_crash_handler(int sig, siginfo_t *info, void *ctx) {
+
+  (void)ctx;
+
+  __afl_crash_hash_publish();
+
+  sigaction(sig, &__afl_crash_old_sa[sig], NULL);
+  if (info->si_code <= 0 || sig == SIGTRAP) { raise(sig); }
+
+}
+
+static void __afl_map_shm_crash(void) {
+
+  char            *id_str = getenv(SHM_CRASH_ENV_VAR);
+  struct sigaction sa;
+  u32              i;
+
+  if (!id_str) { return; }
+
+  #ifdef USEMMAP
+  int shm_fd = shm_open(id_str, O_RDWR, DEFAULT_PERMISSION);
+  if (shm_fd == -1) { return; }
+  __afl_crash_hash = (u64 *)mmap(0, sizeof(u64), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  #else
+  __afl_crash_hash = (u64 *)shmat(atoi(id_str), NULL, 0);
+  #endif
+
+  if (!__afl_crash_hash || __afl_crash_hash == (void *)-1) {
+
+    __afl_crash_hash = NULL;
+    return;
+
+  }
+
+  /* backtrace() loads libgcc_s on first use, not something to do in a
+     crashing process. */
+
+  {
+
+    void *bt[1];
+    (void)backtrace(bt, 1);
+
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = __afl_crash_handler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+
+  for (i = 0; i < sizeof(__afl_crash_signals) / sizeof(int); ++i) {
+
+    sigaction(__afl_crash_signals[i], &sa,
+              &__afl_crash_old_sa[__afl_crash_signals[i]]);
+
+  }
+
+  if (__sanitizer_set_death_callback) {
+
+    __sanitizer_set_death_callback(__afl_crash_death_callback);
+
+  }
+
+}
+
+#else
+
+static void __afl_map_shm_crash(void) {
+
+}
+
+#endif
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
@@ -837,6 +1056,12 @@ void write_error_with_location(char *text, char *filename, int linenumber) {
 }
 
 #ifdef __linux__
+
+/* Userspace snapshots (AFL_USERSPACE_SNAPSHOT) instead of the LKM? */
+
+static u8         __afl_user_snapshot;
+static sigjmp_buf __afl_user_snapshot_env;
+
 static void __afl_start_snapshots(void) {
 
   static u8 tmp[4] = {0, 0, 0, 0};
@@ -1011,8 +1236,27 @@ static void __afl_start_snapshots(void) {
         close(FORKSRV_FD);
         close(FORKSRV_FD + 1);
 
-        if (!afl_snapshot_take(AFL_SNAPSHOT_MMAP | AFL_SNAPSHOT_FDS |
-                               AFL_SNAPSHOT_REGS | AFL_SNAPSHOT_EXIT)) {
+        if (__afl_user_snapshot) {
+
+          /* On exit() the target comes back here from the restore and
+             reports the run as done, just like with the LKM */
+
+          if (sigsetjmp(__afl_user_snapshot_env, 1)) {
+
+            raise(SIGSTOP);
+
+          } else if (afl_snapshot_user_take(&__afl_user_snapshot_env) &&
+
+                     __afl_debug) {
+
+            fprintf(stderr,
+                    "DEBUG: userspace snapshot failed, using fork mode\n");
+
+          }
+
+        } else if (!afl_snapshot_take(AFL_SNAPSHOT_MMAP | AFL_SNAPSHOT_FDS |
+
+                                      AFL_SNAPSHOT_REGS | AFL_SNAPSHOT_EXIT)) {
 
           raise(SIGSTOP);
 
@@ -1093,6 +1337,25 @@ static void __afl_start_forkserver(void) {
 
   }
 
+  if (!is_persistent && !__afl_cmp_map && getenv("AFL_USERSPACE_SNAPSHOT") &&
+      !getenv("AFL_NO_SNAPSHOT")) {
+
+    if (afl_snapshot_user_init() >= 0) {
+
+      __afl_user_snapshot = 1;
+      __afl_start_snapshots();
+      return;
+
+    } else if (__afl_debug) {
+
+      fprintf(stderr,
+              "DEBUG: AFL_USERSPACE_SNAPSHOT needs userfaultfd with async "
+              "write protection and PAGEMAP_SCAN (Linux 6.7+)\n");
+
+    }
+
+  }
+
 #endif
 
   u8  tmp[4] = {0, 0, 0, 0};
@@ -1327,6 +1590,95 @@ static void __afl_start_forkserver(void) {
 
 }
 
+#ifdef __linux__
+
+/* Defined by __AFL_FUZZ_INIT(), never part of the persistent reset */
+
+extern u8 __afl_fuzz_alt[] __attribute__((weak));
+
+/* The sanitizer runtimes keep their allocator and shadow bookkeeping in
+   globals of the executable, resetting those corrupts them */
+
+void __asan_init(void) __attribute__((weak));
+void __msan_init(void) __attribute__((weak));
+
+/* Reads AFL_PERSISTENT_RESET and AFL_PERSISTENT_DRIFT once, returns whether
+   state of the persistent loop is checkpointed at all. */
+
+static u8 __afl_persistent_reset_setup(void) {
+
+  static u8 done, enabled;
+  u8       *every, *drift;
+  s32       drift_fd = -1;
+
+  if (done) { return enabled; }
+  done = 1;
+
+  every = (u8 *)getenv("AFL_PERSISTENT_RESET");
+  drift = (u8 *)getenv("AFL_PERSISTENT_DRIFT");
+  if (!every && !drift) { return 0; }
+
+  if (every && (__asan_init || __msan_init)) {
+
+    fprintf(stderr,
+            "[-] WARNING: AFL_PERSISTENT_RESET does not work with ASAN or "
+            "MSAN, ignored\n");
+    every = NULL;
+    if (!drift) { return 0; }
+
+  }
+
+  if (drift && !strcmp((char *)drift, "1")) {
+
+    drift_fd = 2;
+
+  } else if (drift) {
+
+    drift_fd = open((char *)drift, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    DEFAULT_PERMISSION);
+    if (drift_fd < 0 && __afl_debug) {
+
+      fprintf(stderr, "DEBUG: cannot open AFL_PERSISTENT_DRIFT file %s\n",
+              drift);
+
+    }
+
+  }
+
+  if (afl_persistent_reset_init(every ? atoi((char *)every) : 0, drift_fd)) {
+
+    return 0;
+
+  }
+
+  enabled = 1;
+  return 1;
+
+}
+
+#endif
+
+/* Adds a region (e.g. a heap arena of the harness) to the state that is
+   restored by AFL_PERSISTENT_RESET and watched by AFL_PERSISTENT_DRIFT. */
+
+void __afl_persistent_register(void *ptr, size_t len) {
+
+#ifdef __linux__
+  if (__afl_persistent_reset_setup() &&
+      afl_persistent_reset_register(ptr, len) && __afl_debug) {
+
+    fprintf(stderr, "DEBUG: cannot register %p+%zu for the persistent reset\n",
+            ptr, len);
+
+  }
+
+#else
+  (void)ptr;
+  (void)len;
+#endif
+
+}
+
 /* A simplified persistent mode handler, used as explained in
  * README.llvm.md. */
 
@@ -1350,10 +1702,34 @@ int __afl_persistent_loop(unsigned int max_cnt) {
     first_pass = 0;
     __afl_selective_coverage_temp = 1;
 
+#ifdef __linux__
+    if (__afl_persistent_reset_setup()) {
+
+      afl_persistent_reset_exclude(&cycle_cnt, sizeof(cycle_cnt));
+      afl_persistent_reset_exclude(__afl_area_initial,
+                                   sizeof(__afl_area_initial));
+      afl_persistent_reset_exclude(__afl_fuzz_alt, 1048576);
+
+      if (afl_persistent_reset_checkpoint() && __afl_debug) {
+
+        fprintf(stderr,
+                "DEBUG: no persistent reset, static executable or out of "
+                "memory\n");
+
+      }
+
+    }
+
+#endif
+
     return 1;
 
   } else if (--cycle_cnt) {
 
+#ifdef __linux__
+    afl_persistent_reset_iteration();
+#endif
+
     raise(SIGSTOP);
 
     __afl_area_ptr[0] = 1;
@@ -1370,6 +1746,18 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     __afl_area_ptr = __afl_area_ptr_dummy;
 
+#ifdef __linux__
+    if (__afl_debug && afl_pers_reset) {
+
+      fprintf(stderr,
+              "DEBUG: persistent reset restored %llu pages in %u "
+              "iterations\n",
+              afl_pers_reset->restored_pages, afl_pers_reset->iteration);
+
+    }
+
+#endif
+
     return 0;
 
   }
@@ -1457,6 +1845,7 @@ __attribute__((constructor(CTOR_PRIO))) void __afl_auto_early(void) {
   if (getenv("AFL_DISABLE_LLVM_INSTRUMENTATION")) return;
 
   __afl_map_shm();
+  __afl_map_shm_crash();
 
 }
 
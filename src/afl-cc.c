@@ -1383,6 +1383,20 @@ static void edit_params(u32 argc, char **argv, char **envp) {
 #endif                                                        /* ^__APPLE__ */
         "_I(); } while (0)";
 
+    cc_params[cc_par_cnt++] =
+        "-D__AFL_PERSISTENT_REGISTER(_P,_L)="
+        "do { "
+#ifdef __APPLE__
+        "__attribute__((visibility(\"default\"))) "
+        "void _R(void *, unsigned long) "
+        "__asm__(\"___afl_persistent_register\"); "
+#else
+        "__attribute__((visibility(\"default\"))) "
+        "void _R(void *, unsigned long) "
+        "__asm__(\"__afl_persistent_register\"); "
+#endif                                                        /* ^__APPLE__ */
+        "_R((_P), (_L)); } while (0)";
+
   }
 
   if (x_set) {
@@ -228,6 +228,7 @@ void afl_fsrv_init(afl_forkserver_t *fsrv) {
   fsrv->out_fd = -1;
   fsrv->out_dir_fd = -1;
   fsrv->dev_null_fd = -1;
+  fsrv->child_err_fd = -1;
   fsrv->dev_urandom_fd = -1;
 
   /* Settings */
@@ -237,6 +238,7 @@ void afl_fsrv_init(afl_forkserver_t *fsrv) {
   fsrv->init_tmout = EXEC_TIMEOUT * FORK_WAIT_MULT;
   fsrv->mem_limit = MEM_LIMIT;
   fsrv->out_file = NULL;
+  fsrv->crash_hash = NULL;
   fsrv->child_kill_signal = SIGKILL;
 
   /* exec related stuff */
@@ -259,6 +261,7 @@ void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from) {
 
   fsrv_to->use_stdin = from->use_stdin;
   fsrv_to->dev_null_fd = from->dev_null_fd;
+  fsrv_to->child_err_fd = -1;
   fsrv_to->exec_tmout = from->exec_tmout;
   fsrv_to->init_tmout = from->init_tmout;
   fsrv_to->mem_limit = from->mem_limit;
@@ -271,6 +274,7 @@ void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from) {
   fsrv_to->no_unlink = from->no_unlink;
   fsrv_to->uses_crash_exitcode = from->uses_crash_exitcode;
   fsrv_to->crash_exitcode = from->crash_exitcode;
+  fsrv_to->crash_hash = from->crash_hash;
   fsrv_to->child_kill_signal = from->child_kill_signal;
   fsrv_to->debug = from->debug;
 
@@ -385,6 +389,12 @@ static void afl_fauxsrv_execv(afl_forkserver_t *fsrv, char **argv) {
 
   void (*old_sigchld_handler)(int) = signal(SIGCHLD, SIG_DFL);
 
+  /* We inherited the stop handlers of afl-fuzz, which would leave us
+     running when afl-fuzz sends the kill signal on exit. */
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
   while (1) {
 
     uint32_t was_killed;
@@ -894,7 +904,8 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
     if (!(debug_child_output)) {
 
       dup2(fsrv->dev_null_fd, 1);
-      dup2(fsrv->dev_null_fd, 2);
+      dup2(fsrv->child_err_fd >= 0 ? fsrv->child_err_fd : fsrv->dev_null_fd,
+           2);
 
     }
 
@@ -921,6 +932,7 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
     close(fsrv->out_dir_fd);
     close(fsrv->dev_null_fd);
+    if (fsrv->child_err_fd >= 0) { close(fsrv->child_err_fd); }
     close(fsrv->dev_urandom_fd);
 
     if (fsrv->plot_file != NULL) {
@@ -1659,6 +1671,8 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
   MEM_BARRIER();
 #endif
 
+  if (unlikely(fsrv->crash_hash)) { *fsrv->crash_hash = 0; }
+
   /* we have the fork server (or faux server) up and running
   First, tell it if the previous run timed out. */
 
@@ -1763,6 +1777,7 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
   if (!WIFSTOPPED(fsrv->child_status)) { fsrv->child_pid = -1; }
 
+  fsrv->last_exec_ms = exec_ms;
   fsrv->total_execs++;
 
   /* Any subsequent operations on fsrv->trace_bits must not be moved by the
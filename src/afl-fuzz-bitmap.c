@@ -237,17 +237,70 @@ inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
 
 }
 
+/* The fused variant of classify_counts, has_new_bits and the trace checksum:
+   classifies the trace, stores its path checksum in *cksum and returns the
+   same as has_new_bits, all in one pass over the map. This is what the
+   per-exec paths should use whenever they need more than one of the three. */
+
+inline u8 has_new_bits_cksum(afl_state_t *afl, u8 *virgin_map, u64 *cksum) {
+
+  u8 ret = 0;
+
+#ifdef WORD_SIZE_64
+
+  *cksum =
+      classify_hash_discover((u64 *)afl->fsrv.trace_bits, (u64 *)virgin_map,
+                             afl->fsrv.map_size >> 3, &ret);
+
+#else
+
+  *cksum =
+      classify_hash_discover((u32 *)afl->fsrv.trace_bits, (u32 *)virgin_map,
+                             afl->fsrv.map_size >> 2, &ret);
+
+#endif                                                     /* ^WORD_SIZE_64 */
+
+  if (unlikely(ret) && likely(virgin_map == afl->virgin_bits))
+    afl->bitmap_changed = 1;
+
+  return ret;
+
+}
+
+/* Classify the trace in place and return its path checksum, without looking
+   at any virgin map. Used where only "did the path change" matters, e.g.
+   when trimming. */
+
+u64 classify_and_hash(afl_forkserver_t *fsrv) {
+
+  u8 ret = 0;
+
+#ifdef WORD_SIZE_64
+
+  return classify_hash_discover((u64 *)fsrv->trace_bits, NULL,
+                                fsrv->map_size >> 3, &ret);
+
+#else
+
+  return classify_hash_discover((u32 *)fsrv->trace_bits, NULL,
+                                fsrv->map_size >> 2, &ret);
+
+#endif                                                     /* ^WORD_SIZE_64 */
+
+}
+
 /* A combination of classify_counts and has_new_bits. If 0 is returned, then the
  * trace bits are kept as-is. Otherwise, the trace bits are overwritten with
- * classified values.
+ * classified values and *cksum holds the path checksum.
  *
  * This accelerates the processing: in most cases, no interesting behavior
  * happen, and the trace bits will be discarded soon. This function optimizes
  * for such cases: one-pass scan on trace bits without modifying anything. Only
- * on rare cases it fall backs to the slow path: classify_counts() first, then
- * return has_new_bits(). */
+ * on rare cases it fall backs to the slow path: the fused has_new_bits_cksum()
+ * which classifies, hashes and updates the virgin map in a single pass. */
 
-inline u8 has_new_bits_unclassified(afl_state_t *afl, u8 *virgin_map) {
+inline u8 has_new_bits_unclassified(afl_state_t *afl, u8 *virgin_map,
+                                    u64 *cksum) {
 
   /* Handle the hot path first: no new coverage */
   u8 *end = afl->fsrv.trace_bits + afl->fsrv.map_size;
@@ -263,8 +316,7 @@ inline u8 has_new_bits_unclassified(afl_state_t *afl, u8 *virgin_map) {
     return 0;
 
 #endif                                                     /* ^WORD_SIZE_64 */
-  classify_counts(&afl->fsrv);
-  return has_new_bits(afl, virgin_map);
+  return has_new_bits_cksum(afl, virgin_map, cksum);
 
 }
 
@@ -448,6 +500,77 @@ void write_crash_readme(afl_state_t *afl) {
 
 }
 
+/* AFL_CRASH_BUCKET_LIMIT: the stack hash the target published is a second
+   uniqueness dimension next to the crash coverage, and at most
+   crash_bucket_limit crashes are saved per stack hash. Crashes that did not
+   publish a hash only go by their coverage. Returns 1 to save the crash. */
+
+static u8 crash_bucket_admit(afl_state_t *afl, u8 new_bits) {
+
+  u64 hash = *afl->fsrv.crash_hash;
+  u32 i, mask;
+
+  if (!hash) { return new_bits; }
+
+  if ((afl->crash_buckets + 1) * 2 > afl->crash_bucket_size) {
+
+    struct crash_bucket *old = afl->crash_bucket;
+    u32                  old_size = afl->crash_bucket_size;
+
+    afl->crash_bucket_size = old_size ? old_size * 2 : 256;
+    afl->crash_bucket =
+        ck_alloc(afl->crash_bucket_size * sizeof(struct crash_bucket));
+    mask = afl->crash_bucket_size - 1;
+
+    for (i = 0; i < old_size; ++i) {
+
+      if (old[i].hash) {
+
+        u32 j = old[i].hash & mask;
+        while (afl->crash_bucket[j].hash) {
+
+          j = (j + 1) & mask;
+
+        }
+
+        afl->crash_bucket[j] = old[i];
+
+      }
+
+    }
+
+    if (old) { ck_free(old); }
+
+  }
+
+  mask = afl->crash_bucket_size - 1;
+  for (i = hash & mask;
+       afl->crash_bucket[i].hash && afl->crash_bucket[i].hash != hash;
+       i = (i + 1) & mask) {}
+
+  if (!afl->crash_bucket[i].hash) {
+
+    afl->crash_bucket[i].hash = hash;
+    ++afl->crash_buckets;
+
+  } else if (!new_bits) {
+
+    return 0;
+
+  }
+
+  if (afl->crash_bucket[i].saved >= afl->crash_bucket_limit) {
+
+    ++afl->crashes_limited;
+    return 0;
+
+  }
+
+  ++afl->crash_bucket[i].saved;
+  return 1;
+
+}
+
 /* Check if the result of an execve() during routine fuzzing is interesting,
    save or queue the input test case for further analysis if so. Returns 1 if
    entry is saved, 0 otherwise. */
@@ -459,6 +582,12 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
   if (unlikely(fault == FSRV_RUN_TMOUT && afl->afl_env.afl_ignore_timeouts)) {
 
+    if (unlikely(afl->want_exec_cksum)) {
+
+      afl->last_exec_cksum = classify_and_hash(&afl->fsrv);
+
+    }
+
     return 0;
 
   }
@@ -466,25 +595,31 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
   u8  fn[PATH_MAX];
   u8 *queue_fn = "";
   u8  new_bits = 0, keeping = 0, res, classified = 0, is_timeout = 0,
-     need_hash = 1;
+     fast_sched = (afl->schedule >= FAST && afl->schedule <= RARE);
   s32 fd;
   u64 cksum = 0;
 
-  /* Update path frequency. */
+  /* Generating a hash on every input is expensive, so this is only done for
+     the special schedules and when a stage asked for the path checksum
+     (want_exec_cksum). In that case classification, hashing and the new
+     bits check are done in one fused pass over the map. */
+  if (unlikely(fast_sched || afl->want_exec_cksum)) {
 
-  /* Generating a hash on every input is super expensive. Bad idea and should
-     only be used for special schedules */
-  if (unlikely(afl->schedule >= FAST && afl->schedule <= RARE)) {
+    if (likely(fault == afl->crash_mode)) {
 
-    classify_counts(&afl->fsrv);
-    classified = 1;
-    need_hash = 0;
+      new_bits = has_new_bits_cksum(afl, afl->virgin_bits, &cksum);
+
+    } else {
+
+      cksum = classify_and_hash(&afl->fsrv);
 
-    cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+    }
+
+    classified = 1;
+    afl->last_exec_cksum = cksum;
 
-    /* Saturated increment */
-    if (likely(afl->n_fuzz[cksum % N_FUZZ_SIZE] < 0xFFFFFFFF))
-      afl->n_fuzz[cksum % N_FUZZ_SIZE]++;
+    /* Update path frequency. Saturated increment */
+    if (unlikely(fast_sched)) { n_fuzz_add(afl, cksum); }
 
   }
 
@@ -493,13 +628,9 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
-    if (likely(classified)) {
-
-      new_bits = has_new_bits(afl, afl->virgin_bits);
-
-    } else {
+    if (likely(!classified)) {
 
-      new_bits = has_new_bits_unclassified(afl, afl->virgin_bits);
+      new_bits = has_new_bits_unclassified(afl, afl->virgin_bits, &cksum);
 
       if (unlikely(new_bits)) { classified = 1; }
 
@@ -582,20 +713,13 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
     }
 
-    if (unlikely(need_hash && new_bits)) {
-
-      /* due to classify counts we have to recalculate the checksum */
-      afl->queue_top->exec_cksum =
-          hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
-      need_hash = 0;
-
-    }
+    /* The fused pass that found the new bits also produced the checksum */
+    if (likely(new_bits)) { afl->queue_top->exec_cksum = cksum; }
 
     /* For AFLFast schedules we update the new queue entry */
-    if (likely(cksum)) {
+    if (unlikely(fast_sched)) {
 
-      afl->queue_top->n_fuzz_entry = cksum % N_FUZZ_SIZE;
-      afl->n_fuzz[afl->queue_top->n_fuzz_entry] = 1;
+      afl->queue_top->n_fuzz_cksum = cksum;
 
     }
 
@@ -768,7 +892,19 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
         simplify_trace(afl, afl->fsrv.trace_bits);
 
-        if (!has_new_bits(afl, afl->virgin_crash)) { return keeping; }
+        if (unlikely(afl->crash_bucket_limit)) {
+
+          if (!crash_bucket_admit(afl, has_new_bits(afl, afl->virgin_crash))) {
+
+            return keeping;
+
+          }
+
+        } else if (!has_new_bits(afl, afl->virgin_crash)) {
+
+          return keeping;
+
+        }
 
       }
 
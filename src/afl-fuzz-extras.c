@@ -25,23 +25,6 @@
 
 #include "afl-fuzz.h"
 
-/* helper function for auto_extras qsort */
-static int compare_auto_extras_len(const void *ae1, const void *ae2) {
-
-  return ((struct auto_extra_data *)ae1)->len -
-         ((struct auto_extra_data *)ae2)->len;
-
-}
-
-/* descending order */
-
-static int compare_auto_extras_use_d(const void *ae1, const void *ae2) {
-
-  return ((struct auto_extra_data *)ae2)->hit_cnt -
-         ((struct auto_extra_data *)ae1)->hit_cnt;
-
-}
-
 /* Helper function for load_extras. */
 
 static int compare_extras_len(const void *e1, const void *e2) {
@@ -266,6 +249,8 @@ static void extras_check_and_sort(afl_state_t *afl, u32 min_len, u32 max_len,
 
   qsort(afl->extras, afl->extras_cnt, sizeof(struct extra_data),
         compare_extras_len);
+  afl->extras_index_dirty = 1;
+  afl->extras_ac_dirty = 1;
 
   ACTF("Loaded %u extra tokens, size range %s to %s.", afl->extras_cnt,
        stringify_mem_size(val_bufs[0], sizeof(val_bufs[0]), min_len),
@@ -401,6 +386,508 @@ static inline u8 memcmp_nocase(u8 *m1, u8 *m2, u32 len) {
 
 }
 
+/* Case-insensitive hash of a token for the extras and a_extras indexes. */
+
+static inline u32 hash_extra_nocase(u8 *mem, u32 len) {
+
+  u32 h = 0x811c9dc5 ^ len;
+
+  while (len--) {
+
+    h = (h ^ tolower(*(mem++))) * 0x01000193;
+
+  }
+
+  return h ^ (h >> 15);
+
+}
+
+/* (Re)build the case-insensitive hash index of afl->extras[]. Only needed
+   when extras[] was changed, which happens while loading dictionaries. */
+
+static void index_extras(afl_state_t *afl) {
+
+  u32 i, size = 64;
+
+  while (size < afl->extras_cnt * 2) {
+
+    size <<= 1;
+
+  }
+
+  afl->extras_index =
+      afl_realloc((void **)&afl->extras_index, size * sizeof(u32));
+  if (unlikely(!afl->extras_index)) { PFATAL("alloc"); }
+  memset(afl->extras_index, 0, size * sizeof(u32));
+  afl->extras_index_size = size;
+
+  for (i = 0; i < afl->extras_cnt; ++i) {
+
+    u32 slot = hash_extra_nocase(afl->extras[i].data, afl->extras[i].len) &
+               (size - 1);
+
+    while (afl->extras_index[slot]) {
+
+      slot = (slot + 1) & (size - 1);
+
+    }
+
+    afl->extras_index[slot] = i + 1;
+
+  }
+
+  afl->extras_index_dirty = 0;
+
+}
+
+/* Is there an extra that matches mem case-insensitive? */
+
+static u8 find_extra_nocase(afl_state_t *afl, u8 *mem, u32 len) {
+
+  u32 slot, id;
+
+  if (!afl->extras_cnt) { return 0; }
+
+  if (unlikely(afl->extras_index_dirty || !afl->extras_index_size)) {
+
+    index_extras(afl);
+
+  }
+
+  slot = hash_extra_nocase(mem, len) & (afl->extras_index_size - 1);
+
+  while ((id = afl->extras_index[slot])) {
+
+    if (afl->extras[id - 1].len == len &&
+        !memcmp_nocase(afl->extras[id - 1].data, mem, len)) {
+
+      return 1;
+
+    }
+
+    slot = (slot + 1) & (afl->extras_index_size - 1);
+
+  }
+
+  return 0;
+
+}
+
+/* The a_extras[] index has a fixed size, slots hold the a_extras[] index + 1.
+   a_extras[] itself is kept sorted by hit_cnt, descending. */
+
+#define A_EXTRAS_INDEX_SIZE (MAX_AUTO_EXTRAS * 2)
+
+static inline u32 a_extras_home(afl_state_t *afl, u32 idx) {
+
+  return hash_extra_nocase(afl->a_extras[idx].data, afl->a_extras[idx].len) %
+         A_EXTRAS_INDEX_SIZE;
+
+}
+
+static inline u32 a_extras_next(u32 slot) {
+
+  return slot + 1 == A_EXTRAS_INDEX_SIZE ? 0 : slot + 1;
+
+}
+
+/* Returns the a_extras[] index of a case-insensitive match, or -1. */
+
+static s32 a_extras_find(afl_state_t *afl, u8 *mem, u32 len) {
+
+  u32 slot = hash_extra_nocase(mem, len) % A_EXTRAS_INDEX_SIZE, id;
+
+  while ((id = afl->a_extras_index[slot])) {
+
+    if (afl->a_extras[id - 1].len == len &&
+        !memcmp_nocase(afl->a_extras[id - 1].data, mem, len)) {
+
+      return id - 1;
+
+    }
+
+    slot = a_extras_next(slot);
+
+  }
+
+  return -1;
+
+}
+
+static void a_extras_index_add(afl_state_t *afl, u32 idx) {
+
+  u32 slot = a_extras_home(afl, idx);
+
+  while (afl->a_extras_index[slot]) {
+
+    slot = a_extras_next(slot);
+
+  }
+
+  afl->a_extras_index[slot] = idx + 1;
+
+}
+
+/* Slot that currently holds a_extras[idx]. */
+
+static u32 a_extras_slot(afl_state_t *afl, u32 idx) {
+
+  u32 slot = a_extras_home(afl, idx);
+
+  while (afl->a_extras_index[slot] != idx + 1) {
+
+    slot = a_extras_next(slot);
+
+  }
+
+  return slot;
+
+}
+
+/* Remove a_extras[idx] from the index, moving back the following entries of
+   the probe sequence so no tombstones are needed. */
+
+static void a_extras_index_del(afl_state_t *afl, u32 idx) {
+
+  u32 hole = a_extras_slot(afl, idx), slot = hole, id;
+
+  while ((id = afl->a_extras_index[slot = a_extras_next(slot)])) {
+
+    u32 home = a_extras_home(afl, id - 1);
+
+    /* can the entry at slot move to the hole? yes if its home is not
+       (cyclically) between the hole and slot */
+    if ((slot > hole && (home <= hole || home > slot)) ||
+        (slot < hole && home <= hole && home > slot)) {
+
+      afl->a_extras_index[hole] = id;
+      hole = slot;
+
+    }
+
+  }
+
+  afl->a_extras_index[hole] = 0;
+
+}
+
+/* Havoc pick weight of an a_extras[] entry with hit_cnt hits. */
+
+static inline u32 a_extras_weight(u32 hit_cnt) {
+
+  return 1 + MIN(hit_cnt, (u32)AUTO_EXTRAS_WEIGHT_CAP);
+
+}
+
+/* Add delta (may wrap, i.e. be negative) to the weight of a_extras[idx] in
+   the Fenwick tree. */
+
+static void a_extras_weight_add(afl_state_t *afl, u32 idx, u32 delta) {
+
+  afl->a_extras_weight_sum += delta;
+
+  for (++idx; idx <= MAX_AUTO_EXTRAS; idx += idx & -idx) {
+
+    afl->a_extras_weight[idx] += delta;
+
+  }
+
+}
+
+/* Pick an a_extras[] index for havoc: half of the time uniform, otherwise
+   weighted by a_extras_weight(), found by descending the Fenwick tree. */
+
+u32 pick_auto_extra(afl_state_t *afl) {
+
+  u32 r, pos = 0, step = 1;
+
+  if (rand_below(afl, 2)) { return rand_below(afl, afl->a_extras_cnt); }
+
+  r = rand_below(afl, afl->a_extras_weight_sum);
+
+  while (step << 1 <= MAX_AUTO_EXTRAS) {
+
+    step <<= 1;
+
+  }
+
+  for (; step; step >>= 1) {
+
+    if (pos + step <= MAX_AUTO_EXTRAS &&
+        afl->a_extras_weight[pos + step] <= r) {
+
+      pos += step;
+      r -= afl->a_extras_weight[pos];
+
+    }
+
+  }
+
+  return pos;
+
+}
+
+/* Swap two a_extras[] entries and fix up their index slots and weights. */
+
+static void a_extras_swap(afl_state_t *afl, u32 a, u32 b) {
+
+  struct auto_extra_data tmp;
+
+  if (a == b) { return; }
+
+  u32 slot_a = a_extras_slot(afl, a), slot_b = a_extras_slot(afl, b);
+  u32 delta = a_extras_weight(afl->a_extras[b].hit_cnt) -
+              a_extras_weight(afl->a_extras[a].hit_cnt);
+
+  a_extras_weight_add(afl, a, delta);
+  a_extras_weight_add(afl, b, -delta);
+
+  tmp = afl->a_extras[a];
+  afl->a_extras[a] = afl->a_extras[b];
+  afl->a_extras[b] = tmp;
+
+  afl->a_extras_index[slot_a] = b + 1;
+  afl->a_extras_index[slot_b] = a + 1;
+
+}
+
+/* First a_extras[] index in [lo, hi) with a hit_cnt lower than hit_cnt. */
+
+static u32 a_extras_first_below(afl_state_t *afl, u32 lo, u32 hi,
+                                u32 hit_cnt) {
+
+  while (lo < hi) {
+
+    u32 mid = lo + ((hi - lo) >> 1);
+
+    if (afl->a_extras[mid].hit_cnt < hit_cnt) {
+
+      hi = mid;
+
+    } else {
+
+      lo = mid + 1;
+
+    }
+
+  }
+
+  return lo;
+
+}
+
+/* Returns the indexes of the USE_AUTO_EXTRAS most used a_extras[] sorted by
+   size, which the deterministic auto extras stages rely on. */
+
+u32 *auto_extras_by_len(afl_state_t *afl) {
+
+  u32 cnt[MAX_AUTO_EXTRA + 1] = {0}, i, sum = 0;
+  u32 use = MIN((u32)USE_AUTO_EXTRAS, afl->a_extras_cnt);
+
+  if (!afl->a_extras_by_len_dirty) { return afl->a_extras_by_len; }
+
+  /* counting sort, stable and O(n) */
+
+  for (i = 0; i < use; ++i) {
+
+    ++cnt[afl->a_extras[i].len];
+
+  }
+
+  for (i = 0; i <= MAX_AUTO_EXTRA; ++i) {
+
+    u32 c = cnt[i];
+    cnt[i] = sum;
+    sum += c;
+
+  }
+
+  for (i = 0; i < use; ++i) {
+
+    afl->a_extras_by_len[cnt[afl->a_extras[i].len]++] = i;
+
+  }
+
+  afl->a_extras_by_len_dirty = 0;
+  return afl->a_extras_by_len;
+
+}
+
+/* Token prefix automaton (Aho-Corasick) over the user and the used auto
+   extras. Node 0 is the root, its children are also in extras_ac_root[] so
+   the common case of a mismatch at the root is a single lookup. */
+
+static inline u32 extras_ac_child(afl_state_t *afl, u32 node, u8 byte) {
+
+  u32 n;
+
+  if (!node) { return afl->extras_ac_root[byte]; }
+
+  for (n = afl->extras_ac[node].child; n; n = afl->extras_ac[n].sibling) {
+
+    if (afl->extras_ac[n].byte == byte) { return n; }
+
+  }
+
+  return 0;
+
+}
+
+static void extras_ac_add(afl_state_t *afl, u8 *mem, u32 len) {
+
+  u32 i, node = 0, depth = MIN(len, (u32)EXTRAS_POS_MAX_DEPTH);
+
+  for (i = 0; i < depth; ++i) {
+
+    u32 next = extras_ac_child(afl, node, mem[i]);
+
+    if (!next) {
+
+      next = afl->extras_ac_cnt++;
+      afl->extras_ac =
+          afl_realloc((void **)&afl->extras_ac,
+                      afl->extras_ac_cnt * sizeof(struct extras_ac_node));
+      if (unlikely(!afl->extras_ac)) { PFATAL("alloc"); }
+
+      memset(&afl->extras_ac[next], 0, sizeof(struct extras_ac_node));
+      afl->extras_ac[next].byte = mem[i];
+      afl->extras_ac[next].depth = i + 1;
+      afl->extras_ac[next].sibling = afl->extras_ac[node].child;
+      afl->extras_ac[node].child = next;
+      if (!node) { afl->extras_ac_root[mem[i]] = next; }
+
+    }
+
+    node = next;
+
+  }
+
+  if (len <= EXTRAS_POS_MAX_DEPTH) { afl->extras_ac[node].token = 1; }
+
+}
+
+static void extras_ac_build(afl_state_t *afl) {
+
+  u32 i, head = 0, tail = 0, *queue;
+  u32 use = MIN((u32)USE_AUTO_EXTRAS, afl->a_extras_cnt);
+
+  afl->extras_ac_cnt = 1;
+  afl->extras_ac =
+      afl_realloc((void **)&afl->extras_ac, sizeof(struct extras_ac_node));
+  if (unlikely(!afl->extras_ac)) { PFATAL("alloc"); }
+  memset(afl->extras_ac, 0, sizeof(struct extras_ac_node));
+  memset(afl->extras_ac_root, 0, sizeof(afl->extras_ac_root));
+
+  for (i = 0; i < afl->extras_cnt; ++i) {
+
+    extras_ac_add(afl, afl->extras[i].data, afl->extras[i].len);
+
+  }
+
+  for (i = 0; i < use; ++i) {
+
+    extras_ac_add(afl, afl->a_extras[i].data, afl->a_extras[i].len);
+
+  }
+
+  /* Failure links, breadth first so the link targets are already done. */
+
+  queue = ck_alloc(afl->extras_ac_cnt * sizeof(u32));
+  queue[tail++] = 0;
+
+  while (head < tail) {
+
+    u32 node = queue[head++], child;
+
+    for (child = afl->extras_ac[node].child; child;
+         child = afl->extras_ac[child].sibling) {
+
+      struct extras_ac_node *c = &afl->extras_ac[child];
+      u32                    fail = 0;
+
+      if (node) {
+
+        u32 f = afl->extras_ac[node].fail;
+
+        while (f && !extras_ac_child(afl, f, c->byte)) {
+
+          f = afl->extras_ac[f].fail;
+
+        }
+
+        fail = extras_ac_child(afl, f, c->byte);
+
+      }
+
+      c->fail = fail;
+      c->suffix_token = c->token || afl->extras_ac[fail].suffix_token;
+      queue[tail++] = child;
+
+    }
+
+  }
+
+  ck_free(queue);
+  afl->extras_ac_dirty = 0;
+
+}
+
+/* Mark the offsets of buf where a dictionary token, or a prefix of at least
+   EXTRAS_POS_MIN_PREFIX bytes of one, starts (EXTRAS_POS_START) and where a
+   token ends (EXTRAS_POS_END). One pass over the input. Returns NULL if there
+   is nothing to target so the caller uses all offsets. */
+
+u8 *extras_positions(afl_state_t *afl, u8 *buf, u32 len) {
+
+  u32 i, node = 0, found = 0;
+  u8 *pos;
+
+  if (!afl->extras_cnt && !afl->a_extras_cnt) { return NULL; }
+  if (afl->extras_ac_dirty || !afl->extras_ac_cnt) { extras_ac_build(afl); }
+
+  pos = afl_realloc(AFL_BUF_PARAM(extras_pos), len + 1);
+  if (unlikely(!pos)) { PFATAL("alloc"); }
+  memset(pos, 0, len + 1);
+
+  for (i = 0; i < len; ++i) {
+
+    u32 next, n;
+
+    while (!(next = extras_ac_child(afl, node, buf[i])) && node) {
+
+      node = afl->extras_ac[node].fail;
+
+    }
+
+    node = next;
+    if (!afl->extras_ac[node].suffix_token &&
+        afl->extras_ac[node].depth < EXTRAS_POS_MIN_PREFIX) {
+
+      continue;
+
+    }
+
+    if (afl->extras_ac[node].suffix_token) { pos[i + 1] |= EXTRAS_POS_END; }
+
+    for (n = node; n; n = afl->extras_ac[n].fail) {
+
+      if (afl->extras_ac[n].token ||
+          afl->extras_ac[n].depth >= EXTRAS_POS_MIN_PREFIX) {
+
+        pos[i + 1 - afl->extras_ac[n].depth] |= EXTRAS_POS_START;
+
+      }
+
+    }
+
+    found = 1;
+
+  }
+
+  return found ? pos : NULL;
+
+}
+
 /* add an extra/dict/token - no checks performed, no sorting */
 
 static void add_extra_nocheck(afl_state_t *afl, u8 *mem, u32 len) {
@@ -414,6 +901,8 @@ static void add_extra_nocheck(afl_state_t *afl, u8 *mem, u32 len) {
   afl->extras[afl->extras_cnt].len = len;
   memcpy(afl->extras[afl->extras_cnt].data, mem, len);
   afl->extras_cnt++;
+  afl->extras_index_dirty = 1;
+  afl->extras_ac_dirty = 1;
 
   /* We only want to print this once */
 
@@ -522,6 +1011,8 @@ void deunicode_extras(afl_state_t *afl) {
 
   qsort(afl->extras, afl->extras_cnt, sizeof(struct extra_data),
         compare_extras_len);
+  afl->extras_index_dirty = 1;
+  afl->extras_ac_dirty = 1;
 
 }
 
@@ -560,32 +1051,46 @@ void dedup_extras(afl_state_t *afl) {
 
   }
 
-  if (afl->extras_cnt != orig_cnt)
+  if (afl->extras_cnt != orig_cnt) {
+
     afl->extras = afl_realloc_exact(
         (void **)&afl->extras, afl->extras_cnt * sizeof(struct extra_data));
+    afl->extras_index_dirty = 1;
+    afl->extras_ac_dirty = 1;
+
+  }
 
 }
 
 /* Adds a new extra / dict entry. */
 void add_extra(afl_state_t *afl, u8 *mem, u32 len) {
 
-  u32 i, found = 0;
+  u32 i, lo = 0, hi = afl->extras_cnt;
+
+  /* extras[] is sorted by size, find the first one with this size */
+
+  while (lo < hi) {
 
-  for (i = 0; i < afl->extras_cnt; i++) {
+    u32 mid = lo + ((hi - lo) >> 1);
 
-    if (afl->extras[i].len == len) {
+    if (afl->extras[mid].len < len) {
 
-      if (memcmp(afl->extras[i].data, mem, len) == 0) return;
-      found = 1;
+      lo = mid + 1;
 
     } else {
 
-      if (found) break;
+      hi = mid;
 
     }
 
   }
 
+  for (i = lo; i < afl->extras_cnt && afl->extras[i].len == len; i++) {
+
+    if (memcmp(afl->extras[i].data, mem, len) == 0) return;
+
+  }
+
   if (len > MAX_DICT_FILE) {
 
     u8 val_bufs[2][STRINGIFY_VAL_SIZE_MAX];
@@ -602,8 +1107,17 @@ void add_extra(afl_state_t *afl, u8 *mem, u32 len) {
 
   add_extra_nocheck(afl, mem, len);
 
-  qsort(afl->extras, afl->extras_cnt, sizeof(struct extra_data),
-        compare_extras_len);
+  /* keep the size order by moving it behind the other extras of this size
+     instead of sorting everything again */
+
+  if (i + 1 < afl->extras_cnt) {
+
+    struct extra_data tmp = afl->extras[afl->extras_cnt - 1];
+    memmove(&afl->extras[i + 1], &afl->extras[i],
+            (afl->extras_cnt - 1 - i) * sizeof(struct extra_data));
+    afl->extras[i] = tmp;
+
+  }
 
 }
 
@@ -664,35 +1178,27 @@ void maybe_add_auto(afl_state_t *afl, u8 *mem, u32 len) {
   }
 
   /* Reject anything that matches existing extras. Do a case-insensitive
-     match. We optimize by exploiting the fact that extras[] are sorted
-     by size. */
-
-  for (i = 0; i < afl->extras_cnt; ++i) {
-
-    if (afl->extras[i].len >= len) { break; }
-
-  }
+     match, both extras[] and a_extras[] have a hash index for this. */
 
-  for (; i < afl->extras_cnt && afl->extras[i].len == len; ++i) {
-
-    if (!memcmp_nocase(afl->extras[i].data, mem, len)) { return; }
-
-  }
-
-  /* Last but not least, check afl->a_extras[] for matches. There are no
-     guarantees of a particular sort order. */
+  if (find_extra_nocase(afl, mem, len)) { return; }
 
   afl->auto_changed = 1;
+  afl->a_extras_by_len_dirty = 1;
+  afl->extras_ac_dirty = 1;
 
-  for (i = 0; i < afl->a_extras_cnt; ++i) {
+  /* Last but not least, check afl->a_extras[] for matches. It is sorted by
+     hit_cnt, so a hit just moves the entry in front of all entries that had
+     the same count. */
 
-    if (afl->a_extras[i].len == len &&
-        !memcmp_nocase(afl->a_extras[i].data, mem, len)) {
+  s32 found = a_extras_find(afl, mem, len);
 
-      afl->a_extras[i].hit_cnt++;
-      goto sort_a_extras;
+  if (found >= 0) {
 
-    }
+    u32 hit_cnt = ++afl->a_extras[found].hit_cnt;
+    a_extras_weight_add(afl, found,
+                        a_extras_weight(hit_cnt) - a_extras_weight(hit_cnt - 1));
+    a_extras_swap(afl, found, a_extras_first_below(afl, 0, found, hit_cnt));
+    return;
 
   }
 
@@ -704,29 +1210,37 @@ void maybe_add_auto(afl_state_t *afl, u8 *mem, u32 len) {
 
     memcpy(afl->a_extras[afl->a_extras_cnt].data, mem, len);
     afl->a_extras[afl->a_extras_cnt].len = len;
+    afl->a_extras[afl->a_extras_cnt].hit_cnt = 0;
+    a_extras_index_add(afl, afl->a_extras_cnt);
+    a_extras_weight_add(afl, afl->a_extras_cnt, a_extras_weight(0));
     ++afl->a_extras_cnt;
 
   } else {
 
     i = MAX_AUTO_EXTRAS / 2 + rand_below(afl, (MAX_AUTO_EXTRAS + 1) / 2);
 
+    a_extras_index_del(afl, i);
+    a_extras_weight_add(afl, i,
+                        a_extras_weight(0) -
+                            a_extras_weight(afl->a_extras[i].hit_cnt));
     memcpy(afl->a_extras[i].data, mem, len);
     afl->a_extras[i].len = len;
     afl->a_extras[i].hit_cnt = 0;
+    a_extras_index_add(afl, i);
 
-  }
-
-sort_a_extras:
+    /* Move it behind all entries that still have hits. */
 
-  /* First, sort all auto extras by use count, descending order. */
+    while (i + 1 < afl->a_extras_cnt && afl->a_extras[i + 1].hit_cnt) {
 
-  qsort(afl->a_extras, afl->a_extras_cnt, sizeof(struct auto_extra_data),
-        compare_auto_extras_use_d);
+      u32 last = a_extras_first_below(afl, i + 1, afl->a_extras_cnt,
+                                       afl->a_extras[i + 1].hit_cnt) -
+                 1;
+      a_extras_swap(afl, i, last);
+      i = last;
 
-  /* Then, sort the top USE_AUTO_EXTRAS entries by size. */
+    }
 
-  qsort(afl->a_extras, MIN((u32)USE_AUTO_EXTRAS, afl->a_extras_cnt),
-        sizeof(struct auto_extra_data), compare_auto_extras_len);
+  }
 
 }
 
@@ -823,6 +1337,8 @@ void destroy_extras(afl_state_t *afl) {
   }
 
   afl_free(afl->extras);
+  afl_free(afl->extras_index);
+  afl_free(afl->extras_ac);
 
 }
 
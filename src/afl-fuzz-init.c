@@ -2705,6 +2705,29 @@ void setup_testcase_shmem(afl_state_t *afl) {
 
 }
 
+/* Setup the shared word a crashing target publishes its stack hash in, for
+   AFL_CRASH_BUCKET_LIMIT */
+
+void setup_crash_shmem(afl_state_t *afl) {
+
+  afl->shm_crash = ck_alloc(sizeof(sharedmem_t));
+
+  // we need to set the non-instrumented mode to not overwrite the SHM_ENV_VAR
+  u8 *map = afl_shm_init(afl->shm_crash, sizeof(u64), 1);
+
+  if (!map) { FATAL("BUG: Zero return from afl_shm_init."); }
+
+#ifdef USEMMAP
+  setenv(SHM_CRASH_ENV_VAR, afl->shm_crash->g_shm_file_path, 1);
+#else
+  u8 *shm_str = alloc_printf("%d", afl->shm_crash->shm_id);
+  setenv(SHM_CRASH_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
+#endif
+  afl->fsrv.crash_hash = (u64 *)map;
+
+}
+
 /* Do a PATH search and find target binary to see that it exists and
    isn't a shell script - a common and painful mistake. We also check for
    a valid ELF header and for evidence of AFL instrumentation. */
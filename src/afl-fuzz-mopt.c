@@ -0,0 +1,424 @@
+/*
+   american fuzzy lop++ - MOpt operator statistics and swarm updates
+   -----------------------------------------------------------------
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                     Dominik Maier <mail@dmnk.co>,
+                     Andrea Fioraldi <andreafioraldi@gmail.com> and
+                     Heiko Eissfeldt <heiko.eissfeldt@hexco.de>
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     https://www.apache.org/licenses/LICENSE-2.0
+
+   The bookkeeping of MOpt (-L): every pilot swarm and the core module have
+   one struct mopt_op_stats, the havoc loop only bumps the cycle counter of
+   the operators it applies and credits finds through a bitmask of them.
+   Everything else - the efficiency per period, the choice of the best
+   swarm and the particle swarm update - runs once per period here.
+
+   With AFL_MOPT_SHARE, the operator finds are also published in a file in
+   the sync directory, so that the global best of the swarm update pools the
+   finds of all local instances. Every instance holds an fcntl() lock on its
+   slot, the kernel drops it when the instance dies, so a slot is live
+   exactly while it is locked - no matter which PID namespace its owner
+   runs in.
+
+ */
+
+#include "afl-fuzz.h"
+#include <sys/mman.h>
+
+#define MOPT_SHARE_MAGIC 0x4d4f5074
+#define MOPT_SHARE_SLOTS 64
+
+/* One slot per instance, written by its owner only. seq is odd while the
+   owner updates finds[], readers retry then. pid is informational. */
+
+struct mopt_share {
+
+  u32 magic;
+
+  struct {
+
+    s32 pid;
+    u32 seq;
+    u64 finds[operator_num];
+
+  } slot[MOPT_SHARE_SLOTS];
+
+};
+
+/* One particle swarm optimization step for a swarm: move the operator
+   probabilities towards the best of the swarm and the global best. */
+
+static void mopt_pso_step(afl_state_t *afl, struct mopt_swarm *s) {
+
+  double x_temp = 0.0;
+  u32    i;
+
+  for (i = 0; i < operator_num; ++i) {
+
+    s->probability_now[i] = 0.0;
+    s->v_now[i] = afl->w_now * s->v_now[i] +
+                  RAND_C * (s->L_best[i] - s->x_now[i]) +
+                  RAND_C * (afl->G_best[i] - s->x_now[i]);
+    s->x_now[i] += s->v_now[i];
+
+    if (s->x_now[i] > v_max) {
+
+      s->x_now[i] = v_max;
+
+    } else if (s->x_now[i] < v_min) {
+
+      s->x_now[i] = v_min;
+
+    }
+
+    x_temp += s->x_now[i];
+
+  }
+
+  for (i = 0; i < operator_num; ++i) {
+
+    s->x_now[i] = s->x_now[i] / x_temp;
+    s->probability_now[i] =
+        (likely(i != 0) ? s->probability_now[i - 1] : 0.0) + s->x_now[i];
+
+  }
+
+  if (s->probability_now[operator_num - 1] < 0.99 ||
+      s->probability_now[operator_num - 1] > 1.01) {
+
+    FATAL("ERROR probability");
+
+  }
+
+}
+
+/* Called for -L: random start positions for all swarms. */
+
+void mopt_init(afl_state_t *afl) {
+
+  u32 i, j;
+
+  afl->swarm_now = 0;
+  if (afl->limit_time_puppet == 0) { afl->key_puppet = 1; }
+
+  if (afl->g_now > afl->g_max) { afl->g_now = 0; }
+  afl->w_now = (afl->w_init - afl->w_end) * (afl->g_max - afl->g_now) /
+                   (afl->g_max) +
+               afl->w_end;
+
+  for (i = 0; i < swarm_num; ++i) {
+
+    struct mopt_swarm *s = &afl->mopt_swarm[i];
+    double             total_puppet_temp = 0.0;
+
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->fitness = 0.0;
+
+    for (j = 0; j < operator_num; ++j) {
+
+      s->x_now[j] = ((double)(random() % 7000) * 0.0001 + 0.1);
+      total_puppet_temp += s->x_now[j];
+      s->v_now[j] = 0.1;
+      s->L_best[j] = 0.5;
+      s->eff_best[j] = 0.0;
+      afl->G_best[j] = 0.5;
+
+    }
+
+    for (j = 0; j < operator_num; ++j) {
+
+      s->x_now[j] = s->x_now[j] / total_puppet_temp;
+
+    }
+
+    mopt_pso_step(afl, s);
+
+  }
+
+  memset(&afl->mopt_core, 0, sizeof(afl->mopt_core));
+  afl->mopt_globals_pilot.stats = &afl->mopt_swarm[0].stats;
+
+}
+
+/* End of a pilot or core period: rate the operators (and in pilot mode the
+   swarm), then switch to the next swarm or to the swarm update. */
+
+void mopt_period_done(afl_state_t *afl, MOpt_globals_t *g) {
+
+  struct mopt_op_stats *st = g->stats;
+  u32                   i;
+
+  afl->total_pacemaker_time += *g->pTime;
+  *g->pTime = 0;
+
+  if (g->is_pilot_mode) {
+
+    struct mopt_swarm *s = &afl->mopt_swarm[afl->swarm_now];
+
+    s->fitness = (double)(afl->total_puppet_find - afl->temp_puppet_find) /
+                 ((double)(afl->tmp_pilot_time) / afl->period_pilot_tmp);
+
+    for (i = 0; i < operator_num; ++i) {
+
+      double temp_eff = 0.0;
+
+      if (st->cycles_v2[i] > st->cycles[i]) {
+
+        temp_eff = (double)(st->finds_v2[i] - st->finds[i]) /
+                   (double)(st->cycles_v2[i] - st->cycles[i]);
+
+      }
+
+      if (s->eff_best[i] < temp_eff) {
+
+        s->eff_best[i] = temp_eff;
+        s->L_best[i] = s->x_now[i];
+
+      }
+
+    }
+
+  }
+
+  afl->temp_puppet_find = afl->total_puppet_find;
+
+  memcpy(st->finds, st->finds_v2, sizeof(st->finds));
+  memcpy(st->cycles, st->cycles_v2, sizeof(st->cycles));
+
+  if (g->is_pilot_mode) {
+
+    if (++afl->swarm_now == swarm_num) {
+
+      double swarm_eff = 0.0;
+
+      /* the core module starts from the stats of its last period */
+      memcpy(afl->mopt_core.cycles_v2, afl->mopt_core.cycles,
+             sizeof(afl->mopt_core.cycles));
+      memcpy(afl->mopt_core.finds_v2, afl->mopt_core.finds,
+             sizeof(afl->mopt_core.finds));
+
+      afl->key_module = 1;
+      afl->swarm_now = 0;
+
+      for (i = 0; i < swarm_num; ++i) {
+
+        if (afl->mopt_swarm[i].fitness > swarm_eff) {
+
+          swarm_eff = afl->mopt_swarm[i].fitness;
+          afl->swarm_now = i;
+
+        }
+
+      }
+
+    }
+
+    afl->mopt_globals_pilot.stats = &afl->mopt_swarm[afl->swarm_now].stats;
+
+  } else {
+
+    afl->key_module = 2;
+    afl->old_hit_count = afl->queued_items + afl->saved_crashes;
+
+  }
+
+}
+
+/* Lock (F_WRLCK), unlock or test (F_GETLK, returns 1 if locked by another
+   process) slot i of the share file */
+
+static s32 mopt_share_lock(afl_state_t *afl, u32 i, s32 cmd, s16 type) {
+
+  struct flock fl = {.l_type = type,
+                     .l_whence = SEEK_SET,
+                     .l_start = offsetof(struct mopt_share, slot[i]),
+                     .l_len = sizeof(afl->mopt_share->slot[i])};
+
+  if (fcntl(afl->mopt_share_fd, cmd, &fl)) { return -1; }
+  return cmd == F_GETLK ? fl.l_type != F_UNLCK : 0;
+
+}
+
+/* Map the shared operator stats of the sync directory and claim a slot in
+   it, either a free one or one of an instance that is gone. */
+
+void mopt_share_setup(afl_state_t *afl) {
+
+  u8  *fn = alloc_printf("%s/.mopt_share", afl->sync_dir);
+  s32  fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, DEFAULT_PERMISSION);
+  s32  pid = getpid();
+  u32  i;
+
+  if (fd < 0) { PFATAL("Unable to create '%s'", fn); }
+
+  if (ftruncate(fd, sizeof(struct mopt_share))) {
+
+    PFATAL("Unable to resize '%s'", fn);
+
+  }
+
+  afl->mopt_share = mmap(NULL, sizeof(struct mopt_share),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (afl->mopt_share == MAP_FAILED) { PFATAL("mmap() of '%s' failed", fn); }
+
+  /* stays open, closing it would drop the slot lock */
+  afl->mopt_share_fd = fd;
+
+  /* a new file is all zero, no other instance can have used it yet */
+  u32 magic = 0;
+  __atomic_compare_exchange_n(&afl->mopt_share->magic, &magic,
+                              MOPT_SHARE_MAGIC, 0, __ATOMIC_ACQ_REL,
+                              __ATOMIC_ACQUIRE);
+  if (magic && magic != MOPT_SHARE_MAGIC) {
+
+    FATAL("'%s' is not a MOpt share file", fn);
+
+  }
+
+  for (i = 0; i < MOPT_SHARE_SLOTS; ++i) {
+
+    if (!mopt_share_lock(afl, i, F_SETLK, F_WRLCK)) { break; }
+
+  }
+
+  if (i == MOPT_SHARE_SLOTS) {
+
+    WARNF("All %u slots in '%s' are taken, MOpt stats are not shared.",
+          MOPT_SHARE_SLOTS, fn);
+    munmap(afl->mopt_share, sizeof(struct mopt_share));
+    afl->mopt_share = NULL;
+    close(fd);
+
+  } else {
+
+    /* the finds of a previous owner must not be counted until we publish
+       ours, and if it died while publishing it left an odd seq behind */
+    u32 seq = __atomic_load_n(&afl->mopt_share->slot[i].seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&afl->mopt_share->slot[i].seq, seq | 1, __ATOMIC_RELEASE);
+    memset(afl->mopt_share->slot[i].finds, 0,
+           sizeof(afl->mopt_share->slot[i].finds));
+    __atomic_store_n(&afl->mopt_share->slot[i].pid, pid, __ATOMIC_RELEASE);
+    __atomic_store_n(&afl->mopt_share->slot[i].seq, (seq | 1) + 1,
+                     __ATOMIC_RELEASE);
+
+    afl->mopt_share_slot = i;
+    OKF("MOpt operator stats are shared in '%s' (slot %u).", fn, i);
+
+  }
+
+  ck_free(fn);
+
+}
+
+void mopt_share_destroy(afl_state_t *afl) {
+
+  if (!afl->mopt_share) { return; }
+
+  __atomic_store_n(&afl->mopt_share->slot[afl->mopt_share_slot].pid, 0,
+                   __ATOMIC_RELEASE);
+  munmap(afl->mopt_share, sizeof(struct mopt_share));
+  afl->mopt_share = NULL;
+  close(afl->mopt_share_fd);                     /* releases the slot lock */
+
+}
+
+/* Publish our operator finds, then add those of the other live instances.
+   A slot nobody holds the lock of belongs to an instance that is gone. */
+
+static void mopt_share_pool(afl_state_t *afl, u64 *finds) {
+
+  struct mopt_share *sh = afl->mopt_share;
+  u64                tmp[operator_num];
+  u32                i, j, seq;
+
+  __atomic_add_fetch(&sh->slot[afl->mopt_share_slot].seq, 1, __ATOMIC_ACQ_REL);
+  memcpy(sh->slot[afl->mopt_share_slot].finds, finds, sizeof(tmp));
+  __atomic_add_fetch(&sh->slot[afl->mopt_share_slot].seq, 1, __ATOMIC_ACQ_REL);
+
+  for (i = 0; i < MOPT_SHARE_SLOTS; ++i) {
+
+    if (i == afl->mopt_share_slot ||
+        mopt_share_lock(afl, i, F_GETLK, F_WRLCK) != 1) {
+
+      continue;
+
+    }
+
+    do {
+
+      seq = __atomic_load_n(&sh->slot[i].seq, __ATOMIC_ACQUIRE);
+      memcpy(tmp, sh->slot[i].finds, sizeof(tmp));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    } while ((seq & 1) ||
+             seq != __atomic_load_n(&sh->slot[i].seq, __ATOMIC_ACQUIRE));
+
+    for (j = 0; j < operator_num; ++j) {
+
+      finds[j] += tmp[j];
+
+    }
+
+  }
+
+}
+
+/* The swarm update between two rounds of pilot periods: the global best is
+   the share of the finds of each operator, over all swarms and core. */
+
+void pso_updating(afl_state_t *afl) {
+
+  u64 finds[operator_num], total = 0;
+  u32 i, j;
+
+  afl->g_now++;
+  if (afl->g_now > afl->g_max) { afl->g_now = 0; }
+  afl->w_now =
+      (afl->w_init - afl->w_end) * (afl->g_max - afl->g_now) / (afl->g_max) +
+      afl->w_end;
+
+  memcpy(finds, afl->mopt_core.finds, sizeof(finds));
+
+  for (j = 0; j < swarm_num; ++j) {
+
+    for (i = 0; i < operator_num; ++i) {
+
+      finds[i] += afl->mopt_swarm[j].stats.finds[i];
+
+    }
+
+  }
+
+  if (afl->mopt_share) { mopt_share_pool(afl, finds); }
+
+  for (i = 0; i < operator_num; ++i) {
+
+    total += finds[i];
+
+  }
+
+  for (i = 0; i < operator_num; ++i) {
+
+    if (finds[i]) { afl->G_best[i] = (double)finds[i] / (double)total; }
+
+  }
+
+  for (j = 0; j < swarm_num; ++j) {
+
+    mopt_pso_step(afl, &afl->mopt_swarm[j]);
+
+  }
+
+  afl->swarm_now = 0;
+  afl->mopt_globals_pilot.stats = &afl->mopt_swarm[0].stats;
+  afl->key_module = 0;
+
+}
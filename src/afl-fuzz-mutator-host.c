@@ -0,0 +1,1017 @@
+/*
+   american fuzzy lop++ - out-of-process custom mutator host
+   ---------------------------------------------------------
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     https://www.apache.org/licenses/LICENSE-2.0
+
+   With AFL_CUSTOM_MUTATOR_ISOLATE set, each custom mutator library is not
+   loaded into afl-fuzz but into a forked host process. afl-fuzz and the host
+   share one anonymous memory mapping that holds the input, the splice input,
+   CUSTOM_MUTATOR_BATCH output slots and the queue updates, the two pipes
+   only carry a 32 bit command and its 32 bit answer. For a mutator with
+   afl_custom_fuzz_batch() the output slots are handed to fuzz_one() as the
+   batch buffers, so a whole batch of mutants costs one round-trip and no
+   copy; afl_custom_fuzz() gets one round-trip per mutant, so that describe
+   and queue_new_entry refer to the mutant that was just run.
+
+   The afl_state_t of the host is a copy taken when it was forked. Before
+   each call the current queue entry, the queue counters and the entries
+   added since are forwarded, so that mutators reading afl->queue_cur,
+   afl->queue_buf or queue_testcase_get() see the live queue. If the host
+   crashes or hangs it is restarted, the call that failed just produces no
+   mutants.
+
+ */
+
+#include "afl-fuzz.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+  #include <sys/prctl.h>
+  #include <sys/syscall.h>
+#endif
+
+/* Commands sent to the host */
+
+enum {
+
+  /* 00 */ HOST_CMD_FUZZ_BATCH,
+  /* 01 */ HOST_CMD_FUZZ_COUNT,
+  /* 02 */ HOST_CMD_QUEUE_GET,
+  /* 03 */ HOST_CMD_QUEUE_NEW_ENTRY,
+  /* 04 */ HOST_CMD_DESCRIBE,
+  /* 05 */ HOST_CMD_DEINIT,
+  /* 06 */ HOST_CMD_QUEUE_SYNC,
+  /* 07 */ HOST_CMD_POST_PROCESS,
+  /* 08 */ HOST_CMD_INIT_TRIM,
+  /* 09 */ HOST_CMD_TRIM,
+  /* 10 */ HOST_CMD_POST_TRIM
+
+};
+
+/* Symbols found in the library, reported by the host after loading it */
+
+#define HOST_SYM_FUZZ (1 << 0)
+#define HOST_SYM_FUZZ_BATCH (1 << 1)
+#define HOST_SYM_FUZZ_COUNT (1 << 2)
+#define HOST_SYM_QUEUE_GET (1 << 3)
+#define HOST_SYM_QUEUE_NEW_ENTRY (1 << 4)
+#define HOST_SYM_DESCRIBE (1 << 5)
+#define HOST_SYM_SPLICE_OPTOUT (1 << 6)
+#define HOST_SYM_POST_PROCESS (1 << 7)
+#define HOST_SYM_TRIM (1 << 8)
+#define HOST_SYM_UNSUPPORTED (1 << 9)
+
+/* The queue entry fields a mutator may read, followed in the sync area by
+   fname_len bytes of file name */
+
+struct mutator_host_entry {
+
+  u32    id;                            /* Entry number in queue_buf        */
+  u32    len;                           /* Input length                     */
+  double perf_score;                    /* Performance score                */
+  u8     favored, is_ascii;             /* Flags of the entry               */
+  u16    fname_len;                     /* Length of the name incl. NUL     */
+
+};
+
+#define HOST_ENTRY_SIZE(l) \
+  ((sizeof(struct mutator_host_entry) + (l) + 7) & ~(size_t)7)
+
+/* Header of the shared mapping, followed by the in, add, out and sync
+   areas */
+
+struct mutator_host_shm {
+
+  u64 buf_size;                         /* Size of the input in "in"        */
+  u64 add_size;                         /* Size of the splice input         */
+  u64 max_size;                         /* Maximum size of a mutant         */
+  u64 out_sizes[CUSTOM_MUTATOR_BATCH];  /* Sizes of the produced mutants    */
+  u32 batch_size;                       /* Number of mutants wanted         */
+  u32 ret;                              /* Return value of the call         */
+  u32 syms;                             /* HOST_SYM_* of the library        */
+  u32 seed;                             /* Seed for afl_custom_init         */
+  char error[64];                       /* Load error or unsupported symbol */
+
+  struct mutator_host_entry cur;        /* queue_cur, id ~0 if none         */
+  u32 queued_items, active_items;       /* Queue counters of afl-fuzz       */
+  u32 havoc_div;                        /* Havoc cycle divisor              */
+  u32 sync_cnt;                         /* Entries in the sync area         */
+
+};
+
+struct mutator_host {
+
+  afl_state_t             *afl;
+  const char              *fn;          /* Library path                     */
+  pid_t                    pid;         /* Host pid, -1 if not running      */
+  s32                      ctl_fd;      /* Command pipe (write end)         */
+  s32                      st_fd;       /* Answer pipe (read end)           */
+  struct mutator_host_shm *shm;
+  u8                      *in, *add, *out, *sync;
+  size_t                   map_size;
+  u32                      restarts;    /* Number of host crashes/hangs     */
+  u32                      synced;      /* Queue entries the host knows     */
+  u8                      *desc_buf;    /* Copy of the last description     */
+  u8                      *trim_buf;    /* Copy of the last trimmed input   */
+  u32                      trim_steps;  /* Return value of init_trim        */
+  u32                      trim_restarts; /* restarts at init_trim      */
+
+};
+
+#define HOST_SLOT(h, i) ((h)->out + (size_t)(i)*MAX_FILE)
+
+/* In the host: add the queue entries afl-fuzz found since the last sync to
+   the copy of the queue, entries it already has are updated */
+
+static void host_queue_sync(struct mutator_host *h) {
+
+  afl_state_t *afl = h->afl;
+  u8          *rec = h->sync;
+  u32          i;
+
+  for (i = 0; i < h->shm->sync_cnt; ++i) {
+
+    struct mutator_host_entry *e = (struct mutator_host_entry *)rec;
+    struct queue_entry        *q;
+
+    if (e->id < afl->queued_items) {
+
+      q = afl->queue_buf[e->id];
+
+    } else if (e->id == afl->queued_items) {
+
+      q = ck_alloc(sizeof(struct queue_entry));
+      q->fname = (u8 *)ck_strdup((char *)(e + 1));
+      q->id = e->id;
+
+      if (unlikely(!afl_realloc((void **)&afl->queue_buf,
+                                (afl->queued_items + 1) *
+                                    sizeof(struct queue_entry *)))) {
+
+        _exit(1);
+
+      }
+
+      afl->queue_buf[afl->queued_items++] = q;
+
+    } else {
+
+      _exit(1);
+
+    }
+
+    q->len = e->len;
+    q->perf_score = e->perf_score;
+    q->favored = e->favored;
+    q->is_ascii = e->is_ascii;
+
+    rec += HOST_ENTRY_SIZE(e->fname_len);
+
+  }
+
+}
+
+/* In the host: take over queue_cur and the counters of afl-fuzz */
+
+static void host_set_state(struct mutator_host *h) {
+
+  afl_state_t               *afl = h->afl;
+  struct mutator_host_shm   *shm = h->shm;
+  struct mutator_host_entry *e = &shm->cur;
+
+  afl->active_items = shm->active_items;
+  afl->havoc_div = shm->havoc_div;
+
+  if (e->id < afl->queued_items) {
+
+    struct queue_entry *q = afl->queue_buf[e->id];
+
+    q->len = e->len;
+    q->perf_score = e->perf_score;
+    q->favored = e->favored;
+    q->is_ascii = e->is_ascii;
+
+    afl->queue_cur = q;
+    afl->current_entry = e->id;
+
+  } else {
+
+    afl->queue_cur = NULL;
+
+  }
+
+}
+
+/* Closes [from, to], with close_range() if the kernel has it */
+
+static void host_close_fds(s32 from, s32 to) {
+
+#ifdef SYS_close_range
+  if (!syscall(SYS_close_range, from, to, 0)) { return; }
+#endif
+
+  for (s32 fd = from; fd <= to; ++fd) {
+
+    close(fd);
+
+  }
+
+}
+
+/* The host process: load the library and serve requests until told to quit
+   or afl-fuzz goes away. Never returns. */
+
+static void __attribute__((noreturn))
+host_serve(struct mutator_host *h, s32 ctl_fd, s32 st_fd) {
+
+  struct mutator_host_shm *shm = h->shm;
+  void                    *dh, *data;
+  u32                      cmd, i;
+
+  void *(*init)(afl_state_t *, unsigned int);
+  size_t (*fuzz)(void *, u8 *, size_t, u8 **, u8 *, size_t, size_t);
+  u32 (*fuzz_batch)(void *, const u8 *, size_t, u8 *, size_t, u8 **, size_t *,
+                    u32, size_t);
+  u32 (*fuzz_count)(void *, const u8 *, size_t);
+  u8 (*queue_get)(void *, const u8 *);
+  u8 (*queue_new_entry)(void *, const u8 *, const u8 *);
+  const char *(*describe)(void *, size_t);
+  size_t (*post_process)(void *, u8 *, size_t, u8 **);
+  s32 (*init_trim)(void *, u8 *, size_t);
+  size_t (*trim)(void *, u8 **);
+  s32 (*post_trim)(void *, u8);
+  void (*deinit)(void *);
+
+  static const char *unsupported[] = {
+
+      "afl_custom_havoc_mutation", "afl_custom_fuzz_send", NULL
+
+  };
+
+#if defined(__linux__)
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+  setsid();
+
+  /* Keep only stdio, our pipes and /dev/urandom for rand_below(): the
+     forkserver pipes, the output files and the pipes of the other hosts
+     belong to afl-fuzz. */
+
+  {
+
+    s32 keep[3] = {ctl_fd, st_fd, h->afl->fsrv.dev_urandom_fd}, prev = 2, t;
+    s32 max = sysconf(_SC_OPEN_MAX);
+
+    for (i = 0; i < 3; ++i) {
+
+      u32 j;
+
+      for (j = i + 1; j < 3; ++j) {
+
+        if (keep[j] < keep[i]) {
+
+          t = keep[i];
+          keep[i] = keep[j];
+          keep[j] = t;
+
+        }
+
+      }
+
+      if (keep[i] <= prev) { continue; }
+      host_close_fds(prev + 1, keep[i] - 1);
+      prev = keep[i];
+
+    }
+
+    host_close_fds(prev + 1, MAX(max, prev + 1) - 1);
+
+  }
+
+  if (!(dh = dlopen(h->fn, RTLD_NOW))) {
+
+    snprintf(shm->error, sizeof(shm->error), "%s", dlerror());
+    _exit(1);
+
+  }
+
+  init = dlsym(dh, "afl_custom_init");
+  deinit = dlsym(dh, "afl_custom_deinit");
+  fuzz = dlsym(dh, "afl_custom_fuzz");
+  if (!fuzz) { fuzz = dlsym(dh, "afl_custom_mutator"); }
+  fuzz_batch = dlsym(dh, "afl_custom_fuzz_batch");
+  fuzz_count = dlsym(dh, "afl_custom_fuzz_count");
+  queue_get = dlsym(dh, "afl_custom_queue_get");
+  queue_new_entry = dlsym(dh, "afl_custom_queue_new_entry");
+  describe = dlsym(dh, "afl_custom_describe");
+  post_process = dlsym(dh, "afl_custom_post_process");
+  init_trim = dlsym(dh, "afl_custom_init_trim");
+  trim = dlsym(dh, "afl_custom_trim");
+  post_trim = dlsym(dh, "afl_custom_post_trim");
+
+  shm->syms = (fuzz ? HOST_SYM_FUZZ : 0) |
+              (fuzz_batch ? HOST_SYM_FUZZ_BATCH : 0) |
+              (fuzz_count ? HOST_SYM_FUZZ_COUNT : 0) |
+              (queue_get ? HOST_SYM_QUEUE_GET : 0) |
+              (queue_new_entry ? HOST_SYM_QUEUE_NEW_ENTRY : 0) |
+              (describe ? HOST_SYM_DESCRIBE : 0) |
+              (dlsym(dh, "afl_custom_splice_optout") ? HOST_SYM_SPLICE_OPTOUT
+                                                      : 0) |
+              (post_process ? HOST_SYM_POST_PROCESS : 0) |
+              (init_trim && trim && post_trim ? HOST_SYM_TRIM : 0);
+
+  for (i = 0; unsupported[i]; ++i) {
+
+    if (dlsym(dh, unsupported[i])) {
+
+      shm->syms |= HOST_SYM_UNSUPPORTED;
+      snprintf(shm->error, sizeof(shm->error), "%s", unsupported[i]);
+
+    }
+
+  }
+
+  /* the testcase cache entries are those of afl-fuzz at the fork, read the
+     inputs from disk instead */
+  h->afl->q_testcase_max_cache_size = 0;
+
+  /* a fresh stream, rand_below() would replay the havoc of afl-fuzz */
+  rand_set_seed(h->afl, shm->seed);
+
+  if (!init || !deinit || !(data = init(h->afl, shm->seed))) { _exit(1); }
+
+  cmd = 0;
+  if (write(st_fd, &cmd, 4) != 4) { _exit(1); }
+
+  while (read(ctl_fd, &cmd, 4) == 4) {
+
+    host_set_state(h);
+
+    switch (cmd) {
+
+      case HOST_CMD_FUZZ_BATCH: {
+
+        u8    *out_bufs[CUSTOM_MUTATOR_BATCH];
+        size_t out_sizes[CUSTOM_MUTATOR_BATCH];
+        u8    *add = shm->add_size ? h->add : NULL;
+        u32    cnt = shm->batch_size;
+
+        for (i = 0; i < cnt; ++i) {
+
+          out_bufs[i] = HOST_SLOT(h, i);
+
+        }
+
+        if (fuzz_batch) {
+
+          cnt = fuzz_batch(data, h->in, shm->buf_size, add, shm->add_size,
+                           out_bufs, out_sizes, cnt, shm->max_size);
+
+        } else {
+
+          /* afl-fuzz asks for one mutant at a time */
+
+          for (i = 0; i < cnt; ++i) {
+
+            u8    *mutated = NULL;
+            size_t size = fuzz(data, h->in, shm->buf_size, &mutated, add,
+                               shm->add_size, shm->max_size);
+
+            if (!mutated) { break; }
+            out_sizes[i] = MIN(size, shm->max_size);
+            memcpy(out_bufs[i], mutated, out_sizes[i]);
+
+          }
+
+          cnt = i;
+
+        }
+
+        for (i = 0; i < cnt; ++i) {
+
+          shm->out_sizes[i] = out_sizes[i];
+
+        }
+
+        shm->ret = cnt;
+        break;
+
+      }
+
+      case HOST_CMD_FUZZ_COUNT:
+        shm->ret = fuzz_count(data, h->in, shm->buf_size);
+        break;
+
+      case HOST_CMD_QUEUE_GET:
+        shm->ret = queue_get(data, h->in);
+        break;
+
+      case HOST_CMD_QUEUE_NEW_ENTRY:
+        shm->ret = queue_new_entry(data, h->in, shm->add_size ? h->add : NULL);
+        break;
+
+      case HOST_CMD_DESCRIBE: {
+
+        const char *desc = describe(data, shm->max_size);
+
+        if (desc) {
+
+          snprintf((char *)h->in, shm->max_size + 1, "%s", desc);
+
+        } else {
+
+          h->in[0] = 0;
+
+        }
+
+        shm->ret = desc != NULL;
+        break;
+
+      }
+
+      case HOST_CMD_QUEUE_SYNC:
+        host_queue_sync(h);
+        host_set_state(h);
+        break;
+
+      case HOST_CMD_POST_PROCESS:
+      case HOST_CMD_TRIM: {
+
+        u8    *out = NULL;
+        size_t size;
+
+        if (cmd == HOST_CMD_POST_PROCESS) {
+
+          size = post_process(data, h->in, shm->buf_size, &out);
+
+        } else {
+
+          size = trim(data, &out);
+
+        }
+
+        shm->ret = out != NULL;
+        shm->out_sizes[0] = out ? MIN(size, (size_t)MAX_FILE) : 0;
+        if (out) { memmove(h->add, out, shm->out_sizes[0]); }
+        break;
+
+      }
+
+      case HOST_CMD_INIT_TRIM:
+        shm->ret = (u32)init_trim(data, h->in, shm->buf_size);
+        break;
+
+      case HOST_CMD_POST_TRIM:
+        shm->ret = (u32)post_trim(data, (u8)shm->batch_size);
+        break;
+
+      case HOST_CMD_DEINIT:
+        deinit(data);
+        _exit(0);
+
+    }
+
+    if (write(st_fd, &cmd, 4) != 4) { break; }
+
+  }
+
+  _exit(0);
+
+}
+
+/* Wait for the answer of the host, 0 on success */
+
+static s32 host_wait(struct mutator_host *h, u32 timeout_ms) {
+
+  struct pollfd pfd = {.fd = h->st_fd, .events = POLLIN};
+  u32           status;
+  s32           ret;
+
+  do {
+
+    ret = poll(&pfd, 1, timeout_ms);
+
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret <= 0) { return -1; }
+  if (read(h->st_fd, &status, 4) != 4) { return -1; }
+
+  return 0;
+
+}
+
+static void host_start(struct mutator_host *h) {
+
+  s32 ctl_pipe[2], st_pipe[2];
+
+  if (pipe(ctl_pipe) || pipe(st_pipe)) { PFATAL("pipe() failed"); }
+
+  h->shm->seed = rand_below(h->afl, 0xFFFFFFFF);
+  h->shm->syms = 0;
+  h->shm->cur.id = ~0U;
+  h->synced = h->afl->queued_items;     /* the host forks with these       */
+
+  h->pid = fork();
+  if (h->pid < 0) { PFATAL("fork() failed"); }
+
+  if (!h->pid) {
+
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    host_serve(h, ctl_pipe[0], st_pipe[1]);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+  h->ctl_fd = ctl_pipe[1];
+  h->st_fd = st_pipe[0];
+
+  if (host_wait(h, CUSTOM_MUTATOR_HOST_TMOUT * 10)) {
+
+    if (*h->shm->error) {
+
+      FATAL("Custom mutator host for '%s' failed: %s", h->fn,
+            h->shm->error);
+
+    }
+
+    FATAL("Custom mutator host for '%s' failed to initialize", h->fn);
+
+  }
+
+}
+
+static void host_stop(struct mutator_host *h) {
+
+  if (h->pid > 0) {
+
+    kill(h->pid, SIGKILL);
+    waitpid(h->pid, NULL, 0);
+
+  }
+
+  close(h->ctl_fd);
+  close(h->st_fd);
+  h->pid = -1;
+
+}
+
+static void host_put_entry(struct mutator_host_entry *e,
+                           struct queue_entry        *q) {
+
+  e->id = q->id;
+  e->len = q->len;
+  e->perf_score = q->perf_score;
+  e->favored = q->favored;
+  e->is_ascii = q->is_ascii;
+
+}
+
+static s32 host_call(struct mutator_host *h, u32 cmd);
+
+/* Send the queue entries added since the last call, as many per round-trip
+   as fit into the sync area */
+
+static s32 host_send_queue(struct mutator_host *h) {
+
+  afl_state_t *afl = h->afl;
+
+  while (h->synced < afl->queued_items) {
+
+    u8    *rec = h->sync;
+    size_t used = 0;
+    u32    cnt = 0;
+
+    while (h->synced + cnt < afl->queued_items) {
+
+      struct queue_entry        *q = afl->queue_buf[h->synced + cnt];
+      struct mutator_host_entry *e = (struct mutator_host_entry *)rec;
+      size_t                     fname_len = strlen((char *)q->fname) + 1;
+
+      if (used + HOST_ENTRY_SIZE(fname_len) > MAX_FILE) { break; }
+
+      host_put_entry(e, q);
+      e->fname_len = fname_len;
+      memcpy(e + 1, q->fname, fname_len);
+
+      used += HOST_ENTRY_SIZE(fname_len);
+      rec += HOST_ENTRY_SIZE(fname_len);
+      ++cnt;
+
+    }
+
+    h->shm->sync_cnt = cnt;
+    if (host_call(h, HOST_CMD_QUEUE_SYNC)) { return -1; }
+    h->synced += cnt;
+
+  }
+
+  return 0;
+
+}
+
+/* Run a command in the host. If it crashed or hangs, restart it and return
+   -1, the caller then reports that nothing was done. */
+
+static s32 host_call(struct mutator_host *h, u32 cmd) {
+
+  afl_state_t *afl = h->afl;
+
+  if (unlikely(h->synced < afl->queued_items) && cmd != HOST_CMD_QUEUE_SYNC &&
+      host_send_queue(h)) {
+
+    return -1;
+
+  }
+
+  h->shm->queued_items = afl->queued_items;
+  h->shm->active_items = afl->active_items;
+  h->shm->havoc_div = afl->havoc_div;
+
+  if (likely(afl->queue_cur)) {
+
+    host_put_entry(&h->shm->cur, afl->queue_cur);
+
+  } else {
+
+    h->shm->cur.id = ~0U;
+
+  }
+
+  if (likely(write(h->ctl_fd, &cmd, 4) == 4 &&
+             !host_wait(h, CUSTOM_MUTATOR_HOST_TMOUT))) {
+
+    return 0;
+
+  }
+
+  host_stop(h);
+
+  if (h->afl->stop_soon) { return -1; }
+
+  ++h->restarts;
+  WARNF("Custom mutator host for '%s' crashed or hung, restarting it (%u)",
+        h->fn, h->restarts);
+
+  host_start(h);
+  return -1;
+
+}
+
+static void host_set_in(struct mutator_host *h, const u8 *buf, size_t size) {
+
+  h->shm->buf_size = MIN(size, (size_t)MAX_FILE);
+  memcpy(h->in, buf, h->shm->buf_size);
+
+}
+
+/* The afl_custom_* functions afl-fuzz calls instead of the library ones */
+
+static u32 host_fuzz_batch(void *data, const u8 *buf, size_t buf_size,
+                           u8 *add_buf, size_t add_buf_size, u8 **out_bufs,
+                           size_t *out_sizes, u32 batch_size,
+                           size_t max_size) {
+
+  struct mutator_host *h = data;
+  u32                  cnt, i;
+
+  host_set_in(h, buf, buf_size);
+  h->shm->add_size = add_buf ? MIN(add_buf_size, (size_t)MAX_FILE) : 0;
+  if (h->shm->add_size) { memcpy(h->add, add_buf, h->shm->add_size); }
+  h->shm->max_size = MIN(max_size, (size_t)MAX_FILE);
+  h->shm->batch_size = MIN(batch_size, CUSTOM_MUTATOR_BATCH);
+
+  if (host_call(h, HOST_CMD_FUZZ_BATCH)) { return 0; }
+
+  cnt = MIN(h->shm->ret, h->shm->batch_size);
+
+  for (i = 0; i < cnt; ++i) {
+
+    out_sizes[i] = MIN(h->shm->out_sizes[i], h->shm->max_size);
+
+    /* fuzz_one() hands us the slots in the shared mapping, nothing to copy */
+    if (unlikely(out_bufs[i] != HOST_SLOT(h, i))) {
+
+      memcpy(out_bufs[i], HOST_SLOT(h, i), out_sizes[i]);
+
+    }
+
+  }
+
+  return cnt;
+
+}
+
+static size_t host_fuzz(void *data, u8 *buf, size_t buf_size, u8 **out_buf,
+                        u8 *add_buf, size_t add_buf_size, size_t max_size) {
+
+  struct mutator_host *h = data;
+  u8                  *slot = HOST_SLOT(h, 0);
+  size_t               size = 0;
+
+  if (!host_fuzz_batch(data, buf, buf_size, add_buf, add_buf_size, &slot,
+                       &size, 1, max_size)) {
+
+    *out_buf = NULL;
+    return 0;
+
+  }
+
+  *out_buf = slot;
+  return size;
+
+}
+
+static u32 host_fuzz_count(void *data, const u8 *buf, size_t buf_size) {
+
+  struct mutator_host *h = data;
+
+  host_set_in(h, buf, buf_size);
+  if (host_call(h, HOST_CMD_FUZZ_COUNT)) { return 0; }
+  return h->shm->ret;
+
+}
+
+static u8 host_queue_get(void *data, const u8 *filename) {
+
+  struct mutator_host *h = data;
+
+  host_set_in(h, filename, strlen((char *)filename) + 1);
+  if (host_call(h, HOST_CMD_QUEUE_GET)) { return 1; }
+  return h->shm->ret;
+
+}
+
+static u8 host_queue_new_entry(void *data, const u8 *filename_new_queue,
+                               const u8 *filename_orig_queue) {
+
+  struct mutator_host *h = data;
+
+  host_set_in(h, filename_new_queue, strlen((char *)filename_new_queue) + 1);
+  h->shm->add_size = 0;
+
+  if (filename_orig_queue) {
+
+    h->shm->add_size = strlen((char *)filename_orig_queue) + 1;
+    memcpy(h->add, filename_orig_queue, h->shm->add_size);
+
+  }
+
+  if (host_call(h, HOST_CMD_QUEUE_NEW_ENTRY)) { return 0; }
+  return h->shm->ret;
+
+}
+
+static const char *host_describe(void *data, size_t max_description_len) {
+
+  struct mutator_host *h = data;
+
+  h->shm->max_size = MIN(max_description_len, (size_t)MAX_FILE - 1);
+  if (host_call(h, HOST_CMD_DESCRIBE) || !h->shm->ret) { return NULL; }
+
+  h->desc_buf = ck_realloc(h->desc_buf, h->shm->max_size + 1);
+  memcpy(h->desc_buf, h->in, h->shm->max_size + 1);
+  h->desc_buf[h->shm->max_size] = 0;
+
+  return (const char *)h->desc_buf;
+
+}
+
+/* The result of post_process and trim is in the add area, which is free
+   again once fuzz_batch has returned */
+
+static size_t host_post_process(void *data, u8 *buf, size_t buf_size,
+                                u8 **out_buf) {
+
+  struct mutator_host *h = data;
+
+  host_set_in(h, buf, buf_size);
+
+  if (host_call(h, HOST_CMD_POST_PROCESS) || !h->shm->ret) {
+
+    *out_buf = NULL;
+    return 0;
+
+  }
+
+  *out_buf = h->add;
+  return h->shm->out_sizes[0];
+
+}
+
+/* A trim that was started before the host restarted cannot go on, trim
+   then reports empty inputs and post_trim ends it. */
+
+static s32 host_init_trim(void *data, u8 *buf, size_t buf_size) {
+
+  struct mutator_host *h = data;
+
+  host_set_in(h, buf, buf_size);
+  h->trim_restarts = h->restarts;
+  h->trim_steps = 0;
+
+  if (host_call(h, HOST_CMD_INIT_TRIM) || (s32)h->shm->ret < 0) { return 0; }
+
+  h->trim_steps = h->shm->ret;
+  return (s32)h->trim_steps;
+
+}
+
+static size_t host_trim(void *data, u8 **out_buf) {
+
+  struct mutator_host *h = data;
+  size_t               size = 0;
+
+  if (h->trim_restarts == h->restarts && !host_call(h, HOST_CMD_TRIM) &&
+      h->shm->ret) {
+
+    size = h->shm->out_sizes[0];
+
+  }
+
+  /* copied because post_process() reuses the add area before trimming
+     keeps the result */
+  h->trim_buf = ck_realloc(h->trim_buf, size + 1);
+  memcpy(h->trim_buf, h->add, size);
+
+  *out_buf = h->trim_buf;
+  return size;
+
+}
+
+static s32 host_post_trim(void *data, u8 success) {
+
+  struct mutator_host *h = data;
+
+  h->shm->batch_size = success;
+
+  if (h->trim_restarts != h->restarts || host_call(h, HOST_CMD_POST_TRIM) ||
+      (s32)h->shm->ret < 0) {
+
+    return (s32)h->trim_steps;
+
+  }
+
+  return (s32)h->shm->ret;
+
+}
+
+static void host_splice_optout(void *data) {
+
+  (void)data;
+
+}
+
+struct custom_mutator *load_custom_mutator_host(afl_state_t *afl,
+                                                const char *fn) {
+
+  struct custom_mutator *mutator = ck_alloc(sizeof(struct custom_mutator));
+  struct mutator_host   *h = ck_alloc(sizeof(struct mutator_host));
+  u32                    i;
+
+  if (memchr(fn, '/', strlen(fn))) {
+
+    mutator->name_short = strdup(strrchr(fn, '/') + 1);
+
+  } else {
+
+    mutator->name_short = strdup(fn);
+
+  }
+
+  if (strlen(mutator->name_short) > 22) { mutator->name_short[21] = 0; }
+
+  mutator->name = fn;
+  ACTF("Starting out-of-process host for custom mutator '%s'...", fn);
+
+  h->afl = afl;
+  h->fn = fn;
+  h->map_size = sizeof(struct mutator_host_shm) +
+                (size_t)(3 + CUSTOM_MUTATOR_BATCH) * MAX_FILE;
+  h->shm = mmap(NULL, h->map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (h->shm == MAP_FAILED) { PFATAL("mmap() failed"); }
+
+  h->in = (u8 *)h->shm + sizeof(struct mutator_host_shm);
+  h->add = h->in + MAX_FILE;
+  h->out = h->add + MAX_FILE;
+  h->sync = h->out + (size_t)CUSTOM_MUTATOR_BATCH * MAX_FILE;
+
+  host_start(h);
+
+  if (h->shm->syms & HOST_SYM_UNSUPPORTED) {
+
+    FATAL("'%s' is not supported with AFL_CUSTOM_MUTATOR_ISOLATE",
+          h->shm->error);
+
+  }
+
+  if (!(h->shm->syms & (HOST_SYM_FUZZ | HOST_SYM_FUZZ_BATCH))) {
+
+    FATAL("Custom mutator '%s' has no afl_custom_fuzz(_batch)", fn);
+
+  }
+
+  mutator->data = h;
+  mutator->isolated = 1;
+  mutator->afl_custom_fuzz = host_fuzz;
+
+  if (h->shm->syms & HOST_SYM_FUZZ_COUNT) {
+
+    mutator->afl_custom_fuzz_count = host_fuzz_count;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_QUEUE_GET) {
+
+    mutator->afl_custom_queue_get = host_queue_get;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_QUEUE_NEW_ENTRY) {
+
+    mutator->afl_custom_queue_new_entry = host_queue_new_entry;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_DESCRIBE) {
+
+    mutator->afl_custom_describe = host_describe;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_POST_PROCESS) {
+
+    mutator->afl_custom_post_process = host_post_process;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_TRIM) {
+
+    mutator->afl_custom_init_trim = host_init_trim;
+    mutator->afl_custom_trim = host_trim;
+    mutator->afl_custom_post_trim = host_post_trim;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_SPLICE_OPTOUT) {
+
+    mutator->afl_custom_splice_optout = host_splice_optout;
+    afl->custom_splice_optout = 1;
+
+  }
+
+  if (h->shm->syms & HOST_SYM_FUZZ_BATCH) {
+
+    /* the output slots in the shared mapping are the batch buffers */
+
+    mutator->afl_custom_fuzz_batch = host_fuzz_batch;
+    mutator->fuzz_batch_buf = h->out;
+
+    for (i = 0; i < CUSTOM_MUTATOR_BATCH; ++i) {
+
+      mutator->fuzz_batch_bufs[i] = HOST_SLOT(h, i);
+
+    }
+
+  }
+
+  OKF("Custom mutator '%s' runs out-of-process (pid %d).", fn, h->pid);
+
+  return mutator;
+
+}
+
+void destroy_custom_mutator_host(struct custom_mutator *mutator) {
+
+  struct mutator_host *h = mutator->data;
+
+  if (h->pid > 0 && write(h->ctl_fd, &(u32){HOST_CMD_DEINIT}, 4) == 4) {
+
+    waitpid(h->pid, NULL, 0);
+    h->pid = -1;
+
+  }
+
+  host_stop(h);
+
+  munmap(h->shm, h->map_size);
+  ck_free(h->desc_buf);
+  ck_free(h->trim_buf);
+  ck_free(h);
+
+  mutator->fuzz_batch_buf = NULL;
+  mutator->data = NULL;
+
+}
+
@@ -25,6 +25,7 @@
  */
 
 #include "afl-fuzz.h"
+#include <math.h>
 
 struct custom_mutator *load_custom_mutator(afl_state_t *, const char *);
 #ifdef USE_PYTHON
@@ -85,6 +86,13 @@ void setup_custom_mutators(afl_state_t *afl) {
           "requests that integrates MOpt with the optional mutators "
           "(custom/redqueen/...).");
 
+    /* The table of recent compares is shared, so that isolated mutator
+       hosts see it grow too */
+    afl->cmp_tokens = mmap(NULL, sizeof(struct cmp_tokens),
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                           -1, 0);
+    if (afl->cmp_tokens == MAP_FAILED) { PFATAL("mmap() failed"); }
+
     u8 *fn_token = (u8 *)strsep((char **)&fn, ";:,");
 
     if (likely(!fn_token)) {
@@ -156,6 +164,7 @@ void destroy_custom_mutators(afl_state_t *afl) {
     LIST_FOREACH_CLEAR(&afl->custom_mutator_list, struct custom_mutator, {
 
       if (!el->data) { FATAL("Deintializing NULL mutator"); }
+      if (el->isolated) { destroy_custom_mutator_host(el); }
       if (el->afl_custom_deinit) el->afl_custom_deinit(el->data);
       if (el->dh) dlclose(el->dh);
 
@@ -166,18 +175,243 @@ void destroy_custom_mutators(afl_state_t *afl) {
 
       }
 
+      if (el->fuzz_batch_buf) {
+
+        afl_free(el->fuzz_batch_buf);
+        el->fuzz_batch_buf = NULL;
+
+      }
+
       ck_free(el);
 
     });
 
   }
 
+  if (afl->cmp_tokens) {
+
+    munmap(afl->cmp_tokens, sizeof(struct cmp_tokens));
+    afl->cmp_tokens = NULL;
+
+  }
+
+  if (afl->cmp_tokens_seen) {
+
+    ck_free(afl->cmp_tokens_seen);
+    afl->cmp_tokens_seen = NULL;
+
+  }
+
+  mutator_bandit_destroy(afl);
+
+}
+
+/* Exec budget bandit (AFL_CUSTOM_MUTATOR_BANDIT). The arms are the custom
+   mutators that fuzz, plus havoc (including splice) unless only custom
+   mutators run. Finds of an arm are taken as Poisson with an unknown rate per
+   exec; its Gamma posterior combines the recent global counts, scaled down to
+   MUTATOR_BANDIT_PRIOR execs, with the counts on the current queue entry.
+   Once per queue entry a rate is sampled from each posterior (Thompson
+   sampling), and the default number of execs of each arm is scaled by its
+   share of the sampled rates. */
+
+void mutator_bandit_init(afl_state_t *afl) {
+
+  u32 arms = afl->custom_mutators_count + 1, active = 0;
+
+  afl->mutator_bandit = ck_alloc(arms * sizeof(struct mutator_bandit_arm));
+  afl->mutator_bandit_mult = ck_alloc(arms * sizeof(double));
+  afl->mutator_bandit_execs = 0;
+
+  arms = 0;
+  LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
+
+    el->bandit_arm = arms++;
+    if (el->afl_custom_fuzz || el->afl_custom_fuzz_batch) { ++active; }
+
+  });
+
+  if (!afl->custom_only) { ++active; }
+
+  if (active < 2) {
+
+    WARNF("AFL_CUSTOM_MUTATOR_BANDIT needs at least two mutators, ignored.");
+    mutator_bandit_destroy(afl);
+    return;
+
+  }
+
+  OKF("Exec budget bandit across %u mutators enabled.", active);
+
+}
+
+void mutator_bandit_destroy(afl_state_t *afl) {
+
+  if (afl->mutator_bandit) {
+
+    ck_free(afl->mutator_bandit);
+    ck_free(afl->mutator_bandit_mult);
+    afl->mutator_bandit = NULL;
+    afl->mutator_bandit_mult = NULL;
+
+  }
+
+}
+
+/* Uniform in (0, 1) */
+
+static inline double bandit_uniform(afl_state_t *afl) {
+
+  return (rand_next32(afl) + 0.5) * (1.0 / 4294967296.0);
+
+}
+
+/* Gamma(a, 1) for a >= 1, Marsaglia and Tsang. */
+
+static double bandit_gamma(afl_state_t *afl, double a) {
+
+  double d = a - 1.0 / 3.0, c = 1.0 / sqrt(9.0 * d);
+
+  while (1) {
+
+    double x, v, u;
+
+    do {
+
+      /* Box-Muller */
+      x = sqrt(-2.0 * log(bandit_uniform(afl))) *
+          cos(6.283185307179586 * bandit_uniform(afl));
+      v = 1.0 + c * x;
+
+    } while (v <= 0);
+
+    v = v * v * v;
+    u = bandit_uniform(afl);
+
+    if (log(u) < 0.5 * x * x + d - d * v + d * log(v)) { return d * v; }
+
+  }
+
+}
+
+void mutator_bandit_sample(afl_state_t *afl) {
+
+  struct queue_entry        *q = afl->queue_cur;
+  struct mutator_bandit_arm *g = afl->mutator_bandit;
+  u32                        arms = afl->custom_mutators_count + 1, i;
+  double                     sum = 0, w = 1, total = 0, active = 0;
+  double                    *mult = afl->mutator_bandit_mult;
+
+  if (unlikely(!q->bandit)) {
+
+    q->bandit = ck_alloc(arms * sizeof(struct mutator_bandit_arm));
+
+  }
+
+  for (i = 0; i < arms; ++i) {
+
+    total += g[i].execs;
+    mult[i] = -1;
+
+  }
+
+  if (total > MUTATOR_BANDIT_PRIOR) { w = MUTATOR_BANDIT_PRIOR / total; }
+
+  LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
+
+    if (el->afl_custom_fuzz || el->afl_custom_fuzz_batch) {
+
+      mult[el->bandit_arm] = 0;
+
+    }
+
+  });
+
+  if (!afl->custom_only) { mult[arms - 1] = 0; }
+
+  for (i = 0; i < arms; ++i) {
+
+    if (mult[i] < 0) { continue; }
+
+    /* the prior of one find in MUTATOR_BANDIT_PRIOR / arms execs keeps
+       arms that were never run from being written off */
+    double alpha = 1.0 + w * g[i].finds + q->bandit[i].finds;
+    double beta =
+        MUTATOR_BANDIT_PRIOR / arms + w * g[i].execs + q->bandit[i].execs;
+
+    mult[i] = bandit_gamma(afl, alpha) / beta;
+    sum += mult[i];
+    ++active;
+
+  }
+
+  for (i = 0; i < arms; ++i) {
+
+    if (mult[i] < 0) { continue; }
+
+    double share = (100 - MUTATOR_BANDIT_FLOOR) / 100.0 * mult[i] / sum +
+                   MUTATOR_BANDIT_FLOOR / 100.0 / active;
+    mult[i] = share * active;
+
+  }
+
+}
+
+/* Scale the default number of execs of an arm, 0 stays 0 */
+
+u32 mutator_bandit_budget(afl_state_t *afl, u32 arm, u32 stage_max) {
+
+  if (!stage_max) { return 0; }
+
+  double budget = stage_max * afl->mutator_bandit_mult[arm];
+
+  if (budget < 1) { return 1; }
+  if (budget > (double)UINT32_MAX / 2) { return UINT32_MAX / 2; }
+  return (u32)budget;
+
+}
+
+void mutator_bandit_update(afl_state_t *afl, u32 arm, u32 execs, u32 finds) {
+
+  struct mutator_bandit_arm *g = afl->mutator_bandit;
+  struct queue_entry        *q = afl->queue_cur;
+
+  g[arm].execs += execs;
+  g[arm].finds += finds;
+  q->bandit[arm].execs += execs;
+  q->bandit[arm].finds += finds;
+
+  afl->mutator_bandit_execs += execs;
+
+  if (afl->mutator_bandit_execs > MUTATOR_BANDIT_WINDOW) {
+
+    u32 i;
+
+    for (i = 0; i <= afl->custom_mutators_count; ++i) {
+
+      g[i].execs /= 2;
+      g[i].finds /= 2;
+
+    }
+
+    afl->mutator_bandit_execs /= 2;
+
+  }
+
 }
 
 struct custom_mutator *load_custom_mutator(afl_state_t *afl, const char *fn) {
 
   void                  *dh;
-  struct custom_mutator *mutator = ck_alloc(sizeof(struct custom_mutator));
+  struct custom_mutator *mutator;
+
+  if (afl->afl_env.afl_custom_mutator_isolate) {
+
+    return load_custom_mutator_host(afl, fn);
+
+  }
+
+  mutator = ck_alloc(sizeof(struct custom_mutator));
 
   if (memchr(fn, '/', strlen(fn))) {
 
@@ -231,6 +465,18 @@ struct custom_mutator *load_custom_mutator(afl_state_t *afl, const char *fn) {
 
   }
 
+  /* "afl_custom_fuzz_batch", optional, preferred over afl_custom_fuzz */
+  mutator->afl_custom_fuzz_batch = dlsym(dh, "afl_custom_fuzz_batch");
+  if (!mutator->afl_custom_fuzz_batch) {
+
+    ACTF("optional symbol 'afl_custom_fuzz_batch' not found.");
+
+  } else {
+
+    OKF("Found 'afl_custom_fuzz_batch'.");
+
+  }
+
   /* "afl_custom_introspection", optional */
 #ifdef INTROSPECTION
   mutator->afl_custom_introspection = dlsym(dh, "afl_custom_introspection");
@@ -532,8 +778,7 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
 
         if (afl->stop_soon || fault == FSRV_RUN_ERROR) { goto abort_trimming; }
 
-        classify_counts(&afl->fsrv);
-        cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+        cksum = classify_and_hash(&afl->fsrv);
 
       }
 
@@ -33,21 +33,21 @@
 
 static int select_algorithm(afl_state_t *afl, u32 max_algorithm) {
 
-  int i_puppet, j_puppet = 0, operator_number = max_algorithm;
+  int     i_puppet, j_puppet = 0, operator_number = max_algorithm;
+  double *probability_now = afl->mopt_swarm[afl->swarm_now].probability_now;
 
-  double range_sele =
-      (double)afl->probability_now[afl->swarm_now][operator_number - 1];
+  double range_sele = (double)probability_now[operator_number - 1];
   double sele = ((double)(rand_below(afl, 10000) * 0.0001 * range_sele));
 
   for (i_puppet = 0; i_puppet < operator_num; ++i_puppet) {
 
     if (unlikely(i_puppet == 0)) {
 
-      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) { break; }
+      if (sele < probability_now[i_puppet]) { break; }
 
     } else {
 
-      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) {
+      if (sele < probability_now[i_puppet]) {
 
         j_puppet = 1;
         break;
@@ -58,10 +58,8 @@ static int select_algorithm(afl_state_t *afl, u32 max_algorithm) {
 
   }
 
-  if ((j_puppet == 1 &&
-       sele < afl->probability_now[afl->swarm_now][i_puppet - 1]) ||
-      (i_puppet + 1 < operator_num &&
-       sele > afl->probability_now[afl->swarm_now][i_puppet + 1])) {
+  if ((j_puppet == 1 && sele < probability_now[i_puppet - 1]) ||
+      (i_puppet + 1 < operator_num && sele > probability_now[i_puppet + 1])) {
 
     FATAL("error select_algorithm");
 
@@ -329,7 +327,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
   u32 len, temp_len;
   u32 j;
   u32 i;
-  u8 *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0;
+  u8 *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0, *extras_pos = NULL;
   u64 havoc_queued = 0, orig_hit_cnt, new_hit_cnt = 0, prev_cksum, _prev_cksum;
   u32 splice_cycle = 0, perf_score = 100, orig_perf, eff_cnt = 1;
 
@@ -415,7 +413,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
         afl->queue_cur->perf_score, afl->queue_cur->weight,
         afl->queue_cur->favored, afl->queue_cur->was_fuzzed,
         afl->queue_cur->exec_us,
-        likely(afl->n_fuzz) ? afl->n_fuzz[afl->queue_cur->n_fuzz_entry] : 0,
+        likely(afl->n_fuzz) ? n_fuzz_get(afl, afl->queue_cur->n_fuzz_cksum)
+                            : 0,
         afl->queue_cur->bitmap_size, afl->queue_cur->is_ascii, time_tmp);
     fflush(stdout);
 
@@ -596,11 +595,14 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   orig_hit_cnt = afl->queued_items + afl->saved_crashes;
 
-  /* Get a clean cksum. */
+  /* Get a clean cksum. While want_exec_cksum is set, save_if_interesting()
+     computes it in the same pass that classifies the trace. */
+
+  afl->want_exec_cksum = 1;
 
   if (common_fuzz_stuff(afl, out_buf, len)) { goto abandon_entry; }
 
-  prev_cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+  prev_cksum = afl->last_exec_cksum;
   _prev_cksum = prev_cksum;
 
   /* Now flip bits. */
@@ -649,7 +651,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
     if (!afl->non_instrumented_mode && (afl->stage_cur & 7) == 7) {
 
-      u64 cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+      u64 cksum = afl->last_exec_cksum;
 
       if (afl->stage_cur == afl->stage_max - 1 && cksum == prev_cksum) {
 
@@ -705,6 +707,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   }
 
+  afl->want_exec_cksum = 0;
+
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP1] += new_hit_cnt - orig_hit_cnt;
@@ -823,6 +827,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   orig_hit_cnt = new_hit_cnt;
   prev_cksum = _prev_cksum;
+  afl->want_exec_cksum = 1;
 
   for (afl->stage_cur = 0; afl->stage_cur < afl->stage_max; ++afl->stage_cur) {
 
@@ -851,7 +856,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
       if (!afl->non_instrumented_mode && len >= EFF_MIN_LEN) {
 
-        cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+        cksum = afl->last_exec_cksum;
 
       } else {
 
@@ -872,6 +877,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   }
 
+  afl->want_exec_cksum = 0;
+
   /* If the effector map is more than EFF_MAX_PERC dense, just flag the
      whole thing as worth fuzzing, since we wouldn't be saving much time
      anyway. */
@@ -1609,6 +1616,15 @@ skip_interest:
    * DICTIONARY STUFF *
    ********************/
 
+  /* With AFL_TARGETED_EXTRAS only offsets where a token (prefix) is present
+     are used, extras_pos is NULL if all offsets should be tried. */
+
+  if (afl->afl_env.afl_targeted_extras) {
+
+    extras_pos = extras_positions(afl, out_buf, len);
+
+  }
+
   if (!afl->extras_cnt) { goto skip_user_extras; }
 
   /* Overwrite with user-supplied extras. */
@@ -1628,6 +1644,13 @@ skip_interest:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !(extras_pos[i] & EXTRAS_POS_START)) {
+
+      afl->stage_max -= afl->extras_cnt;
+      continue;
+
+    }
+
     /* Extras are sorted by size, from smallest to largest. This means
        that we don't have to worry about restoring the buffer in
        between writes at a particular offset determined by the outer
@@ -1695,6 +1718,14 @@ skip_interest:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !extras_pos[i]) {
+
+      afl->stage_max -= afl->extras_cnt;
+      ex_tmp[i] = out_buf[i];
+      continue;
+
+    }
+
     for (j = 0; j < afl->extras_cnt; ++j) {
 
       if (len + afl->extras[j].len > MAX_FILE) {
@@ -1757,23 +1788,33 @@ skip_user_extras:
 
     afl->stage_cur_byte = i;
 
-    u32 min_extra_len = MIN(afl->a_extras_cnt, (u32)USE_AUTO_EXTRAS);
+    u32  min_extra_len = MIN(afl->a_extras_cnt, (u32)USE_AUTO_EXTRAS);
+    u32 *a_by_len = auto_extras_by_len(afl);
+
+    if (extras_pos && !(extras_pos[i] & EXTRAS_POS_START)) {
+
+      afl->stage_max -= min_extra_len;
+      continue;
+
+    }
+
     for (j = 0; j < min_extra_len; ++j) {
 
-      /* See the comment in the earlier code; extras are sorted by size. */
+      struct auto_extra_data *extra = &afl->a_extras[a_by_len[j]];
 
-      if (afl->a_extras[j].len > len - i ||
-          !memcmp(afl->a_extras[j].data, out_buf + i, afl->a_extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1,
-                  EFF_SPAN_ALEN(i, afl->a_extras[j].len))) {
+      /* See the comment in the earlier code; a_by_len is sorted by size. */
+
+      if (extra->len > len - i ||
+          !memcmp(extra->data, out_buf + i, extra->len) ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extra->len))) {
 
         --afl->stage_max;
         continue;
 
       }
 
-      last_len = afl->a_extras[j].len;
-      memcpy(out_buf + i, afl->a_extras[j].data, last_len);
+      last_len = extra->len;
+      memcpy(out_buf + i, extra->data, last_len);
 
 #ifdef INTROSPECTION
       snprintf(afl->mutation, sizeof(afl->mutation),
@@ -1815,6 +1856,14 @@ skip_user_extras:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !extras_pos[i]) {
+
+      afl->stage_max -= afl->a_extras_cnt;
+      ex_tmp[i] = out_buf[i];
+      continue;
+
+    }
+
     for (j = 0; j < afl->a_extras_cnt; ++j) {
 
       if (len + afl->a_extras[j].len > MAX_FILE) {
@@ -1887,13 +1936,15 @@ custom_mutator_stage:
 
   orig_hit_cnt = afl->queued_items + afl->saved_crashes;
 
+  if (unlikely(afl->mutator_bandit)) { mutator_bandit_sample(afl); }
+
 #ifdef INTROSPECTION
   afl->mutation[0] = 0;
 #endif
 
   LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
 
-    if (el->afl_custom_fuzz) {
+    if (el->afl_custom_fuzz || el->afl_custom_fuzz_batch) {
 
       afl->current_custom_fuzz = el;
       afl->stage_name = el->name_short;
@@ -1908,12 +1959,47 @@ custom_mutator_stage:
 
       }
 
+      if (unlikely(afl->mutator_bandit)) {
+
+        u32 budget = mutator_bandit_budget(afl, el->bandit_arm, afl->stage_max);
+
+        /* afl_custom_fuzz_count() is the most the mutator wants to do */
+        afl->stage_max =
+            el->afl_custom_fuzz_count ? MIN(budget, afl->stage_max) : budget;
+
+      }
+
+      u64 arm_hit_cnt = afl->queued_items + afl->saved_crashes;
+      afl->stage_cur = 0;
+
       has_custom_fuzz = true;
 
       afl->stage_short = el->name_short;
 
       if (afl->stage_max) {
 
+        u32 batch_cur = 0;
+        u32 batch_cnt = 0;
+
+        if (el->afl_custom_fuzz_batch && !el->fuzz_batch_buf) {
+
+          u32 i;
+
+          if (unlikely(!afl_realloc((void **)&el->fuzz_batch_buf,
+                                    CUSTOM_MUTATOR_BATCH * max_seed_size))) {
+
+            PFATAL("alloc");
+
+          }
+
+          for (i = 0; i < CUSTOM_MUTATOR_BATCH; ++i) {
+
+            el->fuzz_batch_bufs[i] = el->fuzz_batch_buf + i * max_seed_size;
+
+          }
+
+        }
+
         for (afl->stage_cur = 0; afl->stage_cur < afl->stage_max;
              ++afl->stage_cur) {
 
@@ -1921,6 +2007,19 @@ custom_mutator_stage:
           u32                 tid;
           u8                 *new_buf = NULL;
           u32                 target_len = 0;
+          u8                 *mutated_buf = NULL;
+          size_t              mutated_size;
+
+          /* Batched mutators: hand out the next mutant of the current batch,
+             only call into the mutator (and pick a splice partner) once the
+             batch is used up. */
+          if (el->afl_custom_fuzz_batch && batch_cur < batch_cnt) {
+
+            mutated_buf = el->fuzz_batch_bufs[batch_cur];
+            mutated_size = el->fuzz_batch_sizes[batch_cur++];
+            goto custom_mutator_run;
+
+          }
 
           /* check if splicing makes sense yet (enough entries) */
           if (likely(!afl->custom_splice_optout &&
@@ -1946,11 +2045,27 @@ custom_mutator_stage:
 
           }
 
-          u8 *mutated_buf = NULL;
+          if (el->afl_custom_fuzz_batch) {
+
+            batch_cnt = el->afl_custom_fuzz_batch(
+                el->data, out_buf, len, new_buf, target_len,
+                el->fuzz_batch_bufs, el->fuzz_batch_sizes,
+                MIN(CUSTOM_MUTATOR_BATCH, afl->stage_max - afl->stage_cur),
+                max_seed_size);
+
+            if (unlikely(!batch_cnt)) { break; }
+
+            batch_cur = 1;
+            mutated_buf = el->fuzz_batch_bufs[0];
+            mutated_size = el->fuzz_batch_sizes[0];
+
+          } else {
 
-          size_t mutated_size =
-              el->afl_custom_fuzz(el->data, out_buf, len, &mutated_buf, new_buf,
-                                  target_len, max_seed_size);
+            mutated_size =
+                el->afl_custom_fuzz(el->data, out_buf, len, &mutated_buf,
+                                    new_buf, target_len, max_seed_size);
+
+          }
 
           if (unlikely(!mutated_buf)) {
 
@@ -1959,8 +2074,16 @@ custom_mutator_stage:
 
           }
 
+        custom_mutator_run:
+
           if (mutated_size > 0) {
 
+            if (unlikely(mutated_size > max_seed_size)) {
+
+              mutated_size = max_seed_size;
+
+            }
+
             if (common_fuzz_stuff(afl, mutated_buf, (u32)mutated_size)) {
 
               goto abandon_entry;
@@ -1990,12 +2113,20 @@ custom_mutator_stage:
           }
 
           /* out_buf may have been changed by the call to custom_fuzz */
-          memcpy(out_buf, in_buf, len);
+          if (!el->afl_custom_fuzz_batch) { memcpy(out_buf, in_buf, len); }
 
         }
 
       }
 
+      if (unlikely(afl->mutator_bandit)) {
+
+        mutator_bandit_update(
+            afl, el->bandit_arm, afl->stage_cur,
+            afl->queued_items + afl->saved_crashes - arm_hit_cnt);
+
+      }
+
     }
 
   });
@@ -2054,6 +2185,13 @@ havoc_stage:
 
   if (unlikely(afl->stage_max < HAVOC_MIN)) { afl->stage_max = HAVOC_MIN; }
 
+  if (unlikely(afl->mutator_bandit)) {
+
+    afl->stage_max = mutator_bandit_budget(
+        afl, afl->custom_mutators_count, afl->stage_max);
+
+  }
+
   temp_len = len;
 
   orig_hit_cnt = afl->queued_items + afl->saved_crashes;
@@ -3130,7 +3268,7 @@ havoc_stage:
 
           /* Use the dictionary. */
 
-          u32 use_extra = rand_below(afl, afl->a_extras_cnt);
+          u32 use_extra = pick_auto_extra(afl);
           u32 extra_len = afl->a_extras[use_extra].len;
 
           if (unlikely(extra_len > temp_len)) { goto retry_havoc_step; }
@@ -3151,7 +3289,7 @@ havoc_stage:
 
           if (unlikely(!afl->a_extras_cnt)) { goto retry_havoc_step; }
 
-          u32 use_extra = rand_below(afl, afl->a_extras_cnt);
+          u32 use_extra = pick_auto_extra(afl);
           u32 extra_len = afl->a_extras[use_extra].len;
           if (unlikely(temp_len + extra_len >= MAX_FILE)) {
 
@@ -3331,6 +3469,13 @@ havoc_stage:
 
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
+  if (unlikely(afl->mutator_bandit)) {
+
+    mutator_bandit_update(afl, afl->custom_mutators_count, afl->stage_max,
+                          new_hit_cnt - orig_hit_cnt);
+
+  }
+
   if (!splice_cycle) {
 
     afl->stage_finds[STAGE_HAVOC] += new_hit_cnt - orig_hit_cnt;
@@ -3366,7 +3511,7 @@ retry_splicing:
       afl->ready_for_splicing_count > 1 && afl->queue_cur->len >= 4) {
 
     struct queue_entry *target;
-    u32                 tid, split_at;
+    u32                 tid, split_at, d_from, d_to, tries = 0;
     u8                 *new_buf;
     s32                 f_diff, l_diff;
 
@@ -3380,15 +3525,19 @@ retry_splicing:
 
     }
 
-    /* Pick a random queue entry and seek to it. Don't splice with yourself. */
+    /* Pick a random queue entry and seek to it. Don't splice with yourself.
+       Entries that the splice sketches show to be identical to ours in their
+       common part are skipped without loading them. */
 
     do {
 
       tid = rand_below(afl, afl->queued_items);
 
-    } while (
-
-        unlikely(tid == afl->current_entry || afl->queue_buf[tid]->len < 4));
+    } while (unlikely(tid == afl->current_entry ||
+                      afl->queue_buf[tid]->len < 4 ||
+                      (!queue_splice_diff(afl->queue_cur, afl->queue_buf[tid],
+                                          &d_from, &d_to) &&
+                       tries++ < SPLICE_SKETCH_TRIES)));
 
     /* Get the testcase */
     afl->splicing_with = tid;
@@ -3399,7 +3548,15 @@ retry_splicing:
        the last differing byte. Bail out if the difference is just a single
        byte or so. */
 
-    locate_diffs(in_buf, new_buf, MIN(len, (s64)target->len), &f_diff, &l_diff);
+    locate_diffs(in_buf + d_from, new_buf + d_from, d_to - d_from, &f_diff,
+                 &l_diff);
+
+    if (f_diff >= 0) {
+
+      f_diff += d_from;
+      l_diff += d_from;
+
+    }
 
     if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) { goto retry_splicing; }
 
@@ -3432,6 +3589,7 @@ retry_splicing:
 abandon_entry:
 
   afl->splicing_with = -1;
+  afl->want_exec_cksum = 0;
 
   /* Update afl->pending_not_fuzzed count if we made it through the calibration
      cycle and have not seen this entry before. */
@@ -3471,7 +3629,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
   u32 len, temp_len;
   u32 i;
   u32 j;
-  u8 *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0;
+  u8 *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0, *extras_pos = NULL;
   u64 havoc_queued = 0, orig_hit_cnt, new_hit_cnt = 0, cur_ms_lv, prev_cksum,
       _prev_cksum;
   u32 splice_cycle = 0, perf_score = 100, orig_perf, eff_cnt = 1;
@@ -3717,11 +3875,14 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   orig_hit_cnt = afl->queued_items + afl->saved_crashes;
 
-  /* Get a clean cksum. */
+  /* Get a clean cksum. While want_exec_cksum is set, save_if_interesting()
+     computes it in the same pass that classifies the trace. */
+
+  afl->want_exec_cksum = 1;
 
   if (common_fuzz_stuff(afl, out_buf, len)) { goto abandon_entry; }
 
-  prev_cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+  prev_cksum = afl->last_exec_cksum;
   _prev_cksum = prev_cksum;
 
   /* Now flip bits. */
@@ -3769,7 +3930,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
     if (!afl->non_instrumented_mode && (afl->stage_cur & 7) == 7) {
 
-      u64 cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+      u64 cksum = afl->last_exec_cksum;
 
       if (afl->stage_cur == afl->stage_max - 1 && cksum == prev_cksum) {
 
@@ -3825,6 +3986,8 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   }                                                   /* for afl->stage_cur */
 
+  afl->want_exec_cksum = 0;
+
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP1] += new_hit_cnt - orig_hit_cnt;
@@ -3941,6 +4104,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   orig_hit_cnt = new_hit_cnt;
   prev_cksum = _prev_cksum;
+  afl->want_exec_cksum = 1;
 
   for (afl->stage_cur = 0; afl->stage_cur < afl->stage_max; ++afl->stage_cur) {
 
@@ -3968,7 +4132,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
       if (!afl->non_instrumented_mode && len >= EFF_MIN_LEN) {
 
-        cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+        cksum = afl->last_exec_cksum;
 
       } else {
 
@@ -3989,6 +4153,8 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   }                                                   /* for afl->stage_cur */
 
+  afl->want_exec_cksum = 0;
+
   /* If the effector map is more than EFF_MAX_PERC dense, just flag the
      whole thing as worth fuzzing, since we wouldn't be saving much time
      anyway. */
@@ -4709,6 +4875,15 @@ skip_interest:
    * DICTIONARY STUFF *
    ********************/
 
+  /* With AFL_TARGETED_EXTRAS only offsets where a token (prefix) is present
+     are used, extras_pos is NULL if all offsets should be tried. */
+
+  if (afl->afl_env.afl_targeted_extras) {
+
+    extras_pos = extras_positions(afl, out_buf, len);
+
+  }
+
   if (!afl->extras_cnt) { goto skip_user_extras; }
 
   /* Overwrite with user-supplied extras. */
@@ -4728,6 +4903,13 @@ skip_interest:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !(extras_pos[i] & EXTRAS_POS_START)) {
+
+      afl->stage_max -= afl->extras_cnt;
+      continue;
+
+    }
+
     /* Extras are sorted by size, from smallest to largest. This means
        that we don't have to worry about restoring the buffer in
        between writes at a particular offset determined by the outer
@@ -4795,6 +4977,14 @@ skip_interest:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !extras_pos[i]) {
+
+      afl->stage_max -= afl->extras_cnt;
+      ex_tmp[i] = out_buf[i];
+      continue;
+
+    }
+
     for (j = 0; j < afl->extras_cnt; ++j) {
 
       if (len + afl->extras[j].len > MAX_FILE) {
@@ -4857,23 +5047,33 @@ skip_user_extras:
 
     afl->stage_cur_byte = i;
 
-    u32 min_extra_len = MIN(afl->a_extras_cnt, (u32)USE_AUTO_EXTRAS);
+    u32  min_extra_len = MIN(afl->a_extras_cnt, (u32)USE_AUTO_EXTRAS);
+    u32 *a_by_len = auto_extras_by_len(afl);
+
+    if (extras_pos && !(extras_pos[i] & EXTRAS_POS_START)) {
+
+      afl->stage_max -= min_extra_len;
+      continue;
+
+    }
+
     for (j = 0; j < min_extra_len; ++j) {
 
-      /* See the comment in the earlier code; extras are sorted by size. */
+      struct auto_extra_data *extra = &afl->a_extras[a_by_len[j]];
 
-      if ((afl->a_extras[j].len) > (len - i) ||
-          !memcmp(afl->a_extras[j].data, out_buf + i, afl->a_extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1,
-                  EFF_SPAN_ALEN(i, afl->a_extras[j].len))) {
+      /* See the comment in the earlier code; a_by_len is sorted by size. */
+
+      if (extra->len > (len - i) ||
+          !memcmp(extra->data, out_buf + i, extra->len) ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extra->len))) {
 
         --afl->stage_max;
         continue;
 
       }
 
-      last_len = afl->a_extras[j].len;
-      memcpy(out_buf + i, afl->a_extras[j].data, last_len);
+      last_len = extra->len;
+      memcpy(out_buf + i, extra->data, last_len);
 
 #ifdef INTROSPECTION
       snprintf(afl->mutation, sizeof(afl->mutation),
@@ -4916,6 +5116,14 @@ skip_user_extras:
 
     afl->stage_cur_byte = i;
 
+    if (extras_pos && !extras_pos[i]) {
+
+      afl->stage_max -= afl->a_extras_cnt;
+      ex_tmp[i] = out_buf[i];
+      continue;
+
+    }
+
     for (j = 0; j < afl->a_extras_cnt; ++j) {
 
       if (len + afl->a_extras[j].len > MAX_FILE) {
@@ -5059,6 +5267,14 @@ pacemaker_fuzzing:
 
       u32 r_max, r;
 
+#define MOPT_RAN(_op)                     \
+  do {                                    \
+                                          \
+    ++MOpt_globals.stats->cycles_v2[_op]; \
+    mopt_ran |= 1U << (_op);              \
+                                          \
+  } while (0)
+
       r_max = 16 + ((afl->extras_cnt + afl->a_extras_cnt) ? 2 : 0);
 
       if (unlikely(afl->expand_havoc && afl->ready_for_splicing_count > 1)) {
@@ -5077,11 +5293,8 @@ pacemaker_fuzzing:
 
         afl->stage_cur_val = use_stacking;
 
-        for (i = 0; i < operator_num; ++i) {
-
-          MOpt_globals.cycles_v3[i] = MOpt_globals.cycles_v2[i];
-
-        }
+        /* operators applied to this input, credited if it finds something */
+        u32 mopt_ran = 0;
 
 #ifdef INTROSPECTION
         snprintf(afl->mutation, sizeof(afl->mutation), "%s MOPT_HAVOC-%u",
@@ -5095,7 +5308,7 @@ pacemaker_fuzzing:
             case 0:
               /* Flip a single bit somewhere. Spooky! */
               FLIP_BIT(out_buf, rand_below(afl, temp_len << 3));
-              MOpt_globals.cycles_v2[STAGE_FLIP1]++;
+              MOPT_RAN(STAGE_FLIP1);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT1");
               strcat(afl->mutation, afl->m_tmp);
@@ -5107,7 +5320,7 @@ pacemaker_fuzzing:
               temp_len_puppet = rand_below(afl, (temp_len << 3) - 1);
               FLIP_BIT(out_buf, temp_len_puppet);
               FLIP_BIT(out_buf, temp_len_puppet + 1);
-              MOpt_globals.cycles_v2[STAGE_FLIP2]++;
+              MOPT_RAN(STAGE_FLIP2);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT2");
               strcat(afl->mutation, afl->m_tmp);
@@ -5121,7 +5334,7 @@ pacemaker_fuzzing:
               FLIP_BIT(out_buf, temp_len_puppet + 1);
               FLIP_BIT(out_buf, temp_len_puppet + 2);
               FLIP_BIT(out_buf, temp_len_puppet + 3);
-              MOpt_globals.cycles_v2[STAGE_FLIP4]++;
+              MOPT_RAN(STAGE_FLIP4);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT4");
               strcat(afl->mutation, afl->m_tmp);
@@ -5131,7 +5344,7 @@ pacemaker_fuzzing:
             case 3:
               if (temp_len < 4) { break; }
               out_buf[rand_below(afl, temp_len)] ^= 0xFF;
-              MOpt_globals.cycles_v2[STAGE_FLIP8]++;
+              MOPT_RAN(STAGE_FLIP8);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT8");
               strcat(afl->mutation, afl->m_tmp);
@@ -5141,7 +5354,7 @@ pacemaker_fuzzing:
             case 4:
               if (temp_len < 8) { break; }
               *(u16 *)(out_buf + rand_below(afl, temp_len - 1)) ^= 0xFFFF;
-              MOpt_globals.cycles_v2[STAGE_FLIP16]++;
+              MOPT_RAN(STAGE_FLIP16);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT16");
               strcat(afl->mutation, afl->m_tmp);
@@ -5151,7 +5364,7 @@ pacemaker_fuzzing:
             case 5:
               if (temp_len < 8) { break; }
               *(u32 *)(out_buf + rand_below(afl, temp_len - 3)) ^= 0xFFFFFFFF;
-              MOpt_globals.cycles_v2[STAGE_FLIP32]++;
+              MOPT_RAN(STAGE_FLIP32);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT32");
               strcat(afl->mutation, afl->m_tmp);
@@ -5163,7 +5376,7 @@ pacemaker_fuzzing:
                   1 + rand_below(afl, ARITH_MAX);
               out_buf[rand_below(afl, temp_len)] +=
                   1 + rand_below(afl, ARITH_MAX);
-              MOpt_globals.cycles_v2[STAGE_ARITH8]++;
+              MOPT_RAN(STAGE_ARITH8);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH8");
               strcat(afl->mutation, afl->m_tmp);
@@ -5220,7 +5433,7 @@ pacemaker_fuzzing:
 
               }
 
-              MOpt_globals.cycles_v2[STAGE_ARITH16]++;
+              MOPT_RAN(STAGE_ARITH16);
               break;
 
             case 8:
@@ -5274,7 +5487,7 @@ pacemaker_fuzzing:
 
               }
 
-              MOpt_globals.cycles_v2[STAGE_ARITH32]++;
+              MOPT_RAN(STAGE_ARITH32);
               break;
 
             case 9:
@@ -5282,7 +5495,7 @@ pacemaker_fuzzing:
               if (temp_len < 4) { break; }
               out_buf[rand_below(afl, temp_len)] =
                   interesting_8[rand_below(afl, sizeof(interesting_8))];
-              MOpt_globals.cycles_v2[STAGE_INTEREST8]++;
+              MOPT_RAN(STAGE_INTEREST8);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING8");
               strcat(afl->mutation, afl->m_tmp);
@@ -5314,7 +5527,7 @@ pacemaker_fuzzing:
 
               }
 
-              MOpt_globals.cycles_v2[STAGE_INTEREST16]++;
+              MOPT_RAN(STAGE_INTEREST16);
               break;
 
             case 11:
@@ -5344,7 +5557,7 @@ pacemaker_fuzzing:
 
               }
 
-              MOpt_globals.cycles_v2[STAGE_INTEREST32]++;
+              MOPT_RAN(STAGE_INTEREST32);
               break;
 
             case 12:
@@ -5354,7 +5567,7 @@ pacemaker_fuzzing:
                  possibility of a no-op. */
 
               out_buf[rand_below(afl, temp_len)] ^= 1 + rand_below(afl, 255);
-              MOpt_globals.cycles_v2[STAGE_RANDOMBYTE]++;
+              MOPT_RAN(STAGE_RANDOMBYTE);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " RAND8");
               strcat(afl->mutation, afl->m_tmp);
@@ -5386,7 +5599,7 @@ pacemaker_fuzzing:
                       temp_len - del_from - del_len);
 
               temp_len -= del_len;
-              MOpt_globals.cycles_v2[STAGE_DELETEBYTE]++;
+              MOPT_RAN(STAGE_DELETEBYTE);
               break;
 
             }
@@ -5453,7 +5666,7 @@ pacemaker_fuzzing:
                 out_buf = new_buf;
                 afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
                 temp_len += clone_len;
-                MOpt_globals.cycles_v2[STAGE_Clone75]++;
+                MOPT_RAN(STAGE_Clone75);
 
               }
 
@@ -5502,7 +5715,7 @@ pacemaker_fuzzing:
 
               }
 
-              MOpt_globals.cycles_v2[STAGE_OverWrite75]++;
+              MOPT_RAN(STAGE_OverWrite75);
               break;
 
             }                                                    /* case 15 */
@@ -5524,7 +5737,7 @@ pacemaker_fuzzing:
                   /* No user-specified extras or odds in our favor. Let's use an
                     auto-detected one. */
 
-                  u32 use_extra = rand_below(afl, afl->a_extras_cnt);
+                  u32 use_extra = pick_auto_extra(afl);
                   u32 extra_len = afl->a_extras[use_extra].len;
 
                   if (extra_len > (u32)temp_len) break;
@@ -5558,7 +5771,7 @@ pacemaker_fuzzing:
 
                 }
 
-                MOpt_globals.cycles_v2[STAGE_OverWriteExtra]++;
+                MOPT_RAN(STAGE_OverWriteExtra);
 
                 break;
 
@@ -5578,7 +5791,7 @@ pacemaker_fuzzing:
                 if (!afl->extras_cnt ||
                     (afl->a_extras_cnt && rand_below(afl, 2))) {
 
-                  use_extra = rand_below(afl, afl->a_extras_cnt);
+                  use_extra = pick_auto_extra(afl);
                   extra_len = afl->a_extras[use_extra].len;
                   ptr = afl->a_extras[use_extra].data;
 #ifdef INTROSPECTION
@@ -5613,7 +5826,7 @@ pacemaker_fuzzing:
                 memcpy(out_buf + insert_at, ptr, extra_len);
 
                 temp_len += extra_len;
-                MOpt_globals.cycles_v2[STAGE_InsertExtra]++;
+                MOPT_RAN(STAGE_InsertExtra);
                 break;
 
               } else {
@@ -5693,7 +5906,7 @@ pacemaker_fuzzing:
 
                 }
 
-                MOpt_globals.cycles_v2[STAGE_Splice]++;
+                MOPT_RAN(STAGE_Splice);
                 break;
 
               }
@@ -5745,28 +5958,11 @@ pacemaker_fuzzing:
               afl->queued_items + afl->saved_crashes - temp_total_found;
           afl->total_puppet_find = afl->total_puppet_find + temp_temp_puppet;
 
-          if (MOpt_globals.is_pilot_mode) {
-
-            for (i = 0; i < operator_num; ++i) {
-
-              if (MOpt_globals.cycles_v2[i] > MOpt_globals.cycles_v3[i]) {
-
-                MOpt_globals.finds_v2[i] += temp_temp_puppet;
+          while (mopt_ran) {
 
-              }
-
-            }
-
-          } else {
-
-            for (i = 0; i < operator_num; i++) {
-
-              if (afl->core_operator_cycles_puppet_v2[i] >
-                  afl->core_operator_cycles_puppet_v3[i])
-
-                afl->core_operator_finds_puppet_v2[i] += temp_temp_puppet;
-
-            }
+            MOpt_globals.stats->finds_v2[__builtin_ctz(mopt_ran)] +=
+                temp_temp_puppet;
+            mopt_ran &= mopt_ran - 1;
 
           }
 
@@ -5813,7 +6009,7 @@ pacemaker_fuzzing:
           afl->ready_for_splicing_count > 1 && afl->queue_cur->len >= 4) {
 
         struct queue_entry *target;
-        u32                 tid, split_at;
+        u32                 tid, split_at, d_from, d_to, tries = 0;
         u8                 *new_buf;
         s32                 f_diff, l_diff;
 
@@ -5828,13 +6024,16 @@ pacemaker_fuzzing:
         }
 
         /* Pick a random queue entry and seek to it. Don't splice with yourself.
-         */
+           Skip entries whose sketch shows no difference to ours. */
 
         do {
 
           tid = rand_below(afl, afl->queued_items);
 
-        } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+        } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4 ||
+                 (!queue_splice_diff(afl->queue_cur, afl->queue_buf[tid],
+                                     &d_from, &d_to) &&
+                  tries++ < SPLICE_SKETCH_TRIES));
 
         afl->splicing_with = tid;
         target = afl->queue_buf[tid];
@@ -5846,7 +6045,15 @@ pacemaker_fuzzing:
            the last differing byte. Bail out if the difference is just a single
            byte or so. */
 
-        locate_diffs(in_buf, new_buf, MIN(len, target->len), &f_diff, &l_diff);
+        locate_diffs(in_buf + d_from, new_buf + d_from, d_to - d_from, &f_diff,
+                     &l_diff);
+
+        if (f_diff >= 0) {
+
+          f_diff += d_from;
+          l_diff += d_from;
+
+        }
 
         if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) {
 
@@ -5892,6 +6099,7 @@ pacemaker_fuzzing:
       }
 
       afl->splicing_with = -1;
+      afl->want_exec_cksum = 0;
 
       /* Update afl->pending_not_fuzzed count if we made it through the
          calibration cycle and have not seen this entry before. */
@@ -5932,115 +6140,9 @@ pacemaker_fuzzing:
 
       if (unlikely(*MOpt_globals.pTime > MOpt_globals.period)) {
 
-        afl->total_pacemaker_time += *MOpt_globals.pTime;
-        *MOpt_globals.pTime = 0;
-        new_hit_cnt = afl->queued_items + afl->saved_crashes;
-
-        if (MOpt_globals.is_pilot_mode) {
-
-          afl->swarm_fitness[afl->swarm_now] =
-              (double)(afl->total_puppet_find - afl->temp_puppet_find) /
-              ((double)(afl->tmp_pilot_time) / afl->period_pilot_tmp);
-
-        }
-
-        afl->temp_puppet_find = afl->total_puppet_find;
-        for (i = 0; i < operator_num; ++i) {
-
-          if (MOpt_globals.is_pilot_mode) {
-
-            double temp_eff = 0.0;
-
-            if (MOpt_globals.cycles_v2[i] > MOpt_globals.cycles[i]) {
-
-              temp_eff =
-                  (double)(MOpt_globals.finds_v2[i] - MOpt_globals.finds[i]) /
-                  (double)(MOpt_globals.cycles_v2[i] - MOpt_globals.cycles[i]);
-
-            }
-
-            if (afl->eff_best[afl->swarm_now][i] < temp_eff) {
-
-              afl->eff_best[afl->swarm_now][i] = temp_eff;
-              afl->L_best[afl->swarm_now][i] = afl->x_now[afl->swarm_now][i];
-
-            }
-
-          }
-
-          MOpt_globals.finds[i] = MOpt_globals.finds_v2[i];
-          MOpt_globals.cycles[i] = MOpt_globals.cycles_v2[i];
-
-        }                                    /* for i = 0; i < operator_num */
-
-        if (MOpt_globals.is_pilot_mode) {
-
-          afl->swarm_now = afl->swarm_now + 1;
-          if (afl->swarm_now == swarm_num) {
-
-            afl->key_module = 1;
-            for (i = 0; i < operator_num; ++i) {
-
-              afl->core_operator_cycles_puppet_v2[i] =
-                  afl->core_operator_cycles_puppet[i];
-              afl->core_operator_cycles_puppet_v3[i] =
-                  afl->core_operator_cycles_puppet[i];
-              afl->core_operator_finds_puppet_v2[i] =
-                  afl->core_operator_finds_puppet[i];
-
-            }
-
-            double swarm_eff = 0.0;
-            afl->swarm_now = 0;
-            for (i = 0; i < swarm_num; ++i) {
-
-              if (afl->swarm_fitness[i] > swarm_eff) {
-
-                swarm_eff = afl->swarm_fitness[i];
-                afl->swarm_now = i;
-
-              }
-
-            }
-
-            if (afl->swarm_now < 0 || afl->swarm_now > swarm_num - 1) {
-
-              PFATAL("swarm_now error number  %d", afl->swarm_now);
-
-            }
-
-          }                               /* if afl->swarm_now == swarm_num */
-
-          /* adjust pointers dependent on 'afl->swarm_now' */
-          afl->mopt_globals_pilot.finds =
-              afl->stage_finds_puppet[afl->swarm_now];
-          afl->mopt_globals_pilot.finds_v2 =
-              afl->stage_finds_puppet_v2[afl->swarm_now];
-          afl->mopt_globals_pilot.cycles =
-              afl->stage_cycles_puppet[afl->swarm_now];
-          afl->mopt_globals_pilot.cycles_v2 =
-              afl->stage_cycles_puppet_v2[afl->swarm_now];
-          afl->mopt_globals_pilot.cycles_v3 =
-              afl->stage_cycles_puppet_v3[afl->swarm_now];
-
-        } else {
-
-          for (i = 0; i < operator_num; i++) {
-
-            afl->core_operator_finds_puppet[i] =
-                afl->core_operator_finds_puppet_v2[i];
-            afl->core_operator_cycles_puppet[i] =
-                afl->core_operator_cycles_puppet_v2[i];
+        mopt_period_done(afl, &MOpt_globals);
 
-          }
-
-          afl->key_module = 2;
-
-          afl->old_hit_count = new_hit_cnt;
-
-        }                                                  /* if pilot_mode */
-
-      }         /* if (unlikely(*MOpt_globals.pTime > MOpt_globals.period)) */
+      }
 
     }                                                              /* block */
 
@@ -6052,6 +6154,7 @@ pacemaker_fuzzing:
 }
 
 #undef FLIP_BIT
+#undef MOPT_RAN
 
 u8 core_fuzzing(afl_state_t *afl) {
 
@@ -6065,102 +6168,12 @@ u8 pilot_fuzzing(afl_state_t *afl) {
 
 }
 
-void pso_updating(afl_state_t *afl) {
-
-  afl->g_now++;
-  if (afl->g_now > afl->g_max) { afl->g_now = 0; }
-  afl->w_now =
-      (afl->w_init - afl->w_end) * (afl->g_max - afl->g_now) / (afl->g_max) +
-      afl->w_end;
-  int tmp_swarm, i, j;
-  u64 temp_operator_finds_puppet = 0;
-  for (i = 0; i < operator_num; ++i) {
-
-    afl->operator_finds_puppet[i] = afl->core_operator_finds_puppet[i];
-
-    for (j = 0; j < swarm_num; ++j) {
-
-      afl->operator_finds_puppet[i] =
-          afl->operator_finds_puppet[i] + afl->stage_finds_puppet[j][i];
-
-    }
-
-    temp_operator_finds_puppet =
-        temp_operator_finds_puppet + afl->operator_finds_puppet[i];
-
-  }
-
-  for (i = 0; i < operator_num; ++i) {
-
-    if (afl->operator_finds_puppet[i]) {
-
-      afl->G_best[i] = (double)((double)(afl->operator_finds_puppet[i]) /
-                                (double)(temp_operator_finds_puppet));
-
-    }
-
-  }
-
-  for (tmp_swarm = 0; tmp_swarm < swarm_num; ++tmp_swarm) {
-
-    double x_temp = 0.0;
-    for (i = 0; i < operator_num; ++i) {
-
-      afl->probability_now[tmp_swarm][i] = 0.0;
-      afl->v_now[tmp_swarm][i] =
-          afl->w_now * afl->v_now[tmp_swarm][i] +
-          RAND_C * (afl->L_best[tmp_swarm][i] - afl->x_now[tmp_swarm][i]) +
-          RAND_C * (afl->G_best[i] - afl->x_now[tmp_swarm][i]);
-      afl->x_now[tmp_swarm][i] += afl->v_now[tmp_swarm][i];
-      if (afl->x_now[tmp_swarm][i] > v_max) {
-
-        afl->x_now[tmp_swarm][i] = v_max;
-
-      } else if (afl->x_now[tmp_swarm][i] < v_min) {
-
-        afl->x_now[tmp_swarm][i] = v_min;
-
-      }
-
-      x_temp += afl->x_now[tmp_swarm][i];
-
-    }
-
-    for (i = 0; i < operator_num; ++i) {
-
-      afl->x_now[tmp_swarm][i] = afl->x_now[tmp_swarm][i] / x_temp;
-      if (likely(i != 0)) {
-
-        afl->probability_now[tmp_swarm][i] =
-            afl->probability_now[tmp_swarm][i - 1] + afl->x_now[tmp_swarm][i];
-
-      } else {
-
-        afl->probability_now[tmp_swarm][i] = afl->x_now[tmp_swarm][i];
-
-      }
-
-    }
-
-    if (afl->probability_now[tmp_swarm][operator_num - 1] < 0.99 ||
-        afl->probability_now[tmp_swarm][operator_num - 1] > 1.01) {
-
-      FATAL("ERROR probability");
-
-    }
-
-  }
-
-  afl->swarm_now = 0;
-  afl->key_module = 0;
-
-}
-
 /* The entry point for the mutator, choosing the default mutator, and/or MOpt
    depending on the configuration. */
 u8 fuzz_one(afl_state_t *afl) {
 
   int key_val_lv_1 = -1, key_val_lv_2 = -1;
+  u64 orig_execs = afl->fsrv.total_execs;
 
 #ifdef _AFL_DOCUMENT_MUTATIONS
 
@@ -6187,6 +6200,8 @@ u8 fuzz_one(afl_state_t *afl) {
        limit_time_sig  < 0 both are run
   */
 
+  if (unlikely(afl->afl_env.afl_adaptive_tmout)) { adaptive_tmout_start(afl); }
+
   if (afl->limit_time_sig <= 0) { key_val_lv_1 = fuzz_one_original(afl); }
 
   if (afl->limit_time_sig != 0) {
@@ -6207,6 +6222,14 @@ u8 fuzz_one(afl_state_t *afl) {
 
   }
 
+  if (unlikely(afl->edge_hits)) {
+
+    update_edge_hits(afl, afl->queue_cur, afl->fsrv.total_execs - orig_execs);
+
+  }
+
+  if (unlikely(afl->tmout_deferred_cnt)) { adaptive_tmout_flush(afl); }
+
   if (unlikely(key_val_lv_1 == -1)) { key_val_lv_1 = 0; }
   if (likely(key_val_lv_2 == -1)) { key_val_lv_2 = 0; }
 
@@ -72,51 +72,106 @@ static void *unsupported(afl_state_t *afl, unsigned int seed) {
   it just fills in `&py_mutator->something_buf, &py_mutator->something_size`. */
   #define BUF_PARAMS(name) (void **)&((py_mutator_t *)py_mutator)->name##_buf
 
-static size_t fuzz_py(void *py_mutator, u8 *buf, size_t buf_size, u8 **out_buf,
-                      u8 *add_buf, size_t add_buf_size, size_t max_size) {
+/* Returns a bytearray holding buf, with a new reference for the caller.
+   The bytearray in *cache is reused if nobody but us holds a reference to it
+   anymore (i.e. the python mutator did not keep it), which saves allocating
+   and freeing a python object per argument on every call. */
+static PyObject *py_reuse_bytearray(PyObject **cache, const u8 *buf,
+                                    size_t size) {
 
-  size_t    mutated_size;
-  PyObject *py_args, *py_value;
-  py_args = PyTuple_New(3);
-  py_mutator_t *py = (py_mutator_t *)py_mutator;
+  PyObject *ba = *cache;
 
-  /* buf */
-  py_value = PyByteArray_FromStringAndSize(buf, buf_size);
-  if (!py_value) {
+  if (likely(ba && Py_REFCNT(ba) == 1)) {
 
-    Py_DECREF(py_args);
-    FATAL("Failed to convert arguments");
+    if (likely(PyByteArray_Resize(ba, size) == 0)) {
+
+      if (size) { memcpy(PyByteArray_AS_STRING(ba), buf, size); }
+      Py_INCREF(ba);
+      return ba;
+
+    }
+
+    /* still exported, e.g. a memoryview on it was kept */
+    PyErr_Clear();
 
   }
 
-  PyTuple_SetItem(py_args, 0, py_value);
+  Py_XDECREF(ba);
+  ba = PyByteArray_FromStringAndSize((const char *)buf, size);
+  if (!ba) { FATAL("Failed to convert arguments"); }
 
-  /* add_buf */
-  py_value = PyByteArray_FromStringAndSize(add_buf, add_buf_size);
-  if (!py_value) {
+  *cache = ba;
+  Py_INCREF(ba);
+  return ba;
 
-    Py_DECREF(py_args);
-    FATAL("Failed to convert arguments");
+}
 
-  }
+/* Builds the (buf, add_buf, max_size) argument tuple for fuzz and
+   fuzz_batch, reusing the argument objects from the previous call. */
+static PyObject *fuzz_py_args(py_mutator_t *py, const u8 *buf, size_t buf_size,
+                              u8 *add_buf, size_t add_buf_size,
+                              size_t max_size, u32 n_args) {
 
-  PyTuple_SetItem(py_args, 1, py_value);
+  PyObject *py_args = PyTuple_New(n_args);
 
-  /* max_size */
+  if (!py_args) { FATAL("Failed to convert arguments"); }
+
+  PyTuple_SET_ITEM(py_args, 0,
+                   py_reuse_bytearray(&py->fuzz_arg_buf, buf, buf_size));
+  PyTuple_SET_ITEM(
+      py_args, 1,
+      py_reuse_bytearray(&py->fuzz_arg_add_buf, add_buf, add_buf_size));
+
+  if (unlikely(!py->fuzz_arg_max_size || py->fuzz_max_size != max_size)) {
+
+    Py_XDECREF(py->fuzz_arg_max_size);
   #if PY_MAJOR_VERSION >= 3
-  py_value = PyLong_FromLong(max_size);
+    py->fuzz_arg_max_size = PyLong_FromSize_t(max_size);
   #else
-  py_value = PyInt_FromLong(max_size);
+    py->fuzz_arg_max_size = PyInt_FromSize_t(max_size);
   #endif
-  if (!py_value) {
+    if (!py->fuzz_arg_max_size) { FATAL("Failed to convert arguments"); }
+    py->fuzz_max_size = max_size;
 
-    Py_DECREF(py_args);
-    FATAL("Failed to convert arguments");
+  }
+
+  Py_INCREF(py->fuzz_arg_max_size);
+  PyTuple_SET_ITEM(py_args, 2, py->fuzz_arg_max_size);
+
+  return py_args;
+
+}
+
+/* Copies a python object supporting the buffer protocol (bytes, bytearray,
+   memoryview, ...) to out, at most max_size bytes. Returns the size. */
+static size_t py_buffer_copy(PyObject *py_value, u8 *out, size_t max_size) {
+
+  Py_buffer view;
+  size_t    size;
+
+  if (PyObject_GetBuffer(py_value, &view, PyBUF_SIMPLE) == -1) {
+
+    PyErr_Print();
+    FATAL("Python mutator should return a bytes-like object");
 
   }
 
-  PyTuple_SetItem(py_args, 2, py_value);
+  size = MIN((size_t)view.len, max_size);
+  if (size) { memcpy(out, view.buf, size); }
+  PyBuffer_Release(&view);
+
+  return size;
+
+}
+
+static size_t fuzz_py(void *py_mutator, u8 *buf, size_t buf_size, u8 **out_buf,
+                      u8 *add_buf, size_t add_buf_size, size_t max_size) {
+
+  size_t        mutated_size;
+  PyObject     *py_args, *py_value;
+  py_mutator_t *py = (py_mutator_t *)py_mutator;
 
+  py_args = fuzz_py_args(py, buf, buf_size, add_buf, add_buf_size, max_size, 3);
   py_value = PyObject_CallObject(py->py_functions[PY_FUNC_FUZZ], py_args);
 
   Py_DECREF(py_args);
@@ -151,6 +206,84 @@ static size_t fuzz_py(void *py_mutator, u8 *buf, size_t buf_size, u8 **out_buf,
 
 }
 
+/* fuzz_batch(buf, add_buf, max_size, count) returns a sequence of up to count
+   mutants which are copied straight into the afl-fuzz owned output buffers. */
+u32 fuzz_batch_py(void *py_mutator, const u8 *buf, size_t buf_size,
+                  u8 *add_buf, size_t add_buf_size, u8 **out_bufs,
+                  size_t *out_sizes, u32 batch_size, size_t max_size) {
+
+  PyObject     *py_args, *py_value, *py_seq;
+  py_mutator_t *py = (py_mutator_t *)py_mutator;
+  u32           i, cnt;
+
+  py_args = fuzz_py_args(py, buf, buf_size, add_buf, add_buf_size, max_size, 4);
+
+  #if PY_MAJOR_VERSION >= 3
+  py_value = PyLong_FromLong(batch_size);
+  #else
+  py_value = PyInt_FromLong(batch_size);
+  #endif
+  if (!py_value) {
+
+    Py_DECREF(py_args);
+    FATAL("Failed to convert arguments");
+
+  }
+
+  PyTuple_SET_ITEM(py_args, 3, py_value);
+
+  py_value = PyObject_CallObject(py->py_functions[PY_FUNC_FUZZ_BATCH], py_args);
+
+  Py_DECREF(py_args);
+
+  if (py_value == NULL) {
+
+    PyErr_Print();
+    FATAL("python custom fuzz_batch: call failed");
+
+  }
+
+  py_seq = PySequence_Fast(py_value, "fuzz_batch() should return a sequence");
+  Py_DECREF(py_value);
+
+  if (!py_seq) {
+
+    PyErr_Print();
+    FATAL("python custom fuzz_batch: invalid return value");
+
+  }
+
+  cnt = MIN((u32)PySequence_Fast_GET_SIZE(py_seq), batch_size);
+
+  for (i = 0; i < cnt; ++i) {
+
+    out_sizes[i] = py_buffer_copy(PySequence_Fast_GET_ITEM(py_seq, i),
+                                  out_bufs[i], max_size);
+
+  }
+
+  Py_DECREF(py_seq);
+  return cnt;
+
+}
+
+/* The GIL is held by afl-fuzz at all times, so threads started by a python
+   mutator (e.g. to pre-generate inputs) would only run while a python
+   callback is executing. With AFL_PYTHON_RELEASE_GIL it is released for the
+   duration of each target execution. */
+void py_release_gil(afl_state_t *afl) {
+
+  afl->py_thread_state = PyEval_SaveThread();
+
+}
+
+void py_acquire_gil(afl_state_t *afl) {
+
+  PyEval_RestoreThread((PyThreadState *)afl->py_thread_state);
+  afl->py_thread_state = NULL;
+
+}
+
 static const char *custom_describe_py(void  *py_mutator,
                                       size_t max_description_len) {
 
@@ -230,6 +363,8 @@ static py_mutator_t *init_py_module(afl_state_t *afl, u8 *module_name) {
     py_functions[PY_FUNC_FUZZ] = PyObject_GetAttrString(py_module, "fuzz");
     if (!py_functions[PY_FUNC_FUZZ])
       py_functions[PY_FUNC_FUZZ] = PyObject_GetAttrString(py_module, "mutate");
+    py_functions[PY_FUNC_FUZZ_BATCH] =
+        PyObject_GetAttrString(py_module, "fuzz_batch");
     py_functions[PY_FUNC_DESCRIBE] =
         PyObject_GetAttrString(py_module, "describe");
     py_functions[PY_FUNC_FUZZ_COUNT] =
@@ -303,6 +438,10 @@ void finalize_py_module(void *py_mutator) {
 
   }
 
+  Py_XDECREF(py->fuzz_arg_buf);
+  Py_XDECREF(py->fuzz_arg_add_buf);
+  Py_XDECREF(py->fuzz_arg_max_size);
+
   Py_Finalize();
 
 }
@@ -411,6 +550,14 @@ struct custom_mutator *load_custom_mutator_py(afl_state_t *afl,
 
   if (py_functions[PY_FUNC_FUZZ]) { mutator->afl_custom_fuzz = fuzz_py; }
 
+  if (py_functions[PY_FUNC_FUZZ_BATCH]) {
+
+    mutator->afl_custom_fuzz_batch = fuzz_batch_py;
+
+  }
+
+  if (afl->afl_env.afl_python_release_gil) { afl->py_release_gil = 1; }
+
   if (py_functions[PY_FUNC_DESCRIBE]) {
 
     mutator->afl_custom_describe = custom_describe_py;
@@ -47,7 +47,7 @@ void run_afl_custom_queue_new_entry(afl_state_t *afl, struct queue_entry *q,
 
 inline u32 select_next_queue_entry(afl_state_t *afl) {
 
-  u32    s = rand_below(afl, afl->queued_items);
+  u32    s = rand_below(afl, afl->alias_items);
   double p = rand_next_percent(afl);
 
   /*
@@ -56,7 +56,12 @@ inline u32 select_next_queue_entry(afl_state_t *afl) {
   afl->alias_probability[s] ? s : afl->alias_table[s]);
   */
 
-  return (p < afl->alias_probability[s] ? s : afl->alias_table[s]);
+  s = p < afl->alias_probability[s] ? s : afl->alias_table[s];
+
+  /* archiving and restoring set reinit_table, so the table always matches */
+  if (unlikely(afl->queued_archived)) { return afl->alias_queue[s]->id; }
+
+  return s;
 
 }
 
@@ -68,7 +73,7 @@ double compute_weight(afl_state_t *afl, struct queue_entry *q,
 
   if (likely(afl->schedule >= FAST && afl->schedule <= RARE)) {
 
-    u32 hits = afl->n_fuzz[q->n_fuzz_entry];
+    u32 hits = n_fuzz_get(afl, q->n_fuzz_cksum);
     if (likely(hits)) { weight /= (log10(hits) + 1); }
 
   }
@@ -89,8 +94,40 @@ double compute_weight(afl_state_t *afl, struct queue_entry *q,
 
 void create_alias_table(afl_state_t *afl) {
 
-  u32    n = afl->queued_items, i = 0, nSmall = 0, nLarge = n - 1;
-  double sum = 0;
+  struct queue_entry **queue = afl->queue_buf;
+  u32                  n = afl->queued_items, i = 0, nSmall = 0, nLarge;
+  double               sum = 0;
+
+  /* archived entries are left out of the table entirely */
+
+  if (unlikely(afl->queued_archived)) {
+
+    afl->alias_queue = (struct queue_entry **)afl_realloc(
+        (void **)&afl->alias_queue,
+        (afl->queued_items - afl->queued_archived) * sizeof(void *));
+
+    if (!afl->alias_queue) {
+
+      FATAL("could not acquire memory for alias table");
+
+    }
+
+    for (n = 0, i = 0; i < afl->queued_items; i++) {
+
+      if (likely(!afl->queue_buf[i]->archived)) {
+
+        afl->alias_queue[n++] = afl->queue_buf[i];
+
+      }
+
+    }
+
+    queue = afl->alias_queue;
+
+  }
+
+  afl->alias_items = n;
+  nLarge = n - 1;
 
   double *P = (double *)afl_realloc(AFL_BUF_PARAM(out), n * sizeof(double));
   u32 *Small = (int *)afl_realloc(AFL_BUF_PARAM(out_scratch), n * sizeof(u32));
@@ -121,7 +158,7 @@ void create_alias_table(afl_state_t *afl) {
 
     for (i = 0; i < n; i++) {
 
-      struct queue_entry *q = afl->queue_buf[i];
+      struct queue_entry *q = queue[i];
 
       // disabled entries might have timings and bitmap values
       if (likely(!q->disabled)) {
@@ -141,7 +178,7 @@ void create_alias_table(afl_state_t *afl) {
 
     for (i = 0; i < n; i++) {
 
-      struct queue_entry *q = afl->queue_buf[i];
+      struct queue_entry *q = queue[i];
 
       if (likely(!q->disabled)) {
 
@@ -160,7 +197,7 @@ void create_alias_table(afl_state_t *afl) {
 
       for (i = n - cnt; i < n; i++) {
 
-        struct queue_entry *q = afl->queue_buf[i];
+        struct queue_entry *q = queue[i];
 
         if (likely(!q->disabled)) { q->weight *= 2.0; }
 
@@ -171,13 +208,13 @@ void create_alias_table(afl_state_t *afl) {
     for (i = 0; i < n; i++) {
 
       // weight is always 0 for disabled entries
-      if (unlikely(afl->queue_buf[i]->disabled)) {
+      if (unlikely(queue[i]->disabled)) {
 
         P[i] = 0;
 
       } else {
 
-        P[i] = (afl->queue_buf[i]->weight * n) / sum;
+        P[i] = (queue[i]->weight * n) / sum;
 
       }
 
@@ -185,9 +222,31 @@ void create_alias_table(afl_state_t *afl) {
 
   } else {
 
+    /* FairFuzz: an edge is rare if it is hit at most as often as the next
+       power of two of the least hit edge */
+    if (afl->edge_hits) {
+
+      u32 rare_hits = 0xFFFFFFFF;
+
+      for (i = 0; i < n; i++) {
+
+        struct queue_entry *q = queue[i];
+
+        if (likely(!q->disabled)) {
+
+          rare_hits = MIN(rare_hits, afl->edge_hits[q->rare_edge]);
+
+        }
+
+      }
+
+      afl->rare_edge_cutoff = next_p2(rare_hits);
+
+    }
+
     for (i = 0; i < n; i++) {
 
-      struct queue_entry *q = afl->queue_buf[i];
+      struct queue_entry *q = queue[i];
 
       if (likely(!q->disabled)) {
 
@@ -201,13 +260,13 @@ void create_alias_table(afl_state_t *afl) {
     for (i = 0; i < n; i++) {
 
       // perf_score is always 0 for disabled entries
-      if (unlikely(afl->queue_buf[i]->disabled)) {
+      if (unlikely(queue[i]->disabled)) {
 
         P[i] = 0;
 
       } else {
 
-        P[i] = (afl->queue_buf[i]->perf_score * n) / sum;
+        P[i] = (queue[i]->perf_score * n) / sum;
 
       }
 
@@ -678,6 +737,9 @@ void destroy_queue(afl_state_t *afl) {
     q = afl->queue_buf[i];
     ck_free(q->fname);
     ck_free(q->trace_mini);
+    ck_free(q->splice_sketch);
+    ck_free(q->bandit);
+    ck_free(q->exec_hist);
     ck_free(q);
 
   }
@@ -704,7 +766,7 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
   if (unlikely(afl->schedule >= FAST && afl->schedule < RARE))
     fuzz_p2 = 0;  // Skip the fuzz_p2 comparison
   else if (unlikely(afl->schedule == RARE))
-    fuzz_p2 = next_pow2(afl->n_fuzz[q->n_fuzz_entry]);
+    fuzz_p2 = next_pow2(n_fuzz_get(afl, q->n_fuzz_cksum));
   else
     fuzz_p2 = q->fuzz_level;
 
@@ -718,12 +780,40 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
 
   }
 
+  /* RARE also counts the entries per edge and remembers the least hit edge
+     of this one, see update_edge_hits() */
+  u32 *edge_hits = NULL, rare_hits = 0xFFFFFFFF;
+
+  if (unlikely(afl->schedule == RARE)) {
+
+    if (unlikely(!afl->edge_hits)) {
+
+      afl->edge_hits = ck_alloc(afl->fsrv.map_size * sizeof(u32));
+
+    }
+
+    edge_hits = afl->edge_hits;
+
+  }
+
   /* For every byte set in afl->fsrv.trace_bits[], see if there is a previous
      winner, and how it compares to us. */
   for (i = 0; i < afl->fsrv.map_size; ++i) {
 
     if (afl->fsrv.trace_bits[i]) {
 
+      if (unlikely(edge_hits)) {
+
+        if (likely(edge_hits[i] < 0xFFFFFFFF)) { ++edge_hits[i]; }
+        if (edge_hits[i] < rare_hits) {
+
+          rare_hits = edge_hits[i];
+          q->rare_edge = i;
+
+        }
+
+      }
+
       if (afl->top_rated[i]) {
 
         /* Faster-executing or smaller test cases are favored. */
@@ -731,7 +821,7 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
         u64 top_rated_fuzz_p2;
         if (unlikely(afl->schedule >= FAST && afl->schedule <= RARE))
           top_rated_fuzz_p2 =
-              next_pow2(afl->n_fuzz[afl->top_rated[i]->n_fuzz_entry]);
+              next_pow2(n_fuzz_get(afl, afl->top_rated[i]->n_fuzz_cksum));
         else
           top_rated_fuzz_p2 = afl->top_rated[i]->fuzz_level;
 
@@ -804,6 +894,40 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
 
 }
 
+/* Per edge hit counts for RARE, in the spirit of FairFuzz but without
+   looking at the map of every execution: the execs spent on an entry are
+   credited to all edges in its trace_mini, as its mutants mostly take the
+   same edges. Also refreshes the least hit edge of the entry. */
+
+void update_edge_hits(afl_state_t *afl, struct queue_entry *q, u64 execs) {
+
+  u32 *edge_hits = afl->edge_hits;
+  u32  i, j, len = afl->fsrv.map_size >> 3, rare_hits = 0xFFFFFFFF;
+
+  if (!edge_hits || !q->trace_mini) { return; }
+
+  for (j = 0; j < len; ++j) {
+
+    if (likely(!q->trace_mini[j])) { continue; }
+
+    for (i = j << 3; i < (j + 1) << 3; ++i) {
+
+      if (!(q->trace_mini[j] & (1 << (i & 7)))) { continue; }
+
+      edge_hits[i] = MIN((u64)edge_hits[i] + execs, 0xFFFFFFFF);
+      if (edge_hits[i] < rare_hits) {
+
+        rare_hits = edge_hits[i];
+        q->rare_edge = i;
+
+      }
+
+    }
+
+  }
+
+}
+
 /* The second part of the mechanism discussed above is a routine that
    goes over afl->top_rated[] entries, and then sequentially grabs winners for
    previously-unseen bytes (temp_v) and marks them as favored, at least
@@ -875,6 +999,114 @@ void cull_queue(afl_state_t *afl) {
 
   }
 
+  if (unlikely(afl->afl_env.afl_queue_archive)) { queue_archive(afl); }
+
+}
+
+/* Online corpus reduction (AFL_QUEUE_ARCHIVE): entries that do not win a
+   single edge in afl->top_rated[] any more are dominated in coverage. Once
+   they had their share of fuzzing they are archived: disabled, left out of
+   the alias table and stripped of everything that can be rebuilt from the
+   file. They stay in queue_buf (ids, splicing and syncing are unchanged). */
+
+void queue_archive(afl_state_t *afl) {
+
+  struct queue_entry *q;
+  u32                 i, cnt = 0;
+
+  for (i = 0; i < afl->queued_items; i++) {
+
+    q = afl->queue_buf[i];
+
+    if (likely(q->disabled || q->tc_ref || !q->was_fuzzed ||
+               q->fuzz_level < QUEUE_ARCHIVE_LEVEL || q == afl->queue_cur)) {
+
+      continue;
+
+    }
+
+    q->archived = 1;
+    q->disabled = 1;
+    --afl->active_items;
+    ++cnt;
+
+    ck_free(q->splice_sketch);
+    q->splice_sketch = NULL;
+    q->splice_sketch_cnt = 0;
+
+    if (q->cmplog_colorinput) {
+
+      ck_free(q->cmplog_colorinput);
+      q->cmplog_colorinput = NULL;
+
+    }
+
+    while (q->taint) {
+
+      struct tainted *t = q->taint->next;
+      ck_free(q->taint);
+      q->taint = t;
+
+    }
+
+  }
+
+  if (likely(!cnt)) { return; }
+
+  afl->queued_archived += cnt;
+  afl->reinit_table = 1;
+
+  /* and out of the testcase cache */
+
+  for (i = 0; i < afl->q_testcase_max_cache_count; i++) {
+
+    q = afl->q_testcase_cache[i];
+
+    if (q && q->archived) {
+
+      free(q->testcase_buf);
+      q->testcase_buf = NULL;
+      afl->q_testcase_cache_size -= q->len;
+      afl->q_testcase_cache[i] = NULL;
+      --afl->q_testcase_cache_count;
+      if (i < afl->q_testcase_smallest_free) {
+
+        afl->q_testcase_smallest_free = i;
+
+      }
+
+    }
+
+  }
+
+}
+
+/* Brings all archived entries back into scheduling. Nothing changes their
+   dominance later on (top_rated[] winners are only ever replaced by better
+   ones), so this is done when finds dry up or the schedule changes, and the
+   next change in coverage archives them again. */
+
+void queue_restore(afl_state_t *afl) {
+
+  u32 i;
+
+  for (i = 0; i < afl->queued_items; i++) {
+
+    struct queue_entry *q = afl->queue_buf[i];
+
+    if (q->archived) {
+
+      q->archived = 0;
+      q->disabled = 0;
+      ++afl->active_items;
+
+    }
+
+  }
+
+  afl->queued_archived = 0;
+  afl->reinit_table = 1;
+
 }
 
 /* Calculate case desirability score to adjust the length of havoc fuzzing.
@@ -1032,7 +1264,7 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
 
         if (likely(!afl->queue_buf[i]->disabled)) {
 
-          fuzz_mu += log2(afl->n_fuzz[afl->queue_buf[i]->n_fuzz_entry]);
+          fuzz_mu += log2(n_fuzz_get(afl, afl->queue_buf[i]->n_fuzz_cksum));
           n_items++;
 
         }
@@ -1043,7 +1275,7 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
 
       fuzz_mu = fuzz_mu / n_items;
 
-      if (log2(afl->n_fuzz[q->n_fuzz_entry]) > fuzz_mu) {
+      if (log2(n_fuzz_get(afl, q->n_fuzz_cksum)) > fuzz_mu) {
 
         /* Never skip favourites */
         if (!q->favored) factor = 0;
@@ -1058,7 +1290,7 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
       // Don't modify unfuzzed seeds
       if (!q->fuzz_level) break;
 
-      switch ((u32)log2(afl->n_fuzz[q->n_fuzz_entry])) {
+      switch ((u32)log2(n_fuzz_get(afl, q->n_fuzz_cksum))) {
 
         case 0 ... 1:
           factor = 4;
@@ -1097,15 +1329,15 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
       // Don't modify perf_score for unfuzzed seeds
       if (!q->fuzz_level) break;
 
-      factor = q->fuzz_level / (afl->n_fuzz[q->n_fuzz_entry] + 1);
+      factor = q->fuzz_level / (n_fuzz_get(afl, q->n_fuzz_cksum) + 1);
       break;
 
     case QUAD:
       // Don't modify perf_score for unfuzzed seeds
       if (!q->fuzz_level) break;
 
-      factor =
-          q->fuzz_level * q->fuzz_level / (afl->n_fuzz[q->n_fuzz_entry] + 1);
+      factor = q->fuzz_level * q->fuzz_level /
+               (n_fuzz_get(afl, q->n_fuzz_cksum) + 1);
       break;
 
     case MMOPT:
@@ -1130,8 +1362,24 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
       perf_score += (q->tc_ref * 10);
       // the more often fuzz result paths are equal to this queue entry,
       // reduce its value
-      perf_score *= (1 - (double)((double)afl->n_fuzz[q->n_fuzz_entry] /
+      perf_score *= (1 - (double)((double)n_fuzz_get(afl, q->n_fuzz_cksum) /
                                   (double)afl->fsrv.total_execs));
+      // and more energy to entries that reach a rare edge
+      if (likely(afl->edge_hits)) {
+
+        u32 hits = afl->edge_hits[q->rare_edge];
+
+        if (hits <= afl->rare_edge_cutoff) {
+
+          perf_score *= 4;
+
+        } else if (hits <= afl->rare_edge_cutoff * 4) {
+
+          perf_score *= 2;
+
+        }
+
+      }
 
       break;
 
@@ -1200,6 +1448,12 @@ inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
     ck_read(fd, q->testcase_buf, len, q->fname);
     close(fd);
 
+    queue_splice_sketch(q, q->testcase_buf);
+
+  } else {
+
+    q->splice_sketch_cnt = 0;
+
   }
 
 }
@@ -1228,8 +1482,13 @@ inline void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q,
 
     if (unlikely(!is_same)) { memcpy(q->testcase_buf, in, len); }
 
+    /* the realloc may have moved in as well */
+    in = q->testcase_buf;
+
   }
 
+  queue_splice_sketch(q, in);
+
 }
 
 /* Returns the testcase buf from the file behind this queue entry.
@@ -1267,6 +1526,9 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
     ck_read(fd, buf, len, q->fname);
     close(fd);
+
+    if (unlikely(!q->splice_sketch_cnt)) { queue_splice_sketch(q, buf); }
+
     return buf;
 
   }
@@ -1369,6 +1631,12 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
     ck_read(fd, q->testcase_buf, len, q->fname);
     close(fd);
 
+    if (unlikely(!q->splice_sketch_cnt)) {
+
+      queue_splice_sketch(q, q->testcase_buf);
+
+    }
+
     /* Register testcase as cached */
     afl->q_testcase_cache[tid] = q;
     afl->q_testcase_cache_size += len;
@@ -1396,6 +1664,8 @@ inline void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q,
 
   u32 len = q->len;
 
+  queue_splice_sketch(q, mem);
+
   if (unlikely(afl->q_testcase_cache_size + len >=
                    afl->q_testcase_max_cache_size ||
                afl->q_testcase_cache_count >=
@@ -1452,3 +1722,132 @@ inline void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q,
 
 }
 
+/* Splice sketches. The content of each entry is summarized by the hashes of
+   its aligned blocks of SPLICE_SKETCH_BLOCK << lvl bytes, lvl being chosen
+   so that at most SPLICE_SKETCH_LEN blocks are needed. The block hash is the
+   polynomial sum((buf[i] + 1) * P^i), hence the hash of adjacent blocks can
+   be combined from theirs and entries using different block sizes can still
+   be compared with each other - without loading them. */
+
+#define SPLICE_SKETCH_MUL 0x9e3779b97f4a7c15ULL
+
+/* P^(SPLICE_SKETCH_BLOCK << lvl), to append a block of that size */
+
+static inline u64 splice_sketch_pow(u32 lvl) {
+
+  u64 p = SPLICE_SKETCH_MUL;
+  u32 n = lvl + __builtin_ctz(SPLICE_SKETCH_BLOCK);
+
+  while (n--) {
+
+    p *= p;
+
+  }
+
+  return p;
+
+}
+
+void queue_splice_sketch(struct queue_entry *q, u8 *buf) {
+
+  u32 lvl = 0, blk, cnt, i;
+
+  while ((u64)(SPLICE_SKETCH_BLOCK << lvl) * SPLICE_SKETCH_LEN < q->len) {
+
+    ++lvl;
+
+  }
+
+  blk = SPLICE_SKETCH_BLOCK << lvl;
+  cnt = (q->len + blk - 1) / blk;
+
+  /* Only as many hashes as the entry has blocks, the length can change. */
+
+  if (cnt != q->splice_sketch_cnt || !q->splice_sketch) {
+
+    q->splice_sketch = ck_realloc(q->splice_sketch, cnt * sizeof(u64));
+
+  }
+
+  for (i = 0; i < cnt; ++i) {
+
+    u32 from = i * blk, to = MIN(from + blk, q->len);
+    u64 h = 0;
+
+    while (to > from) {
+
+      h = h * SPLICE_SKETCH_MUL + buf[--to] + 1;
+
+    }
+
+    q->splice_sketch[i] = h;
+
+  }
+
+  q->splice_sketch_cnt = cnt;
+  q->splice_sketch_lvl = lvl;
+
+}
+
+/* Hash of block k at level lvl (>= the level of the entry) */
+
+static u64 splice_sketch_block(struct queue_entry *q, u32 lvl, u32 k) {
+
+  u32 shift = lvl - q->splice_sketch_lvl;
+  u32 i = k << shift, end = MIN((k + 1) << shift, q->splice_sketch_cnt);
+  u64 h = 0, pw = 1, step = splice_sketch_pow(q->splice_sketch_lvl);
+
+  for (; i < end; ++i) {
+
+    h += pw * q->splice_sketch[i];
+    pw *= step;
+
+  }
+
+  return h;
+
+}
+
+/* Returns 0 if the common part of a and b is identical according to their
+   sketches. Otherwise [*from, *to) is set to the part that contains the first
+   and the last difference - the whole common length if a sketch is missing -
+   so locate_diffs() only has to look there. */
+
+u8 queue_splice_diff(struct queue_entry *a, struct queue_entry *b, u32 *from,
+                     u32 *to) {
+
+  u32 len = MIN(a->len, b->len), lvl, blk, cnt, k;
+  s32 first = -1, last = -1;
+
+  *from = 0;
+  *to = len;
+
+  if (unlikely(!a->splice_sketch_cnt || !b->splice_sketch_cnt)) { return 1; }
+
+  lvl = MAX(a->splice_sketch_lvl, b->splice_sketch_lvl);
+  blk = SPLICE_SKETCH_BLOCK << lvl;
+  cnt = (len + blk - 1) / blk;
+
+  for (k = 0; k < cnt; ++k) {
+
+    /* a block cut short by the end of only one entry cannot be compared */
+
+    if (((u64)(k + 1) * blk > len && a->len != b->len) ||
+        splice_sketch_block(a, lvl, k) != splice_sketch_block(b, lvl, k)) {
+
+      if (first < 0) { first = k; }
+      last = k;
+
+    }
+
+  }
+
+  if (first < 0) { return 0; }
+
+  *from = first * blk;
+  *to = MIN((u64)(last + 1) * blk, len);
+
+  return 1;
+
+}
+
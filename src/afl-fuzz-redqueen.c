@@ -161,9 +161,15 @@ static void dump_file(char *path, char *name, u32 counter, u8 *buf, u32 len) {
 
 static u8 get_exec_checksum(afl_state_t *afl, u8 *buf, u32 len, u64 *cksum) {
 
-  if (unlikely(common_fuzz_stuff(afl, buf, len))) { return 1; }
+  u8 ret;
+
+  afl->want_exec_cksum = 1;
+  ret = common_fuzz_stuff(afl, buf, len);
+  afl->want_exec_cksum = 0;
 
-  *cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+  if (unlikely(ret)) { return 1; }
+
+  *cksum = afl->last_exec_cksum;
 
   return 0;
 
@@ -304,8 +310,8 @@ static u8 colorization(afl_state_t *afl, u8 *buf, u32 len,
   afl->stage_max = (len << 1);
   afl->stage_cur = 0;
 
-  // in colorization we do not classify counts, hence we have to calculate
-  // the original checksum.
+  // calculate the original checksum from a fresh run so that it is
+  // comparable to the ones produced below.
   if (unlikely(get_exec_checksum(afl, buf, len, &exec_cksum))) {
 
     goto checksum_fail;
@@ -2686,6 +2692,104 @@ static u8 rtn_fuzz(afl_state_t *afl, u32 key, u8 *orig_buf, u8 *buf, u8 *cbuf,
 ///// Input to State stage
 
 // afl->queue_cur->exec_cksum
+/* Adds a pair of compare operands to the table of recent compares for the
+   custom mutators, unless it was added recently */
+
+static void cmp_tokens_add(afl_state_t *afl, u8 *v0, u32 l0, u8 *v1, u32 l1) {
+
+  struct cmp_tokens *ct = afl->cmp_tokens;
+  u64                hash;
+  u32                slot, *seen;
+
+  if (l0 == l1 && !memcmp(v0, v1, l0)) { return; }
+
+  hash = hash64(v0, l0, HASH_CONST) ^ (hash64(v1, l1, HASH_CONST) << 1);
+  seen = &afl->cmp_tokens_seen[hash & (CMP_TOKENS - 1)];
+  if (*seen == (u32)(hash >> 32)) { return; }
+  *seen = (u32)(hash >> 32);
+
+  slot = ct->cnt % CMP_TOKENS;
+  memcpy(ct->tok[slot].val, v0, l0);
+  ct->tok[slot].len = l0;
+  memcpy(ct->tok[slot + 1].val, v1, l1);
+  ct->tok[slot + 1].len = l1;
+  ct->cnt += 2;
+
+}
+
+/* Copies the operands of all logged compares of the original input into the
+   table of recent compares. Runs once per cmplog stage, not per exec. */
+
+static void cmp_tokens_collect(afl_state_t *afl, struct cmp_map *map) {
+
+  u32 k, i, loggeds;
+
+  if (unlikely(!afl->cmp_tokens_seen)) {
+
+    afl->cmp_tokens_seen = ck_alloc(sizeof(u32) * CMP_TOKENS);
+
+  }
+
+  for (k = 0; k < CMP_MAP_W; ++k) {
+
+    struct cmp_header *h = &map->headers[k];
+    u32                size = SHAPE_BYTES(h->shape);
+
+    if (!h->hits) { continue; }
+
+    if (h->type == CMP_TYPE_INS) {
+
+      /* single bytes are found by havoc anyway */
+      if (size < 2) { continue; }
+      loggeds = MIN((u32)h->hits, (u32)CMP_MAP_H);
+
+      for (i = 0; i < loggeds; ++i) {
+
+        struct cmp_operands *o = &map->log[k][i];
+        u8                   v0[16], v1[16];
+
+        if (size <= 8) {
+
+#if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+          cmp_tokens_add(afl, (u8 *)&o->v0, size, (u8 *)&o->v1, size);
+#else
+          cmp_tokens_add(afl, (u8 *)&o->v0 + 8 - size, size,
+                         (u8 *)&o->v1 + 8 - size, size);
+#endif
+
+        } else {
+
+          size = MIN(size, 16U);
+          memcpy(v0, &o->v0, 8);
+          memcpy(v0 + 8, &o->v0_128, 8);
+          memcpy(v1, &o->v1, 8);
+          memcpy(v1 + 8, &o->v1_128, 8);
+          cmp_tokens_add(afl, v0, size, v1, size);
+
+        }
+
+      }
+
+    } else {
+
+      loggeds = MIN((u32)h->hits, (u32)CMP_MAP_RTN_H);
+
+      for (i = 0; i < loggeds; ++i) {
+
+        struct cmpfn_operands *o = &((struct cmpfn_operands *)map->log[k])[i];
+        u32                    l0 = MIN(o->v0_len & 0x7f, 31);
+        u32                    l1 = MIN(o->v1_len & 0x7f, 31);
+
+        if (l0 && l1) { cmp_tokens_add(afl, o->v0, l0, o->v1, l1); }
+
+      }
+
+    }
+
+  }
+
+}
+
 u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len) {
 
   u8 r = 1;
@@ -2725,6 +2829,22 @@ u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len) {
       fprintf(stderr, "TAINT FAILED\n");
 #endif
       afl->queue_cur->colorized = CMPLOG_LVL_MAX;
+
+      /* the compares are still interesting for the custom mutators */
+      if (afl->cmp_tokens) {
+
+        memset(afl->shm.cmp_map->headers, 0,
+               sizeof(struct cmp_header) * CMP_MAP_W);
+        if (unlikely(common_fuzz_cmplog_stuff(afl, orig_buf, len))) {
+
+          return 1;
+
+        }
+
+        cmp_tokens_collect(afl, afl->shm.cmp_map);
+
+      }
+
       return 0;
 
     }
@@ -2787,6 +2907,8 @@ u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len) {
   }
 
   memcpy(afl->orig_cmp_map, afl->shm.cmp_map, sizeof(struct cmp_map));
+  if (afl->cmp_tokens) { cmp_tokens_collect(afl, afl->orig_cmp_map); }
+
   memset(afl->shm.cmp_map->headers, 0, sizeof(struct cmp_header) * CMP_MAP_W);
   if (unlikely(common_fuzz_cmplog_stuff(afl, buf, len))) {
 
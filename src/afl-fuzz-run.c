@@ -58,8 +58,16 @@ fuzz_run_target(afl_state_t *afl, afl_forkserver_t *fsrv, u32 timeout) {
 
 #endif
 
+#ifdef USE_PYTHON
+  if (unlikely(afl->py_release_gil)) { py_release_gil(afl); }
+#endif
+
   fsrv_run_result_t res = afl_fsrv_run_target(fsrv, timeout, &afl->stop_soon);
 
+#ifdef USE_PYTHON
+  if (unlikely(afl->py_release_gil)) { py_acquire_gil(afl); }
+#endif
+
 #ifdef PROFILING
   clock_gettime(CLOCK_REALTIME, &spec);
   time_spent_start = (spec.tv_sec * 1000000000) + spec.tv_nsec;
@@ -527,12 +535,12 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
     if (unlikely(!q->bitsmap_size)) q->bitsmap_size = afl->bitsmap_size;
 #endif
 
-    classify_counts(&afl->fsrv);
-    cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
-    if (q->exec_cksum != cksum) {
+    /* Classify, hash and check for new bits in one pass. If the checksum
+       matches the entry's, the new bits check is a no-op anyway. */
+    hnb = has_new_bits_cksum(afl, afl->virgin_bits, &cksum);
+    if (hnb > new_bits) { new_bits = hnb; }
 
-      hnb = has_new_bits(afl, afl->virgin_bits);
-      if (hnb > new_bits) { new_bits = hnb; }
+    if (q->exec_cksum != cksum) {
 
       if (q->exec_cksum) {
 
@@ -874,7 +882,9 @@ void sync_fuzzers(afl_state_t *afl) {
 
 /* Trim all new test cases to save cycles when doing deterministic checks. The
    trimmer uses power-of-two increments somewhere between 1/16 and 1/1024 of
-   file size, to keep the stage short and sweet. */
+   file size, to keep the stage short and sweet. Chunk sizes and input sizes
+   that rarely trimmed anything on this target so far are skipped, see
+   TRIM_LEARN_* in config.h. */
 
 u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
@@ -907,10 +917,11 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
   }
 
-  u8  needs_write = 0, fault = 0;
+  u8  needs_write = 0, fault = 0, explore;
   u32 trim_exec = 0;
   u32 remove_len;
   u32 len_p2;
+  u32 size_lvl;
 
   u8 val_bufs[2][STRINGIFY_VAL_SIZE_MAX];
 
@@ -920,6 +931,19 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
   if (q->len < 5) { return 0; }
 
+  /* Skip input sizes for which trimming hardly removed anything so far. */
+
+  size_lvl = 31 - __builtin_clz(q->len);
+  explore = !rand_below(afl, TRIM_LEARN_EXPLORE);
+
+  if (!explore && afl->trim_size_runs[size_lvl] >= TRIM_LEARN_RUNS &&
+      (afl->trim_size_in[size_lvl] - afl->trim_size_out[size_lvl]) * 100 <
+          afl->trim_size_in[size_lvl] * TRIM_LEARN_MIN_GAIN) {
+
+    return 0;
+
+  }
+
   afl->stage_name = afl->stage_name_buf;
   afl->bytes_trim_in += q->len;
 
@@ -935,6 +959,18 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
   while (remove_len >= MAX(len_p2 / TRIM_END_STEPS, (u32)TRIM_MIN_BYTES)) {
 
     u32 remove_pos = remove_len;
+    u32 chunk_lvl = 31 - __builtin_clz(remove_len);
+
+    /* Skip chunk sizes that (almost) never could be removed so far. */
+
+    if (!explore && afl->trim_chunk_execs[chunk_lvl] >= TRIM_LEARN_EXECS &&
+        afl->trim_chunk_hits[chunk_lvl] * 100 <
+            afl->trim_chunk_execs[chunk_lvl] * TRIM_LEARN_MIN_HITS) {
+
+      remove_len >>= 1;
+      continue;
+
+    }
 
     sprintf(afl->stage_name_buf, "trim %s/%s",
             u_stringify_int(val_bufs[0], remove_len),
@@ -958,8 +994,8 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
        */
 
       ++afl->trim_execs;
-      classify_counts(&afl->fsrv);
-      cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+      ++afl->trim_chunk_execs[chunk_lvl];
+      cksum = classify_and_hash(&afl->fsrv);
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
@@ -970,6 +1006,7 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
         u32 move_tail = q->len - remove_pos - trim_avail;
 
+        ++afl->trim_chunk_hits[chunk_lvl];
         q->len -= trim_avail;
         len_p2 = next_pow2(q->len);
 
@@ -1046,11 +1083,193 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
 abort_trimming:
 
+  ++afl->trim_size_runs[size_lvl];
+  afl->trim_size_in[size_lvl] += orig_len;
+  afl->trim_size_out[size_lvl] += q->len;
+
   afl->bytes_trim_out += q->len;
   return fault;
 
 }
 
+/* Adaptive timeouts (AFL_ADAPTIVE_TMOUT). Mutants of the current entry are
+   killed at fuzz_tmout, derived from the run times of earlier mutants of
+   the same entry, instead of exec_tmout. An early killed run is not
+   treated as a timeout. If its partial trace is new it is deferred, and
+   adaptive_tmout_flush() re-runs it with exec_tmout after fuzz_one() (or
+   once ADAPTIVE_TMOUT_DEFER of them are waiting) and hands it to
+   save_if_interesting(), which deduplicates on the full trace and confirms
+   hangs with hang_tmout as usual. A slow input that takes a known path up
+   to fuzz_tmout only costs the short run: it is counted in early_kills and
+   dropped, whatever it would have done after the deadline. */
+
+static u32 adaptive_tmout_deadline(afl_state_t *afl, struct queue_entry *q) {
+
+  u32 *hist = q->exec_hist, b, sum = 0, want;
+
+  if (hist[0] < ADAPTIVE_TMOUT_SAMPLES) { return afl->fsrv.exec_tmout; }
+
+  want = (u64)hist[0] * ADAPTIVE_TMOUT_PERMILLE / 1000;
+
+  for (b = 1; b < ADAPTIVE_TMOUT_BUCKETS; ++b) {
+
+    sum += hist[b];
+    if (sum > want) { break; }
+
+  }
+
+  /* bucket b holds run times below 2^b ms */
+  return MIN(afl->fsrv.exec_tmout,
+             MAX(ADAPTIVE_TMOUT_MIN, ADAPTIVE_TMOUT_MULT << b));
+
+}
+
+void adaptive_tmout_start(afl_state_t *afl) {
+
+  struct queue_entry *q = afl->queue_cur;
+
+  if (unlikely(!q->exec_hist)) {
+
+    q->exec_hist = ck_alloc((ADAPTIVE_TMOUT_BUCKETS + 1) * sizeof(u32));
+
+  }
+
+  afl->fuzz_tmout = adaptive_tmout_deadline(afl, q);
+
+}
+
+static inline void adaptive_tmout_sample(afl_state_t *afl) {
+
+  u32 *hist = afl->queue_cur->exec_hist, ms = afl->fsrv.last_exec_ms, n;
+
+  if (unlikely(!ms || hist[0] == 0xFFFFFFFF)) { return; }
+
+  ++hist[MIN(32 - __builtin_clz(ms), ADAPTIVE_TMOUT_BUCKETS)];
+  n = ++hist[0];
+
+  /* refine the deadline at 256, 512, 1024, ... samples */
+  if (unlikely(!(n & (n - 1)) && n >= ADAPTIVE_TMOUT_SAMPLES)) {
+
+    afl->fuzz_tmout = adaptive_tmout_deadline(afl, afl->queue_cur);
+
+  }
+
+}
+
+/* mem is the input as the stage made it, write_to_testcase() applies
+   afl_custom_post_process again on the re-run. */
+
+static void adaptive_tmout_defer(afl_state_t *afl, u8 *mem, u32 len) {
+
+  struct tmout_deferred *d;
+
+  ++afl->early_kills;
+
+  /* the bitflip stage reads last_exec_cksum after every run */
+
+  if (unlikely(afl->want_exec_cksum)) {
+
+    afl->last_exec_cksum = classify_and_hash(&afl->fsrv);
+
+  } else {
+
+    classify_counts(&afl->fsrv);
+
+  }
+
+  simplify_trace(afl, afl->fsrv.trace_bits);
+
+  if (unlikely(!afl->virgin_early)) {
+
+    afl->virgin_early = ck_alloc_nozero(afl->fsrv.map_size);
+    memset(afl->virgin_early, 255, afl->fsrv.map_size);
+
+  }
+
+  if (likely(!has_new_bits(afl, afl->virgin_early))) { return; }
+
+  if (unlikely(afl->tmout_deferred_cnt == ADAPTIVE_TMOUT_DEFER)) {
+
+    adaptive_tmout_flush(afl);
+
+  }
+
+  if (unlikely(!afl->tmout_deferred)) {
+
+    afl->tmout_deferred =
+        ck_alloc(ADAPTIVE_TMOUT_DEFER * sizeof(struct tmout_deferred));
+
+  }
+
+  d = &afl->tmout_deferred[afl->tmout_deferred_cnt++];
+  d->buf = ck_alloc_nozero(len);
+  memcpy(d->buf, mem, len);
+  d->len = len;
+  d->stage_short = afl->stage_short;
+  d->stage_cur_byte = afl->stage_cur_byte;
+  d->stage_cur_val = afl->stage_cur_val;
+  d->stage_val_type = afl->stage_val_type;
+  d->splicing_with = afl->splicing_with;
+
+}
+
+void adaptive_tmout_flush(afl_state_t *afl) {
+
+  struct custom_mutator *custom_fuzz = afl->current_custom_fuzz;
+  u8                    *stage_name = afl->stage_name;
+  u8                    *stage_short = afl->stage_short;
+  s32                    stage_cur_byte = afl->stage_cur_byte,
+      stage_cur_val = afl->stage_cur_val, splicing_with = afl->splicing_with;
+  u8  stage_val_type = afl->stage_val_type;
+  u64 last_exec_cksum = afl->last_exec_cksum;
+  u32 i;
+
+  afl->stage_name = "tmout confirm";
+  afl->current_custom_fuzz = NULL;
+
+  for (i = 0; i < afl->tmout_deferred_cnt; ++i) {
+
+    struct tmout_deferred *d = &afl->tmout_deferred[i];
+    void                  *mem = d->buf;
+    u32                    len;
+    u8                     fault;
+
+    if (likely(!afl->stop_soon) &&
+        likely(len = write_to_testcase(afl, &mem, d->len, 0))) {
+
+      fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+
+      if (likely(!afl->stop_soon)) {
+
+        afl->stage_short = d->stage_short;
+        afl->stage_cur_byte = d->stage_cur_byte;
+        afl->stage_cur_val = d->stage_cur_val;
+        afl->stage_val_type = d->stage_val_type;
+        afl->splicing_with = d->splicing_with;
+
+        afl->queued_discovered += save_if_interesting(afl, mem, len, fault);
+
+      }
+
+    }
+
+    ck_free(d->buf);
+
+  }
+
+  /* this can run in the middle of a stage, which must not notice */
+  afl->tmout_deferred_cnt = 0;
+  afl->stage_name = stage_name;
+  afl->stage_short = stage_short;
+  afl->stage_cur_byte = stage_cur_byte;
+  afl->stage_cur_val = stage_cur_val;
+  afl->stage_val_type = stage_val_type;
+  afl->splicing_with = splicing_with;
+  afl->last_exec_cksum = last_exec_cksum;
+  afl->current_custom_fuzz = custom_fuzz;
+
+}
+
 /* Write a modified test case, run program, process results. Handle
    error conditions, returning 1 if it's time to bail out. This is
    a helper function for fuzz_one(). */
@@ -1058,7 +1277,9 @@ abort_trimming:
 u8 __attribute__((hot))
 common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
-  u8 fault;
+  u8  fault, early_kill = 0;
+  u8 *orig_buf = out_buf;
+  u32 orig_len = len;
 
   if (unlikely(len = write_to_testcase(afl, (void **)&out_buf, len, 0)) == 0) {
 
@@ -1066,13 +1287,33 @@ common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
   }
 
-  fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+  if (unlikely(afl->afl_env.afl_adaptive_tmout)) {
+
+    fault = fuzz_run_target(afl, &afl->fsrv, afl->fuzz_tmout);
+
+    if (likely(fault != FSRV_RUN_TMOUT)) {
+
+      adaptive_tmout_sample(afl);
+
+    } else if (afl->fuzz_tmout < afl->fsrv.exec_tmout && !afl->stop_soon) {
+
+      early_kill = 1;
+
+    }
+
+  } else {
+
+    fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+
+  }
 
   if (afl->stop_soon) { return 1; }
 
+  /* Early kills do not count, the input might not time out at all. */
+
   if (fault == FSRV_RUN_TMOUT) {
 
-    if (afl->subseq_tmouts++ > TMOUT_LIMIT) {
+    if (likely(!early_kill) && afl->subseq_tmouts++ > TMOUT_LIMIT) {
 
       ++afl->cur_skipped_items;
       return 1;
@@ -1096,9 +1337,17 @@ common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
   }
 
-  /* This handles FAULT_ERROR for us: */
+  if (unlikely(early_kill)) {
+
+    adaptive_tmout_defer(afl, orig_buf, orig_len);
+
+  } else {
 
-  afl->queued_discovered += save_if_interesting(afl, out_buf, len, fault);
+    /* This handles FAULT_ERROR for us: */
+
+    afl->queued_discovered += save_if_interesting(afl, out_buf, len, fault);
+
+  }
 
   if (!(afl->stage_cur % afl->stats_update_freq) ||
       afl->stage_cur + 1 == afl->stage_max) {
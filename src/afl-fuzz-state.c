@@ -41,11 +41,7 @@ char *power_names[POWER_SCHEDULES_NUM] = {"explore", "mmopt", "exploit",
 static void init_mopt_globals(afl_state_t *afl) {
 
   MOpt_globals_t *core = &afl->mopt_globals_core;
-  core->finds = afl->core_operator_finds_puppet;
-  core->finds_v2 = afl->core_operator_finds_puppet_v2;
-  core->cycles = afl->core_operator_cycles_puppet;
-  core->cycles_v2 = afl->core_operator_cycles_puppet_v2;
-  core->cycles_v3 = afl->core_operator_cycles_puppet_v3;
+  core->stats = &afl->mopt_core;
   core->is_pilot_mode = 0;
   core->pTime = &afl->tmp_core_time;
   core->period = period_core;
@@ -55,11 +51,7 @@ static void init_mopt_globals(afl_state_t *afl) {
   core->splice_stagenameshort = "MOpt_core_splice";
 
   MOpt_globals_t *pilot = &afl->mopt_globals_pilot;
-  pilot->finds = afl->stage_finds_puppet[0];
-  pilot->finds_v2 = afl->stage_finds_puppet_v2[0];
-  pilot->cycles = afl->stage_cycles_puppet[0];
-  pilot->cycles_v2 = afl->stage_cycles_puppet_v2[0];
-  pilot->cycles_v3 = afl->stage_cycles_puppet_v3[0];
+  pilot->stats = &afl->mopt_swarm[0].stats;
   pilot->is_pilot_mode = 1;
   pilot->pTime = &afl->tmp_pilot_time;
   pilot->period = period_pilot;
@@ -276,6 +268,41 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_custom_mutator_only =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_ADAPTIVE_TMOUT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_adaptive_tmout =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_QUEUE_ARCHIVE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_queue_archive =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_MOPT_SHARE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_mopt_share =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_CUSTOM_MUTATOR_BANDIT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_custom_mutator_bandit =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_CUSTOM_MUTATOR_ISOLATE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_custom_mutator_isolate =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_CMPLOG_ONLY_NEW",
 
                               afl_environment_variable_len)) {
@@ -409,6 +436,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_post_process_keep_original =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_PYTHON_RELEASE_GIL",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_python_release_gil =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_TMPDIR",
 
                               afl_environment_variable_len)) {
@@ -491,6 +525,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_statsd_tags_flavor =
                 (u8 *)get_afl_env(afl_environment_variables[i]);
 
+          } else if (!strncmp(env, "AFL_CRASH_BUCKET_LIMIT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_crash_bucket_limit =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
           } else if (!strncmp(env, "AFL_CRASH_EXITCODE",
 
                               afl_environment_variable_len)) {
@@ -536,6 +577,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_target_env =
                 (u8 *)get_afl_env(afl_environment_variables[i]);
 
+          } else if (!strncmp(env, "AFL_TARGETED_EXTRAS",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_targeted_extras =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_INPUT_LEN_MIN",
 
                               afl_environment_variable_len)) {
@@ -686,14 +734,20 @@ void afl_state_deinit(afl_state_t *afl) {
   if (afl->pass_stats) { ck_free(afl->pass_stats); }
   if (afl->orig_cmp_map) { ck_free(afl->orig_cmp_map); }
   if (afl->cmplog_binary) { ck_free(afl->cmplog_binary); }
+  if (afl->edge_hits) { ck_free(afl->edge_hits); }
+  if (afl->virgin_early) { ck_free(afl->virgin_early); }
+  if (afl->tmout_deferred) { ck_free(afl->tmout_deferred); }
+  if (afl->crash_bucket) { ck_free(afl->crash_bucket); }
 
   afl_free(afl->queue_buf);
+  afl_free(afl->alias_queue);
   afl_free(afl->out_buf);
   afl_free(afl->out_scratch_buf);
   afl_free(afl->eff_buf);
   afl_free(afl->in_buf);
   afl_free(afl->in_scratch_buf);
   afl_free(afl->ex_buf);
+  afl_free(afl->extras_pos_buf);
 
   ck_free(afl->virgin_bits);
   ck_free(afl->virgin_tmout);
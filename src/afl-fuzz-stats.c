@@ -383,6 +383,56 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
           : "default",
       afl->orig_cmdline);
 
+  if (afl->afl_env.afl_adaptive_tmout) {
+
+    fprintf(f, "early_kills       : %llu\n", afl->early_kills);
+
+  }
+
+  if (afl->afl_env.afl_queue_archive) {
+
+    fprintf(f, "corpus_archived   : %u\n", afl->queued_archived);
+
+  }
+
+  if (afl->crash_bucket_limit) {
+
+    fprintf(f,
+            "crash_buckets     : %u\n"
+            "crashes_limited   : %llu\n",
+            afl->crash_buckets, afl->crashes_limited);
+
+  }
+
+  /* recent finds/execs of the mutators sharing the exec budget */
+
+  if (afl->mutator_bandit) {
+
+    struct mutator_bandit_arm *g = afl->mutator_bandit;
+
+    fprintf(f, "mutator_bandit    :");
+    LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
+
+      if (el->afl_custom_fuzz || el->afl_custom_fuzz_batch) {
+
+        fprintf(f, " %s=%.0f/%.0f", el->name_short, g[el->bandit_arm].finds,
+                g[el->bandit_arm].execs);
+
+      }
+
+    });
+
+    if (!afl->custom_only) {
+
+      fprintf(f, " havoc=%.0f/%.0f", g[afl->custom_mutators_count].finds,
+              g[afl->custom_mutators_count].execs);
+
+    }
+
+    fprintf(f, "\n");
+
+  }
+
   /* ignore errors */
 
   if (afl->debug) {
@@ -255,9 +255,11 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_BENCH_JUST_ONE: run the target just once\n"
       "AFL_BENCH_UNTIL_CRASH: exit soon when the first crashing input has been found\n"
       "AFL_CMPLOG_ONLY_NEW: do not run cmplog on initial testcases (good for resumes!)\n"
+      "AFL_CRASH_BUCKET_LIMIT: save at most this many crashes per crash stack\n"
       "AFL_CRASH_EXITCODE: optional child exit code to be interpreted as crash\n"
       "AFL_CUSTOM_MUTATOR_LIBRARY: lib with afl_custom_fuzz() to mutate inputs\n"
       "AFL_CUSTOM_MUTATOR_ONLY: avoid AFL++'s internal mutators\n"
+      "AFL_CUSTOM_MUTATOR_ISOLATE: run custom mutator libraries in a separate process\n"
       "AFL_CYCLE_SCHEDULES: after completing a cycle, switch to a different -p schedule\n"
       "AFL_DEBUG: extra debugging output for Python mode trimming\n"
       "AFL_DEBUG_CHILD: do not suppress stdout/stderr from target\n"
@@ -310,6 +312,7 @@ static void usage(u8 *argv0, int more_help) {
 
       "AFL_PATH: path to AFL support binaries\n"
       "AFL_PYTHON_MODULE: mutate and trim inputs with the specified Python module\n"
+      "AFL_PYTHON_RELEASE_GIL: let Python mutator threads run while the target executes\n"
       "AFL_QUIET: suppress forkserver status messages\n"
 
       PERSISTENT_MSG
@@ -318,6 +321,8 @@ static void usage(u8 *argv0, int more_help) {
       "                                the queue, but execute the post-processed one\n"
       "AFL_PRELOAD: LD_PRELOAD / DYLD_INSERT_LIBRARIES settings for target\n"
       "AFL_TARGET_ENV: pass extra environment variables to target\n"
+      "AFL_TARGETED_EXTRAS: deterministic dictionary steps only at offsets where\n"
+      "                     a dictionary token (prefix) is present in the input\n"
       "AFL_SHUFFLE_QUEUE: reorder the input queue randomly on startup\n"
       "AFL_SKIP_BIN_CHECK: skip afl compatibility checks, also disables auto map size\n"
       "AFL_SKIP_CPUFREQ: do not warn about variable cpu clocking\n"
@@ -1203,109 +1208,7 @@ int main(int argc, char **argv_orig, char **envp) {
         }
 
         afl->limit_time_puppet = limit_time_puppet2;
-        afl->swarm_now = 0;
-        if (afl->limit_time_puppet == 0) { afl->key_puppet = 1; }
-
-        int j;
-        int tmp_swarm = 0;
-
-        if (afl->g_now > afl->g_max) { afl->g_now = 0; }
-        afl->w_now = (afl->w_init - afl->w_end) * (afl->g_max - afl->g_now) /
-                         (afl->g_max) +
-                     afl->w_end;
-
-        for (tmp_swarm = 0; tmp_swarm < swarm_num; ++tmp_swarm) {
-
-          double total_puppet_temp = 0.0;
-          afl->swarm_fitness[tmp_swarm] = 0.0;
-
-          for (j = 0; j < operator_num; ++j) {
-
-            afl->stage_finds_puppet[tmp_swarm][j] = 0;
-            afl->probability_now[tmp_swarm][j] = 0.0;
-            afl->x_now[tmp_swarm][j] =
-                ((double)(random() % 7000) * 0.0001 + 0.1);
-            total_puppet_temp += afl->x_now[tmp_swarm][j];
-            afl->v_now[tmp_swarm][j] = 0.1;
-            afl->L_best[tmp_swarm][j] = 0.5;
-            afl->G_best[j] = 0.5;
-            afl->eff_best[tmp_swarm][j] = 0.0;
-
-          }
-
-          for (j = 0; j < operator_num; ++j) {
-
-            afl->stage_cycles_puppet_v2[tmp_swarm][j] =
-                afl->stage_cycles_puppet[tmp_swarm][j];
-            afl->stage_finds_puppet_v2[tmp_swarm][j] =
-                afl->stage_finds_puppet[tmp_swarm][j];
-            afl->x_now[tmp_swarm][j] =
-                afl->x_now[tmp_swarm][j] / total_puppet_temp;
-
-          }
-
-          double x_temp = 0.0;
-
-          for (j = 0; j < operator_num; ++j) {
-
-            afl->probability_now[tmp_swarm][j] = 0.0;
-            afl->v_now[tmp_swarm][j] =
-                afl->w_now * afl->v_now[tmp_swarm][j] +
-                RAND_C *
-                    (afl->L_best[tmp_swarm][j] - afl->x_now[tmp_swarm][j]) +
-                RAND_C * (afl->G_best[j] - afl->x_now[tmp_swarm][j]);
-
-            afl->x_now[tmp_swarm][j] += afl->v_now[tmp_swarm][j];
-
-            if (afl->x_now[tmp_swarm][j] > v_max) {
-
-              afl->x_now[tmp_swarm][j] = v_max;
-
-            } else if (afl->x_now[tmp_swarm][j] < v_min) {
-
-              afl->x_now[tmp_swarm][j] = v_min;
-
-            }
-
-            x_temp += afl->x_now[tmp_swarm][j];
-
-          }
-
-          for (j = 0; j < operator_num; ++j) {
-
-            afl->x_now[tmp_swarm][j] = afl->x_now[tmp_swarm][j] / x_temp;
-            if (likely(j != 0)) {
-
-              afl->probability_now[tmp_swarm][j] =
-                  afl->probability_now[tmp_swarm][j - 1] +
-                  afl->x_now[tmp_swarm][j];
-
-            } else {
-
-              afl->probability_now[tmp_swarm][j] = afl->x_now[tmp_swarm][j];
-
-            }
-
-          }
-
-          if (afl->probability_now[tmp_swarm][operator_num - 1] < 0.99 ||
-              afl->probability_now[tmp_swarm][operator_num - 1] > 1.01) {
-
-            FATAL("ERROR probability");
-
-          }
-
-        }
-
-        for (j = 0; j < operator_num; ++j) {
-
-          afl->core_operator_finds_puppet[j] = 0;
-          afl->core_operator_finds_puppet_v2[j] = 0;
-          afl->core_operator_cycles_puppet[j] = 0;
-          afl->core_operator_cycles_puppet_v2[j] = 0;
-          afl->core_operator_cycles_puppet_v3[j] = 0;
-
-        }
+        mopt_init(afl);
 
         WARNF(
             "Note that the MOpt mode is not maintained and is not as effective "
@@ -1583,7 +1486,7 @@ int main(int argc, char **argv_orig, char **envp) {
   /* Dynamically allocate memory for AFLFast schedules */
   if (afl->schedule >= FAST && afl->schedule <= RARE) {
 
-    afl->n_fuzz = ck_alloc(N_FUZZ_SIZE * sizeof(u32));
+    afl->n_fuzz = ck_alloc((N_FUZZ_DEPTH << N_FUZZ_BITS) * sizeof(u32));
 
   }
 
@@ -1705,6 +1608,20 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_crash_bucket_limit) {
+
+    s32 limit = atoi(afl->afl_env.afl_crash_bucket_limit);
+    if (limit < 1) {
+
+      FATAL("Invalid AFL_CRASH_BUCKET_LIMIT, expected a value >= 1, got %s",
+            afl->afl_env.afl_crash_bucket_limit);
+
+    }
+
+    afl->crash_bucket_limit = limit;
+
+  }
+
   if (afl->non_instrumented_mode == 2 && afl->no_forkserver) {
 
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
@@ -1972,7 +1889,11 @@ int main(int argc, char **argv_orig, char **envp) {
     u32 custom_fuzz = 0;
     LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
 
-      if (el->afl_custom_fuzz) { custom_fuzz = 1; }
+      if (el->afl_custom_fuzz || el->afl_custom_fuzz_batch) {
+
+        custom_fuzz = 1;
+
+      }
 
     });
 
@@ -1984,6 +1905,44 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_mopt_share) {
+
+    if (!afl->limit_time_sig) {
+
+      WARNF("AFL_MOPT_SHARE without MOpt (-L) is ignored.");
+
+    } else if (!afl->sync_dir) {
+
+      WARNF("AFL_MOPT_SHARE without a sync directory (-M/-S) is ignored.");
+
+    } else {
+
+      mopt_share_setup(afl);
+
+    }
+
+  }
+
+  if (afl->afl_env.afl_custom_mutator_bandit) {
+
+    if (afl->limit_time_sig) {
+
+      FATAL("AFL_CUSTOM_MUTATOR_BANDIT is incompatible with MOpt (-L)");
+
+    }
+
+    if (afl->custom_mutators_count) {
+
+      mutator_bandit_init(afl);
+
+    } else {
+
+      WARNF("AFL_CUSTOM_MUTATOR_BANDIT without custom mutators is ignored.");
+
+    }
+
+  }
+
   write_setup_file(afl, argc, argv);
 
   setup_cmdline_file(afl, argv + optind);
@@ -2104,6 +2063,7 @@ int main(int argc, char **argv_orig, char **envp) {
   #endif
 
   if (afl->shmem_testcase_mode) { setup_testcase_shmem(afl); }
+  if (afl->crash_bucket_limit) { setup_crash_shmem(afl); }
 
   afl->start_time = get_cur_time();
 
@@ -2558,6 +2518,14 @@ int main(int argc, char **argv_orig, char **envp) {
 
           ++afl->cycles_wo_finds;
 
+          if (unlikely(afl->queued_archived &&
+                       afl->cycles_wo_finds % QUEUE_ARCHIVE_RESTORE_CYCLES ==
+                           0)) {
+
+            queue_restore(afl);
+
+          }
+
           if (unlikely(afl->shm.cmplog_mode &&
                        afl->cmplog_max_filesize < MAX_FILE)) {
 
@@ -2679,6 +2647,8 @@ int main(int argc, char **argv_orig, char **envp) {
         }
 
         // we must recalculate the scores of all queue entries
+        if (unlikely(afl->queued_archived)) { queue_restore(afl); }
+
         for (u32 i = 0; i < afl->queued_items; i++) {
 
           if (likely(!afl->queue_buf[i]->disabled)) {
@@ -2913,6 +2883,7 @@ stop_fuzzing:
   destroy_queue(afl);
   destroy_extras(afl);
   destroy_custom_mutators(afl);
+  mopt_share_destroy(afl);
   afl_shm_deinit(&afl->shm);
 
   if (afl->shm_fuzz) {
@@ -2922,6 +2893,13 @@ stop_fuzzing:
 
   }
 
+  if (afl->shm_crash) {
+
+    afl_shm_deinit(afl->shm_crash);
+    ck_free(afl->shm_crash);
+
+  }
+
   afl_fsrv_deinit(&afl->fsrv);
 
   /* remove tmpfile */
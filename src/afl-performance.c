@@ -27,47 +27,85 @@
 #include "xxhash.h"
 #undef XXH_INLINE_ALL
 
+/* splitmix64, used to expand the seed into the state of all lanes */
+
+static inline u64 splitmix64(u64 *x) {
+
+  u64 z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+
+}
+
 void rand_set_seed(afl_state_t *afl, s64 init_seed) {
 
+  u64 x;
+  u32 i, l;
+
   afl->init_seed = init_seed;
-  afl->rand_seed[0] =
-      hash64((u8 *)&afl->init_seed, sizeof(afl->init_seed), HASH_CONST);
-  afl->rand_seed[1] = afl->rand_seed[0] ^ 0x1234567890abcdef;
-  afl->rand_seed[2] = (afl->rand_seed[0] & 0x1234567890abcdef) ^
-                      (afl->rand_seed[1] | 0xfedcba9876543210);
+  x = hash64((u8 *)&afl->init_seed, sizeof(afl->init_seed), HASH_CONST);
 
-}
+  for (i = 0; i < 4; ++i) {
 
-#define ROTL(d, lrot) ((d << (lrot)) | (d >> (8 * sizeof(d) - (lrot))))
+    for (l = 0; l < RAND_LANES; ++l) {
 
-#ifdef WORD_SIZE_64
-// romuDuoJr
-inline AFL_RAND_RETURN rand_next(afl_state_t *afl) {
+      afl->rand_seed[i][l] = splitmix64(&x);
 
-  AFL_RAND_RETURN xp = afl->rand_seed[0];
-  afl->rand_seed[0] = 15241094284759029579u * afl->rand_seed[1];
-  afl->rand_seed[1] = afl->rand_seed[1] - xp;
-  afl->rand_seed[1] = ROTL(afl->rand_seed[1], 27);
-  return xp;
+    }
 
-}
+  }
 
-#else
-// RomuTrio32
-inline AFL_RAND_RETURN rand_next(afl_state_t *afl) {
-
-  AFL_RAND_RETURN xp = afl->rand_seed[0], yp = afl->rand_seed[1],
-                  zp = afl->rand_seed[2];
-  afl->rand_seed[0] = 3323815723u * zp;
-  afl->rand_seed[1] = yp - xp;
-  afl->rand_seed[1] = ROTL(afl->rand_seed[1], 6);
-  afl->rand_seed[2] = zp - yp;
-  afl->rand_seed[2] = ROTL(afl->rand_seed[2], 22);
-  return xp;
+  afl->rand_buf_pos = RAND_BUF_SIZE;
 
 }
 
-#endif
+#define ROTL(d, lrot) (((d) << (lrot)) | ((d) >> (8 * sizeof(d) - (lrot))))
+
+/* xoshiro256++ on RAND_LANES independent states at once. It only needs adds,
+   shifts and xors, so the inner loops vectorize (SSE2/AVX2/NEON), and even
+   when not, the lanes do not depend on each other. */
+
+void rand_fill(afl_state_t *afl) {
+
+  u64 s0[RAND_LANES], s1[RAND_LANES], s2[RAND_LANES], s3[RAND_LANES];
+  u64 out[RAND_LANES];
+  u32 i, l;
+
+  memcpy(s0, afl->rand_seed[0], sizeof(s0));
+  memcpy(s1, afl->rand_seed[1], sizeof(s1));
+  memcpy(s2, afl->rand_seed[2], sizeof(s2));
+  memcpy(s3, afl->rand_seed[3], sizeof(s3));
+
+  for (i = 0; i < RAND_BUF_SIZE; i += 2 * RAND_LANES) {
+
+    for (l = 0; l < RAND_LANES; ++l) {
+
+      u64 t = s1[l] << 17;
+
+      out[l] = ROTL(s0[l] + s3[l], 23) + s0[l];
+
+      s2[l] ^= s0[l];
+      s3[l] ^= s1[l];
+      s1[l] ^= s2[l];
+      s0[l] ^= s3[l];
+      s2[l] ^= t;
+      s3[l] = ROTL(s3[l], 45);
+
+    }
+
+    memcpy(afl->rand_buf + i, out, sizeof(out));
+
+  }
+
+  memcpy(afl->rand_seed[0], s0, sizeof(s0));
+  memcpy(afl->rand_seed[1], s1, sizeof(s1));
+  memcpy(afl->rand_seed[2], s2, sizeof(s2));
+  memcpy(afl->rand_seed[3], s3, sizeof(s3));
+
+  afl->rand_buf_pos = 0;
+
+}
 
 #undef ROTL
 
@@ -0,0 +1,1282 @@
+/*
+   american fuzzy lop++ - crash triage
+   -----------------------------------
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com> and
+                        Dominik Maier <mail@dmnk.co>
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     https://www.apache.org/licenses/LICENSE-2.0
+
+   Replays a directory of crashing inputs through a pool of forkservers,
+   buckets them by the sanitizer report the target writes to stderr (the
+   kind of fault plus the top stack frames) and minimizes one representative
+   per bucket. Crashes without a sanitizer report fall back to the signal
+   and the covered edges. This is the native replacement for the gdb loop in
+   utils/crash_triage/triage_crashes.sh.
+
+ */
+
+#define AFL_MAIN
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "hash.h"
+#include "forkserver.h"
+#include "sharedmem.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define TRIAGE_DESC_LEN 256U
+
+struct triage_crash {
+
+  u64 key;                              /* Bucket key, 0 = no crash         */
+  u32 len;                              /* Size of the crashing input       */
+  u8  desc[TRIAGE_DESC_LEN];            /* Fault type and top frames        */
+
+};
+
+struct triage_bucket {
+
+  u64 key;                              /* Shared crash key                 */
+  u32 first,                            /* First member in crash_order      */
+      count,                            /* Number of members                */
+      rep,                              /* Smallest member (representative) */
+      len;                              /* Representative size after -s/min */
+
+};
+
+static afl_forkserver_t *fsrv;
+static sharedmem_t       shm;
+
+static u8 *in_dir,                      /* Crash directory (-i)             */
+    *out_dir,                           /* Output directory (-o)            */
+    *target_file,                       /* Input file read by target (-f)   */
+    *err_file;                          /* Per-worker child stderr          */
+
+static u8 **crash_fn,                   /* Crashing inputs, sorted by name  */
+    *report;                            /* Child stderr of the last run     */
+
+static u32 crash_cnt, bucket_cnt, jobs, report_len, target_argc,
+    frames = TRIAGE_FRAMES, map_size = MAP_SIZE;
+
+static u32 *crash_order;                /* Crash indices, grouped by key    */
+
+static struct triage_crash  *crashes;   /* Shared with the workers          */
+static struct triage_bucket *buckets;   /* Shared with the workers          */
+static volatile u32         *job_next,  /* Next job to hand out             */
+    *job_done;                          /* Jobs finished                    */
+
+static u8 no_minimize, remove_shm;
+
+static volatile u8 stop_soon;
+
+/* Frames that belong to the sanitizer runtime or to libc look the same for
+   every report of a kind and are not hashed. */
+
+static const char *runtime_frames[] = {
+
+    "libasan", "libubsan", "libmsan", "libclang_rt.", "__asan_", "__ubsan_",
+    "__msan_", "__sanitizer_", "__interceptor_", "libc.so", "__libc_start",
+    NULL
+
+};
+
+/* Get rid of temp files and the forkserver of a worker (atexit()). */
+
+static void at_exit_handler(void) {
+
+  if (remove_shm) { afl_shm_deinit(&shm); }
+
+  afl_fsrv_killall();
+
+  if (fsrv->out_file && fsrv->out_file != target_file) {
+
+    unlink(fsrv->out_file);
+
+  }
+
+  if (err_file) { unlink(err_file); }
+
+}
+
+/* Handle Ctrl-C and the like. */
+
+static void handle_stop_sig(int sig) {
+
+  (void)sig;
+  stop_soon = 1;
+  afl_fsrv_killall();
+
+}
+
+/* Setup signal handlers, duh. */
+
+static void setup_signal_handlers(void) {
+
+  struct sigaction sa;
+
+  sa.sa_handler = NULL;
+#ifdef SA_RESTART
+  sa.sa_flags = SA_RESTART;
+#else
+  sa.sa_flags = 0;
+#endif
+  sa.sa_sigaction = NULL;
+
+  sigemptyset(&sa.sa_mask);
+
+  sa.sa_handler = handle_stop_sig;
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+}
+
+/* Anonymous memory that stays shared with the forked workers. */
+
+static void *shared_alloc(size_t size) {
+
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (ptr == MAP_FAILED) { PFATAL("mmap() failed"); }
+
+  return ptr;
+
+}
+
+/* Collect the crashing inputs. Accepts either a crashes/ directory or an
+   afl-fuzz output directory that contains one. */
+
+static void read_crash_dir(void) {
+
+  struct dirent **nl;
+  struct stat     st;
+  u8             *dir = alloc_printf("%s/crashes", in_dir);
+  s32             nl_cnt, i;
+
+  if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+
+    ck_free(dir);
+    dir = ck_strdup(in_dir);
+
+  }
+
+  nl_cnt = scandir(dir, &nl, NULL, alphasort);
+  if (nl_cnt < 0) { PFATAL("Unable to open '%s'", dir); }
+
+  crash_fn = ck_alloc(nl_cnt * sizeof(u8 *));
+
+  for (i = 0; i < nl_cnt; ++i) {
+
+    u8 *fn = alloc_printf("%s/%s", dir, nl[i]->d_name);
+
+    if (nl[i]->d_name[0] == '.' || !strcmp(nl[i]->d_name, "README.txt") ||
+        lstat(fn, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+
+      ck_free(fn);
+
+    } else if (st.st_size > TMIN_MAX_FILE) {
+
+      WARNF("Skipping '%s', too large (%ld MB max)", fn,
+            TMIN_MAX_FILE / 1024 / 1024);
+      ck_free(fn);
+
+    } else {
+
+      crash_fn[crash_cnt++] = fn;
+
+    }
+
+    free(nl[i]);
+
+  }
+
+  free(nl);
+
+  if (!crash_cnt) { FATAL("No crashing inputs found in '%s'", dir); }
+
+  ck_free(dir);
+
+}
+
+/* Read one crashing input into memory. */
+
+static u8 *read_crash(u32 idx, u32 *len) {
+
+  struct stat st;
+  s32         fd = open(crash_fn[idx], O_RDONLY);
+  u8         *mem;
+
+  if (fd < 0 || fstat(fd, &st)) {
+
+    PFATAL("Unable to open '%s'", crash_fn[idx]);
+
+  }
+
+  *len = st.st_size;
+  mem = ck_alloc_nozero(*len);
+  ck_read(fd, mem, *len, crash_fn[idx]);
+  close(fd);
+
+  return mem;
+
+}
+
+/* Write a buffer to a new file. */
+
+static void write_file(u8 *fn, u8 *mem, u32 len) {
+
+  s32 fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+
+  if (fd < 0) { PFATAL("Unable to create '%s'", fn); }
+
+  ck_write(fd, mem, len, fn);
+  close(fd);
+
+}
+
+/* Run the target once and pick up whatever it wrote to stderr. The file is
+   opened with O_APPEND, so truncating it rewinds the child's writes too. */
+
+static fsrv_run_result_t triage_run(u8 *mem, u32 len) {
+
+  fsrv_run_result_t ret;
+  s32               n;
+
+  if (ftruncate(fsrv->child_err_fd, 0)) { PFATAL("ftruncate() failed"); }
+
+  afl_fsrv_write_to_testcase(fsrv, mem, len);
+
+  ret = afl_fsrv_run_target(fsrv, fsrv->exec_tmout, &stop_soon);
+
+  if (stop_soon) { exit(1); }
+  if (ret == FSRV_RUN_ERROR) { FATAL("Unable to execute target application"); }
+
+  n = pread(fsrv->child_err_fd, report, TRIAGE_REPORT_MAX, 0);
+  report_len = n > 0 ? n : 0;
+
+  /* Keep the parser on the text if the target dumped binary data. */
+
+  for (n = 0; n < (s32)report_len; ++n) {
+
+    if (!report[n]) { report[n] = '\n'; }
+
+  }
+
+  report[report_len] = 0;
+
+  return ret;
+
+}
+
+/* Append at most len bytes of str to the signature buffer. */
+
+static void sig_append(u8 *sig, u32 *pos, u8 *str, u32 len) {
+
+  if (*pos + len >= TRIAGE_REPORT_MAX) { len = TRIAGE_REPORT_MAX - *pos - 1; }
+
+  memcpy(sig + *pos, str, len);
+  *pos += len;
+  sig[*pos] = 0;
+
+}
+
+/* Length of the current line, up to the newline. */
+
+static u32 line_len(u8 *s) {
+
+  u8 *nl = strchr(s, '\n');
+
+  return nl ? (u32)(nl - s) : strlen(s);
+
+}
+
+/* The kind of fault: "AddressSanitizer: heap-buffer-overflow" from the
+   ERROR line, or the message of an UBSAN "runtime error" up to the first
+   colon. */
+
+static void report_type(u8 *sig, u32 *pos) {
+
+  u8 *p = strstr(report, "ERROR: "), *q;
+
+  if (p && (q = strstr(p, "Sanitizer: ")) && q - p < (s64)line_len(p)) {
+
+    p += 7;
+    q += 11;
+    while (*q && *q != ' ' && *q != '\n') {
+
+      ++q;
+
+    }
+
+    sig_append(sig, pos, p, q - p);
+    return;
+
+  }
+
+  if ((p = strstr(report, "runtime error: "))) {
+
+    q = p + 15;
+    while (*q && *q != ':' && *q != '\n') {
+
+      ++q;
+
+    }
+
+    sig_append(sig, pos, p, MIN(q - p, 96));
+
+  }
+
+}
+
+/* The top frames of the first stack trace in the report, skipping the
+   sanitizer runtime. Only the location after the address is used, which is
+   either a symbol or "(module+offset)" with symbolize=0. */
+
+static void report_frames(u8 *sig, u32 *pos) {
+
+  u8 *p = report;
+  u32 used = 0;
+  s32 last = -1;
+
+  while (used < frames && (p = strstr(p, "    #"))) {
+
+    u8   *end;
+    u32   len, i;
+    s32   num = strtol(p + 5, (char **)&end, 10);
+    u8    line[256];
+    u8    skip = 0;
+
+    if (end == p + 5 || num <= last) { break; }
+    last = num;
+
+    while (*end == ' ') {
+
+      ++end;
+
+    }
+
+    if (!strncmp(end, "0x", 2)) {
+
+      while (*end && *end != ' ' && *end != '\n') {
+
+        ++end;
+
+      }
+
+      while (*end == ' ') {
+
+        ++end;
+
+      }
+
+    }
+
+    len = MIN(line_len(end), sizeof(line) - 1);
+    memcpy(line, end, len);
+    line[len] = 0;
+    p = end + len;
+
+    for (i = 0; runtime_frames[i]; ++i) {
+
+      if (strstr(line, runtime_frames[i])) { skip = 1; }
+
+    }
+
+    if (skip || !len) { continue; }
+
+    sig_append(sig, pos, " | ", 3);
+    sig_append(sig, pos, line, len);
+    ++used;
+
+  }
+
+}
+
+/* Bucket key of the last run, and a short description of it. Crashes that
+   did not print a sanitizer report are told apart by the signal and the
+   edges they covered. Returns 0 if the input did not crash. */
+
+static u64 crash_key(fsrv_run_result_t ret, u8 *desc) {
+
+  static u8 sig[TRIAGE_REPORT_MAX];
+  u32       pos = 0;
+  u64       key;
+
+  sig[0] = 0;
+
+  if (ret == FSRV_RUN_TMOUT) {
+
+    sig_append(sig, &pos, "timeout", 7);
+
+  } else if (ret == FSRV_RUN_CRASH) {
+
+    report_type(sig, &pos);
+    if (pos) { report_frames(sig, &pos); }
+
+  } else {
+
+    if (desc) { strcpy(desc, "did not crash"); }
+    return 0;
+
+  }
+
+  key = hash64(sig, pos, HASH_CONST);
+
+  if (!pos) {
+
+    u32 i, edges;
+    int status = fsrv->child_status;
+
+    for (i = 0; i < fsrv->map_size; ++i) {
+
+      fsrv->trace_bits[i] = !!fsrv->trace_bits[i];
+
+    }
+
+    edges = hash32(fsrv->trace_bits, fsrv->map_size, HASH_CONST);
+
+    if (WIFSIGNALED(status)) {
+
+      pos = snprintf(sig, sizeof(sig), "signal %d, no report, path %08x",
+                     WTERMSIG(status), edges);
+
+    } else {
+
+      pos = snprintf(sig, sizeof(sig), "exit %d, no report, path %08x",
+                     WEXITSTATUS(status), edges);
+
+    }
+
+    key = hash64(sig, pos, HASH_CONST);
+
+  }
+
+  if (desc) {
+
+    memcpy(desc, sig, MIN(pos, TRIAGE_DESC_LEN - 1));
+    desc[MIN(pos, TRIAGE_DESC_LEN - 1)] = 0;
+
+  }
+
+  return key ? key : 1;
+
+}
+
+/* Remove blocks of shrinking size as long as the input stays in its bucket,
+   the deletion pass of afl-tmin with the crash key as the oracle. */
+
+static u32 triage_minimize(u8 *mem, u32 len, u64 key) {
+
+  u8 *tmp = ck_alloc_nozero(len);
+  u32 passes = 0;
+  u8  changed;
+
+  do {
+
+    u32 del_len = next_pow2(len / TRIM_START_STEPS);
+
+    changed = 0;
+
+    while (del_len && len > 1) {
+
+      u32 del_pos = 0;
+
+      while (del_pos < len) {
+
+        u32 cut = MIN(del_len, len - del_pos);
+
+        if (cut == len) {
+
+          del_pos += del_len;
+          continue;
+
+        }
+
+        memcpy(tmp, mem, del_pos);
+        memcpy(tmp + del_pos, mem + del_pos + cut, len - del_pos - cut);
+
+        if (crash_key(triage_run(tmp, len - cut), NULL) == key) {
+
+          len -= cut;
+          memcpy(mem, tmp, len);
+          changed = 1;
+
+        } else {
+
+          del_pos += del_len;
+
+        }
+
+      }
+
+      del_len >>= 1;
+
+    }
+
+  } while (changed && ++passes < TRIAGE_MIN_PASSES);
+
+  ck_free(tmp);
+
+  return len;
+
+}
+
+/* Phase one: replay a crash and record its key. */
+
+static void replay_crash(u32 idx) {
+
+  u32 len;
+  u8 *mem = read_crash(idx, &len);
+
+  crashes[idx].len = len;
+  crashes[idx].key = crash_key(triage_run(mem, len), crashes[idx].desc);
+
+  ck_free(mem);
+
+}
+
+/* Phase two: minimize the representative of a bucket and write it out
+   together with its sanitizer report. */
+
+static void minimize_bucket(u32 idx) {
+
+  struct triage_bucket *b = &buckets[idx];
+  u32                   len;
+  u8                   *mem = read_crash(b->rep, &len), *dir, *fn;
+
+  if (!no_minimize && strcmp(crashes[b->rep].desc, "timeout")) {
+
+    len = triage_minimize(mem, len, b->key);
+
+  }
+
+  /* Re-run the final input, the last run may have been a failed attempt. */
+
+  triage_run(mem, len);
+
+  dir = alloc_printf("%s/bucket_%04u", out_dir, idx + 1);
+  if (mkdir(dir, 0700) && errno != EEXIST) {
+
+    PFATAL("Unable to create '%s'", dir);
+
+  }
+
+  fn = alloc_printf("%s/repro", dir);
+  write_file(fn, mem, len);
+  ck_free(fn);
+
+  fn = alloc_printf("%s/report.txt", dir);
+  write_file(fn, report, report_len);
+  ck_free(fn);
+
+  b->len = len;
+
+  ck_free(dir);
+  ck_free(mem);
+
+}
+
+/* Worker body: bring up a forkserver of our own and pull jobs until there
+   are none left. */
+
+static void run_worker(u32 id, char **argv, u32 job_cnt,
+                       void (*job)(u32)) {
+
+  char **use_argv;
+  u32    idx;
+
+  be_quiet = 1;
+
+  if (!target_file) {
+
+    fsrv->out_file = alloc_printf("%s/.cur_input.%u", out_dir, id);
+    unlink(fsrv->out_file);
+
+  } else if (jobs > 1) {
+
+    fsrv->out_file = alloc_printf("%s.%u", target_file, id);
+
+  }
+
+  fsrv->out_fd =
+      open(fsrv->out_file, O_RDWR | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (fsrv->out_fd < 0) { PFATAL("Unable to create '%s'", fsrv->out_file); }
+
+  err_file = alloc_printf("%s/.stderr.%u", out_dir, id);
+  fsrv->child_err_fd = open(err_file, O_RDWR | O_CREAT | O_TRUNC | O_APPEND,
+                            DEFAULT_PERMISSION);
+  if (fsrv->child_err_fd < 0) { PFATAL("Unable to create '%s'", err_file); }
+
+  report = ck_alloc_nozero(TRIAGE_REPORT_MAX + 1);
+
+  fsrv->trace_bits = afl_shm_init(&shm, map_size, 0);
+  remove_shm = 1;
+
+  detect_file_args(argv + optind, fsrv->out_file, &fsrv->use_stdin);
+
+  if (fsrv->qemu_mode) {
+
+    use_argv = get_qemu_argv(argv[0], &fsrv->target_path, target_argc,
+                             argv + optind);
+
+  } else {
+
+    use_argv = argv + optind;
+
+  }
+
+  if (!fsrv->qemu_mode) {
+
+    fsrv->map_size = 4194304;  // dummy temporary value
+    u32 new_map_size = afl_fsrv_get_mapsize(fsrv, use_argv, &stop_soon, 0);
+
+    if (new_map_size) {
+
+      if (map_size < new_map_size ||
+          (new_map_size > map_size && new_map_size - map_size > MAP_SIZE)) {
+
+        afl_shm_deinit(&shm);
+        afl_fsrv_kill(fsrv);
+        fsrv->map_size = new_map_size;
+        fsrv->trace_bits = afl_shm_init(&shm, new_map_size, 0);
+        afl_fsrv_start(fsrv, use_argv, &stop_soon, 0);
+
+      }
+
+      map_size = new_map_size;
+
+    }
+
+    fsrv->map_size = map_size;
+
+  } else {
+
+    afl_fsrv_start(fsrv, use_argv, &stop_soon, 0);
+
+  }
+
+  while (!stop_soon && (idx = __sync_fetch_and_add(job_next, 1)) < job_cnt) {
+
+    job(idx);
+    __sync_fetch_and_add(job_done, 1);
+
+  }
+
+  exit(stop_soon ? 1 : 0);
+
+}
+
+/* Fork the workers for one phase and wait for them, with a progress line. */
+
+static void run_phase(u8 *what, char **argv, u32 job_cnt, void (*job)(u32)) {
+
+  pid_t *pids = ck_alloc(jobs * sizeof(pid_t));
+  u32    i, alive = 0, n = MIN(jobs, job_cnt);
+
+  *job_next = 0;
+  *job_done = 0;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (i = 0; i < n; ++i) {
+
+    pids[i] = fork();
+
+    if (pids[i] < 0) { PFATAL("fork() failed"); }
+    if (!pids[i]) { run_worker(i, argv, job_cnt, job); }
+
+    ++alive;
+
+  }
+
+  while (alive) {
+
+    int   status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+
+    if (pid < 0 && errno != EINTR) { PFATAL("waitpid() failed"); }
+
+    if (pid > 0) {
+
+      --alive;
+
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+
+        for (i = 0; i < n; ++i) {
+
+          if (pids[i] != pid) { kill(pids[i], SIGTERM); }
+
+        }
+
+        while (wait(NULL) > 0) {}
+
+        if (stop_soon) { FATAL("Aborted by user"); }
+        FATAL("A worker failed, see the messages above");
+
+      }
+
+      continue;
+
+    }
+
+    SAYF("\r" cGRA "    %s: " cRST "%u/%u" cRST "   ", what, *job_done,
+         job_cnt);
+    fflush(stdout);
+    usleep(100000);
+
+  }
+
+  SAYF("\r" cGRA "    %s: " cRST "%u/%u" cRST "   \n", what, *job_done,
+       job_cnt);
+
+  ck_free(pids);
+
+}
+
+static int compare_crash(const void *a, const void *b) {
+
+  u64 ka = crashes[*(u32 *)a].key, kb = crashes[*(u32 *)b].key;
+
+  if (ka != kb) { return ka < kb ? -1 : 1; }
+  return *(u32 *)a < *(u32 *)b ? -1 : 1;
+
+}
+
+static int compare_bucket(const void *a, const void *b) {
+
+  const struct triage_bucket *ba = a, *bb = b;
+
+  if (ba->count != bb->count) { return ba->count > bb->count ? -1 : 1; }
+  return ba->first < bb->first ? -1 : 1;
+
+}
+
+/* Group the replayed crashes by key, largest bucket first. Inputs that did
+   not crash again sort to the front of crash_order and are left out. */
+
+static void group_crashes(void) {
+
+  u32 i, start;
+
+  crash_order = ck_alloc(crash_cnt * sizeof(u32));
+  for (i = 0; i < crash_cnt; ++i) {
+
+    crash_order[i] = i;
+
+  }
+
+  qsort(crash_order, crash_cnt, sizeof(u32), compare_crash);
+
+  for (start = 0; start < crash_cnt && !crashes[crash_order[start]].key;
+       ++start) {}
+
+  buckets = shared_alloc((crash_cnt - start + 1) * sizeof(*buckets));
+
+  for (i = start; i < crash_cnt; ++i) {
+
+    struct triage_bucket *b;
+    struct triage_crash  *c = &crashes[crash_order[i]];
+
+    if (i == start || c->key != crashes[crash_order[i - 1]].key) {
+
+      b = &buckets[bucket_cnt++];
+      b->key = c->key;
+      b->first = i;
+      b->rep = crash_order[i];
+
+    } else {
+
+      b = &buckets[bucket_cnt - 1];
+
+    }
+
+    if (c->len < crashes[b->rep].len) { b->rep = crash_order[i]; }
+    ++b->count;
+
+  }
+
+  qsort(buckets, bucket_cnt, sizeof(*buckets), compare_bucket);
+
+}
+
+/* Write triage.txt, the member lists and the list of inputs that did not
+   reproduce, and print the summary. */
+
+static void write_results(void) {
+
+  u8   *fn = alloc_printf("%s/triage.txt", out_dir);
+  FILE *f = fopen(fn, "w");
+  u32   i, j, lost = 0;
+
+  if (!f) { PFATAL("Unable to create '%s'", fn); }
+  ck_free(fn);
+
+  fprintf(f, "# bucket    crashes  repro_len  signature\n");
+
+  SAYF("\n" cGRA "    bucket    crashes  repro_len  signature\n" cRST);
+
+  for (i = 0; i < bucket_cnt; ++i) {
+
+    struct triage_bucket *b = &buckets[i];
+    FILE                 *m;
+
+    fprintf(f, "bucket_%04u %7u %10u  %s\n", i + 1, b->count, b->len,
+            crashes[b->rep].desc);
+    SAYF("    bucket_%04u %7u %10u  %.*s\n", i + 1, b->count, b->len, 80,
+         crashes[b->rep].desc);
+
+    fn = alloc_printf("%s/bucket_%04u/crashes.txt", out_dir, i + 1);
+    m = fopen(fn, "w");
+    if (!m) { PFATAL("Unable to create '%s'", fn); }
+    ck_free(fn);
+
+    for (j = b->first; j < b->first + b->count; ++j) {
+
+      fprintf(m, "%s\n", crash_fn[crash_order[j]]);
+
+    }
+
+    fclose(m);
+
+  }
+
+  fclose(f);
+
+  for (i = 0; i < crash_cnt; ++i) {
+
+    if (!crashes[i].key) { ++lost; }
+
+  }
+
+  if (lost) {
+
+    fn = alloc_printf("%s/not_reproduced.txt", out_dir);
+    f = fopen(fn, "w");
+    if (!f) { PFATAL("Unable to create '%s'", fn); }
+    ck_free(fn);
+
+    for (i = 0; i < crash_cnt; ++i) {
+
+      if (!crashes[i].key) { fprintf(f, "%s\n", crash_fn[i]); }
+
+    }
+
+    fclose(f);
+
+    WARNF("%u of %u inputs did not crash again, see not_reproduced.txt",
+          lost, crash_cnt);
+
+  }
+
+  OKF("%u crashes in " cCYA "%u" cRST " buckets, results are in '%s'.",
+      crash_cnt - lost, bucket_cnt, out_dir);
+
+}
+
+/* Sanitizer settings for triage: unlike afl-fuzz we want the report and the
+   stack trace, including for plain SEGVs caught by ASAN. */
+
+static void set_up_environment(char **argv) {
+
+  u8 *opts =
+      "abort_on_error=1:symbolize=0:detect_leaks=0:malloc_context_size=0:"
+      "allocator_may_return_null=1:detect_odr_violation=0:handle_segv=1:"
+      "handle_sigbus=1:handle_abort=1:handle_sigfpe=1:handle_sigill=1:"
+      "print_stacktrace=1:halt_on_error=1";
+
+  fsrv->dev_null_fd = open("/dev/null", O_RDWR);
+  if (fsrv->dev_null_fd < 0) { PFATAL("Unable to open /dev/null"); }
+
+  if (!getenv("ASAN_OPTIONS") && !getenv("UBSAN_OPTIONS") &&
+      !getenv("MSAN_OPTIONS") && !getenv("LSAN_OPTIONS")) {
+
+    setenv("ASAN_OPTIONS", opts, 1);
+    setenv("UBSAN_OPTIONS", opts, 1);
+
+  }
+
+  set_sanitizer_defaults();
+
+  if (fsrv->frida_mode) {
+
+    u8 *frida_binary = find_afl_binary(argv[0], "afl-frida-trace.so");
+    u8 *preload = getenv("AFL_PRELOAD")
+                      ? alloc_printf("%s:%s", getenv("AFL_PRELOAD"),
+                                     frida_binary)
+                      : alloc_printf("%s", frida_binary);
+
+    setenv("LD_PRELOAD", preload, 1);
+    setenv("DYLD_INSERT_LIBRARIES", preload, 1);
+    ck_free(preload);
+    ck_free(frida_binary);
+
+  } else if (getenv("AFL_PRELOAD") && !fsrv->qemu_mode) {
+
+    /* afl-qemu-trace takes care of converting AFL_PRELOAD. */
+
+    setenv("LD_PRELOAD", getenv("AFL_PRELOAD"), 1);
+    setenv("DYLD_INSERT_LIBRARIES", getenv("AFL_PRELOAD"), 1);
+
+  }
+
+}
+
+/* Display usage hints. */
+
+static void usage(u8 *argv0) {
+
+  SAYF(
+      "\n%s [ options ] -- /path/to/target_app [ ... ]\n\n"
+
+      "Required parameters:\n"
+
+      "  -i dir        - crashes directory, or an afl-fuzz output directory\n"
+      "  -o dir        - output directory for buckets and reports\n\n"
+
+      "Execution control settings:\n"
+
+      "  -f file       - input file read by the tested program (stdin),\n"
+      "                  implies -j 1 unless @@ is used\n"
+      "  -t msec       - timeout for each run (%u ms)\n"
+      "  -m megs       - memory limit for child process (%u MB)\n"
+      "  -O            - use binary-only instrumentation (FRIDA mode)\n"
+#if defined(__linux__)
+      "  -Q            - use binary-only instrumentation (QEMU mode)\n"
+#endif
+      "\n"
+
+      "Triage settings:\n"
+
+      "  -j jobs       - parallel forkservers (number of CPUs)\n"
+      "  -n frames     - stack frames that make up a bucket (%u)\n"
+      "  -s            - skip minimization of the bucket representatives\n\n"
+
+      "For additional tips, please consult %s/README.md.\n\n"
+
+      "Environment variables used:\n"
+      "AFL_CRASH_EXITCODE: optional child exit code to be interpreted as crash\n"
+      "AFL_FORKSRV_INIT_TMOUT: time spent waiting for forkserver during startup (in ms)\n"
+      "AFL_KILL_SIGNAL: Signal ID delivered to child processes on timeout, etc.\n"
+      "                 (default: SIGKILL)\n"
+      "AFL_MAP_SIZE: the shared memory size for that target. must be >= the size\n"
+      "              the target was compiled for\n"
+      "AFL_PRELOAD:  LD_PRELOAD / DYLD_INSERT_LIBRARIES settings for target\n"
+      "AFL_NO_FORKSRV: run target via execve instead of using the forkserver\n"
+      "ASAN_OPTIONS: custom settings for ASAN\n"
+      "              (must contain abort_on_error=1, symbolize=1 gives readable\n"
+      "              reports but is slow)\n"
+      "MSAN_OPTIONS: custom settings for MSAN\n"
+      "              (must contain exitcode="STRINGIFY(MSAN_ERROR)")\n",
+      argv0, EXEC_TIMEOUT, MEM_LIMIT, TRIAGE_FRAMES, doc_path);
+
+  exit(1);
+
+}
+
+/* Main entry point */
+
+int main(int argc, char **argv_orig, char **envp) {
+
+  s32    opt;
+  u8     mem_limit_given = 0, timeout_given = 0;
+  char **argv = argv_cpy_dup(argc, argv_orig);
+
+  afl_forkserver_t fsrv_var = {0};
+  fsrv = &fsrv_var;
+  afl_fsrv_init(fsrv);
+  map_size = get_map_size();
+  fsrv->map_size = map_size;
+
+  doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
+
+  SAYF(cCYA "afl-triage" VERSION cRST "\n");
+
+  while ((opt = getopt(argc, argv, "+i:o:f:j:m:n:t:sOQh")) > 0) {
+
+    switch (opt) {
+
+      case 'i':
+
+        if (in_dir) { FATAL("Multiple -i options not supported"); }
+        in_dir = optarg;
+        break;
+
+      case 'o':
+
+        if (out_dir) { FATAL("Multiple -o options not supported"); }
+        out_dir = optarg;
+        break;
+
+      case 'f':
+
+        if (target_file) { FATAL("Multiple -f options not supported"); }
+        fsrv->use_stdin = 0;
+        target_file = ck_strdup(optarg);
+        break;
+
+      case 'j':
+
+        jobs = atoi(optarg);
+        if (!jobs || optarg[0] == '-') { FATAL("Bad value of -j"); }
+        break;
+
+      case 'n':
+
+        frames = atoi(optarg);
+        if (!frames || optarg[0] == '-') { FATAL("Bad value of -n"); }
+        break;
+
+      case 's':
+
+        no_minimize = 1;
+        break;
+
+      case 'm': {
+
+        u8 suffix = 'M';
+
+        if (mem_limit_given) { FATAL("Multiple -m options not supported"); }
+        mem_limit_given = 1;
+
+        if (!strcmp(optarg, "none")) {
+
+          fsrv->mem_limit = 0;
+          break;
+
+        }
+
+        if (sscanf(optarg, "%llu%c", &fsrv->mem_limit, &suffix) < 1 ||
+            optarg[0] == '-') {
+
+          FATAL("Bad syntax used for -m");
+
+        }
+
+        switch (suffix) {
+
+          case 'T':
+            fsrv->mem_limit *= 1024 * 1024;
+            break;
+          case 'G':
+            fsrv->mem_limit *= 1024;
+            break;
+          case 'k':
+            fsrv->mem_limit /= 1024;
+            break;
+          case 'M':
+            break;
+
+          default:
+            FATAL("Unsupported suffix or bad syntax for -m");
+
+        }
+
+        if (fsrv->mem_limit < 5) { FATAL("Dangerously low value of -m"); }
+
+      }
+
+      break;
+
+      case 't':
+
+        if (timeout_given) { FATAL("Multiple -t options not supported"); }
+        timeout_given = 1;
+
+        fsrv->exec_tmout = atoi(optarg);
+
+        if (fsrv->exec_tmout < 10 || optarg[0] == '-') {
+
+          FATAL("Dangerously low value of -t");
+
+        }
+
+        break;
+
+      case 'O':                                               /* FRIDA mode */
+
+        if (fsrv->frida_mode) { FATAL("Multiple -O options not supported"); }
+
+        fsrv->frida_mode = 1;
+        setenv("AFL_FRIDA_INST_SEED", "1", 1);
+        break;
+
+      case 'Q':
+
+        if (fsrv->qemu_mode) { FATAL("Multiple -Q options not supported"); }
+        if (!mem_limit_given) { fsrv->mem_limit = MEM_LIMIT_QEMU; }
+
+        fsrv->qemu_mode = 1;
+        break;
+
+      case 'h':
+        usage(argv[0]);
+        return -1;
+        break;
+
+      default:
+        usage(argv[0]);
+
+    }
+
+  }
+
+  if (optind == argc || !in_dir || !out_dir) { usage(argv[0]); }
+
+  check_environment_vars(envp);
+
+  target_argc = argc - optind;
+
+  if (!jobs) {
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!jobs) { jobs = 1; }
+
+  }
+
+  if (target_file) {
+
+    u32 i;
+    u8  file_arg = 0;
+
+    for (i = optind; i < (u32)argc; ++i) {
+
+      if (strstr(argv[i], "@@")) { file_arg = 1; }
+
+    }
+
+    if (!file_arg && jobs > 1) {
+
+      WARNF("-f without @@ means all workers share one file, using -j 1.");
+      jobs = 1;
+
+    }
+
+    fsrv->out_file = target_file;
+
+  }
+
+  if (getenv("AFL_NO_FORKSRV")) {             /* if set, use the fauxserver */
+    fsrv->use_fauxsrv = true;
+
+  }
+
+  setenv("AFL_NO_AUTODICT", "1", 1);
+
+  /* MSAN reports through its exit code rather than a signal. */
+
+  fsrv->uses_asan = 1;
+
+  if (mkdir(out_dir, 0700)) {
+
+    if (errno == EEXIST) {
+
+      FATAL("Output directory '%s' already exists, remove it first", out_dir);
+
+    }
+
+    PFATAL("Unable to create '%s'", out_dir);
+
+  }
+
+  atexit(at_exit_handler);
+  setup_signal_handlers();
+
+  set_up_environment(argv);
+
+  fsrv->target_path = find_binary(argv[optind]);
+  (void)check_binary_signatures(fsrv->target_path);
+
+  if (getenv("AFL_FORKSRV_INIT_TMOUT")) {
+
+    s32 forksrv_init_tmout = atoi(getenv("AFL_FORKSRV_INIT_TMOUT"));
+    if (forksrv_init_tmout < 1) {
+
+      FATAL("Bad value specified for AFL_FORKSRV_INIT_TMOUT");
+
+    }
+
+    fsrv->init_tmout = (u32)forksrv_init_tmout;
+
+  }
+
+  configure_afl_kill_signals(fsrv, NULL, NULL,
+                             fsrv->qemu_mode ? SIGKILL : SIGTERM);
+
+  if (getenv("AFL_CRASH_EXITCODE")) {
+
+    long exitcode = strtol(getenv("AFL_CRASH_EXITCODE"), NULL, 10);
+    if ((!exitcode && (errno == EINVAL || errno == ERANGE)) ||
+        exitcode < -127 || exitcode > 128) {
+
+      FATAL("Invalid crash exitcode, expected -127 to 128, but got %s",
+            getenv("AFL_CRASH_EXITCODE"));
+
+    }
+
+    fsrv->uses_crash_exitcode = true;
+    // WEXITSTATUS is 8 bit unsigned
+    fsrv->crash_exitcode = (u8)exitcode;
+
+  }
+
+  read_crash_dir();
+
+  crashes = shared_alloc(crash_cnt * sizeof(*crashes));
+  job_next = shared_alloc(2 * sizeof(u32));
+  job_done = job_next + 1;
+
+  ACTF("Replaying %u crashes with %u workers (timeout = %u ms, %u frames)...",
+       crash_cnt, MIN(jobs, crash_cnt), fsrv->exec_tmout, frames);
+
+  run_phase("replayed", argv, crash_cnt, replay_crash);
+
+  group_crashes();
+
+  if (bucket_cnt) {
+
+    ACTF("%s %u bucket representatives...",
+         no_minimize ? "Writing" : "Minimizing", bucket_cnt);
+
+    run_phase(no_minimize ? "written" : "minimized", argv, bucket_cnt,
+              minimize_bucket);
+
+  }
+
+  write_results();
+
+  OKF("We're done here. Have a nice day!\n");
+
+  argv_cpy_free(argv);
+
+  exit(0);
+
+}
+
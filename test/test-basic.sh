@@ -4,7 +4,7 @@
 
 
 AFL_GCC=afl-gcc
-$ECHO "$BLUE[*] Testing: ${AFL_GCC}, afl-showmap, afl-fuzz, afl-cmin and afl-tmin"
+$ECHO "$BLUE[*] Testing: ${AFL_GCC}, afl-showmap, afl-fuzz, afl-cmin, afl-tmin and afl-triage"
 test "$SYS" = "i686" -o "$SYS" = "x86_64" -o "$SYS" = "amd64" -o "$SYS" = "i86pc" -o "$SYS" = "i386" && {
  test -e ../${AFL_GCC} -a -e ../afl-showmap -a -e ../afl-fuzz && {
   ../${AFL_GCC} -v 2>&1 | grep -qi "gcc version" && {
@@ -118,6 +118,28 @@ test "$SYS" = "i686" -o "$SYS" = "x86_64" -o "$SYS" = "amd64" -o "$SYS" = "i86pc
     rm -rf in out errors in2
     unset AFL_QUIET
    }
+   test -e ../afl-triage && {
+    AFL_USE_ASAN=1 ../${AFL_GCC} -o test-triage.asan test-triage.c > /dev/null 2>&1
+    test -e test-triage.asan && {
+     mkdir -p in
+     printf 'A1234567' > in/heap1
+     printf 'A9876543210' > in/heap2
+     printf 'B1234567' > in/stack
+     ../afl-triage -m none -i in -o out -- ./test-triage.asan > /dev/null 2>&1
+     BUCKETS=`ls -d out/bucket_* 2>/dev/null | wc -l`
+     SAME=`cat out/bucket_0001/crashes.txt 2>/dev/null | wc -l`
+     test "$BUCKETS" -eq 2 -a "$SAME" -eq 2 && {
+      $ECHO "$GREEN[+] afl-triage correctly bucketed the crashes by their stacks"
+     } || {
+      $ECHO "$RED[!] afl-triage did not bucket the crashes correctly ($BUCKETS buckets)"
+      CODE=1
+     }
+     rm -rf in out test-triage.asan
+    } || {
+     $ECHO "$YELLOW[-] ${AFL_GCC} cannot build with ASAN, cannot test afl-triage"
+     INCOMPLETE=1
+    }
+   }
    rm -f test-instr.plain
   } || {
    $ECHO "$YELLOW[-] afl-gcc executes clang, cannot test!"
@@ -30,6 +30,7 @@ test -e test-custom-mutator.c -a -e ${CUSTOM_MUTATOR_PATH}/example.c -a -e ${CUS
   # Compile the custom mutator
   cc -D_FIXED_CHAR=0x41 -g -fPIC -shared -I../include ../custom_mutators/examples/simple_example.c -o libexamplemutator.so > /dev/null 2>&1
   cc -D_FIXED_CHAR=0x42 -g -fPIC -shared -I../include ../custom_mutators/examples/simple_example.c -o libexamplemutator2.so > /dev/null 2>&1
+  cc -D_FIXED_CHAR=0x41 -D_FUZZ_BATCH -g -fPIC -shared -I../include ../custom_mutators/examples/simple_example.c -o libexamplemutatorbatch.so > /dev/null 2>&1
   test -e test-custom-mutator -a -e ./libexamplemutator.so && {
     # Create input directory
     mkdir -p in
@@ -55,6 +56,44 @@ test -e test-custom-mutator.c -a -e ${CUSTOM_MUTATOR_PATH}/example.c -a -e ${CUS
     # Clean
     rm -rf out errors core.*
 
+    # Run afl-fuzz w/ the batched C mutator
+    test -e ./libexamplemutatorbatch.so && {
+      $ECHO "$GREY[*] running afl-fuzz for the batched C mutator, this will take approx 10 seconds"
+      {
+        AFL_CUSTOM_MUTATOR_LIBRARY=./libexamplemutatorbatch.so AFL_CUSTOM_MUTATOR_ONLY=1 ../afl-fuzz -V07 -m ${MEM_LIMIT} -i in -o out -- ./test-custom-mutator >>errors 2>&1
+      } >>errors 2>&1
+
+      test -n "$( ls out/default/crashes/id:000000* 2>/dev/null )" && {
+        $ECHO "$GREEN[+] afl-fuzz is working correctly with the batched C mutator"
+      } || {
+        echo CUT------------------------------------------------------------------CUT
+        cat errors
+        echo CUT------------------------------------------------------------------CUT
+        $ECHO "$RED[!] afl-fuzz is not working correctly with the batched C mutator"
+        CODE=1
+      }
+
+      rm -rf out errors core.*
+    }
+
+    # Run afl-fuzz w/ the C mutator in an out-of-process host
+    $ECHO "$GREY[*] running afl-fuzz for the isolated C mutator, this will take approx 10 seconds"
+    {
+      AFL_CUSTOM_MUTATOR_ISOLATE=1 AFL_CUSTOM_MUTATOR_LIBRARY=./libexamplemutator.so AFL_CUSTOM_MUTATOR_ONLY=1 ../afl-fuzz -V07 -m ${MEM_LIMIT} -i in -o out -- ./test-custom-mutator >>errors 2>&1
+    } >>errors 2>&1
+
+    test -n "$( ls out/default/crashes/id:000000* 2>/dev/null )" && {
+      $ECHO "$GREEN[+] afl-fuzz is working correctly with the isolated C mutator"
+    } || {
+      echo CUT------------------------------------------------------------------CUT
+      cat errors
+      echo CUT------------------------------------------------------------------CUT
+      $ECHO "$RED[!] afl-fuzz is not working correctly with the isolated C mutator"
+      CODE=1
+    }
+
+    rm -rf out errors core.*
+
     # Run afl-fuzz w/ multiple C mutators
     $ECHO "$GREY[*] running afl-fuzz with multiple custom C mutators, this will take approx 10 seconds"
     {
@@ -73,6 +112,25 @@ test -e test-custom-mutator.c -a -e ${CUSTOM_MUTATOR_PATH}/example.c -a -e ${CUS
 
     # Clean
     rm -rf out errors core.*
+
+    # Run afl-fuzz w/ multiple C mutators sharing the budget with a bandit
+    $ECHO "$GREY[*] running afl-fuzz with the mutator bandit, this will take approx 10 seconds"
+    {
+      AFL_CUSTOM_MUTATOR_BANDIT=1 AFL_CUSTOM_MUTATOR_LIBRARY="./libexamplemutator.so;./libexamplemutator2.so" AFL_CUSTOM_MUTATOR_ONLY=1 ../afl-fuzz -V07 -m ${MEM_LIMIT} -i in -o out -- ./test-multiple-mutators >>errors 2>&1
+    } >>errors 2>&1
+
+    test -n "$( ls out/default/crashes/id:000000* 2>/dev/null )" && grep -q "^mutator_bandit" out/default/fuzzer_stats && {
+      $ECHO "$GREEN[+] afl-fuzz is working correctly with the mutator bandit"
+    } || {
+      echo CUT------------------------------------------------------------------CUT
+      cat errors
+      echo CUT------------------------------------------------------------------CUT
+      $ECHO "$RED[!] afl-fuzz is not working correctly with the mutator bandit"
+      CODE=1
+    }
+
+    # Clean
+    rm -rf out errors core.*
   } || {
     ls .
     ls ${CUSTOM_MUTATOR_PATH}
@@ -107,7 +165,7 @@ test "1" = "`../afl-fuzz | grep -i 'without python' >/dev/null; echo $?`" && {
       # Clean
       rm -rf in out errors core.*
       rm -rf ${CUSTOM_MUTATOR_PATH}/__pycache__/
-      rm -f test-multiple-mutators test-custom-mutator libexamplemutator.so libexamplemutator2.so
+      rm -f test-multiple-mutators test-custom-mutator libexamplemutator.so libexamplemutator2.so libexamplemutatorbatch.so
     } || {
       ls .
       ls ${CUSTOM_MUTATOR_PATH}
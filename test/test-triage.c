@@ -0,0 +1,53 @@
+/* Crash target for afl-triage: inputs starting with 'A' overflow the heap
+   in the same place whatever follows, 'B' overflows a stack buffer, so the
+   crashes make up two buckets. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *heap;
+
+static void heap_overflow(char *buf, int len) {
+
+  heap = malloc(len);
+  memcpy(heap, buf, len);
+  heap[len] = heap[0];
+
+}
+
+static void stack_overflow(char *buf, int len) {
+
+  volatile char local[4];
+  int           i;
+
+  for (i = 0; i < len; ++i) {
+
+    local[i] = buf[i];
+
+  }
+
+}
+
+int main(int argc, char **argv) {
+
+  char buf[16] = {0};
+  int  len = read(0, buf, sizeof(buf));
+
+  if (len < 8) { return 0; }
+
+  if (buf[0] == 'A') {
+
+    heap_overflow(buf, len);
+
+  } else if (buf[0] == 'B') {
+
+    stack_overflow(buf, len);
+
+  }
+
+  free(heap);
+  return 0;
+
+}
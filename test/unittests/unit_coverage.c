@@ -0,0 +1,298 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <assert.h>
+#include <cmocka.h>
+/* cmocka < 1.0 didn't support these features we need */
+#ifndef assert_ptr_equal
+#define assert_ptr_equal(a, b) \
+    _assert_int_equal(cast_ptr_to_largest_integral_type(a), \
+                      cast_ptr_to_largest_integral_type(b), \
+                      __FILE__, __LINE__)
+#define CMUnitTest UnitTest
+#define cmocka_unit_test unit_test
+#define cmocka_run_group_tests(t, setup, teardown) run_tests(t)
+#endif
+
+
+extern void mock_assert(const int result, const char* const expression,
+                        const char * const file, const int line);
+#undef assert
+#define assert(expression) \
+    mock_assert((int)(expression), #expression, __FILE__, __LINE__);
+
+#include "afl-fuzz.h"
+#include "hash.h"
+
+/* remap exit -> assert, then use cmocka's mock_assert
+    (compile with `--wrap=exit`) */
+extern void exit(int status);
+extern void __real_exit(int status);
+void __wrap_exit(int status);
+void __wrap_exit(int status) {
+    (void)status;
+    assert(0);
+}
+
+/* ignore all printfs */
+#undef printf
+extern int printf(const char *format, ...);
+extern int __real_printf(const char *format, ...);
+int __wrap_printf(const char *format, ...);
+int __wrap_printf(const char *format, ...) {
+    (void)format;
+    return 1;
+}
+
+/* the lookup tables of afl-fuzz-bitmap.c the coverage headers work on */
+
+const u8 simplify_lookup[256] = {
+
+    [0] = 1, [1 ... 255] = 128
+
+};
+
+const u8 count_class_lookup8[256] = {
+
+    [0] = 0,
+    [1] = 1,
+    [2] = 2,
+    [3] = 4,
+    [4 ... 7] = 8,
+    [8 ... 15] = 16,
+    [16 ... 31] = 32,
+    [32 ... 127] = 64,
+    [128 ... 255] = 128
+
+};
+
+u16 count_class_lookup16[65536];
+
+static void init_lookup16(void) {
+
+    u32 b1, b2;
+
+    for (b1 = 0; b1 < 256; b1++)
+        for (b2 = 0; b2 < 256; b2++)
+            count_class_lookup16[(b1 << 8) + b2] =
+                (count_class_lookup8[b1] << 8) | count_class_lookup8[b2];
+
+}
+
+#ifdef WORD_SIZE_64
+  #include "coverage-64.h"
+typedef u64 word_t;
+#else
+  #include "coverage-32.h"
+typedef u32 word_t;
+#endif
+
+#define TEST_MAP 4096
+#define TEST_WORDS (TEST_MAP / sizeof(word_t))
+#define ALIGNED __attribute__((aligned(64)))
+
+/* a sparse trace with a few hit counts, deterministic for seed */
+static void make_trace(u8 *trace, u32 seed) {
+
+    u32 i;
+
+    memset(trace, 0, TEST_MAP);
+    for (i = 0; i < 64; i++) {
+        seed = seed * 1103515245 + 12345;
+        trace[(seed >> 8) % TEST_MAP] = (seed >> 24) | 1;
+    }
+
+}
+
+/* the baseline classify_counts + hash64 + has_new_bits, one byte at a
+   time and without any of the word tricks under test */
+static u64 reference(u8 *trace, u8 *virgin, u8 *ret) {
+
+    u32 i;
+
+    for (i = 0; i < TEST_MAP; i++) {
+
+        trace[i] = count_class_lookup8[trace[i]];
+
+        if (trace[i] & virgin[i]) {
+            if (virgin[i] == 0xff) *ret = 2;
+            else if (!*ret) *ret = 1;
+            virgin[i] &= ~trace[i];
+        }
+
+    }
+
+    return hash64(trace, TEST_MAP, HASH_CONST);
+
+}
+
+/* the fused pass classifies and discovers like the old passes */
+static void test_fused_equals_reference(void **state) {
+    (void)state;
+
+    u8 trace[TEST_MAP] ALIGNED, trace_ref[TEST_MAP] ALIGNED;
+    u8 virgin[TEST_MAP] ALIGNED, virgin_ref[TEST_MAP] ALIGNED;
+    u32 seed;
+
+    memset(virgin, 255, TEST_MAP);
+    memset(virgin_ref, 255, TEST_MAP);
+
+    for (seed = 1; seed < 64; seed++) {
+
+        u8 ret = 0, ret_ref = 0;
+
+        make_trace(trace, seed % 16);
+        memcpy(trace_ref, trace, TEST_MAP);
+
+        classify_hash_discover((word_t *)trace, (word_t *)virgin, TEST_WORDS,
+                               &ret);
+        reference(trace_ref, virgin_ref, &ret_ref);
+
+        assert_int_equal(ret, ret_ref);
+        assert_memory_equal(trace, trace_ref, TEST_MAP);
+        assert_memory_equal(virgin, virgin_ref, TEST_MAP);
+
+    }
+
+}
+
+/* the sparse checksum tells traces apart exactly when hash64 over the
+   classified map does: same bucket -> same path, moved or re-bucketed
+   tuples -> another one */
+#define TEST_TRACES 64
+
+static void test_cksum_matches_hash64(void **state) {
+    (void)state;
+
+    static u8 traces[TEST_TRACES][TEST_MAP] ALIGNED;
+    u8        tmp[TEST_MAP] ALIGNED, virgin[TEST_MAP] ALIGNED, ret = 0;
+    u64       h[TEST_TRACES], h_ref[TEST_TRACES];
+    u32       i, j;
+
+    for (i = 0; i < TEST_TRACES; i += 4) {
+
+        u8 *t = traces[i];
+
+        make_trace(t, i / 4);
+
+        /* other counts in the same buckets */
+        memcpy(traces[i + 1], t, TEST_MAP);
+        for (j = 0; j < TEST_MAP; j++)
+            if (t[j] >= 4 && t[j] < 7) traces[i + 1][j] = t[j] + 1;
+
+        /* the same counts one word further */
+        memset(traces[i + 2], 0, TEST_MAP);
+        memcpy(traces[i + 2] + sizeof(word_t), t, TEST_MAP - sizeof(word_t));
+
+        /* one count in another bucket */
+        memcpy(traces[i + 3], t, TEST_MAP);
+        for (j = 0; !t[j]; j++) {}
+        traces[i + 3][j] = t[j] < 128 ? 255 : 1;
+
+    }
+
+    for (i = 0; i < TEST_TRACES; i++) {
+
+        memcpy(tmp, traces[i], TEST_MAP);
+        h[i] = classify_hash_discover((word_t *)tmp, NULL, TEST_WORDS, &ret);
+
+        memcpy(tmp, traces[i], TEST_MAP);
+        memset(virgin, 255, TEST_MAP);
+        h_ref[i] = reference(tmp, virgin, &ret);
+
+    }
+
+    for (i = 0; i < TEST_TRACES; i++)
+        for (j = i + 1; j < TEST_TRACES; j++)
+            assert_int_equal(h[i] == h[j], h_ref[i] == h_ref[j]);
+
+}
+
+/* new tuple -> 2, new hit count bucket -> 1, nothing new -> 0 */
+static void test_discover_levels(void **state) {
+    (void)state;
+
+    u8 trace[TEST_MAP] ALIGNED, virgin[TEST_MAP] ALIGNED, ret;
+
+    memset(virgin, 255, TEST_MAP);
+
+    memset(trace, 0, TEST_MAP);
+    trace[100] = 1;
+    ret = 0;
+    classify_hash_discover((word_t *)trace, (word_t *)virgin, TEST_WORDS,
+                           &ret);
+    assert_int_equal(ret, 2);
+
+    memset(trace, 0, TEST_MAP);
+    trace[100] = 1;
+    ret = 0;
+    classify_hash_discover((word_t *)trace, (word_t *)virgin, TEST_WORDS,
+                           &ret);
+    assert_int_equal(ret, 0);
+
+    memset(trace, 0, TEST_MAP);
+    trace[100] = 5;
+    ret = 0;
+    classify_hash_discover((word_t *)trace, (word_t *)virgin, TEST_WORDS,
+                           &ret);
+    assert_int_equal(ret, 1);
+    assert_int_equal(trace[100], 8);
+
+    /* same bucket as before */
+    memset(trace, 0, TEST_MAP);
+    trace[100] = 7;
+    ret = 0;
+    classify_hash_discover((word_t *)trace, (word_t *)virgin, TEST_WORDS,
+                           &ret);
+    assert_int_equal(ret, 0);
+
+}
+
+/* the checksum only depends on the trace, not on the virgin map */
+static void test_cksum_stable(void **state) {
+    (void)state;
+
+    u8  trace[TEST_MAP] ALIGNED, virgin[TEST_MAP] ALIGNED, ret = 0;
+    u64 h1, h2, h3;
+
+    memset(virgin, 255, TEST_MAP);
+
+    make_trace(trace, 7);
+    h1 = classify_hash_discover((word_t *)trace, NULL, TEST_WORDS, &ret);
+    make_trace(trace, 7);
+    h2 = classify_hash_discover((word_t *)trace, (word_t *)virgin,
+                                TEST_WORDS, &ret);
+    assert_int_equal(h1, h2);
+
+    /* one more tuple changes it */
+    make_trace(trace, 7);
+    trace[TEST_MAP - 1] ^= 1;
+    h3 = classify_hash_discover((word_t *)trace, NULL, TEST_WORDS, &ret);
+    assert_int_not_equal(h1, h3);
+
+    /* an empty trace hashes to a constant */
+    memset(trace, 0, TEST_MAP);
+    h1 = classify_hash_discover((word_t *)trace, NULL, TEST_WORDS, &ret);
+    assert_int_equal(h1, hash_trace_final(HASH_CONST));
+
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    init_lookup16();
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_fused_equals_reference),
+        cmocka_unit_test(test_cksum_matches_hash64),
+        cmocka_unit_test(test_discover_levels),
+        cmocka_unit_test(test_cksum_stable)
+    };
+
+    //return cmocka_run_group_tests (tests, setup, teardown);
+    __real_exit( cmocka_run_group_tests (tests, NULL, NULL) );
+
+    // fake return for dumb compilers
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+   american fuzzy lop++ - LD_PRELOAD forkserver
+   --------------------------------------------
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   This library is linked together with afl-compiler-rt and injects its
+   forkserver into uninstrumented, dynamically linked binaries, so that
+   afl-fuzz does not have to execve() them for every input. Where the
+   forkserver starts is selected with AFL_PRELOAD_FORKSRV_AT:
+
+     (unset), main - right before main(), after all constructors ran
+     init          - when this library is initialized, before the
+                     constructors of the target binary
+     0x<offset>    - when the code at this offset from the load address of
+                     the main binary is reached (a plain address for
+                     non-PIE binaries)
+     <symbol>      - when the function <symbol> is reached, it has to be
+                     visible to dlsym(), e.g. exported by a library
+
+   The last two use a one-shot breakpoint (x86, x86_64 and aarch64 only), the
+   forkserver then runs inside of the SIGTRAP handler and each child returns
+   from it right into the selected function. See README.md.
+
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "types.h"
+
+/* After the CTOR_PRIO and EARLY_FS_PRIO constructors of afl-compiler-rt: */
+
+#define PRELOAD_PRIO 6
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define BP_INSN "\xcc"                                  /* int3          */
+  #define BP_LEN 1
+#elif defined(__aarch64__)
+  #define BP_INSN "\x00\x00\x20\xd4"                      /* brk #0        */
+  #define BP_LEN 4
+#endif
+
+/* From afl-compiler-rt. */
+
+extern u32 __afl_already_initialized_init;
+extern u32 __afl_map_size;
+void       __afl_manual_init(void);
+
+typedef int (*main_fn_t)(int, char **, char **);
+typedef int (*libc_start_main_fn_t)(main_fn_t, int, char **, void (*)(void),
+                                    void (*)(void), void (*)(void), void *);
+
+static main_fn_t real_main;
+
+#ifdef BP_LEN
+
+static u8              *bp_addr;
+static u8               bp_orig[BP_LEN];
+static struct sigaction bp_old_action;
+
+/* Write len bytes of code at addr. */
+
+static int patch_code(u8 *addr, const void *bytes, size_t len) {
+
+  uintptr_t page_mask = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+  u8       *page = (u8 *)((uintptr_t)addr & page_mask);
+  size_t    span = addr + len - page;
+
+  if (mprotect(page, span, PROT_READ | PROT_WRITE | PROT_EXEC)) { return -1; }
+
+  memcpy(addr, bytes, len);
+  __builtin___clear_cache((char *)addr, (char *)addr + len);
+
+  return mprotect(page, span, PROT_READ | PROT_EXEC);
+
+}
+
+/* The breakpoint was hit: remove it, point the pc back at the original
+   instruction and start the forkserver. The forkserver never returns here,
+   its children return from the handler and run the original code. */
+
+static void bp_handler(int sig, siginfo_t *info, void *context) {
+
+  ucontext_t *uc = (ucontext_t *)context;
+
+  (void)info;
+
+  #if defined(__x86_64__)
+  u8 *hit = (u8 *)uc->uc_mcontext.gregs[REG_RIP] - BP_LEN;
+  #elif defined(__i386__)
+  u8 *hit = (u8 *)uc->uc_mcontext.gregs[REG_EIP] - BP_LEN;
+  #else
+  u8 *hit = (u8 *)uc->uc_mcontext.pc;
+  #endif
+
+  sigaction(SIGTRAP, &bp_old_action, NULL);
+
+  if (hit != bp_addr) {
+
+    /* Not ours, hand it to whoever was there before. */
+    raise(sig);
+    return;
+
+  }
+
+  if (patch_code(bp_addr, bp_orig, BP_LEN)) {
+
+    fprintf(stderr, "[afl-preload-forkserver] cannot remove breakpoint\n");
+    _exit(1);
+
+  }
+
+  #if defined(__x86_64__)
+  uc->uc_mcontext.gregs[REG_RIP] = (uintptr_t)bp_addr;
+  #elif defined(__i386__)
+  uc->uc_mcontext.gregs[REG_EIP] = (uintptr_t)bp_addr;
+  #endif
+
+  bp_addr = NULL;
+  __afl_manual_init();
+
+}
+
+static int main_base_cb(struct dl_phdr_info *info, size_t size, void *data) {
+
+  (void)size;
+
+  *(uintptr_t *)data = info->dlpi_addr;
+  return 1;                                /* the main binary comes first */
+
+}
+
+/* Place the breakpoint for AFL_PRELOAD_FORKSRV_AT, returns 0 on success. */
+
+static int set_breakpoint(const char *at) {
+
+  struct sigaction sa;
+  u8              *addr;
+
+  if (!strncmp(at, "0x", 2) || !strncmp(at, "0X", 2)) {
+
+    uintptr_t base = 0;
+    char     *end;
+
+    dl_iterate_phdr(main_base_cb, &base);
+    addr = (u8 *)(base + strtoull(at, &end, 16));
+    if (*end) { return -1; }
+
+  } else {
+
+    addr = (u8 *)dlsym(RTLD_DEFAULT, at);
+
+  }
+
+  if (!addr) { return -1; }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = bp_handler;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGTRAP, &sa, &bp_old_action)) { return -1; }
+
+  memcpy(bp_orig, addr, BP_LEN);
+  bp_addr = addr;
+
+  if (patch_code(addr, BP_INSN, BP_LEN)) {
+
+    bp_addr = NULL;
+    sigaction(SIGTRAP, &bp_old_action, NULL);
+    return -1;
+
+  }
+
+  return 0;
+
+}
+
+#else
+
+static int set_breakpoint(const char *at) {
+
+  (void)at;
+  return -1;
+
+}
+
+#endif
+
+/* Takes the place of main(): constructors are done at this point. */
+
+static int preload_main(int argc, char **argv, char **envp) {
+
+  char *at = getenv("AFL_PRELOAD_FORKSRV_AT");
+
+  if (!at || !*at || !strcmp(at, "main")) {
+
+    __afl_manual_init();
+
+  } else if (strcmp(at, "init") && set_breakpoint(at)) {
+
+    fprintf(stderr,
+            "[afl-preload-forkserver] cannot break at '%s', starting the "
+            "forkserver at main()\n",
+            at);
+    __afl_manual_init();
+
+  }
+
+  return real_main(argc, argv, envp);
+
+}
+
+int __libc_start_main(main_fn_t main, int argc, char **argv,
+                      void (*init)(void), void (*fini)(void),
+                      void (*rtld_fini)(void), void *stack_end) {
+
+  libc_start_main_fn_t real_libc_start_main =
+      (libc_start_main_fn_t)dlsym(RTLD_NEXT, "__libc_start_main");
+
+  real_main = main;
+  return real_libc_start_main(preload_main, argc, argv, init, fini, rtld_fini,
+                              stack_end);
+
+}
+
+/* Runs after the shm setup of afl-compiler-rt and keeps its constructor
+   from starting the forkserver, unless it is wanted right now. */
+
+__attribute__((constructor(PRELOAD_PRIO))) static void preload_init(void) {
+
+  char *at = getenv("AFL_PRELOAD_FORKSRV_AT");
+
+  /* There is no coverage in here, so there is nothing to tell afl-fuzz to
+     resize its map for. */
+
+  __afl_map_size = MAP_SIZE;
+
+  if (at && !strcmp(at, "init")) {
+
+    __afl_manual_init();
+
+  } else {
+
+    __afl_already_initialized_init = 1;
+
+  }
+
+}
+
@@ -0,0 +1,634 @@
+/*
+   american fuzzy lop++ - afl-untracer basic block discovery
+   ---------------------------------------------------------
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Finds the basic blocks of a loaded module without IDA or Ghidra: the
+   functions come from the symbol tables of the file on disk (or the whole
+   executable sections if it has none), each function is decoded linearly and
+   block starts are the function entry, direct branch targets, the fall
+   through of conditional branches and whatever follows an unconditional
+   branch or return. Targets that do not land on a decoded instruction
+   boundary are dropped, so a desynchronized sweep costs coverage, not
+   correctness.
+
+   x86_64 uses a small instruction length decoder, aarch64 only needs to look
+   at the branch encodings.
+
+*/
+
+#ifndef _AFL_UNTRACER_BLOCKS_INL_H
+#define _AFL_UNTRACER_BLOCKS_INL_H
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+
+#define BLK_INSN 1                  /* an instruction starts here           */
+#define BLK_LEADER 2                /* fall through block start             */
+#define BLK_TARGET 4                /* branch target                        */
+#define BLK_ENTRY 8                 /* symbol, decoding resyncs here        */
+
+#define BLK_NONE 0
+#define BLK_COND 1                  /* conditional direct branch            */
+#define BLK_JUMP 2                  /* unconditional direct branch          */
+#define BLK_END 3                   /* ret, indirect jump, trap             */
+#define BLK_PAD 4                   /* nop, never starts a block            */
+
+typedef void (*blk_add_t)(u8 *addr);
+
+#if defined(__x86_64__)
+
+/* One byte opcodes that take a ModRM byte. */
+
+static const u8 blk_modrm1[256 / 8] = {
+
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,  // 00-3f: x0-x3, x8-xb
+    0x00, 0x00, 0x00, 0x00, 0x0c, 0x0a, 0x00, 0x00,  // 62 63 69 6b
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 80-8f
+    0xf3, 0x00, 0x0f, 0xff, 0x00, 0x00, 0xc0, 0xc0   // c0 c1 c4-c7 d0-df
+                                                     // f6 f7 fe ff
+
+};
+
+/* Length of the x86_64 instruction at p, 0 if it cannot be decoded. Sets
+   kind and for direct branches the target. */
+
+static u32 blk_decode(u8 *p, u32 max, u32 *kind, u8 **target) {
+
+  u8  *s = p, *e = p + max;
+  u32  op16 = 0, rex_w = 0, a32 = 0, modrm = 0, imm = 0, map = 0, rel = 0;
+  u8   op;
+
+  *kind = BLK_NONE;
+
+  /* Legacy prefixes, then REX. */
+
+  while (p < e) {
+
+    switch (*p) {
+
+      case 0x66:
+        op16 = 1;
+        p++;
+        continue;
+      case 0x67:
+        a32 = 1;
+        p++;
+        continue;
+      case 0xf0:
+      case 0xf2:
+      case 0xf3:
+      case 0x2e:
+      case 0x36:
+      case 0x3e:
+      case 0x26:
+      case 0x64:
+      case 0x65:
+        p++;
+        continue;
+
+    }
+
+    break;
+
+  }
+
+  if (p < e && (*p & 0xf0) == 0x40) { rex_w = *p++ & 8; }
+  if (p >= e) { return 0; }
+
+  op = *p++;
+
+  if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+
+    /* VEX and EVEX: the map comes from the prefix, ModRM follows all but
+       vzeroupper/vzeroall. */
+
+    u32 len = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+    if (p + len >= e) { return 0; }
+    map = op == 0xc5 ? 1 : (p[0] & 7);
+    p += len;
+    op = *p++;
+    modrm = !(map == 1 && op == 0x77);
+    if (map == 3 || (map == 1 && ((op >= 0x70 && op <= 0x73) ||
+                                  (op >= 0xc4 && op <= 0xc6) || op == 0xc2))) {
+
+      imm = 1;
+
+    }
+
+  } else if (op == 0x0f) {
+
+    if (p >= e) { return 0; }
+    op = *p++;
+
+    if (op == 0x38 || op == 0x3a) {
+
+      if (p >= e) { return 0; }
+      p++;
+      modrm = 1;
+      imm = op == 0x3a;
+
+    } else if (op >= 0x80 && op <= 0x8f) {
+
+      rel = 4;
+      *kind = BLK_COND;
+
+    } else if (op == 0x05 || op == 0x06 || op == 0x07 || op == 0x08 ||
+               op == 0x09 || op == 0x0e || op == 0x77 || op == 0xa0 ||
+               op == 0xa1 || op == 0xa2 || op == 0xa8 || op == 0xa9 ||
+               op == 0xaa || (op >= 0x30 && op <= 0x37) ||
+               (op >= 0xc8 && op <= 0xcf)) {
+
+      /* no operands */
+
+    } else if (op == 0x0b) {
+
+      *kind = BLK_END;                                        /* ud2 */
+
+    } else {
+
+      modrm = 1;
+      if ((op >= 0x70 && op <= 0x73) || op == 0xa4 || op == 0xac ||
+          op == 0xba || op == 0xc2 || (op >= 0xc4 && op <= 0xc6) ||
+          op == 0x0f) {
+
+        imm = 1;
+
+      }
+
+      if (op == 0x1f && !(p < e && ((*p >> 3) & 7))) { *kind = BLK_PAD; }
+
+    }
+
+  } else {
+
+    switch (op) {
+
+      case 0x06:
+      case 0x07:
+      case 0x0e:
+      case 0x16:
+      case 0x17:
+      case 0x1e:
+      case 0x1f:
+      case 0x27:
+      case 0x2f:
+      case 0x37:
+      case 0x3f:
+      case 0x60:
+      case 0x61:
+      case 0x82:
+      case 0x9a:
+      case 0xd4:
+      case 0xd5:
+      case 0xd6:
+      case 0xea:
+        return 0;                              /* invalid in 64 bit mode */
+
+    }
+
+    modrm = (blk_modrm1[op >> 3] >> (op & 7)) & 1;
+
+    if ((op & 0xc7) == 0x04 && op < 0x40) {
+
+      imm = 1;
+
+    } else if ((op & 0xc7) == 0x05 && op < 0x40) {
+
+      imm = op16 ? 2 : 4;
+
+    } else if (op >= 0x70 && op <= 0x7f) {
+
+      rel = 1;
+      *kind = BLK_COND;
+
+    } else if (op >= 0xe0 && op <= 0xe3) {
+
+      rel = 1;
+      *kind = BLK_COND;
+
+    } else if (op >= 0xb8 && op <= 0xbf) {
+
+      imm = rex_w ? 8 : op16 ? 2 : 4;
+
+    } else if (op >= 0xa0 && op <= 0xa3) {
+
+      imm = a32 ? 4 : 8;
+
+    } else {
+
+      switch (op) {
+
+        case 0x6a:
+        case 0x6b:
+        case 0x80:
+        case 0x83:
+        case 0xa8:
+        case 0xc0:
+        case 0xc1:
+        case 0xc6:
+        case 0xcd:
+        case 0xe4:
+        case 0xe5:
+        case 0xe6:
+        case 0xe7:
+          imm = 1;
+          break;
+        case 0xb0 ... 0xb7:
+          imm = 1;
+          break;
+        case 0x68:
+        case 0x69:
+        case 0x81:
+        case 0xa9:
+        case 0xc7:
+          imm = op16 ? 2 : 4;
+          break;
+        case 0xc2:
+        case 0xca:
+          imm = 2;
+          *kind = BLK_END;
+          break;
+        case 0xc8:
+          imm = 3;
+          break;
+        case 0xc3:
+        case 0xcb:
+        case 0xf4:
+          *kind = BLK_END;
+          break;
+        case 0xe8:
+          rel = 4;                          /* calls do not end the block */
+          break;
+        case 0xe9:
+          rel = 4;
+          *kind = BLK_JUMP;
+          break;
+        case 0xeb:
+          rel = 1;
+          *kind = BLK_JUMP;
+          break;
+        case 0x90:
+        case 0xcc:                                 /* int3 fills gaps too */
+          *kind = BLK_PAD;
+          break;
+
+      }
+
+    }
+
+    if ((op == 0xf6 || op == 0xf7) && p < e && !((*p >> 3) & 6)) {
+
+      imm = op == 0xf6 ? 1 : op16 ? 2 : 4;
+
+    }
+
+    if (op == 0xff && p < e && (((*p >> 3) & 7) == 4 || ((*p >> 3) & 7) == 5)) {
+
+      *kind = BLK_END;                                  /* jmp indirect */
+
+    }
+
+  }
+
+  if (modrm) {
+
+    if (p >= e) { return 0; }
+
+    u8 m = *p++, mod = m >> 6, rm = m & 7;
+
+    if (mod != 3) {
+
+      if (rm == 4) {
+
+        if (p >= e) { return 0; }
+        if (mod == 0 && (*p & 7) == 5) { p += 4; }
+        p++;
+
+      }
+
+      if (mod == 0 && rm == 5) { p += 4; }
+      if (mod == 1) { p += 1; }
+      if (mod == 2) { p += 4; }
+
+    }
+
+  }
+
+  p += imm + rel;
+  if (p > e) { return 0; }
+
+  if (rel) {
+
+    s64 d = rel == 1 ? (s64)(s8)p[-1] : (s64)(s32)(p[-4] | p[-3] << 8 |
+                                                  p[-2] << 16 | (u32)p[-1] << 24);
+    *target = p + d;
+
+  }
+
+  return p - s;
+
+}
+
+#elif defined(__aarch64__)
+
+static u32 blk_decode(u8 *p, u32 max, u32 *kind, u8 **target) {
+
+  u32 i;
+
+  if (max < 4) { return 0; }
+  memcpy(&i, p, 4);
+
+  *kind = BLK_NONE;
+
+  if ((i & 0xfc000000) == 0x14000000) {                          /* b */
+
+    *kind = BLK_JUMP;
+    *target = p + ((s64)((s32)(i << 6) >> 6) << 2);
+
+  } else if ((i & 0xff000010) == 0x54000000 ||             /* b.cond */
+             (i & 0x7e000000) == 0x34000000) {            /* cbz, cbnz */
+
+    *kind = BLK_COND;
+    *target = p + ((s64)((s32)(i << 8) >> 13) << 2);
+
+  } else if ((i & 0x7e000000) == 0x36000000) {            /* tbz, tbnz */
+
+    *kind = BLK_COND;
+    *target = p + ((s64)((s32)(i << 13) >> 18) << 2);
+
+  } else if ((i & 0xfffffc1f) == 0xd61f0000 ||                  /* br */
+             (i & 0xfffffc1f) == 0xd65f0000 ||                 /* ret */
+             (i & 0xffe0001f) == 0xd4200000) {                 /* brk */
+
+    *kind = BLK_END;
+
+  } else if (i == 0xd503201f || !i) {                     /* nop, udf #0 */
+
+    *kind = BLK_PAD;
+
+  }
+
+  return 4;
+
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+/* Size *flags for len bytes and clear them. */
+
+static u8 *blk_flags(u32 len, u8 **flags, u32 *flags_size) {
+
+  if (*flags_size < len) {
+
+    *flags = realloc(*flags, len);
+    *flags_size = len;
+
+  }
+
+  memset(*flags, 0, len);
+  return *flags;
+
+}
+
+/* Decode the code at [s, s + len), a copy of what is loaded at addr, and
+   report its block starts. f holds a flag byte per code byte, cleared except
+   for BLK_ENTRY marks: those start a block, and decoding restarts there when
+   an instruction runs across one or a byte does not decode. */
+
+static void blk_sweep(u8 *s, u8 *addr, u32 len, u8 *f, blk_add_t add) {
+
+  u32 pos = 0, kind, pending = 1;
+  u8 *target = NULL;
+
+  while (pos < len) {
+
+    u32 n = blk_decode(s + pos, len - pos, &kind, &target), i;
+
+    if (!n) {
+
+      while (++pos < len && !(f[pos] & BLK_ENTRY)) {}
+      pending = 1;
+      continue;
+
+    }
+
+    f[pos] |= BLK_INSN;
+
+    if (pending && kind != BLK_PAD) {
+
+      f[pos] |= BLK_LEADER;
+      pending = 0;
+
+    }
+
+    if ((kind == BLK_COND || kind == BLK_JUMP) && target >= s &&
+        target < s + len) {
+
+      f[target - s] |= BLK_TARGET;
+
+    }
+
+    if (kind != BLK_NONE && kind != BLK_PAD) { pending = 1; }
+
+    for (i = 1; i < n && pos + i < len && !(f[pos + i] & BLK_ENTRY); i++) {}
+    pos += i;
+
+  }
+
+  for (pos = 0; pos < len; pos++) {
+
+    if ((f[pos] & BLK_INSN) &&
+        (f[pos] & (BLK_LEADER | BLK_TARGET | BLK_ENTRY))) {
+
+      add(addr + pos);
+
+    }
+
+  }
+
+}
+
+static void blk_function(u8 *s, u8 *addr, u32 len, u8 **flags,
+                         u32 *flags_size, blk_add_t add) {
+
+  if (!len) { return; }
+  blk_sweep(s, addr, len, blk_flags(len, flags, flags_size), add);
+
+}
+
+/* Walk the functions of the ELF file at path, loaded at base, that lie in
+   executable sections other than the PLT and .init/.fini. Without a .symtab
+   the whole sections are swept. The code is read from the file, as the
+   loaded copy gets patched while we go. Returns the number of functions or
+   sections, or 0 if the file has no usable section headers. */
+
+static u32 blk_module(const char *path, uintptr_t base, blk_add_t add) {
+
+  ElfW(Ehdr) *eh;
+  ElfW(Shdr) *sh;
+  struct stat st;
+  u8         *file, *flags = NULL, *exec;
+  u32         flags_size = 0, funcs = 0, i, j;
+  const char *shstr;
+  s32         fd = open(path, O_RDONLY);
+
+  if (fd < 0) { return 0; }
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+
+    close(fd);
+    return 0;
+
+  }
+
+  file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) { return 0; }
+
+  eh = (ElfW(Ehdr) *)file;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || !eh->e_shoff ||
+      eh->e_shstrndx >= eh->e_shnum ||
+      eh->e_shoff + (u64)eh->e_shnum * sizeof(ElfW(Shdr)) >
+          (u64)st.st_size) {
+
+    munmap(file, st.st_size);
+    return 0;
+
+  }
+
+  sh = (ElfW(Shdr) *)(file + eh->e_shoff);
+  shstr = (const char *)file + sh[eh->e_shstrndx].sh_offset;
+
+  /* Sections worth instrumenting. */
+
+  exec = calloc(eh->e_shnum, 1);
+
+  for (i = 0; i < eh->e_shnum; i++) {
+
+    const char *name = shstr + sh[i].sh_name;
+
+    if ((sh[i].sh_flags & SHF_EXECINSTR) && sh[i].sh_type == SHT_PROGBITS &&
+        sh[i].sh_offset + sh[i].sh_size <= (u64)st.st_size &&
+        strncmp(name, ".plt", 4) && strcmp(name, ".init") &&
+        strcmp(name, ".fini")) {
+
+      exec[i] = 1;
+
+    }
+
+  }
+
+  /* With a full symbol table, one sweep per function. */
+
+  for (i = 0; i < eh->e_shnum; i++) {
+
+    if (sh[i].sh_type != SHT_SYMTAB ||
+        sh[i].sh_offset + sh[i].sh_size > (u64)st.st_size) {
+
+      continue;
+
+    }
+
+    ElfW(Sym) *sym = (ElfW(Sym) *)(file + sh[i].sh_offset);
+    u32        n = sh[i].sh_size / sizeof(ElfW(Sym));
+
+    for (u32 k = 0; k < n; k++) {
+
+      if (ELF64_ST_TYPE(sym[k].st_info) != STT_FUNC || !sym[k].st_size ||
+          sym[k].st_shndx >= eh->e_shnum || !exec[sym[k].st_shndx]) {
+
+        continue;
+
+      }
+
+      ElfW(Shdr) *code = &sh[sym[k].st_shndx];
+
+      if (sym[k].st_value < code->sh_addr ||
+          sym[k].st_value + sym[k].st_size > code->sh_addr + code->sh_size) {
+
+        continue;
+
+      }
+
+      blk_function(file + code->sh_offset + sym[k].st_value - code->sh_addr,
+                   (u8 *)(base + sym[k].st_value), sym[k].st_size, &flags,
+                   &flags_size, add);
+      funcs++;
+
+    }
+
+  }
+
+  /* Stripped: one sweep per section. The dynamic symbols only cover the
+     exports, they just add block starts where decoding resyncs. */
+
+  if (!funcs) {
+
+    for (i = 0; i < eh->e_shnum; i++) {
+
+      if (!exec[i] || !sh[i].sh_size) { continue; }
+
+      u8 *f = blk_flags(sh[i].sh_size, &flags, &flags_size);
+
+      for (j = 0; j < eh->e_shnum; j++) {
+
+        if (sh[j].sh_type != SHT_DYNSYM ||
+            sh[j].sh_offset + sh[j].sh_size > (u64)st.st_size) {
+
+          continue;
+
+        }
+
+        ElfW(Sym) *sym = (ElfW(Sym) *)(file + sh[j].sh_offset);
+        u32        n = sh[j].sh_size / sizeof(ElfW(Sym));
+
+        for (u32 k = 0; k < n; k++) {
+
+          if (ELF64_ST_TYPE(sym[k].st_info) == STT_FUNC &&
+              sym[k].st_shndx == i && sym[k].st_value >= sh[i].sh_addr &&
+              sym[k].st_value < sh[i].sh_addr + sh[i].sh_size) {
+
+            f[sym[k].st_value - sh[i].sh_addr] |= BLK_ENTRY;
+
+          }
+
+        }
+
+      }
+
+      blk_sweep(file + sh[i].sh_offset, (u8 *)(base + sh[i].sh_addr),
+                sh[i].sh_size, f, add);
+      funcs++;
+
+    }
+
+  }
+
+  free(exec);
+  free(flags);
+  munmap(file, st.st_size);
+  return funcs;
+
+}
+
+#endif
+
+#endif
+
@@ -27,6 +27,17 @@
 
    Just look these steps up in the code, look for "// STEP x:"
 
+   The libraries to instrument are either listed with their basic blocks in
+   the AFL_UNTRACER_FILE patch file (see the ghidra/ida scripts), or named in
+   AFL_UNTRACER_MODULES, e.g. "libfoo.so,libbar.so", in which case their
+   basic blocks are found by afl-untracer-blocks-inl.h. Both can be combined.
+
+   By default every trap stays in place, which costs a signal per block per
+   run but reports the complete block coverage of every run to afl-fuzz.
+   With AFL_UNTRACER_UNPATCH a child that hits a trap reports the location
+   back to the forkserver parent, which removes the trap, so all later
+   children run that block at native speed but no longer report it.
+
 
 */
 
@@ -60,6 +71,9 @@
 #if defined(__linux__)
   #include <sys/personality.h>
   #include <sys/ucontext.h>
+  #if defined(__x86_64__) || defined(__aarch64__)
+    #include "afl-untracer-blocks-inl.h"
+  #endif
 #elif defined(__APPLE__) && defined(__LP64__)
   #include <mach-o/dyld_images.h>
 #elif defined(__FreeBSD__)
@@ -73,6 +87,10 @@
 #define MEMORY_MAP_DECREMENT 0x200000000000
 #define MAX_LIB_COUNT 128
 
+/* Trap hits a child can report back to the forkserver parent per run, the
+   rest is picked up by later runs. */
+#define MAX_HIT_COUNT 65536
+
 // STEP 1:
 
 /* here you need to specify the parameter for the target function */
@@ -97,6 +115,13 @@ typedef struct library_list {
 
 } library_list_t;
 
+typedef struct hit_list {
+
+  u32 count;
+  u32 index[MAX_HIT_COUNT];
+
+} hit_list_t;
+
 #ifdef __ANDROID__
 u32 __afl_map_size = MAP_SIZE;
 u32 do_exit;
@@ -115,6 +140,14 @@ static u32       len;
 static library_list_t liblist[MAX_LIB_COUNT];
 static u32            liblist_cnt;
 
+/* Patched locations by bitmap index, and the hits the children report. The
+   hit list is shared memory, NULL unless AFL_UNTRACER_UNPATCH is set. */
+static u8        **patch_addr;
+static u32         patch_addr_size;
+static u32         bitmap_index = 1;  // index 0 marks a foreign trap
+static u32         bitmap_skipped;
+static hit_list_t *hit_list;
+
 static void sigtrap_handler(int signum, siginfo_t *si, void *context);
 static void fuzz(void);
 
@@ -465,6 +498,202 @@ inline static void __afl_end_testcase(int status) {
                   ((uintptr_t)addr & 0x3) * 0x10000000000))
 #endif
 
+#ifdef __aarch64__
+typedef uint64_t shadow_t;
+#else
+typedef uint32_t shadow_t;
+#endif
+
+/* Make a code range writable and create its shadow memory. */
+
+static void setup_code_range(char *name, u8 *lib_addr, size_t lib_size) {
+
+  // Make library code writable.
+  if (mprotect((void *)lib_addr, lib_size,
+               PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    FATAL("Failed to mprotect library %s writable", name);
+
+    // Create shadow memory.
+#ifdef __aarch64__
+  for (int i = 0; i < 8; i++) {
+
+#else
+  for (int i = 0; i < 4; i++) {
+
+#endif
+
+    void *shadow_addr = SHADOW(lib_addr + i);
+    void *shadow = mmap(shadow_addr, lib_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON | MAP_FIXED, 0, 0);
+    if (debug)
+      fprintf(stderr, "Shadow: %s %d = %p-%p for %p\n", name, i, shadow,
+              shadow + lib_size - 1, lib_addr);
+    if (shadow == MAP_FAILED) FATAL("Failed to mmap shadow memory");
+
+  }
+
+}
+
+/* Replace the instruction at addr with a trap and remember it. */
+
+static void patch_location(u8 *addr) {
+
+  shadow_t *shadow = SHADOW(addr);
+  if (*shadow != 0) return;  // skip duplicates
+
+  // the map size the forkserver can announce, and the index bits we have
+  if (bitmap_index >= FS_OPT_MAX_MAPSIZE || bitmap_index >= (1 << 24)) {
+
+    bitmap_skipped++;
+    return;
+
+  }
+
+  if (bitmap_index >= patch_addr_size) {
+
+    patch_addr_size = patch_addr_size ? patch_addr_size * 2 : 4096;
+    patch_addr = realloc(patch_addr, patch_addr_size * sizeof(u8 *));
+    if (!patch_addr) FATAL("out of memory");
+
+  }
+
+  patch_addr[bitmap_index] = addr;
+
+  // Make lookup entry in shadow memory.
+
+#if ((defined(__APPLE__) && defined(__LP64__)) || defined(__x86_64__) || \
+     defined(__i386__))
+
+  // this is for Intel x64
+
+  uint8_t orig_byte = *addr;
+  *shadow = (bitmap_index << 8) | orig_byte;
+  *addr = 0xcc;  // replace instruction with debug trap
+  if (debug)
+    fprintf(stderr, "Patch entry: %p = %02x -> SHADOW(%p) #%d -> %08x\n",
+            addr, orig_byte, shadow, bitmap_index, *shadow);
+
+#elif defined(__aarch64__)
+
+  // this is for aarch64
+
+  uint32_t *patch_bytes = (uint32_t *)addr;
+  uint32_t  orig_bytes = *patch_bytes;
+  *shadow = ((uint64_t)bitmap_index << 32) | orig_bytes;
+  *patch_bytes = 0xd4200000;  // replace instruction with debug trap
+  __builtin___clear_cache((char *)addr, (char *)addr + 4);
+  if (debug)
+    fprintf(stderr, "Patch entry: %p = %08x -> SHADOW(%p) #%d -> %016lx\n",
+            addr, orig_bytes, shadow, bitmap_index, (unsigned long)*shadow);
+
+#else
+  // this will be ARM and AARCH64
+  // for ARM we will need to identify if the code is in thumb or ARM
+  #error "non x86_64/aarch64 not supported yet"
+  //__arm__:
+  // linux thumb: 0xde01
+  // linux arm: 0xe7f001f0
+  //__aarch64__:
+  // linux aarch64: 0xd4200000
+#endif
+
+  bitmap_index++;
+
+}
+
+/* Put the original instruction back, returns its bitmap index (0 if this is
+   not one of our traps). */
+
+static inline u32 restore_location(u8 *addr) {
+
+  shadow_t shadow = *SHADOW(addr);
+
+#ifdef __aarch64__
+  u32 index = shadow >> 32;
+  if (likely(index)) {
+
+    *(uint32_t *)addr = (uint32_t)shadow;
+    __builtin___clear_cache((char *)addr, (char *)addr + 4);
+
+  }
+
+#else
+  u32 index = shadow >> 8;
+  if (likely(index)) *addr = shadow & 0xff;
+#endif
+
+  return index;
+
+}
+
+/* Forkserver parent: remove the traps the last child hit for good. */
+
+static void unpatch_hits(void) {
+
+  u32 i, count = MIN(hit_list->count, MAX_HIT_COUNT);
+
+  for (i = 0; i < count; i++) {
+
+    u32 index = hit_list->index[i];
+
+    if (index < bitmap_index && patch_addr[index]) {
+
+      restore_location(patch_addr[index]);
+      patch_addr[index] = NULL;
+
+    }
+
+  }
+
+  hit_list->count = 0;
+
+}
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+
+/* Instrument all blocks of a module named in AFL_UNTRACER_MODULES. */
+
+static int setup_module(struct dl_phdr_info *info, size_t size, void *data) {
+
+  char *name = (char *)data, *base = strrchr(info->dlpi_name, '/');
+  uintptr_t page_mask = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+  u32       before = bitmap_index;
+
+  (void)size;
+
+  base = base ? base + 1 : (char *)info->dlpi_name;
+  if (!*base || strncmp(base, name, strlen(name))) return 0;
+
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+    if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X)) {
+
+      uintptr_t start = (info->dlpi_addr + ph->p_vaddr) & page_mask;
+      uintptr_t end =
+          (info->dlpi_addr + ph->p_vaddr + ph->p_memsz + ~page_mask) &
+          page_mask;
+
+      setup_code_range(name, (u8 *)start, end - start);
+
+    }
+
+  }
+
+  if (!blk_module(info->dlpi_name, info->dlpi_addr, patch_location))
+    FATAL("Could not read the section headers of %s", info->dlpi_name);
+
+  if (debug)
+    fprintf(stderr, "Module %s: %u blocks\n", info->dlpi_name,
+            bitmap_index - before);
+
+  return 1;
+
+}
+
+#endif
+
 void setup_trap_instrumentation(void) {
 
   library_list_t *lib_base = NULL;
@@ -473,29 +702,35 @@ void setup_trap_instrumentation(void) {
   char           *line = NULL;
   size_t          nread, len = 0;
   char           *filename = getenv("AFL_UNTRACER_FILE");
+  char           *modules = getenv("AFL_UNTRACER_MODULES");
+  FILE           *patches = NULL;
   if (!filename) filename = getenv("TRAPFUZZ_FILE");
-  if (!filename) FATAL("AFL_UNTRACER_FILE environment variable not set");
+  if (!filename && !modules)
+    FATAL("Neither AFL_UNTRACER_FILE nor AFL_UNTRACER_MODULES is set");
 
-  FILE *patches = fopen(filename, "r");
-  if (!patches) FATAL("Couldn't open AFL_UNTRACER_FILE file %s", filename);
+  if (filename && !(patches = fopen(filename, "r")))
+    FATAL("Couldn't open AFL_UNTRACER_FILE file %s", filename);
 
-    // Index into the coverage bitmap for the current trap instruction.
-#ifdef __aarch64__
-  uint64_t bitmap_index = 0;
-  #ifdef __APPLE__
+#if defined(__aarch64__) && defined(__APPLE__)
   pthread_jit_write_protect_np(0);
-  #endif
-#else
-  uint32_t bitmap_index = 0;
 #endif
 
+  // Install signal handler for SIGTRAP. This is done first, as the code that
+  // does the patching may be patched as well (e.g. libc), and it has to stay
+  // unblocked while the handler runs, libc traps in the signal return path.
+  struct sigaction s;
+  s.sa_flags = SA_SIGINFO | SA_NODEFER;
+  s.sa_sigaction = sigtrap_handler;
+  sigemptyset(&s.sa_mask);
+  sigaction(SIGTRAP, &s, 0);
+
 #if defined(__FreeBSD__) && __FreeBSD_version >= 1301000
   // We try to allow W/X pages despite kern.elf32/64.allow_wx system settings
   int allow_wx = PROC_WX_MAPPINGS_PERMIT;
   (void)procctl(P_PID, 0, PROC_WXMAP_CTL, &allow_wx);
 #endif
 
-  while ((nread = getline(&line, &len, patches)) != -1) {
+  while (patches && (nread = getline(&line, &len, patches)) != -1) {
 
     char *end = line + len;
 
@@ -519,29 +754,7 @@ void setup_trap_instrumentation(void) {
               lib_size);
 
       lib_addr = (u8 *)lib_base->addr_start;
-      // Make library code writable.
-      if (mprotect((void *)lib_addr, lib_size,
-                   PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
-        FATAL("Failed to mprotect library %s writable", line);
-
-        // Create shadow memory.
-#ifdef __aarch64__
-      for (int i = 0; i < 8; i++) {
-
-#else
-      for (int i = 0; i < 4; i++) {
-
-#endif
-
-        void *shadow_addr = SHADOW(lib_addr + i);
-        void *shadow = mmap(shadow_addr, lib_size, PROT_READ | PROT_WRITE,
-                            MAP_PRIVATE | MAP_ANON | MAP_FIXED, 0, 0);
-        if (debug)
-          fprintf(stderr, "Shadow: %s %d = %p-%p for %p\n", line, i, shadow,
-                  shadow + lib_size - 1, lib_addr);
-        if (shadow == MAP_FAILED) FATAL("Failed to mmap shadow memory");
-
-      }
+      setup_code_range(line, lib_addr, lib_size);
 
       // Done, continue with next line.
       continue;
@@ -555,73 +768,42 @@ void setup_trap_instrumentation(void) {
       FATAL("Invalid offset: 0x%lx. Current library is 0x%zx bytes large",
             offset, lib_size);
 
-    if (bitmap_index >= __afl_map_size)
-      FATAL("Too many basic blocks to instrument");
+    patch_location(lib_addr + offset);
 
-#ifdef __arch64__
-    uint64_t
-#else
-    uint32_t
-#endif
-        *shadow = SHADOW(lib_addr + offset);
-    if (*shadow != 0) continue;  // skip duplicates
-
-      // Make lookup entry in shadow memory.
+  }
 
-#if ((defined(__APPLE__) && defined(__LP64__)) || defined(__x86_64__) || \
-     defined(__i386__))
+  free(line);
+  if (patches) fclose(patches);
 
-    // this is for Intel x64
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+  if (modules) {
 
-    uint8_t orig_byte = lib_addr[offset];
-    *shadow = (bitmap_index << 8) | orig_byte;
-    lib_addr[offset] = 0xcc;  // replace instruction with debug trap
-    if (debug)
-      fprintf(stderr,
-              "Patch entry: %p[%lx] = %p = %02x -> SHADOW(%p) #%d -> %08x\n",
-              lib_addr, offset, lib_addr + offset, orig_byte, shadow,
-              bitmap_index, *shadow);
+    for (char *name = strtok(modules, ","); name; name = strtok(NULL, ",")) {
 
-#elif defined(__aarch64__)
+      if (!dl_iterate_phdr(setup_module, name))
+        FATAL("Module %s does not appear to be loaded", name);
 
-    // this is for aarch64
+    }
 
-    uint32_t *patch_bytes = (uint32_t *)(lib_addr + offset);
-    uint32_t  orig_bytes = *patch_bytes;
-    *shadow = (bitmap_index << 32) | orig_bytes;
-    *patch_bytes = 0xd4200000;  // replace instruction with debug trap
-    if (debug)
-      fprintf(stderr,
-              "Patch entry: %p[%lx] = %p = %02x -> SHADOW(%p) #%d -> %016x\n",
-              lib_addr, offset, lib_addr + offset, orig_bytes, shadow,
-              bitmap_index, *shadow);
+  }
 
 #else
-    // this will be ARM and AARCH64
-    // for ARM we will need to identify if the code is in thumb or ARM
-  #error "non x86_64/aarch64 not supported yet"
-    //__arm__:
-    // linux thumb: 0xde01
-    // linux arm: 0xe7f001f0
-    //__aarch64__:
-    // linux aarch64: 0xd4200000
+  if (modules)
+    FATAL("AFL_UNTRACER_MODULES is only supported on Linux x86_64/aarch64");
 #endif
 
-    bitmap_index++;
+  if (bitmap_skipped)
+    WARNF("Map is full, %u basic blocks are not instrumented", bitmap_skipped);
 
-  }
+  if (getenv("AFL_UNTRACER_UNPATCH")) {
 
-  free(line);
-  fclose(patches);
+    hit_list = mmap(NULL, sizeof(hit_list_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANON, -1, 0);
+    if (hit_list == MAP_FAILED) FATAL("Failed to mmap the hit list");
 
-  // Install signal handler for SIGTRAP.
-  struct sigaction s;
-  s.sa_flags = SA_SIGINFO;
-  s.sa_sigaction = sigtrap_handler;
-  sigemptyset(&s.sa_mask);
-  sigaction(SIGTRAP, &s, 0);
+  }
 
-  if (debug) fprintf(stderr, "Patched %u locations.\n", bitmap_index);
+  if (debug) fprintf(stderr, "Patched %u locations.\n", bitmap_index - 1);
   __afl_map_size = bitmap_index;
   if (__afl_map_size % 8) __afl_map_size = (((__afl_map_size + 7) >> 3) << 3);
 
@@ -632,22 +814,24 @@ void setup_trap_instrumentation(void) {
 static void sigtrap_handler(int signum, siginfo_t *si, void *context) {
 
   uint64_t addr;
-  // Must re-execute the instruction, so decrement PC by one instruction.
+  // Must re-execute the instruction: int3 leaves the PC behind the trap, brk
+  // leaves it on the trap.
   ucontext_t *ctx = (ucontext_t *)context;
 #if defined(__APPLE__) && defined(__LP64__)
   #if defined(__x86_64__)
   ctx->uc_mcontext->__ss.__rip -= 1;
   addr = ctx->uc_mcontext->__ss.__rip;
   #else
-  ctx->uc_mcontext->__ss.__pc -= 4;
   addr = ctx->uc_mcontext->__ss.__pc;
   #endif
 #elif defined(__linux__)
-  #if defined(__x86_64__) || defined(__i386__)
+  #if defined(__x86_64__)
   ctx->uc_mcontext.gregs[REG_RIP] -= 1;
   addr = ctx->uc_mcontext.gregs[REG_RIP];
+  #elif defined(__i386__)
+  ctx->uc_mcontext.gregs[REG_EIP] -= 1;
+  addr = ctx->uc_mcontext.gregs[REG_EIP];
   #elif defined(__aarch64__)
-  ctx->uc_mcontext.pc -= 4;
   addr = ctx->uc_mcontext.pc;
   #else
     #error "Unsupported processor"
@@ -659,32 +843,24 @@ static void sigtrap_handler(int signum, siginfo_t *si, void *context) {
   #error "Unsupported platform"
 #endif
 
-  // fprintf(stderr, "TRAP at context addr = %lx, fault addr = %lx\n", addr,
-  // si->si_addr);
-
-  // If the trap didn't come from our instrumentation, then we probably will
-  // just segfault here
-  uint8_t *faultaddr;
-  if (unlikely(si->si_addr))
-    faultaddr = (u8 *)si->si_addr - 1;
-  else
-    faultaddr = (u8 *)addr;
-  // if (debug) fprintf(stderr, "Shadow location: %p\n", SHADOW(faultaddr));
-  uint32_t shadow = *SHADOW(faultaddr);
-  uint8_t  orig_byte = shadow & 0xff;
-  uint32_t index = shadow >> 8;
-
-  // if (debug) fprintf(stderr, "shadow data: %x, orig_byte %02x, index %d\n",
-  // shadow, orig_byte, index);
+  (void)signum;
+  (void)si;
 
   // Index zero is invalid so that it is still possible to catch actual trap
   // instructions in instrumented libraries.
+  u32 index = restore_location((u8 *)addr);
   if (unlikely(index == 0)) abort();
 
-  // Restore original instruction
-  *faultaddr = orig_byte;
+  // traps hit during the setup are not coverage
+  if (likely(__afl_area_ptr != __afl_dummy)) __afl_area_ptr[index] = 128;
+
+  // Tell the forkserver parent to remove this trap for all later children.
+  if (hit_list) {
 
-  __afl_area_ptr[index] = 128;
+    u32 slot = __atomic_fetch_add(&hit_list->count, 1, __ATOMIC_RELAXED);
+    if (likely(slot < MAX_HIT_COUNT)) hit_list->index[slot] = index;
+
+  }
 
 }
 
@@ -742,6 +918,8 @@ int main(int argc, char *argv[]) {
       if (waitpid(pid, (int *)&status, 0) < 0) exit(1);
       /* report the test case is done and wait for the next */
       __afl_end_testcase(status);
+      /* the blocks this child reached run without traps from now on */
+      if (hit_list) unpatch_hits();
 
     } else {
 
@@ -21,6 +21,9 @@
 # (e.g., from ports). You can set GDB=/some/path to point to it if
 # necessary.
 #
+# For sanitizer builds, afl-triage is much faster and also deduplicates
+# and minimizes the crashes, see docs/fuzzing_in_depth.md.
+#
 
 echo "crash triage utility for afl-fuzz by Michal Zalewski"
 echo